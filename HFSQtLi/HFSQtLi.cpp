@@ -13,6 +13,17 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 #include "sqlite3.h"
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <atomic>
+#include <QIODevice>
+#include <cstdio>
+#include <cstdlib>
+#include <QThread>
+#include <QRandomGenerator>
+#include <QFileInfo>
+#include <QElapsedTimer>
 #include "HFSQtLi.h"
 
 
@@ -23,6 +34,10 @@ const int SQLiteCode::MISUSE=SQLITE_MISUSE;
 const int SQLiteCode::CONSTRAINT=SQLITE_CONSTRAINT;
 const int SQLiteCode::OK=SQLITE_OK;
 const int SQLiteCode::DONE=SQLITE_DONE;
+const int SQLiteCode::INTERRUPT=SQLITE_INTERRUPT;
+const int SQLiteCode::ABORT=SQLITE_ABORT;
+// Extended code of SQLITE_INTERRUPT not used by SQLite
+const int SQLiteCode::TIMEOUT=SQLITE_INTERRUPT|(0x80<<8);
 
 bool SQLiteCode::isSuccess(int code)
 {
@@ -39,12 +54,111 @@ bool SQLiteCode::isSuccess(int code)
 
 QString SQLiteCode::errorStringFull(int code)
 {
+  if(code==TIMEOUT)
+    return QString::fromUtf8("deadline expired");
   return QString::fromUtf8(sqlite3_errstr(code));
 }
 
 QString SQLiteCode::errorString(int code)
 {
-  return isSuccess(code)?QString():QString::fromUtf8(sqlite3_errstr(code));
+  return isSuccess(code)?QString():errorStringFull(code);
+}
+
+QString TextView::toString() const
+{
+  return QString::fromUtf8(m_data, m_size);
+}
+
+QByteArray BlobView::toByteArray() const
+{
+  return QByteArray(m_data, m_size);
+}
+
+QString Helper::quoteIdentifier(const QString &name)
+{
+  QString ret=name;
+  ret.replace("\"", "\"\"");
+  return "\""+ret+"\"";
+}
+
+namespace
+{
+  // Same characters as sqlite3Isspace
+  inline bool isSqlSpace(char c)
+  {
+    return c==' ' || (c>='\t' && c<='\r');
+  }
+
+  inline bool isDigit(char c)
+  {
+    return c>='0' && c<='9';
+  }
+}
+
+qint64 Helper::textToInt64(const char *text, qsizetype size)
+{
+  // As sqlite3Atoi64: leading spaces, optional sign and the following digits, clamped on overflow
+  qsizetype i=0;
+  while(i<size && isSqlSpace(text[i]))
+    i++;
+  bool negative=false;
+  if(i<size && (text[i]=='-' || text[i]=='+'))
+    negative=text[i++]=='-';
+  quint64 value=0;
+  const quint64 limit=quint64(std::numeric_limits<qint64>::max())+(negative?1:0);
+  for(;i<size && isDigit(text[i]);i++)
+  {
+    unsigned digit=unsigned(text[i]-'0');
+    if(value>(limit-digit)/10)
+      return negative?std::numeric_limits<qint64>::min():std::numeric_limits<qint64>::max();
+    value=value*10+digit;
+  }
+  return negative?qint64(0-value):qint64(value);
+}
+
+double Helper::textToDouble(const char *text, qsizetype size)
+{
+  // As sqlite3AtoF: the longest prefix that is a number, after leading spaces
+  qsizetype i=0;
+  while(i<size && isSqlSpace(text[i]))
+    i++;
+  qsizetype start=i;
+  if(i<size && (text[i]=='-' || text[i]=='+'))
+    i++;
+  int digits=0;
+  for(;i<size && isDigit(text[i]);i++)
+    digits++;
+  if(i<size && text[i]=='.')
+    for(i++;i<size && isDigit(text[i]);i++)
+      digits++;
+  if(!digits)
+    return 0;
+  qsizetype end=i;
+  if(i<size && (text[i]=='e' || text[i]=='E'))
+  {
+    i++;
+    if(i<size && (text[i]=='-' || text[i]=='+'))
+      i++;
+    if(i<size && isDigit(text[i]))
+    {
+      while(i<size && isDigit(text[i]))
+        i++;
+      end=i;
+    }
+  }
+  return QByteArray(text+start, int(end-start)).toDouble();
+}
+
+qint64 Helper::doubleToInt64(double value)
+{
+  // As sqlite3VdbeIntValue: values out of range are clamped instead of being undefined behaviour
+  if(std::isnan(value))
+    return 0;
+  if(value<=double(std::numeric_limits<qint64>::min()))
+    return std::numeric_limits<qint64>::min();
+  if(value>=double(std::numeric_limits<qint64>::max()))
+    return std::numeric_limits<qint64>::max();
+  return qint64(value);
 }
 
 Type SQLiteCode::typeFromSqlite(int type)
@@ -138,27 +252,250 @@ Type Value::type()
   return m_value?SQLiteCode::typeFromSqlite(sqlite3_value_type(m_value)):Type::Invalid;
 }
 
+sqlite3_value *ValueRef::pointer() const
+{
+  return m_stmt?sqlite3_column_value(m_stmt, m_column):m_value;
+}
+
+Type ValueRef::type() const
+{
+  if(m_stmt)
+    return SQLiteCode::typeFromSqlite(sqlite3_column_type(m_stmt, m_column));
+  return m_value?SQLiteCode::typeFromSqlite(sqlite3_value_type(m_value)):Type::Invalid;
+}
+
+double ValueRef::toDouble() const
+{
+  if(m_stmt)
+    return sqlite3_column_double(m_stmt, m_column);
+  return m_value?sqlite3_value_double(m_value):qQNaN();
+}
+
+qint64 ValueRef::toInt64() const
+{
+  if(m_stmt)
+    return sqlite3_column_int64(m_stmt, m_column);
+  return m_value?sqlite3_value_int64(m_value):0;
+}
+
+QString ValueRef::toString() const
+{
+  return toText().toString();
+}
+
+TextView ValueRef::toText() const
+{
+  Type t=type();
+  if(t==Type::Invalid || t==Type::Null)
+    return TextView();
+  const char *text;
+  int size;
+  if(m_stmt)
+  {
+    text=reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, m_column));
+    size=sqlite3_column_bytes(m_stmt, m_column);
+  }
+  else
+  {
+    text=reinterpret_cast<const char *>(sqlite3_value_text(m_value));
+    size=sqlite3_value_bytes(m_value);
+  }
+  return TextView(text?text:"", size);
+}
+
+BlobView ValueRef::toBlob() const
+{
+  Type t=type();
+  if(t==Type::Invalid || t==Type::Null)
+    return BlobView();
+  const char *data;
+  int size;
+  if(m_stmt)
+  {
+    data=static_cast<const char *>(sqlite3_column_blob(m_stmt, m_column));
+    size=sqlite3_column_bytes(m_stmt, m_column);
+  }
+  else
+  {
+    data=static_cast<const char *>(sqlite3_value_blob(m_value));
+    size=sqlite3_value_bytes(m_value);
+  }
+  // Empty blobs are returned as a null pointer: only NULL is a null view
+  return BlobView(data?data:"", size);
+}
+
+OwnedValue::OwnedValue(const ValueRef &value): OwnedValue()
+{
+  set(value);
+}
+
+void OwnedValue::set(const ValueRef &value)
+{
+  switch(value.type())
+  {
+  case Type::Integer: setInt64(value.toInt64()); break;
+  case Type::Float: setDouble(value.toDouble()); break;
+  case Type::Text:
+  {
+    TextView text=value.toText();
+    setText(text.data(), text.size());
+    break;
+  }
+  case Type::Blob:
+  {
+    BlobView blob=value.toBlob();
+    setBlob(blob.data(), blob.size());
+    break;
+  }
+  default:
+    setNull();
+  }
+}
+
+void OwnedValue::setNull()
+{
+  m_heap=QByteArray();
+  m_type=Type::Null;
+  m_size=0;
+  m_int=0;
+}
+
+void OwnedValue::setInt64(qint64 value)
+{
+  m_heap=QByteArray();
+  m_type=Type::Integer;
+  m_size=0;
+  m_int=value;
+}
+
+void OwnedValue::setDouble(double value)
+{
+  m_heap=QByteArray();
+  m_type=Type::Float;
+  m_size=0;
+  m_double=value;
+}
+
+void OwnedValue::setText(const char *data, qsizetype size)
+{
+  setData(Type::Text, data, size);
+}
+
+void OwnedValue::setBlob(const char *data, qsizetype size)
+{
+  setData(Type::Blob, data, size);
+}
+
+void OwnedValue::setData(Type type, const char *data, qsizetype size)
+{
+  m_type=type;
+  if(size<=InlineSize)
+  {
+    m_heap=QByteArray();
+    m_size=int(size);
+    if(size>0)
+      memcpy(m_inline, data, size);
+    m_inline[size]=0;
+  }
+  else
+  {
+    m_size=0;
+    m_heap=QByteArray(data, size);
+  }
+}
+
+double OwnedValue::toDouble() const
+{
+  switch(m_type)
+  {
+  case Type::Integer: return double(m_int);
+  case Type::Float: return m_double;
+  case Type::Text:
+  {
+    TextView text=toText();
+    return Helper::textToDouble(text.data(), text.size());
+  }
+  default: return 0;
+  }
+}
+
+qint64 OwnedValue::toInt64() const
+{
+  switch(m_type)
+  {
+  case Type::Integer: return m_int;
+  case Type::Float: return Helper::doubleToInt64(m_double);
+  case Type::Text:
+  {
+    TextView text=toText();
+    return Helper::textToInt64(text.data(), text.size());
+  }
+  default: return 0;
+  }
+}
+
+QString OwnedValue::toString() const
+{
+  switch(m_type)
+  {
+  case Type::Integer: return QString::number(m_int);
+  case Type::Float: return QString::number(m_double, 'g', 15);
+  case Type::Text:
+  case Type::Blob: return toText().toString();
+  default: return QString();
+  }
+}
+
+TextView OwnedValue::toText() const
+{
+  if(m_type!=Type::Text && m_type!=Type::Blob)
+    return TextView();
+  return isInline()?TextView(m_inline, m_size):TextView(m_heap.constData(), m_heap.size());
+}
+
+BlobView OwnedValue::toBlob() const
+{
+  TextView text=toText();
+  return BlobView(text.data(), text.size());
+}
+
 
 #ifndef SQLITE_ENABLE_COLUMN_METADATA
 #warning SQLITE_ENABLE_COLUMN_METADATA not enabled. Reduced BLOB functionality (see documentation in section "How to compile")
 #endif
 
+#ifdef SQLITE_ENABLE_CARRAY
+#ifndef SQLITE_CARRAY_INT32
+// carray extension compiled separately from the amalgamation (ext/misc/carray.c)
+extern "C" int sqlite3_carray_bind(sqlite3_stmt *pStmt, int i, void *aData, int nData, int mFlags, void (*xDel)(void *));
+#define SQLITE_CARRAY_INT32 0
+#define SQLITE_CARRAY_INT64 1
+#define SQLITE_CARRAY_DOUBLE 2
+#define SQLITE_CARRAY_TEXT 3
+#endif
+#endif
+
+// Number of virtual machine instructions between two checks of the deadline
+static const int progressDeadlineInstructions=1000;
+// Last value of Query::m_prepareGeneration, shared by all the queries so that no two statements get the same number
+static std::atomic<quint64> lastPrepareGeneration{0};
+
 using namespace HFSQtLi;
-Query::Query(Db *db, const char *query, bool persistent, bool storeErrorMsg, const char **tail): m_db(db), m_stmt(nullptr), m_keepErrorMsg(storeErrorMsg)
+Query::Query(Db *db, const char *query, bool persistent, bool storeErrorMsg, const char **tail): m_db(db), m_stmt(nullptr), m_values(nullptr), m_valueCount(0), m_keepErrorMsg(storeErrorMsg), m_hasDeadline(false), m_deadlineExpired(false), m_parameterIndexesBuilt(false), m_columnIndexesReprepare(-1), m_prepareGeneration(0), m_arena(nullptr), m_internPool(nullptr)
 {
   if(db)
     db->m_queryCount++;
   prepare(query, persistent, tail);
 }
 
-Query::Query(Db *db, const QString &query, bool persistent, bool storeErrorMsg, QString *tail): m_db(db), m_stmt(nullptr), m_keepErrorMsg(storeErrorMsg)
+Query::Query(Db *db, const QString &query, bool persistent, bool storeErrorMsg, QString *tail): m_db(db), m_stmt(nullptr), m_values(nullptr), m_valueCount(0), m_keepErrorMsg(storeErrorMsg), m_hasDeadline(false), m_deadlineExpired(false), m_parameterIndexesBuilt(false), m_columnIndexesReprepare(-1), m_prepareGeneration(0), m_arena(nullptr), m_internPool(nullptr)
 {
   if(db)
     db->m_queryCount++;
   prepare(query, persistent, tail);
 }
 
-Query::Query(Db *db, bool storeErrorMsg): m_db(db), m_stmt(nullptr), m_keepErrorMsg(storeErrorMsg)
+Query::Query(Db *db, bool storeErrorMsg): m_db(db), m_stmt(nullptr), m_values(nullptr), m_valueCount(0), m_keepErrorMsg(storeErrorMsg), m_hasDeadline(false), m_deadlineExpired(false), m_parameterIndexesBuilt(false), m_columnIndexesReprepare(-1), m_prepareGeneration(0), m_arena(nullptr), m_internPool(nullptr)
 {
   if(db)
     db->m_queryCount++;
@@ -182,6 +519,13 @@ bool Query::prepare(const char *query, bool persistent, const char **tail)
       m_error=sqlite3_finalize(m_stmt);
       m_stmt=nullptr;
     }
+    m_parameterIndexes.clear();
+    m_parameterIndexesBuilt=false;
+    m_columnIndexes.clear();
+    m_columnIndexesReprepare=-1;
+    m_prepareGeneration=++lastPrepareGeneration;
+    m_ownedBindings.clear();
+    clearBoundValues();
     if(m_error==SQLITE_OK)
       m_error=sqlite3_prepare_v3(m_db->m_db, query?query:"", -1, persistent?SQLITE_PREPARE_PERSISTENT:0, &m_stmt, tail);
     lock.release(m_errorMsg);
@@ -205,6 +549,13 @@ bool Query::prepare(const QString &query, bool persistent, QString *tail)
       m_error=sqlite3_finalize(m_stmt);
       m_stmt=nullptr;
     }
+    m_parameterIndexes.clear();
+    m_parameterIndexesBuilt=false;
+    m_columnIndexes.clear();
+    m_columnIndexesReprepare=-1;
+    m_prepareGeneration=++lastPrepareGeneration;
+    m_ownedBindings.clear();
+    clearBoundValues();
     if(m_error==SQLITE_OK)
       m_error=sqlite3_prepare16_v3(m_db->m_db, query.data(), query.size()*sizeof(QChar), persistent?SQLITE_PREPARE_PERSISTENT:0, &m_stmt, &tailPtr);
     lock.release(m_errorMsg);
@@ -223,6 +574,8 @@ bool Query::stepNoFetch()
   int ret=0;
   if(!isPrepared())
     setInternalError(SQLITE_MISUSE);
+  else if(m_hasDeadline)
+    ret=stepWithDeadline();
   else
   {
     Db::Lock lock(m_db, m_keepErrorMsg);
@@ -233,6 +586,44 @@ bool Query::stepNoFetch()
   return ret;
 }
 
+bool Query::stepWithDeadline()
+{
+  if(std::chrono::steady_clock::now()>=m_deadline)
+  {
+    setInternalError(SQLiteCode::TIMEOUT, "Query deadline expired");
+    return false;
+  }
+  // Progress handler is per connection: keep the mutex for the whole step so that no other query can replace it.
+  // The handler set with Db::setProgressHandler is called by progressDeadline and restored after the step.
+  Db::Lock lock(m_db, true);
+  m_deadlineExpired=false;
+  int instructions=progressDeadlineInstructions;
+  if(m_db->m_progressHandler && m_db->m_progressInstructions>0)
+    instructions=qMin(instructions, m_db->m_progressInstructions);
+  sqlite3_progress_handler(m_db->m_db, instructions, &Query::progressDeadline, this);
+  m_error=sqlite3_step(m_stmt);
+  sqlite3_progress_handler(m_db->m_db, m_db->m_progressInstructions, m_db->m_progressHandler, m_db->m_progressData);
+  if(m_error==SQLITE_INTERRUPT && m_deadlineExpired)
+  {
+    lock.release();
+    setInternalError(SQLiteCode::TIMEOUT, "Query deadline expired");
+  }
+  else if(m_keepErrorMsg)
+    lock.release(m_errorMsg);
+  return (m_error==SQLITE_ROW);
+}
+
+int Query::progressDeadline(void *query)
+{
+  Query *qry=static_cast<Query *>(query);
+  if(std::chrono::steady_clock::now()>=qry->m_deadline)
+    qry->m_deadlineExpired=true;
+  if(qry->m_deadlineExpired)
+    return 1;
+  Db *db=qry->m_db;
+  return db->m_progressHandler?db->m_progressHandler(db->m_progressData):0;
+}
+
 bool Query::finalize()
 {
   bool ret=false;
@@ -244,6 +635,13 @@ bool Query::finalize()
     m_error=sqlite3_finalize(m_stmt);
     lock.release(m_errorMsg);
     m_stmt=nullptr;
+    m_parameterIndexes.clear();
+    m_parameterIndexesBuilt=false;
+    m_columnIndexes.clear();
+    m_columnIndexesReprepare=-1;
+    m_prepareGeneration=++lastPrepareGeneration;
+    m_ownedBindings.clear();
+    clearBoundValues();
     ret=(m_error==SQLITE_OK);
   }
   return ret;
@@ -260,6 +658,10 @@ bool Query::reset()
       m_error=sqlite3_reset(m_stmt);
       lock.release(m_errorMsg);
       ret=(m_error==SQLITE_OK);
+      // sqlite3_reset returns the error of the last step: report the expired deadline as the step did
+      if(m_error==SQLITE_INTERRUPT && m_deadlineExpired)
+        setInternalError(SQLiteCode::TIMEOUT, "Query deadline expired");
+      m_deadlineExpired=false;
     }
     return ret;
 }
@@ -274,6 +676,8 @@ bool Query::clearBindings()
     Db::Lock lock(m_db, m_keepErrorMsg);
     m_error=sqlite3_clear_bindings(m_stmt);
     lock.release(m_errorMsg);
+    m_ownedBindings.clear();
+    clearBoundValues();
     ret=(m_error==SQLITE_OK);
   }
   return ret;
@@ -283,24 +687,29 @@ bool Query::clearBindings()
 int Query::bindSingle(bool, int i, qint64 value)
 {
   m_error=sqlite3_bind_int64(m_stmt, i, value);
+  recordBinding(i, 'i', &value, sizeof(value));
   return fetchErrorString()?2:0;
 }
 
 int Query::bindSingle(bool, int i, double value)
 {
   m_error=sqlite3_bind_double(m_stmt, i, value);
+  recordBinding(i, 'f', &value, sizeof(value));
   return fetchErrorString()?2:0;
 }
 
 int Query::bindSingle(bool, int i, std::nullptr_t)
 {
   m_error=sqlite3_bind_null(m_stmt, i);
+  recordBinding(i, 'n', nullptr, 0);
   return fetchErrorString()?2:0;
 }
 
 int Query::bindSingle(bool, int i, const ZeroBlob &zeroBlob)
 {
   m_error=sqlite3_bind_zeroblob64(m_stmt, i, zeroBlob.size());
+  qint64 size=zeroBlob.size();
+  recordBinding(i, 'z', &size, sizeof(size));
   return fetchErrorString()?2:0;
 }
 
@@ -308,19 +717,213 @@ int Query::bindSingle(bool, int i, const char *value, int size)
 {
 //  m_error=sqlite3_bind_text(m_stmt, i, value.toUtf8(), -1, SQLITE_TRANSIENT);
   m_error=sqlite3_bind_text(m_stmt, i, value, size, SQLITE_TRANSIENT);
+  if(m_boundValues)
+    recordBinding(i, value?'t':'n', value, !value?0:(size<0?qsizetype(strlen(value)):size));
   return fetchErrorString()?2:0;
 }
 
 int Query::bindSingle(bool temporary, int i, const QString &value)
 {
   m_error=sqlite3_bind_text16(m_stmt, i, value.data(), -1, temporary?SQLITE_STATIC: SQLITE_TRANSIENT);
+  recordBinding(i, 'u', value.constData(), value.size()*sizeof(QChar));
+  return fetchErrorString()?2:0;
+}
+
+int Query::bindSingle(bool temporary, int i, const TextView &value)
+{
+  // A null pointer would bind NULL instead of an empty string
+  m_error=sqlite3_bind_text64(m_stmt, i, value.data()?value.data():"", value.size(), temporary?SQLITE_STATIC: SQLITE_TRANSIENT, SQLITE_UTF8);
+  recordBinding(i, 't', value.data(), value.size());
+  return fetchErrorString()?2:0;
+}
+
+Query::OwnedBinding *Query::ownedBinding(int i)
+{
+  if(i<1 || i>sqlite3_bind_parameter_count(m_stmt))
+    return nullptr;
+  if(m_ownedBindings.size()<i)
+    m_ownedBindings.resize(i);
+  return &m_ownedBindings[i-1];
+}
+
+int Query::bindSingle(bool temporary, int i, QByteArray &&value)
+{
+  OwnedBinding *owned=temporary?nullptr:ownedBinding(i);
+  if(!owned)
+    return bindSingle(temporary, i, const_cast<const QByteArray &>(value));
+  // The data is shared with the query, which outlives the binding: no copy is needed
+  owned->blob=std::move(value);
+  owned->text=QString();
+  m_error=sqlite3_bind_blob64(m_stmt, i, owned->blob.constData(), owned->blob.size(), SQLITE_STATIC);
+  recordBinding(i, 'b', owned->blob.constData(), owned->blob.size());
+  return fetchErrorString()?2:0;
+}
+
+int Query::bindSingle(bool temporary, int i, QString &&value)
+{
+  OwnedBinding *owned=temporary?nullptr:ownedBinding(i);
+  if(!owned)
+    return bindSingle(temporary, i, const_cast<const QString &>(value));
+  owned->text=std::move(value);
+  owned->blob=QByteArray();
+  m_error=sqlite3_bind_text16(m_stmt, i, owned->text.constData(), -1, SQLITE_STATIC);
+  recordBinding(i, 'u', owned->text.constData(), owned->text.size()*sizeof(QChar));
+  return fetchErrorString()?2:0;
+}
+
+int Query::bindSingle(bool temporary, int i, const BlobView &value)
+{
+  // As for TextView a null view binds an empty blob, not NULL
+  m_error=sqlite3_bind_blob64(m_stmt, i, value.data()?value.data():"", value.size(), temporary?SQLITE_STATIC: SQLITE_TRANSIENT);
+  recordBinding(i, 'b', value.data(), value.size());
+  return fetchErrorString()?2:0;
+}
+
+int Query::bindSingle(bool, int i, const ValueRef &value)
+{
+  // SQLite always copies the value
+  m_error=value.isValid()?sqlite3_bind_value(m_stmt, i, value.pointer()):sqlite3_bind_null(m_stmt, i);
+  if(m_boundValues)
+  {
+    switch(value.type())
+    {
+    case Type::Integer:
+    {
+      qint64 number=value.toInt64();
+      recordBinding(i, 'i', &number, sizeof(number));
+      break;
+    }
+    case Type::Float:
+    {
+      double number=value.toDouble();
+      recordBinding(i, 'f', &number, sizeof(number));
+      break;
+    }
+    case Type::Text:
+    {
+      TextView text=value.toText();
+      recordBinding(i, 't', text.data(), text.size());
+      break;
+    }
+    case Type::Blob:
+    {
+      BlobView blob=value.toBlob();
+      recordBinding(i, 'b', blob.data(), blob.size());
+      break;
+    }
+    default:
+      recordBinding(i, 'n', nullptr, 0);
+    }
+  }
   return fetchErrorString()?2:0;
 }
 
+int Query::bindSingle(bool temporary, int i, const OwnedValue &value)
+{
+  switch(value.type())
+  {
+  case Type::Integer: return bindSingle(temporary, i, value.toInt64());
+  case Type::Float: return bindSingle(temporary, i, value.toDouble());
+  case Type::Text: return bindSingle(temporary, i, value.toText());
+  case Type::Blob: return bindSingle(temporary, i, value.toBlob());
+  default: return bindSingle(temporary, i, nullptr);
+  }
+}
+
 int Query::bindSingle(bool temporary, int i, const QByteArray &value)
 {
   m_error=sqlite3_bind_blob64(m_stmt, i, value.data(), value.size(), temporary?SQLITE_STATIC: SQLITE_TRANSIENT);
+  recordBinding(i, 'b', value.data(), value.size());
+  return fetchErrorString()?2:0;
+}
+
+int Query::bindArray(bool temporary, int i, const void *data, qsizetype size, ArrayType type)
+{
+#ifdef SQLITE_ENABLE_CARRAY
+  int flags=SQLITE_CARRAY_INT64;
+  switch(type)
+  {
+    case ArrayType::Int32: flags=SQLITE_CARRAY_INT32; break;
+    case ArrayType::Int64: flags=SQLITE_CARRAY_INT64; break;
+    case ArrayType::Double: flags=SQLITE_CARRAY_DOUBLE; break;
+    case ArrayType::Text: flags=SQLITE_CARRAY_TEXT; break;
+  }
+  // A transient empty array would be copied with sqlite3_malloc64(0), that returns NULL and fails with SQLITE_NOMEM: bind a static element instead
+  static const qint64 emptyArray=0;
+  if(size==0)
+  {
+    data=&emptyArray;
+    temporary=true;
+  }
+  if(size>std::numeric_limits<int>::max())
+    m_error=SQLITE_TOOBIG;
+  else
+    m_error=sqlite3_carray_bind(m_stmt, i, const_cast<void *>(data), int(size), flags, temporary?SQLITE_STATIC:SQLITE_TRANSIENT);
+  if(m_boundValues)
+  {
+    if(type==ArrayType::Text)
+    {
+      // The content of the strings, not their addresses
+      QByteArray strings;
+      for(qsizetype j=0;j<size;j++)
+        strings.append(static_cast<const char *const *>(data)[j]).append('\0');
+      recordBinding(i, char('A'+flags), strings.constData(), strings.size());
+    }
+    else
+      recordBinding(i, char('A'+flags), data, size*(type==ArrayType::Int32?4:8));
+  }
+  return fetchErrorString()?2:0;
+#else
+  Q_UNUSED(temporary);
+  Q_UNUSED(i);
+  Q_UNUSED(data);
+  Q_UNUSED(size);
+  Q_UNUSED(type);
+  setInternalError(SQLITE_MISUSE, "Binding arrays requires SQLite compiled with SQLITE_ENABLE_CARRAY");
+  return 0;
+#endif
+}
+
+int Query::bindSingle(bool, int i, const QStringList &value)
+{
+#ifdef SQLITE_ENABLE_CARRAY
+  // Single allocation holding the table of pointers followed by the strings. Ownership is passed to carray that will release it with sqlite3_free.
+  QVector<QByteArray> utf8;
+  qsizetype bytes=value.size()*sizeof(char *);
+  utf8.reserve(value.size());
+  for(const QString &str: value)
+  {
+    utf8.append(str.toUtf8());
+    bytes+=utf8.last().size()+1;
+  }
+  char **block=static_cast<char **>(sqlite3_malloc64(qMax<qsizetype>(bytes, 1)));
+  if(!block)
+    m_error=SQLITE_NOMEM;
+  else if(value.size()>std::numeric_limits<int>::max())
+  {
+    sqlite3_free(block);
+    m_error=SQLITE_TOOBIG;
+  }
+  else
+  {
+    char *str=reinterpret_cast<char *>(block+value.size());
+    for(qsizetype j=0;j<utf8.size();j++)
+    {
+      block[j]=str;
+      memcpy(str, utf8[j].constData(), utf8[j].size()+1);
+      str+=utf8[j].size()+1;
+    }
+    // Recorded before binding, that passes the ownership of block to carray
+    recordBinding(i, char('A'+SQLITE_CARRAY_TEXT), block+value.size(), bytes-value.size()*sizeof(char *));
+    m_error=sqlite3_carray_bind(m_stmt, i, block, int(value.size()), SQLITE_CARRAY_TEXT, sqlite3_free);
+  }
   return fetchErrorString()?2:0;
+#else
+  Q_UNUSED(i);
+  Q_UNUSED(value);
+  setInternalError(SQLITE_MISUSE, "Binding arrays requires SQLite compiled with SQLITE_ENABLE_CARRAY");
+  return 0;
+#endif
 }
 
 int Query::error(QString *errorOut)
@@ -352,9 +955,30 @@ int Query::clearBindingInternal()
   int ret=SQLITE_MISUSE;
   if(m_stmt)
     ret=sqlite3_clear_bindings(m_stmt);
+  m_ownedBindings.clear();
+  clearBoundValues();
   return ret;
 }
 
+void Query::recordBinding(int i, char tag, const void *data, qsizetype size)
+{
+  if(!m_boundValues || i<1)
+    return;
+  if(m_boundValues->size()<i)
+    m_boundValues->resize(i);
+  QByteArray &value=(*m_boundValues)[i-1];
+  value.resize(1+size);
+  value[0]=tag;
+  if(size>0)
+    memcpy(value.data()+1, data, size);
+}
+
+void Query::clearBoundValues()
+{
+  if(m_boundValues)
+    m_boundValues->clear();
+}
+
 void Query::resetInternalError()
 {
   m_error=SQLITE_OK;
@@ -410,49 +1034,164 @@ int Query::assertFetchColumnCount(int i)
   return ret;
 }
 
-int Query::assertBindColumnCount(int i)
+int Query::parameterIndex(const char *name)
 {
-  int ret=-1;
-  if(!m_stmt)
-    setInternalError(SQLITE_MISUSE);
-  else
+  if(!m_stmt || !name)
+    return 0;
+  // Statements without named parameters leave the map empty: a flag avoids scanning them again at every call
+  if(!m_parameterIndexesBuilt)
   {
-    int numCol=sqlite3_bind_parameter_count(m_stmt);
-    if(i==numCol)
-      ret=i;
-    else
-      setInternalError(SQLITE_CONSTRAINT, QString("Bound %1 value(s) in a query using %2").arg(i).arg(numCol).toUtf8());
+    m_parameterIndexesBuilt=true;
+    int count=sqlite3_bind_parameter_count(m_stmt);
+    for(int i=1;i<=count;i++)
+    {
+      // Parameters with the same name share the index, nameless ones (?) return null
+      const char *parameter=sqlite3_bind_parameter_name(m_stmt, i);
+      if(parameter)
+        m_parameterIndexes.insert(QByteArray(parameter), i);
+    }
   }
-  return ret;
+  return m_parameterIndexes.value(QByteArray::fromRawData(name, int(strlen(name))), 0);
 }
 
-Type Query::columnType(int i)
+int Query::columnIndex(const char *name)
+{
+  if(!name)
+    return -1;
+  return columnIndex(QByteArray::fromRawData(name, int(strlen(name))));
+}
+
+int Query::columnIndex(const QByteArray &name)
 {
-  Type ret=Type::Invalid;
   if(!m_stmt)
-    setInternalError(SQLITE_MISUSE);
-  else
+    return -1;
+  // SQLite reprepares the statement after a schema change, the columns may be different
+  int reprepare=sqlite3_stmt_status(m_stmt, SQLITE_STMTSTATUS_REPREPARE, 0);
+  if(reprepare!=m_columnIndexesReprepare)
   {
-    ret=SQLiteCode::typeFromSqlite(sqlite3_column_type(m_stmt, i));
-    if(ret==Type::Invalid)
-      setInternalError(SQLITE_MISUSE, "Unknown type returned from sqlite3_column_type");
+    m_columnIndexes.clear();
+    m_columnIndexesReprepare=reprepare;
+    int count=sqlite3_column_count(m_stmt);
+    for(int i=0;i<count;i++)
+    {
+      const char *column=sqlite3_column_name(m_stmt, i);
+      if(column && !m_columnIndexes.contains(QByteArray::fromRawData(column, int(strlen(column)))))
+        m_columnIndexes.insert(QByteArray(column), i);
+    }
   }
-  return ret;
+  return m_columnIndexes.value(name, -1);
 }
 
-qint64 Query::readColumnIntSQLite(int i, bool &ok)
+int Query::namedColumn(const char *name)
 {
-  ok=true;
-  return sqlite3_column_int64(m_stmt, i);
+  return name?namedColumn(QByteArray::fromRawData(name, int(strlen(name)))):namedColumn(QByteArray());
 }
 
-double Query::readColumnDoubleSQLite(int i, bool &ok)
+int Query::namedColumn(const QByteArray &name)
 {
-  ok=true;
-  return sqlite3_column_double(m_stmt, i);
+  int ret=-1;
+  if(!m_stmt)
+    setInternalError(SQLITE_MISUSE);
+  else if((ret=columnIndex(name))<0)
+    setInternalError(SQLITE_RANGE, QString("Unknown column %1").arg(QString::fromUtf8(name)).toUtf8());
+  return ret;
 }
 
-int Query::readColumn(bool strict, int i, QString &value)
+int Query::namedIndex(const char *name)
+{
+  int ret=0;
+  if(!m_stmt)
+    setInternalError(SQLITE_MISUSE);
+  else if(!(ret=parameterIndex(name)))
+    setInternalError(SQLITE_RANGE, QString("Unknown parameter %1").arg(QString(name)).toUtf8());
+  return ret;
+}
+
+int Query::assertBindColumnCount(int i)
+{
+  int ret=-1;
+  if(!m_stmt)
+    setInternalError(SQLITE_MISUSE);
+  else
+  {
+    int numCol=sqlite3_bind_parameter_count(m_stmt);
+    if(i==numCol)
+      ret=i;
+    else
+      setInternalError(SQLITE_CONSTRAINT, QString("Bound %1 value(s) in a query using %2").arg(i).arg(numCol).toUtf8());
+  }
+  return ret;
+}
+
+int Query::cellType(int i)
+{
+  if(!m_values)
+    return sqlite3_column_type(m_stmt, i);
+  return i>=0 && i<m_valueCount?sqlite3_value_type(m_values[i]):SQLITE_NULL;
+}
+
+qint64 Query::cellInt64(int i)
+{
+  if(!m_values)
+    return sqlite3_column_int64(m_stmt, i);
+  return i>=0 && i<m_valueCount?sqlite3_value_int64(m_values[i]):0;
+}
+
+double Query::cellDouble(int i)
+{
+  if(!m_values)
+    return sqlite3_column_double(m_stmt, i);
+  return i>=0 && i<m_valueCount?sqlite3_value_double(m_values[i]):0;
+}
+
+const char *Query::cellText(int i)
+{
+  if(!m_values)
+    return reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, i));
+  return i>=0 && i<m_valueCount?reinterpret_cast<const char *>(sqlite3_value_text(m_values[i])):nullptr;
+}
+
+const void *Query::cellBlob(int i)
+{
+  if(!m_values)
+    return sqlite3_column_blob(m_stmt, i);
+  return i>=0 && i<m_valueCount?sqlite3_value_blob(m_values[i]):nullptr;
+}
+
+int Query::cellBytes(int i)
+{
+  if(!m_values)
+    return sqlite3_column_bytes(m_stmt, i);
+  return i>=0 && i<m_valueCount?sqlite3_value_bytes(m_values[i]):0;
+}
+
+Type Query::columnType(int i)
+{
+  Type ret=Type::Invalid;
+  if(!m_stmt && !m_values)
+    setInternalError(SQLITE_MISUSE);
+  else
+  {
+    ret=SQLiteCode::typeFromSqlite(cellType(i));
+    if(ret==Type::Invalid)
+      setInternalError(SQLITE_MISUSE, "Unknown type returned from sqlite3_column_type");
+  }
+  return ret;
+}
+
+qint64 Query::readColumnIntSQLite(int i, bool &ok)
+{
+  ok=true;
+  return cellInt64(i);
+}
+
+double Query::readColumnDoubleSQLite(int i, bool &ok)
+{
+  ok=true;
+  return cellDouble(i);
+}
+
+int Query::readColumn(bool strict, int i, QString &value)
 {
   bool ok=true;
   if(strict)
@@ -463,18 +1202,85 @@ int Query::readColumn(bool strict, int i, QString &value)
       ok=false;
     }
     else
-      value=QString::fromUtf8(sqlite3_column_text(m_stmt, i));
+      value=QString::fromUtf8(cellText(i));
   }
   else
-    value=QString::fromUtf8(sqlite3_column_text(m_stmt, i));
+    value=QString::fromUtf8(cellText(i));
   return ok?2:0;
 }
 
+int Query::readColumn(bool strict, int i, TextView &value)
+{
+  if(strict && columnType(i)!=Type::Text)
+  {
+    setInternalError(SQLiteCode::CONSTRAINT, "Read column was not a string");
+    return 0;
+  }
+  const char *text=cellText(i);
+  qsizetype size=cellBytes(i);
+  if(text && m_arena)
+    text=m_arena->store(text, size, true);
+  value=TextView(text, size);
+  return 2;
+}
+
+int Query::readColumn(bool strict, int i, BlobView &value)
+{
+  if(strict && columnType(i)!=Type::Blob)
+  {
+    setInternalError(SQLiteCode::CONSTRAINT, "Read column was not a blob");
+    return 0;
+  }
+  const char *data=static_cast<const char *>(cellBlob(i));
+  qsizetype size=cellBytes(i);
+  // Empty blobs are returned as a null pointer: only NULL is a null view
+  if(!data && cellType(i)!=SQLITE_NULL)
+    data="";
+  else if(data && m_arena)
+    data=m_arena->store(data, size);
+  value=BlobView(data, size);
+  return 2;
+}
+
+int Query::readColumn(bool strict, int i, Interned<QString> &value)
+{
+  if(strict && columnType(i)!=Type::Text)
+  {
+    setInternalError(SQLiteCode::CONSTRAINT, "Read column was not a string");
+    return 0;
+  }
+  const char *text=cellText(i);
+  value=Interned<QString>(internPool()->intern(text, cellBytes(i)));
+  return 2;
+}
+
+void Query::setInternPool(InternPool *pool)
+{
+  m_internPool=pool;
+}
+
+InternPool *Query::internPool()
+{
+  if(m_internPool)
+    return m_internPool;
+  if(!m_ownInternPool)
+    m_ownInternPool.reset(new InternPool());
+  return m_ownInternPool.data();
+}
+
 int Query::readColumn(bool, int i, Value &result)
 {
   int ret=0;
   result.clear();
-  if(!isPrepared())
+  if(m_values)
+  {
+    // Protected values are duplicated directly, without the connection mutex
+    if(i>=0 && i<m_valueCount)
+      result=Value(sqlite3_value_dup(m_values[i]));
+    setInternalError(result.isValid()?SQLITE_OK:SQLITE_NOMEM);
+    ret=(m_error==SQLITE_OK)?2:0;
+  }
+  else if(!isPrepared())
     setInternalError(SQLITE_MISUSE);
   else
   {
@@ -493,6 +1299,52 @@ int Query::readColumn(bool, int i, Value &result)
   return ret;
 }
 
+int Query::readColumn(bool, int i, ValueRef &result)
+{
+  // sqlite3_column_value returns an unprotected value: the ValueRef reads the column with the sqlite3_column_* functions
+  if(m_values)
+    result=i>=0 && i<m_valueCount?ValueRef(m_values[i]):ValueRef();
+  else
+    result=ValueRef(m_stmt, i);
+  return 2;
+}
+
+int Query::readColumn(bool, int i, OwnedValue &result)
+{
+  // The column functions are used instead of sqlite3_column_value, which returns an unprotected value
+  switch(cellType(i))
+  {
+  case SQLITE_INTEGER: result.setInt64(cellInt64(i)); break;
+  case SQLITE_FLOAT: result.setDouble(cellDouble(i)); break;
+  case SQLITE_TEXT:
+  {
+    const char *text=cellText(i);
+    result.setText(text, cellBytes(i));
+    break;
+  }
+  case SQLITE_BLOB:
+  {
+    const char *data=static_cast<const char *>(cellBlob(i));
+    result.setBlob(data, cellBytes(i));
+    break;
+  }
+  default:
+    result.setNull();
+  }
+  return 2;
+}
+
+int Query::readColumn(bool, int i, RowBuffer &row)
+{
+  // A RowBuffer reads the columns of a statement
+  if(m_values)
+  {
+    setInternalError(SQLITE_MISUSE);
+    return 0;
+  }
+  return row.fetch(m_stmt, i, m_prepareGeneration);
+}
+
 int Query::readColumn(bool strict, int i, Blob &value)
 {
   return readColumnInternal(i, value, strict);
@@ -507,11 +1359,11 @@ int Query::readColumn(bool strict, int i, QByteArray &value)
   }
   else
   {
-    int bytes=sqlite3_column_bytes(m_stmt, i);
+    int bytes=cellBytes(i);
     if(bytes>0)
     {
       value.resize(bytes);
-      memcpy(value.data(), sqlite3_column_blob(m_stmt, i), bytes);
+      memcpy(value.data(), cellBlob(i), bytes);
       ok=true;
     }
     else if(bytes==0)
@@ -568,6 +1420,477 @@ int Query::readColumnInternal(int i, Blob &value, bool strict)
   return (m_error==SQLITE_OK)?2:0;
 }
 
+#ifdef HFSQTLI_ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace HFSQtLi;
+
+namespace
+{
+  const char g_hexDigits[]="0123456789abcdef";
+
+  // Writes a CSV field, quoting it only when needed
+  void writeCsvText(Helper::ExportWriter &writer, const char *text, int size)
+  {
+    const char *end=text+size;
+    const char *p=text;
+    while(p<end && *p!='"' && *p!=',' && *p!='\n' && *p!='\r')
+      p++;
+    if(p==end)
+    {
+      writer.write(text, size);
+      return;
+    }
+    writer.put('"');
+    while(text<end)
+    {
+      p=static_cast<const char *>(memchr(text, '"', end-text));
+      if(!p)
+      {
+        writer.write(text, end-text);
+        break;
+      }
+      writer.write(text, p+1-text);
+      writer.put('"');
+      text=p+1;
+    }
+    writer.put('"');
+  }
+
+  void writeTsvText(Helper::ExportWriter &writer, const char *text, int size)
+  {
+    const char *end=text+size;
+    const char *start=text;
+    for(const char *p=text;p<end;p++)
+    {
+      const char *escape;
+      switch(*p)
+      {
+      case '\t': escape="\\t"; break;
+      case '\n': escape="\\n"; break;
+      case '\r': escape="\\r"; break;
+      case '\\': escape="\\\\"; break;
+      default: continue;
+      }
+      writer.write(start, p-start);
+      writer.write(escape, 2);
+      start=p+1;
+    }
+    writer.write(start, end-start);
+  }
+
+  void writeJsonString(Helper::ExportWriter &writer, const char *text, int size)
+  {
+    const char *end=text+size;
+    const char *start=text;
+    writer.put('"');
+    for(const char *p=text;p<end;p++)
+    {
+      unsigned char c=static_cast<unsigned char>(*p);
+      if(c>=0x20 && c!='"' && c!='\\')
+        continue;
+      writer.write(start, p-start);
+      switch(c)
+      {
+      case '"': writer.write("\\\"", 2); break;
+      case '\\': writer.write("\\\\", 2); break;
+      case '\n': writer.write("\\n", 2); break;
+      case '\r': writer.write("\\r", 2); break;
+      case '\t': writer.write("\\t", 2); break;
+      default:
+        {
+          char escape[6]={'\\', 'u', '0', '0', g_hexDigits[c>>4], g_hexDigits[c&15]};
+          writer.write(escape, 6);
+        }
+        break;
+      }
+      start=p+1;
+    }
+    writer.write(start, end-start);
+    writer.put('"');
+  }
+
+  // Writes a REAL with the shortest of %.15g/%.17g that reads back to the same value: sqlite3_column_text only keeps 15 digits.
+  // Like SQLite a ".0" is appended to integral values so that they are imported back as REAL. Infinities are null in JSON.
+  void writeDouble(Helper::ExportWriter &writer, double value, bool json)
+  {
+    if(!std::isfinite(value))
+    {
+      if(json)
+        writer.write("null", 4);
+      else
+        writer.write(value<0?"-Inf":"Inf", value<0?4:3);
+      return;
+    }
+    char text[32];
+    int size=snprintf(text, sizeof(text), "%.15g", value);
+    if(strtod(text, nullptr)!=value)
+      size=snprintf(text, sizeof(text), "%.17g", value);
+    if(!strpbrk(text, ".eE"))
+    {
+      text[size++]='.';
+      text[size++]='0';
+    }
+    writer.write(text, size);
+  }
+
+  void writeHex(Helper::ExportWriter &writer, const unsigned char *data, int size)
+  {
+    char chunk[256];
+    while(size>0)
+    {
+      int n=qMin(size, int(sizeof(chunk)/2));
+      for(int i=0;i<n;i++)
+      {
+        chunk[2*i]=g_hexDigits[data[i]>>4];
+        chunk[2*i+1]=g_hexDigits[data[i]&15];
+      }
+      writer.write(chunk, 2*n);
+      data+=n;
+      size-=n;
+    }
+  }
+}
+
+Helper::ExportWriter::ExportWriter(QIODevice *device, const ExportOptions &options):
+  m_device(device), m_options(options), m_used(0), m_zstream(nullptr)
+{
+  m_buffer.resize(qMax(options.bufferSize, 1024));
+#ifdef HFSQTLI_ENABLE_ZLIB
+  if(options.gzip)
+  {
+    auto *stream=new z_stream;
+    memset(stream, 0, sizeof(z_stream));
+    // 16 added to window bits writes gzip header and trailer instead of zlib ones
+    if(deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+    {
+      delete stream;
+      m_errorMsg="Cannot initialize gzip compression";
+    }
+    else
+    {
+      m_zstream=stream;
+      m_compressed.resize(m_buffer.size());
+    }
+  }
+#else
+  if(options.gzip)
+    m_errorMsg="gzip compression requires HFSQTLI_ENABLE_ZLIB";
+#endif
+}
+
+Helper::ExportWriter::~ExportWriter()
+{
+#ifdef HFSQTLI_ENABLE_ZLIB
+  if(m_zstream)
+  {
+    deflateEnd(static_cast<z_stream *>(m_zstream));
+    delete static_cast<z_stream *>(m_zstream);
+  }
+#endif
+}
+
+bool Helper::ExportWriter::finish()
+{
+  flushBuffer();
+  if(m_zstream)
+    output(nullptr, 0, true);
+  return isOk();
+}
+
+void Helper::ExportWriter::flushBuffer()
+{
+  if(m_used>0)
+  {
+    output(m_buffer.constData(), m_used);
+    m_used=0;
+  }
+}
+
+void Helper::ExportWriter::output(const char *data, qsizetype size, bool last)
+{
+  if(!isOk())
+    return;
+#ifdef HFSQTLI_ENABLE_ZLIB
+  if(m_zstream)
+  {
+    auto *stream=static_cast<z_stream *>(m_zstream);
+    stream->next_in=reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream->avail_in=uInt(size);
+    int ret;
+    // Without Z_FINISH deflate is done when all input is consumed, i.e. some output space is left
+    do
+    {
+      stream->next_out=reinterpret_cast<Bytef *>(m_compressed.data());
+      stream->avail_out=uInt(m_compressed.size());
+      ret=deflate(stream, last?Z_FINISH:Z_NO_FLUSH);
+      if(ret==Z_STREAM_ERROR)
+      {
+        m_errorMsg="gzip compression failed";
+        return;
+      }
+      writeDevice(m_compressed.constData(), m_compressed.size()-stream->avail_out);
+    } while(isOk() && (stream->avail_out==0 || (last && ret!=Z_STREAM_END)));
+    return;
+  }
+#else
+  Q_UNUSED(last);
+#endif
+  writeDevice(data, size);
+}
+
+void Helper::ExportWriter::writeDevice(const char *data, qint64 size)
+{
+  while(size>0 && isOk())
+  {
+    qint64 written=m_device->write(data, size);
+    if(written<0)
+    {
+      m_errorMsg=m_device->errorString();
+      if(m_errorMsg.isEmpty())
+        m_errorMsg="Error writing to device";
+      return;
+    }
+    data+=written;
+    size-=written;
+    // Backpressure: don't let a slow device (e.g. a socket) accumulate the whole result in its write buffer
+    while(isOk() && (written==0 || m_device->bytesToWrite()>m_options.maxPendingBytes))
+    {
+      if(!m_device->waitForBytesWritten(m_options.writeTimeout))
+        m_errorMsg="Timeout writing to device";
+      written=1;
+    }
+  }
+}
+
+bool Query::exportTo(QIODevice *device, ExportFormat format, const ExportOptions &options, qint64 *rows)
+{
+  qint64 count=0;
+  if(rows)
+    *rows=0;
+  if(!isPrepared() || !device || !device->isWritable())
+  {
+    setInternalError(SQLITE_MISUSE);
+    return false;
+  }
+  Helper::ExportWriter writer(device, options);
+  if(!writer.isOk())
+  {
+    setInternalError(SQLITE_MISUSE, writer.errorMsg().toUtf8().constData());
+    return false;
+  }
+  int columns=sqlite3_column_count(m_stmt);
+  // Column names, already escaped: JSON keys include quotes and colon
+  QVector<QByteArray> names(columns);
+  bool json=format==ExportFormat::Json || format==ExportFormat::JsonLines;
+  for(int i=0;i<columns;i++)
+  {
+    const char *name=sqlite3_column_name(m_stmt, i);
+    int size=name?int(strlen(name)):0;
+    if(json)
+    {
+      QByteArray key=(i?",":"")+QByteArray("\"");
+      for(int j=0;j<size;j++)
+      {
+        unsigned char c=static_cast<unsigned char>(name[j]);
+        if(c=='"' || c=='\\')
+          key+='\\';
+        if(c<0x20)
+          key+="\\u00"+QByteArray(1, g_hexDigits[c>>4])+QByteArray(1, g_hexDigits[c&15]);
+        else
+          key+=char(c);
+      }
+      names[i]=key+"\":";
+    }
+    else if(options.header)
+    {
+      if(i)
+        writer.put(format==ExportFormat::Csv?',':'\t');
+      if(format==ExportFormat::Csv)
+        writeCsvText(writer, name, size);
+      else
+        writeTsvText(writer, name, size);
+    }
+  }
+  if(!json && options.header)
+    writer.write(format==ExportFormat::Csv?"\r\n":"\n");
+  if(format==ExportFormat::Json)
+    writer.put('[');
+  // A query already positioned on a row (stepped but not done nor reset) starts from that row
+  if(m_error==SQLITE_ROW && sqlite3_stmt_busy(m_stmt))
+    exportRow(writer, format, names, count++);
+  while(writer.isOk() && stepNoFetch())
+    exportRow(writer, format, names, count++);
+  bool ret=writer.isOk() && m_error==SQLITE_DONE;
+  if(ret && format==ExportFormat::Json)
+    writer.write(count?"\n]\n":"]\n");
+  if(!writer.finish())
+  {
+    setInternalError(SQLITE_IOERR, writer.errorMsg().toUtf8().constData());
+    ret=false;
+  }
+  if(rows)
+    *rows=count;
+  return ret;
+}
+
+void Query::exportRow(Helper::ExportWriter &writer, ExportFormat format, const QVector<QByteArray> &names, qint64 row)
+{
+  int columns=names.size();
+  switch(format)
+  {
+  case ExportFormat::Csv:
+  case ExportFormat::Tsv:
+    {
+      bool csv=format==ExportFormat::Csv;
+      for(int i=0;i<columns;i++)
+      {
+        if(i)
+          writer.put(csv?',':'\t');
+        switch(sqlite3_column_type(m_stmt, i))
+        {
+        case SQLITE_NULL:
+          if(!csv)
+            writer.write("\\N", 2);
+          break;
+        case SQLITE_BLOB:
+          writeHex(writer, static_cast<const unsigned char *>(sqlite3_column_blob(m_stmt, i)), sqlite3_column_bytes(m_stmt, i));
+          break;
+        case SQLITE_TEXT:
+          {
+            auto text=reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, i));
+            int size=sqlite3_column_bytes(m_stmt, i);
+            if(csv)
+              writeCsvText(writer, text, size);
+            else
+              writeTsvText(writer, text, size);
+          }
+          break;
+        case SQLITE_FLOAT:
+          writeDouble(writer, sqlite3_column_double(m_stmt, i), false);
+          break;
+        default:
+          // Integers never need quoting or escaping
+          writer.write(reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, i)), sqlite3_column_bytes(m_stmt, i));
+          break;
+        }
+      }
+      writer.write(csv?"\r\n":"\n", csv?2:1);
+    }
+    break;
+  case ExportFormat::Json:
+  case ExportFormat::JsonLines:
+    if(format==ExportFormat::Json)
+      writer.write(row?",\n":"\n", row?2:1);
+    writer.put('{');
+    for(int i=0;i<columns;i++)
+    {
+      writer.write(names[i].constData(), names[i].size());
+      switch(sqlite3_column_type(m_stmt, i))
+      {
+      case SQLITE_NULL:
+        writer.write("null", 4);
+        break;
+      case SQLITE_BLOB:
+        writer.put('"');
+        writeHex(writer, static_cast<const unsigned char *>(sqlite3_column_blob(m_stmt, i)), sqlite3_column_bytes(m_stmt, i));
+        writer.put('"');
+        break;
+      case SQLITE_TEXT:
+        writeJsonString(writer, reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, i)), sqlite3_column_bytes(m_stmt, i));
+        break;
+      case SQLITE_FLOAT:
+        writeDouble(writer, sqlite3_column_double(m_stmt, i), true);
+        break;
+      default:
+        writer.write(reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, i)), sqlite3_column_bytes(m_stmt, i));
+        break;
+      }
+    }
+    writer.put('}');
+    if(format==ExportFormat::JsonLines)
+      writer.put('\n');
+    break;
+  }
+}
+
+
+using namespace HFSQtLi;
+
+QStringList Helper::mappedColumns(const char *names)
+{
+  QStringList ret;
+  for(const QString &name: QString(names).split(','))
+    ret.append(name.trimmed());
+  return ret;
+}
+
+QVector<QByteArray> Helper::mappedColumnNames(const QStringList &columns)
+{
+  QVector<QByteArray> ret;
+  ret.reserve(columns.size());
+  for(const QString &column: columns)
+    ret.append(column.toUtf8());
+  return ret;
+}
+
+QString Helper::mappedCreateTableSql(const QString &table, const QStringList &columns, const char *const *types, const QString &constraints)
+{
+  QStringList definitions;
+  for(int i=0;i<columns.size();i++)
+    definitions.append(quoteIdentifier(columns[i])+" "+types[i]);
+  if(!constraints.isEmpty())
+    definitions.append(constraints);
+  return "CREATE TABLE IF NOT EXISTS "+quoteIdentifier(table)+" ("+definitions.join(", ")+")";
+}
+
+QString Helper::mappedInsertSql(const QString &table, const QStringList &columns)
+{
+  QStringList quoted, parameters;
+  for(const QString &column: columns)
+  {
+    quoted.append(quoteIdentifier(column));
+    parameters.append("?");
+  }
+  return "INSERT INTO "+quoteIdentifier(table)+" ("+quoted.join(", ")+") VALUES ("+parameters.join(", ")+")";
+}
+
+QString Helper::mappedSelectSql(const QString &table, const QStringList &columns, const QString &where)
+{
+  QStringList quoted;
+  for(const QString &column: columns)
+    quoted.append(quoteIdentifier(column));
+  QString ret="SELECT "+quoted.join(", ")+" FROM "+quoteIdentifier(table);
+  if(!where.isEmpty())
+    ret+=" WHERE "+where;
+  return ret;
+}
+
+
+using namespace HFSQtLi;
+
+InternPool::InternPool(int maxSize): m_maxSize(maxSize), m_hits(0), m_misses(0)
+{
+}
+
+QString InternPool::intern(const char *utf8, qsizetype size)
+{
+  if(!utf8)
+    return QString();
+  auto it=m_strings.constFind(QByteArray::fromRawData(utf8, size));
+  if(it!=m_strings.constEnd())
+  {
+    m_hits++;
+    return it.value();
+  }
+  m_misses++;
+  QString ret=QString::fromUtf8(utf8, size);
+  if(m_strings.size()<m_maxSize)
+    m_strings.insert(QByteArray(utf8, size), ret);
+  return ret;
+}
+
 using namespace HFSQtLi;
 
 Db *Db::open(const QString &filename, QIODevice::OpenMode flags, QString *errorMsg, const char *zVfs)
@@ -586,25 +1909,40 @@ Db *Db::open(const QString &filename, QIODevice::OpenMode flags, QString *errorM
 Db::Db(const QString &filename, QIODevice::OpenMode flags, const char *zVfs)
 {
   int sqliteFlags=SQLITE_OPEN_EXRESCODE;
-  if(flags&QIODevice::ReadWrite)
+  // QIODevice::ReadOnly is a bit of QIODevice::ReadWrite: only the write bit selects a read/write database.
+  // SQLite accepts SQLITE_OPEN_CREATE only together with SQLITE_OPEN_READWRITE.
+  if(flags&QIODevice::WriteOnly)
+  {
     sqliteFlags|=SQLITE_OPEN_READWRITE;
+    if(!(flags&QIODevice::Append))
+      sqliteFlags|=SQLITE_OPEN_CREATE;
+  }
   else
     sqliteFlags|=SQLITE_OPEN_READONLY;
-  if(!(flags&QIODevice::Append))
-    sqliteFlags|=SQLITE_OPEN_CREATE;
 
   m_openError=sqlite3_open_v2(filename.toUtf8(),
                           &m_db,
                           sqliteFlags,
                           zVfs);
   m_queryCount=0;
+  m_changes=nullptr;
+  m_resultCache=nullptr;
+  m_writeWaited=0;
+  m_writeRetries=0;
+  m_writeSavedTimeout=0;
+  m_progressInstructions=0;
+  m_progressHandler=nullptr;
+  m_progressData=nullptr;
   if(!m_db)
     m_openErrorMsg=SQLiteCode::errorString(m_openError);
 }
 
 Db::~Db()
 {
+  // The cache holds prepared statements
+  delete m_resultCache;
   Q_ASSERT(m_queryCount==0);
+  delete m_changes;
   if(m_db)
     sqlite3_close_v2(m_db);
 }
@@ -625,12 +1963,218 @@ QString Db::errorMsg() const
   return m_db?QString::fromUtf8(sqlite3_errmsg(m_db)):m_openErrorMsg;
 }
 
-Query *Db::query(const char *queryStr, bool persistent, bool keepErrorMessage)
+void Db::cancel()
 {
-  auto ret=new Query(this, queryStr, persistent, keepErrorMessage);
+  if(m_db)
+    sqlite3_interrupt(m_db);
+}
+
+void Db::setProgressHandler(int instructions, int (*handler)(void *), void *userData)
+{
+  // Queries with a deadline read the handler while they step, holding the mutex
+  Lock lock(this, true);
+  m_progressInstructions=handler?instructions:0;
+  m_progressHandler=handler;
+  m_progressData=handler?userData:nullptr;
+  if(m_db)
+    sqlite3_progress_handler(m_db, m_progressInstructions, m_progressHandler, m_progressData);
+}
+
+Query *Db::query(const char *queryStr, bool persistent, bool keepErrorMessage)
+{
+  auto ret=new Query(this, queryStr, persistent, keepErrorMessage);
+  return ret;
+}
+
+void Db::writeStart()
+{
+  m_writeWaited=0;
+  m_writeRetries=0;
+  m_writeBusyTimer.invalidate();
+  m_writeSavedTimeout=0;
+  if(m_db)
+  {
+    // SQLite has no getter for the busy handler, but the busy timeout can be read back to restore it at the end
+    sqlite3_stmt *stmt=nullptr;
+    if(sqlite3_prepare_v2(m_db, "PRAGMA busy_timeout", -1, &stmt, nullptr)==SQLITE_OK && sqlite3_step(stmt)==SQLITE_ROW)
+      m_writeSavedTimeout=sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    sqlite3_busy_handler(m_db, &Db::writeBusyHandler, this);
+  }
+}
+
+int Db::writeBegin(QString *errorMsg)
+{
+  int ret=SQLITE_MISUSE;
+  if(m_db)
+  {
+    m_writeBusyTimer.invalidate();
+    ret=sqlite3_exec(m_db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr);
+  }
+  if(ret!=SQLITE_OK && errorMsg)
+    *errorMsg=m_db?QString::fromUtf8(sqlite3_errmsg(m_db)):SQLiteCode::errorString(ret);
+  return ret;
+}
+
+int Db::writeCommit()
+{
+  m_writeBusyTimer.invalidate();
+  return sqlite3_exec(m_db, "COMMIT", nullptr, nullptr, nullptr);
+}
+
+int Db::writeAbortCode()
+{
+  int code=sqlite3_extended_errcode(m_db);
+  int primary=code&0xff;
+  return (primary==SQLITE_BUSY || primary==SQLITE_LOCKED)?code:SQLITE_ABORT;
+}
+
+void Db::writeRollback(int code, QString *errorMsg)
+{
+  if(errorMsg)
+  {
+    // A function returning false without a failed statement has no error message of its own
+    int last=sqlite3_errcode(m_db);
+    if(code==SQLITE_ABORT && (last==SQLITE_OK || last==SQLITE_ROW || last==SQLITE_DONE))
+      *errorMsg=QString::fromUtf8("Write function aborted the transaction");
+    else
+      *errorMsg=QString::fromUtf8(sqlite3_errmsg(m_db));
+  }
+  if(!sqlite3_get_autocommit(m_db))
+    sqlite3_exec(m_db, "ROLLBACK", nullptr, nullptr, nullptr);
+}
+
+qint64 Db::writeDelay(int count)
+{
+  // Exponential backoff with "equal jitter": a random delay between half and the full exponential value
+  qint64 delay=qMin<qint64>(m_writePolicy.maxBackoff, qint64(qMax(m_writePolicy.initialBackoff, 1))<<qMin(count, 30));
+  return delay/2+QRandomGenerator::global()->bounded(delay/2+1);
+}
+
+bool Db::writeBackoff(int code, int attempt)
+{
+  bool ret=false;
+  int primary=code&0xff;
+  if((primary==SQLITE_BUSY || primary==SQLITE_LOCKED) && attempt<m_writePolicy.maxRetries)
+  {
+    qint64 delay=writeDelay(attempt);
+    QThread::usleep(delay);
+    m_writeWaited+=delay;
+    m_writeRetries++;
+    ret=true;
+  }
+  return ret;
+}
+
+void Db::writeFinish(bool success)
+{
+  if(m_db)
+    sqlite3_busy_timeout(m_db, m_writeSavedTimeout);
+  m_writeStats.waitTime.add(m_writeWaited);
+  m_writeStats.retries.add(m_writeRetries);
+  if(!success)
+    m_writeStats.failures++;
+}
+
+int Db::writeBusyHandler(void *db, int count)
+{
+  Db *self=static_cast<Db *>(db);
+  if(count==0 || !self->m_writeBusyTimer.isValid())
+    self->m_writeBusyTimer.start();
+  else if(self->m_writeBusyTimer.hasExpired(self->m_writePolicy.busyTimeout))
+    return 0;
+  qint64 delay=self->writeDelay(count);
+  QThread::usleep(delay);
+  self->m_writeWaited+=delay;
+  self->m_writeRetries++;
+  return 1;
+}
+
+bool Db::createFunction(const char *name, int argc, int flags, void *data, void (*function)(sqlite3_context *, int, sqlite3_value **), void (*destroy)(void *))
+{
+  if(!m_db)
+  {
+    destroy(data);
+    return false;
+  }
+  return sqlite3_create_function_v2(m_db, name, argc, SQLITE_UTF8|functionFlags(flags), data, function, nullptr, nullptr, destroy)==SQLITE_OK;
+}
+
+bool Db::createAggregate(const char *name, int argc, int flags, void (*step)(sqlite3_context *, int, sqlite3_value **), void (*final)(sqlite3_context *),
+                         void (*value)(sqlite3_context *), void (*inverse)(sqlite3_context *, int, sqlite3_value **))
+{
+  if(!m_db)
+    return false;
+  return sqlite3_create_window_function(m_db, name, argc, SQLITE_UTF8|functionFlags(flags), nullptr, step, final, value, inverse, nullptr)==SQLITE_OK;
+}
+
+int Db::functionFlags(int flags)
+{
+  int ret=0;
+  if(flags&FunctionDeterministic)
+    ret|=SQLITE_DETERMINISTIC;
+#ifdef SQLITE_DIRECTONLY
+  if(flags&FunctionDirectOnly)
+    ret|=SQLITE_DIRECTONLY;
+#endif
+#ifdef SQLITE_INNOCUOUS
+  if(flags&FunctionInnocuous)
+    ret|=SQLITE_INNOCUOUS;
+#endif
+  return ret;
+}
+
+Backup *Db::backupTo(Db *destination, int pagesPerStep, int sleepBetweenSteps, const char *sourceName, const char *destinationName)
+{
+  return destination?new Backup(this, sourceName, destination, destinationName, false, pagesPerStep, sleepBetweenSteps):nullptr;
+}
+
+Backup *Db::backupTo(const QString &filename, int pagesPerStep, int sleepBetweenSteps, QString *errorMsg)
+{
+  Db *destination=Db::open(filename, QIODevice::ReadWrite, errorMsg);
+  return destination?new Backup(this, "main", destination, "main", true, pagesPerStep, sleepBetweenSteps):nullptr;
+}
+
+Checkpointer *Db::checkpointer(int interval, qint64 walSizeLimit, int busyTimeout, QString *errorMsg)
+{
+  Checkpointer *ret=nullptr;
+  const char *filename=m_db?sqlite3_db_filename(m_db, "main"):nullptr;
+  if(!filename || !*filename)
+  {
+    if(errorMsg)
+      *errorMsg=SQLiteCode::errorString(SQLITE_MISUSE);
+  }
+  else
+  {
+    QString name=QString::fromUtf8(filename);
+    Db *connection=Db::open(name, QIODevice::ReadWrite|QIODevice::Append, errorMsg);
+    if(connection)
+    {
+      sqlite3_busy_timeout(connection->m_db, busyTimeout);
+      ret=new Checkpointer(this, connection, name+"-wal", interval, walSizeLimit);
+    }
+  }
   return ret;
 }
 
+ChangeNotifier *Db::changes()
+{
+  if(!m_changes && m_db)
+    m_changes=new ChangeNotifier(this);
+  return m_changes;
+}
+
+ResultCache *Db::resultCache()
+{
+  if(!m_resultCache && m_db)
+  {
+    // Changes are tracked by the hooks of the change notifier
+    changes();
+    m_resultCache=new ResultCache(this);
+  }
+  return m_resultCache;
+}
+
 Db::Lock::Lock(Db *db, bool lock)
 {
   Q_ASSERT(db);
@@ -713,244 +2257,2835 @@ int Db::Lock::releaseInternal(int code, QString &msg, const char *explicitMessag
 
 
 using namespace HFSQtLi;
-using namespace HFSQtLi::Helper;
 
-qint64 BlobData::size()
+void Histogram::add(quint64 value)
 {
-  qint64 ret=-1;
-  if(m_blob)
-  {
-    if(m_sizeCache<=0)
-      m_sizeCache=sqlite3_blob_bytes(m_blob);
-    ret=m_sizeCache;
-  }
-  return ret;
+  int i=0;
+  for(quint64 v=value; v; v>>=1)
+    i++;
+  m_buckets[qMin(i, Buckets-1)]++;
+  m_count++;
+  m_sum+=value;
+  m_max=qMax(m_max, value);
 }
 
-bool BlobData::close(QString *errorMsg)
+double Histogram::mean() const
 {
-  int ret=SQLITE_OK;
-  if(m_blob)
+  return m_count?double(m_sum)/m_count:qQNaN();
+}
+
+quint64 Histogram::percentile(double p) const
+{
+  quint64 ret=0;
+  if(m_count)
   {
-    Db::Lock lock(m_db, true);
-    if((ret=sqlite3_blob_close(m_blob))==SQLITE_OK)
+    quint64 target=qMax<quint64>(1, quint64(qBound(0., p, 1.)*m_count+0.5));
+    quint64 cumulative=0;
+    for(int i=0;i<Buckets;i++)
     {
-      m_blob=nullptr;
-      m_sizeCache=-1;
+      cumulative+=m_buckets[i];
+      if(cumulative>=target)
+      {
+        ret=qMin(bucketUpperBound(i), m_max);
+        break;
+      }
     }
-    lock.release(errorMsg);
   }
-  return (ret==SQLITE_OK);
+  return ret;
 }
 
-bool BlobData::open(QString *errorMsg)
+
+using namespace HFSQtLi;
+
+void *Helper::contextUserData(sqlite3_context *context)
 {
-  int ret=SQLITE_MISUSE;
-  if(m_db && m_table && m_column && m_hasRowId && !m_blob)
-  {
-    Db::Lock lock(m_db, true);
-    ret=sqlite3_blob_open(m_db->m_db, m_database?m_database:"main", m_table, m_column, m_rowId, m_readWrite?1:0, &m_blob);
-    lock.release(errorMsg);
-  }
-  else if(errorMsg)
-    *errorMsg=SQLiteCode::errorString(SQLITE_MISUSE);
-  return (ret==SQLITE_OK);
+  return sqlite3_user_data(context);
 }
 
-bool BlobData::open(qint64 id, QString *errorMsg)
+void *Helper::aggregateContext(sqlite3_context *context, int bytes)
 {
-  bool ret;
-  if(isOpen())
-    ret=reopenFast(id, errorMsg);
-  else
-  {
-    m_rowId=id;
-    m_hasRowId=true;
-    ret=open(errorMsg);
-  }
-  return ret;
+  return sqlite3_aggregate_context(context, bytes);
 }
 
-bool BlobData::reopenFast(qint64 newId, QString *errorMsg)
+void Helper::resultNull(sqlite3_context *context)
 {
-  int ret=SQLITE_MISUSE;
-  if(m_blob)
-  {
-    m_rowId=newId;
-    Db::Lock lock(m_db, true);
-    ret=sqlite3_blob_reopen(m_blob, m_rowId);
-    if(ret!=SQLITE_OK)
-    {
-      sqlite3_blob_close(m_blob);
-      m_blob=nullptr;
-    }
-    lock.release(errorMsg);
-  }
-  else if(errorMsg)
-    *errorMsg=SQLiteCode::errorString(SQLITE_MISUSE);
-  m_sizeCache=-1;
-  return (ret==SQLITE_OK);
+  sqlite3_result_null(context);
 }
 
-BlobData::BlobData(Db *connection, const char *database, const char *table, const char *column, bool readWrite, bool autoOpen): m_db(connection), m_blob(nullptr), m_database(nullptr), m_table(nullptr), m_column(nullptr), m_rowId(std::numeric_limits<qint64>::min()), m_hasRowId(false), m_readWrite(readWrite), m_autoOpen(autoOpen), m_sizeCache(-1)
+void Helper::resultInt64(sqlite3_context *context, qint64 value)
 {
-  setDatabase(database);
-  setTable(table);
-  setColumn(column);
+  sqlite3_result_int64(context, value);
 }
 
-BlobData::~BlobData()
+void Helper::resultDouble(sqlite3_context *context, double value)
 {
-  close(nullptr);
-  if(m_db)
-    m_db->m_queryCount--;
+  sqlite3_result_double(context, value);
 }
 
-bool BlobData::read(void *data, qsizetype size, qsizetype offset)
+void Helper::resultText(sqlite3_context *context, const QString &value)
 {
-  bool ret=false;
-  if(m_blob)
-    ret=(sqlite3_blob_read(m_blob, data, size, offset)==SQLITE_OK);
-  return ret;
+  QByteArray utf8=value.toUtf8();
+  sqlite3_result_text64(context, utf8.constData(), utf8.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
 }
 
-bool BlobData::write(const void *data, qsizetype size, qsizetype offset)
+void Helper::resultText(sqlite3_context *context, const char *value)
 {
-  bool ret=false;
-  if(m_blob)
-    ret=(sqlite3_blob_write(m_blob, data, size, offset)==SQLITE_OK);
-  return ret;
+  if(value)
+    sqlite3_result_text(context, value, -1, SQLITE_TRANSIENT);
+  else
+    sqlite3_result_null(context);
+}
+
+void Helper::resultBlob(sqlite3_context *context, const QByteArray &value)
+{
+  sqlite3_result_blob64(context, value.constData(), value.size(), SQLITE_TRANSIENT);
 }
 
+void Helper::resultError(sqlite3_context *context, const char *message)
+{
+  sqlite3_result_error(context, message, -1);
+}
 
-bool BlobData::setDbPointer(Db *db)
+void Helper::resultNoMemory(sqlite3_context *context)
 {
-  bool ret=false;
-  if(db==m_db && (m_blob || !m_autoOpen)) // Not changing value on an already opened or a not auto-opening blob. No need to try to open it again.
-    ret=true;
-  else
+  sqlite3_result_error_nomem(context);
+}
+
+
+using namespace HFSQtLi;
+
+namespace
+{
+  // Bits of idxNum describing the rowid constraints used by the plan. Arguments are passed in the same order.
+  enum RowidConstraint
   {
-    if(close(nullptr))
+    RowidEq=1,
+    RowidGe=2,
+    RowidGt=4,
+    RowidLe=8,
+    RowidLt=16
+  };
+
+  struct Table
+  {
+    sqlite3_vtab base;
+    const Helper::TableSource *source;
+  };
+
+  struct Cursor
+  {
+    sqlite3_vtab_cursor base;
+    qint64 row;
+    qint64 end;
+  };
+
+  const Helper::TableSource *cursorSource(sqlite3_vtab_cursor *cursor)
+  {
+    return reinterpret_cast<Table *>(cursor->pVtab)->source;
+  }
+
+  // Converts a rowid bound to the first row index satisfying it (or the index following the last one for upper bounds)
+  qint64 rowBound(sqlite3_value *value, int constraint, qint64 rows)
+  {
+    double d=sqlite3_value_double(value);
+    double ret;
+    switch(constraint)
     {
-      if(m_db)
-        m_db->m_queryCount--;
-      m_db=db;
-      if(m_db)
-        m_db->m_queryCount++;
-      ret=checkAutoOpen();
+    case RowidGe:
+    case RowidLt:
+      ret=std::ceil(d);
+      break;
+    default: // RowidGt, RowidLe
+      ret=std::floor(d)+1;
+      break;
     }
+    return ret<0?0:(ret>double(rows)?rows:qint64(ret));
   }
-  return ret;
-}
 
-bool BlobData::setDatabase(const char *database)
-{
-  bool ret=false;
-  if(((m_database && database && !strcmp(database, m_database)) || (!m_database && database)) && (m_blob || !m_autoOpen)) // Not changing value on an already opened or a not auto-opening blob. No need to try to open it again.
-    ret=true;
-  else
+  int tableConnect(sqlite3 *db, void *aux, int, const char *const *, sqlite3_vtab **vtab, char **)
   {
-    if(close(nullptr))
+    auto *source=static_cast<const Helper::TableSource *>(aux);
+    int ret=sqlite3_declare_vtab(db, source->schema().constData());
+    if(ret==SQLITE_OK)
     {
-      free(m_database);
-      m_database=database?strdup(database):nullptr;
-      ret=checkAutoOpen();
+      auto *table=static_cast<Table *>(sqlite3_malloc(sizeof(Table)));
+      if(table)
+      {
+        memset(table, 0, sizeof(Table));
+        table->source=source;
+        *vtab=&table->base;
+      }
+      else
+        ret=SQLITE_NOMEM;
     }
+    return ret;
   }
-  return ret;
-}
 
+  int tableDisconnect(sqlite3_vtab *vtab)
+  {
+    sqlite3_free(vtab);
+    return SQLITE_OK;
+  }
 
-bool BlobData::setTable(const char *table)
-{
-  bool ret=false;
-  if(m_table && table && !strcmp(table, m_table) && (m_blob || !m_autoOpen)) // Not changing value on an already opened or a not auto-opening blob. No need to try to open it again.
-    ret=true;
-  else
+  int constraintBit(unsigned char op)
   {
-    if(close(nullptr))
+    switch(op)
     {
-      free(m_table);
-      m_table=table?strdup(table):nullptr;
-      ret=checkAutoOpen();
+    case SQLITE_INDEX_CONSTRAINT_EQ: return RowidEq;
+    case SQLITE_INDEX_CONSTRAINT_GE: return RowidGe;
+    case SQLITE_INDEX_CONSTRAINT_GT: return RowidGt;
+    case SQLITE_INDEX_CONSTRAINT_LE: return RowidLe;
+    case SQLITE_INDEX_CONSTRAINT_LT: return RowidLt;
+    default: return 0;
     }
   }
-  return ret;
-}
 
-bool BlobData::setColumn(const char *column)
-{
-  bool ret=false;
-  if(m_column && column && !strcmp(column, m_column) && (m_blob || !m_autoOpen)) // Not changing value on an already opened or a not auto-opening blob. No need to try to open it again.
-    ret=true;
-  else
+  int tableBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info)
   {
-    if(close(nullptr))
+    double rows=double(qMax<qint64>(reinterpret_cast<Table *>(vtab)->source->rowCount(), 1));
+    int idxNum=0;
+    bool equality=false;
+    int used[5]={-1, -1, -1, -1, -1}; // Constraint used for each bit of RowidConstraint
+    for(int i=0;i<info->nConstraint;i++)
     {
-      free(m_column);
-      m_column=column?strdup(column):nullptr;
-      ret=checkAutoOpen();
+      const auto &constraint=info->aConstraint[i];
+      if(!constraint.usable)
+        continue;
+      if(constraint.iColumn>=0)
+      {
+        // Equality on other columns can't use an index, but makes the planner expect fewer rows when ordering joins
+        equality|=constraint.op==SQLITE_INDEX_CONSTRAINT_EQ;
+        continue;
+      }
+      int bit=constraintBit(constraint.op);
+      // Use at most one lower and one upper bound
+      if(!bit || (idxNum&bit) || ((bit&(RowidGe|RowidGt)) && (idxNum&(RowidGe|RowidGt))) || ((bit&(RowidLe|RowidLt)) && (idxNum&(RowidLe|RowidLt))))
+        continue;
+      idxNum|=bit;
+      for(int j=0;j<5;j++)
+        if(bit==(1<<j))
+          used[j]=i;
     }
-  }
-  return ret;
+    // Arguments are passed to xFilter in the order of the bits
+    int argc=0;
+    for(int j=0;j<5;j++)
+    {
+      if(used[j]>=0)
+      {
+        // Not omitted: xFilter ignores the values that are not numbers and SQLite checks them against every row
+        info->aConstraintUsage[used[j]].argvIndex=++argc;
+      }
+    }
+    if(idxNum&RowidEq)
+    {
+      info->estimatedCost=1;
+      info->estimatedRows=1;
+      info->idxFlags=SQLITE_INDEX_SCAN_UNIQUE;
+    }
+    else
+    {
+      if((idxNum&(RowidGe|RowidGt)) && (idxNum&(RowidLe|RowidLt)))
+        rows/=16;
+      else if(idxNum)
+        rows/=4;
+      info->estimatedCost=rows;
+      info->estimatedRows=qMax<sqlite3_int64>(sqlite3_int64(equality?rows/10:rows), 1);
+    }
+    info->idxNum=idxNum;
+    // Rows are always visited in rowid order
+    if(info->nOrderBy==1 && info->aOrderBy[0].iColumn<0 && !info->aOrderBy[0].desc)
+      info->orderByConsumed=1;
+    return SQLITE_OK;
+  }
+
+  int cursorOpen(sqlite3_vtab *, sqlite3_vtab_cursor **cursor)
+  {
+    auto *ret=static_cast<Cursor *>(sqlite3_malloc(sizeof(Cursor)));
+    if(!ret)
+      return SQLITE_NOMEM;
+    memset(ret, 0, sizeof(Cursor));
+    *cursor=&ret->base;
+    return SQLITE_OK;
+  }
+
+  int cursorClose(sqlite3_vtab_cursor *cursor)
+  {
+    sqlite3_free(cursor);
+    return SQLITE_OK;
+  }
+
+  int cursorFilter(sqlite3_vtab_cursor *vtabCursor, int idxNum, const char *, int argc, sqlite3_value **argv)
+  {
+    auto *cursor=reinterpret_cast<Cursor *>(vtabCursor);
+    qint64 rows=cursorSource(vtabCursor)->rowCount();
+    cursor->row=0;
+    cursor->end=rows;
+    int arg=0;
+    for(int bit=RowidEq;bit<=RowidLt && arg<argc;bit<<=1)
+    {
+      if(!(idxNum&bit))
+        continue;
+      sqlite3_value *value=argv[arg++];
+      int type=sqlite3_value_numeric_type(value);
+      if(type==SQLITE_NULL)
+      {
+        // Comparisons with NULL are never true
+        cursor->end=0;
+        break;
+      }
+      // Text that is not a number and blobs don't restrict the range: the constraint is evaluated by SQLite
+      if(type!=SQLITE_INTEGER && type!=SQLITE_FLOAT)
+        continue;
+      switch(bit)
+      {
+      case RowidEq:
+        {
+          double d=sqlite3_value_double(value);
+          if(d>=0 && d<double(rows) && std::floor(d)==d)
+          {
+            cursor->row=qMax(cursor->row, qint64(d));
+            cursor->end=qMin(cursor->end, qint64(d)+1);
+          }
+          else
+            cursor->end=0;
+        }
+        break;
+      case RowidGe:
+      case RowidGt:
+        cursor->row=qMax(cursor->row, rowBound(value, bit, rows));
+        break;
+      default:
+        cursor->end=qMin(cursor->end, rowBound(value, bit, rows));
+        break;
+      }
+    }
+    return SQLITE_OK;
+  }
+
+  int cursorNext(sqlite3_vtab_cursor *cursor)
+  {
+    reinterpret_cast<Cursor *>(cursor)->row++;
+    return SQLITE_OK;
+  }
+
+  int cursorEof(sqlite3_vtab_cursor *vtabCursor)
+  {
+    auto *cursor=reinterpret_cast<Cursor *>(vtabCursor);
+    // The container may shrink while a statement is running
+    return cursor->row>=cursor->end || cursor->row>=cursorSource(vtabCursor)->rowCount();
+  }
+
+  int cursorColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *context, int i)
+  {
+    cursorSource(cursor)->column(context, reinterpret_cast<Cursor *>(cursor)->row, i);
+    return SQLITE_OK;
+  }
+
+  int cursorRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+  {
+    *rowid=reinterpret_cast<Cursor *>(cursor)->row;
+    return SQLITE_OK;
+  }
+
+  // Eponymous-only module: xCreate is null, the table exists in the main schema as soon as the module is registered
+  const sqlite3_module g_module=
+  {
+    0,                // iVersion
+    nullptr,          // xCreate
+    tableConnect,     // xConnect
+    tableBestIndex,   // xBestIndex
+    tableDisconnect,  // xDisconnect
+    tableDisconnect,  // xDestroy
+    cursorOpen,       // xOpen
+    cursorClose,      // xClose
+    cursorFilter,     // xFilter
+    cursorNext,       // xNext
+    cursorEof,        // xEof
+    cursorColumn,     // xColumn
+    cursorRowid,      // xRowid
+    nullptr,          // xUpdate
+    nullptr,          // xBegin
+    nullptr,          // xSync
+    nullptr,          // xCommit
+    nullptr,          // xRollback
+    nullptr,          // xFindFunction
+    nullptr,          // xRename
+    nullptr,          // xSavepoint
+    nullptr,          // xRelease
+    nullptr,          // xRollbackTo
+    nullptr           // xShadowName
+  };
+}
+
+Helper::TableSource::TableSource(int columns, const QStringList &names): m_columns(qMax(columns, 0)), m_names(names)
+{
+}
+
+Helper::TableSource::~TableSource()
+{
+}
+
+QByteArray Helper::TableSource::schema() const
+{
+  QByteArray ret("CREATE TABLE x(");
+  for(int i=0;i<m_columns;i++)
+  {
+    if(i)
+      ret+=", ";
+    QByteArray name=i<m_names.size()?m_names.at(i).toUtf8():QByteArray("c")+QByteArray::number(i+1);
+    ret+='"'+name.replace('"', "\"\"")+'"';
+  }
+  ret+=")";
+  return ret;
+}
+
+void Helper::TableSource::destroy(void *source)
+{
+  delete static_cast<TableSource *>(source);
+}
+
+bool Db::createTableModule(const char *name, Helper::TableSource *source)
+{
+  if(!m_db || source->columnCount()<=0)
+  {
+    delete source;
+    return false;
+  }
+  // On failure SQLite destroys source too
+  return sqlite3_create_module_v2(m_db, name, &g_module, source, &Helper::TableSource::destroy)==SQLITE_OK;
+}
+
+
+using namespace HFSQtLi;
+
+ResultCache::Entry::~Entry()
+{
+  for(sqlite3_value *value: qAsConst(values))
+    sqlite3_value_free(value);
+}
+
+ResultCache::ResultCache(Db *db): m_db(db), m_entries(16*1024*1024), m_dataVersionQuery(nullptr), m_dataVersion(-1),
+  m_schemaVersionQuery(nullptr), m_schemaVersion(-1), m_recording(nullptr),
+  m_userAuthorizer(nullptr), m_userAuthorizerData(nullptr), m_hits(0), m_misses(0), m_invalidations(0)
+{
+  if(m_db && m_db->m_db)
+    sqlite3_set_authorizer(m_db->m_db, &ResultCache::authorizer, this);
+}
+
+ResultCache::~ResultCache()
+{
+  if(m_db && m_db->m_db)
+    sqlite3_set_authorizer(m_db->m_db, nullptr, nullptr);
+  for(const Statement &statement: qAsConst(m_statements))
+    delete statement.query;
+  delete m_dataVersionQuery;
+  delete m_schemaVersionQuery;
+}
+
+void ResultCache::clear()
+{
+  m_entries.clear();
+  m_uncached.reset();
+}
+
+void ResultCache::invalidate(const QString &table)
+{
+  tableChanged(table.toUtf8().constData());
+}
+
+int ResultCache::tableIndex(const char *table)
+{
+  QByteArray name(table);
+  auto it=m_tableIndexes.constFind(name);
+  if(it!=m_tableIndexes.constEnd())
+    return it.value();
+  int ret=m_versions.size();
+  m_tableIndexes.insert(name, ret);
+  m_versions.append(0);
+  return ret;
+}
+
+void ResultCache::tableChanged(const char *table)
+{
+  int index=tableIndex(table);
+  m_versions[index]++;
+  m_dirty.insert(index);
+}
+
+void ResultCache::transactionEnd(bool committed)
+{
+  // Entries read inside the transaction may contain rolled back data
+  if(!committed)
+    for(int index: qAsConst(m_dirty))
+      m_versions[index]++;
+  m_dirty.clear();
+}
+
+void ResultCache::setAuthorizer(Authorizer authorizer, void *userData)
+{
+  m_userAuthorizer=authorizer;
+  m_userAuthorizerData=userData;
+}
+
+int ResultCache::authorizer(void *cache, int action, const char *arg1, const char *arg2, const char *database, const char *trigger)
+{
+  auto *self=static_cast<ResultCache *>(cache);
+  // A denied or ignored action is not done: the cache doesn't need to track it
+  if(self->m_userAuthorizer)
+  {
+    int ret=self->m_userAuthorizer(self->m_userAuthorizerData, action, arg1, arg2, database, trigger);
+    if(ret!=SQLITE_OK)
+      return ret;
+  }
+  switch(action)
+  {
+  case SQLITE_READ:
+    // arg1 is the table, reported with an empty column even when no column is read (e.g. SELECT COUNT(*))
+    if(self->m_recording && arg1)
+    {
+      int index=self->tableIndex(arg1);
+      if(!self->m_recording->contains(index))
+        self->m_recording->append(index);
+    }
+    break;
+  case SQLITE_DROP_TABLE:
+  case SQLITE_DROP_TEMP_TABLE:
+  case SQLITE_DROP_VIEW:
+  case SQLITE_DROP_TEMP_VIEW:
+    // The statement is only being prepared: the drop itself is detected by checkDataVersion through the schema version
+    if(arg1)
+      self->m_dropping=arg1;
+    break;
+  case SQLITE_DELETE:
+    // Ignoring DELETE disables the truncate optimization, so the update hook is called for every row.
+    // Deletes from the schema table and from the table being dropped are done by DROP statements and must be allowed, ignoring them would skip the DROP.
+    if(arg1 && strncmp(arg1, "sqlite_", 7)!=0)
+    {
+      if(strcmp(arg1, self->m_dropping.constData())!=0)
+        return SQLITE_IGNORE;
+      self->m_dropping.clear();
+    }
+    break;
+  default:
+    break;
+  }
+  return SQLITE_OK;
+}
+
+ResultCache::Statement *ResultCache::statement(const QString &sql, QString *errorMsg)
+{
+  auto it=m_statements.find(sql);
+  if(it!=m_statements.end())
+    return &it.value();
+  // Bound the number of prepared statements kept
+  if(m_statements.size()>=64)
+  {
+    for(const Statement &statement: qAsConst(m_statements))
+      delete statement.query;
+    m_statements.clear();
+  }
+  Statement statement{new Query(m_db, true), QVector<int>()};
+  statement.query->m_boundValues.reset(new QVector<QByteArray>);
+  m_recording=&statement.tables;
+  bool ok=statement.query->prepare(sql, true);
+  m_recording=nullptr;
+  if(!ok)
+  {
+    if(errorMsg)
+      *errorMsg=statement.query->errorMsg();
+    delete statement.query;
+    return nullptr;
+  }
+  return &m_statements.insert(sql, statement).value();
+}
+
+bool ResultCache::checkDataVersion()
+{
+  if(!m_dataVersionQuery)
+    m_dataVersionQuery=new Query(m_db, "PRAGMA data_version", true);
+  if(!m_schemaVersionQuery)
+    m_schemaVersionQuery=new Query(m_db, "PRAGMA schema_version", true);
+  qint64 version=-1, schemaVersion=-1;
+  bool ret=m_dataVersionQuery->step(version);
+  m_dataVersionQuery->reset();
+  ret=ret && m_schemaVersionQuery->step(schemaVersion);
+  m_schemaVersionQuery->reset();
+  // Another connection committed (tables changed are unknown) or the schema changed (the update hook is not called for the rows of a
+  // dropped table, and a table created again with the same name must not match old entries)
+  if(ret && (version!=m_dataVersion || schemaVersion!=m_schemaVersion))
+  {
+    if(m_dataVersion>=0)
+    {
+      m_invalidations+=m_entries.size();
+      clear();
+    }
+    m_dataVersion=version;
+    m_schemaVersion=schemaVersion;
+  }
+  return ret;
+}
+
+sqlite3_value **ResultCache::fetch(Statement *statement, int columns)
+{
+  Query *query=statement->query;
+  sqlite3_stmt *stmt=query->m_stmt;
+  m_uncached.reset();
+  if(sqlite3_column_count(stmt)!=columns)
+  {
+    query->assertFetchColumnCount(columns);
+    return nullptr;
+  }
+  // A commit of this connection done since the last hook releases the tables it changed
+  if(m_db->m_changes)
+    m_db->m_changes->checkCommitted(false);
+  bool cacheable=checkDataVersion();
+  // Rows read after a change of the running transaction may be undone by a ROLLBACK TO, which calls no hook: they are not cached
+  for(int index: qAsConst(statement->tables))
+    cacheable&=!m_dirty.contains(index);
+  QByteArray key;
+  if(cacheable)
+  {
+    // The SQL text followed by the size and the bytes of every bound value. Values are not converted to text, that would round doubles.
+    key=sqlite3_sql(stmt);
+    const QVector<QByteArray> &values=*query->m_boundValues;
+    int count=sqlite3_bind_parameter_count(stmt);
+    for(int i=0;i<count;i++)
+    {
+      QByteArray value=i<values.size()?values.at(i):QByteArray();
+      qint32 size=qint32(value.size());
+      key.append(reinterpret_cast<const char *>(&size), sizeof(size));
+      key.append(value);
+    }
+  }
+  if(cacheable)
+  {
+    if(Entry *entry=m_entries.object(key))
+    {
+      bool valid=true;
+      for(const auto &version: qAsConst(entry->versions))
+        valid&=m_versions[version.first]==version.second;
+      if(valid)
+      {
+        m_hits++;
+        return entry->values.data();
+      }
+      m_invalidations++;
+      m_entries.remove(key);
+    }
+  }
+  m_misses++;
+  QScopedPointer<Entry> entry(new Entry);
+  // Versions are taken before running the query, so changes made while it runs make the entry stale
+  for(int index: qAsConst(statement->tables))
+    entry->versions.append(qMakePair(index, m_versions[index]));
+  if(!query->stepNoFetch())
+  {
+    if(query->isDone())
+      query->setInternalError(SQLiteCode::CONSTRAINT, "Step single query returned no rows");
+    return nullptr;
+  }
+  qint64 cost=sizeof(Entry)+key.size();
+  for(int i=0;i<columns;i++)
+  {
+    sqlite3_value *value=sqlite3_value_dup(sqlite3_column_value(stmt, i));
+    if(!value)
+    {
+      query->setInternalError(SQLITE_NOMEM);
+      return nullptr;
+    }
+    entry->values.append(value);
+    cost+=64;
+    // Asking the size of numbers would convert them to text
+    int type=sqlite3_value_type(value);
+    if(type==SQLITE_TEXT || type==SQLITE_BLOB)
+      cost+=sqlite3_value_bytes(value);
+  }
+  if(query->stepNoFetch())
+  {
+    query->setInternalError(SQLiteCode::CONSTRAINT, "Step single query returned more than one row");
+    return nullptr;
+  }
+  if(!query->isDone())
+    return nullptr;
+  sqlite3_value **ret=entry->values.data();
+  if(cacheable && cost<=m_entries.maxCost())
+    m_entries.insert(key, entry.take(), cost);
+  else
+    m_uncached.reset(entry.take());
+  return ret;
+}
+
+
+using namespace HFSQtLi;
+using namespace HFSQtLi::Helper;
+
+qint64 BlobData::size()
+{
+  qint64 ret=-1;
+  if(m_blob)
+  {
+    if(m_sizeCache<=0)
+      m_sizeCache=sqlite3_blob_bytes(m_blob);
+    ret=m_sizeCache;
+  }
+  return ret;
+}
+
+bool BlobData::close(QString *errorMsg)
+{
+  int ret=SQLITE_OK;
+  if(m_blob)
+  {
+    Db::Lock lock(m_db, true);
+    if((ret=sqlite3_blob_close(m_blob))==SQLITE_OK)
+    {
+      m_blob=nullptr;
+      m_sizeCache=-1;
+    }
+    lock.release(errorMsg);
+  }
+  return (ret==SQLITE_OK);
+}
+
+bool BlobData::open(QString *errorMsg)
+{
+  int ret=SQLITE_MISUSE;
+  if(m_db && m_table && m_column && m_hasRowId && !m_blob)
+  {
+    Db::Lock lock(m_db, true);
+    ret=sqlite3_blob_open(m_db->m_db, m_database?m_database:"main", m_table, m_column, m_rowId, m_readWrite?1:0, &m_blob);
+    lock.release(errorMsg);
+  }
+  else if(errorMsg)
+    *errorMsg=SQLiteCode::errorString(SQLITE_MISUSE);
+  return (ret==SQLITE_OK);
+}
+
+bool BlobData::open(qint64 id, QString *errorMsg)
+{
+  bool ret;
+  if(isOpen())
+    ret=reopenFast(id, errorMsg);
+  else
+  {
+    m_rowId=id;
+    m_hasRowId=true;
+    ret=open(errorMsg);
+  }
+  return ret;
+}
+
+bool BlobData::reopenFast(qint64 newId, QString *errorMsg)
+{
+  int ret=SQLITE_MISUSE;
+  if(m_blob)
+  {
+    m_rowId=newId;
+    Db::Lock lock(m_db, true);
+    ret=sqlite3_blob_reopen(m_blob, m_rowId);
+    if(ret!=SQLITE_OK)
+    {
+      sqlite3_blob_close(m_blob);
+      m_blob=nullptr;
+    }
+    lock.release(errorMsg);
+  }
+  else if(errorMsg)
+    *errorMsg=SQLiteCode::errorString(SQLITE_MISUSE);
+  m_sizeCache=-1;
+  return (ret==SQLITE_OK);
+}
+
+BlobData::BlobData(Db *connection, const char *database, const char *table, const char *column, bool readWrite, bool autoOpen): m_db(connection), m_blob(nullptr), m_database(nullptr), m_table(nullptr), m_column(nullptr), m_rowId(std::numeric_limits<qint64>::min()), m_hasRowId(false), m_readWrite(readWrite), m_autoOpen(autoOpen), m_sizeCache(-1)
+{
+  setDatabase(database);
+  setTable(table);
+  setColumn(column);
+}
+
+BlobData::~BlobData()
+{
+  close(nullptr);
+  if(m_db)
+    m_db->m_queryCount--;
+}
+
+bool BlobData::read(void *data, qsizetype size, qsizetype offset)
+{
+  bool ret=false;
+  if(m_blob)
+    ret=(sqlite3_blob_read(m_blob, data, size, offset)==SQLITE_OK);
+  return ret;
+}
+
+bool BlobData::write(const void *data, qsizetype size, qsizetype offset)
+{
+  bool ret=false;
+  if(m_blob)
+    ret=(sqlite3_blob_write(m_blob, data, size, offset)==SQLITE_OK);
+  return ret;
+}
+
+
+bool BlobData::setDbPointer(Db *db)
+{
+  bool ret=false;
+  if(db==m_db && (m_blob || !m_autoOpen)) // Not changing value on an already opened or a not auto-opening blob. No need to try to open it again.
+    ret=true;
+  else
+  {
+    if(close(nullptr))
+    {
+      if(m_db)
+        m_db->m_queryCount--;
+      m_db=db;
+      if(m_db)
+        m_db->m_queryCount++;
+      ret=checkAutoOpen();
+    }
+  }
+  return ret;
+}
+
+bool BlobData::setDatabase(const char *database)
+{
+  bool ret=false;
+  if(((m_database && database && !strcmp(database, m_database)) || (!m_database && database)) && (m_blob || !m_autoOpen)) // Not changing value on an already opened or a not auto-opening blob. No need to try to open it again.
+    ret=true;
+  else
+  {
+    if(close(nullptr))
+    {
+      free(m_database);
+      m_database=database?strdup(database):nullptr;
+      ret=checkAutoOpen();
+    }
+  }
+  return ret;
+}
+
+
+bool BlobData::setTable(const char *table)
+{
+  bool ret=false;
+  if(m_table && table && !strcmp(table, m_table) && (m_blob || !m_autoOpen)) // Not changing value on an already opened or a not auto-opening blob. No need to try to open it again.
+    ret=true;
+  else
+  {
+    if(close(nullptr))
+    {
+      free(m_table);
+      m_table=table?strdup(table):nullptr;
+      ret=checkAutoOpen();
+    }
+  }
+  return ret;
+}
+
+bool BlobData::setColumn(const char *column)
+{
+  bool ret=false;
+  if(m_column && column && !strcmp(column, m_column) && (m_blob || !m_autoOpen)) // Not changing value on an already opened or a not auto-opening blob. No need to try to open it again.
+    ret=true;
+  else
+  {
+    if(close(nullptr))
+    {
+      free(m_column);
+      m_column=column?strdup(column):nullptr;
+      ret=checkAutoOpen();
+    }
+  }
+  return ret;
+}
+
+bool BlobData::setRowId(qint64 value)
+{
+  bool ret=false;
+  if(m_hasRowId && m_rowId==value && (m_blob || !m_autoOpen)) // Not changing value on an already opened or a not auto-opening blob. No need to try to open it again.
+    ret=true;
+  else
+  {
+    if(m_blob && m_autoOpen)
+      ret=reopenFast(value);
+    else if(close(nullptr))
+    {
+      m_rowId=value;
+      m_hasRowId=true;
+      if(!m_autoOpen || !isValid())
+        ret=true;
+      else
+        ret=open();
+    }
+  }
+  return ret;
+}
+
+bool BlobData::checkAutoOpen()
+{
+  bool ret=true;
+  if(m_autoOpen && m_db && m_table && m_column && m_hasRowId)
+    ret=open(nullptr);
+  return ret;
+}
+
+bool Blob::set(Db *db, const char *database, const char *table, const char *column, qint64 rowid)
+{
+  bool curAutoOpen=m_data->autoOpen();
+  bool ret;
+  ret=m_data->setAutoOpen(false) && m_data->setDbPointer(db) && m_data->setDatabase(database) && m_data->setTable(table) && m_data->setColumn(column) && m_data->setRowId(rowid);
+  m_data->setAutoOpen(curAutoOpen);
+  ret&=m_data->checkAutoOpen();
+  return ret;
+}
+
+bool Blob::set(Db *db, const char *database, const char *table, const char *column)
+{
+  bool curAutoOpen=m_data->autoOpen();
+  bool ret;
+  ret=m_data->setAutoOpen(false) && m_data->setDbPointer(db) && m_data->setDatabase(database) && m_data->setTable(table) && m_data->setColumn(column);
+  m_data->setAutoOpen(curAutoOpen);
+  ret&=m_data->checkAutoOpen();
+  return ret;
+}
+
+bool Blob::set(Db *db, const char *database, const char *table, qint64 rowid)
+{
+  bool curAutoOpen=m_data->autoOpen();
+  bool ret;
+  ret=m_data->setAutoOpen(false) && m_data->setDbPointer(db) && m_data->setDatabase(database) && m_data->setTable(table) && m_data->setRowId(rowid);
+  m_data->setAutoOpen(curAutoOpen);
+  ret&=m_data->checkAutoOpen();
+  return ret;
+}
+
+
+using namespace HFSQtLi;
+
+ResultArena::ResultArena(qsizetype slabSize): m_slabSize(qMax<qsizetype>(slabSize, 64)), m_next(nullptr), m_left(0), m_used(0), m_allocated(0)
+{
+}
+
+ResultArena::~ResultArena()
+{
+  for(char *slab: qAsConst(m_slabs))
+    delete[] slab;
+  for(char *large: qAsConst(m_large))
+    delete[] large;
+}
+
+const char *ResultArena::store(const char *data, qsizetype size, bool terminate)
+{
+  if(size==0 && !terminate)
+    return "";
+  char *ret=allocate(size+(terminate?1:0));
+  if(size>0)
+    memcpy(ret, data, size);
+  if(terminate)
+    ret[size]=0;
+  return ret;
+}
+
+void ResultArena::clear()
+{
+  for(char *large: qAsConst(m_large))
+    delete[] large;
+  m_large.clear();
+  for(int i=1;i<m_slabs.size();i++)
+    delete[] m_slabs[i];
+  m_slabs.resize(qMin<qsizetype>(m_slabs.size(), 1));
+  m_next=m_slabs.isEmpty()?nullptr:m_slabs[0];
+  m_left=m_slabs.isEmpty()?0:m_slabSize;
+  m_allocated=m_left;
+  m_used=0;
+}
+
+char *ResultArena::allocateSlab(qsizetype size)
+{
+  if(size>m_slabSize/4)
+  {
+    // The current slab keeps serving small values
+    char *ret=new char[size];
+    m_large.append(ret);
+    m_allocated+=size;
+    return ret;
+  }
+  char *slab=new char[m_slabSize];
+  m_slabs.append(slab);
+  m_allocated+=m_slabSize;
+  m_next=slab+size;
+  m_left=m_slabSize-size;
+  return slab;
+}
+
+
+using namespace HFSQtLi;
+
+RowBuffer::RowBuffer(): m_poolUsed(0), m_namesGeneration(0), m_namesReprepare(-1), m_namesFirst(0)
+{
+}
+
+int RowBuffer::fetch(sqlite3_stmt *stmt, int first, quint64 generation)
+{
+  int count=qMax(sqlite3_column_count(stmt)-first, 0);
+  // Names are read once per statement, the same buffer is usually fetched from the same query.
+  // The address of the statement is not enough: a statement prepared after another one was finalized may get the same address.
+  int reprepare=sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_REPREPARE, 0);
+  if(generation!=m_namesGeneration || reprepare!=m_namesReprepare || first!=m_namesFirst || count!=m_names.size())
+  {
+    m_names.resize(count);
+    for(int i=0;i<count;i++)
+      m_names[i]=QString::fromUtf8(sqlite3_column_name(stmt, first+i));
+    m_namesGeneration=generation;
+    m_namesReprepare=reprepare;
+    m_namesFirst=first;
+  }
+  m_cells.resize(count);
+  m_poolUsed=0;
+  for(int i=0;i<count;i++)
+  {
+    Cell &cell=m_cells[i];
+    int column=first+i;
+    switch(sqlite3_column_type(stmt, column))
+    {
+    case SQLITE_INTEGER:
+      cell.type=Type::Integer;
+      cell.integer=sqlite3_column_int64(stmt, column);
+      break;
+    case SQLITE_FLOAT:
+      cell.type=Type::Float;
+      cell.real=sqlite3_column_double(stmt, column);
+      break;
+    case SQLITE_TEXT:
+    {
+      const char *text=reinterpret_cast<const char *>(sqlite3_column_text(stmt, column));
+      cell.type=Type::Text;
+      cell.size=sqlite3_column_bytes(stmt, column);
+      cell.offset=store(text, cell.size);
+      break;
+    }
+    case SQLITE_BLOB:
+    {
+      const char *data=static_cast<const char *>(sqlite3_column_blob(stmt, column));
+      cell.type=Type::Blob;
+      cell.size=sqlite3_column_bytes(stmt, column);
+      cell.offset=store(data, cell.size);
+      break;
+    }
+    default:
+      cell.type=Type::Null;
+      cell.size=0;
+      cell.integer=0;
+    }
+  }
+  return count+1;
+}
+
+qsizetype RowBuffer::store(const char *data, qsizetype size)
+{
+  qsizetype offset=m_poolUsed;
+  qsizetype needed=offset+size+1;
+  // The pool never shrinks: after the largest row no more allocations are needed
+  if(needed>m_pool.size())
+    m_pool.resize(qMax(needed, 2*m_pool.size()));
+  char *dest=m_pool.data()+offset;
+  if(size>0)
+    memcpy(dest, data, size);
+  dest[size]=0;
+  m_poolUsed=needed;
+  return offset;
+}
+
+qint64 RowBuffer::toInt64(int i) const
+{
+  switch(type(i))
+  {
+  case Type::Integer: return m_cells[i].integer;
+  case Type::Float: return Helper::doubleToInt64(m_cells[i].real);
+  case Type::Text:
+  {
+    TextView value=text(i);
+    return Helper::textToInt64(value.data(), value.size());
+  }
+  default: return 0;
+  }
+}
+
+double RowBuffer::toDouble(int i) const
+{
+  switch(type(i))
+  {
+  case Type::Integer: return double(m_cells[i].integer);
+  case Type::Float: return m_cells[i].real;
+  case Type::Text:
+  {
+    TextView value=text(i);
+    return Helper::textToDouble(value.data(), value.size());
+  }
+  default: return 0;
+  }
+}
+
+TextView RowBuffer::text(int i) const
+{
+  Type t=type(i);
+  if(t!=Type::Text && t!=Type::Blob)
+    return TextView();
+  return TextView(m_pool.constData()+m_cells[i].offset, m_cells[i].size);
+}
+
+BlobView RowBuffer::blob(int i) const
+{
+  TextView data=text(i);
+  return BlobView(data.data(), data.size());
+}
+
+QString RowBuffer::toString(int i) const
+{
+  switch(type(i))
+  {
+  case Type::Integer: return QString::number(m_cells[i].integer);
+  case Type::Float: return QString::number(m_cells[i].real, 'g', 15);
+  case Type::Text:
+  case Type::Blob: return text(i).toString();
+  default: return QString();
+  }
+}
+
+QVariant RowBuffer::toVariant(int i) const
+{
+  switch(type(i))
+  {
+  case Type::Integer: return QVariant(m_cells[i].integer);
+  case Type::Float: return QVariant(m_cells[i].real);
+  case Type::Text: return QVariant(text(i).toString());
+  case Type::Blob: return QVariant(blob(i).toByteArray());
+  default: return QVariant();
+  }
+}
+
+QJsonValue RowBuffer::toJsonValue(int i) const
+{
+  switch(type(i))
+  {
+  case Type::Integer: return QJsonValue(m_cells[i].integer);
+  case Type::Float: return QJsonValue(m_cells[i].real);
+  case Type::Text: return QJsonValue(text(i).toString());
+  case Type::Blob: return QJsonValue(QString::fromLatin1(blob(i).toByteArray().toHex()));
+  default: return QJsonValue(QJsonValue::Null);
+  }
+}
+
+QVariantList RowBuffer::toVariantList() const
+{
+  QVariantList ret;
+  ret.reserve(m_cells.size());
+  for(int i=0;i<m_cells.size();i++)
+    ret.append(toVariant(i));
+  return ret;
+}
+
+QJsonObject RowBuffer::toJsonObject() const
+{
+  QJsonObject ret;
+  for(int i=0;i<m_cells.size();i++)
+    ret.insert(m_names.value(i), toJsonValue(i));
+  return ret;
+}
+
+void RowBuffer::clear()
+{
+  m_cells.clear();
+  m_pool.clear();
+  m_poolUsed=0;
+  m_names.clear();
+  m_namesGeneration=0;
+  m_namesReprepare=-1;
+  m_namesFirst=0;
+}
+
+
+using namespace HFSQtLi;
+
+namespace
+{
+  // Julian day of 1970-01-01T00:00:00Z, as returned by julianday('1970-01-01')
+  const double g_unixEpochJulianDay=2440587.5;
+  const double g_microsPerDay=86400000000.0;
+
+  // Rounds to the nearest millisecond: Julian days read back as doubles are a few microseconds off, truncating would lose a millisecond.
+  // Floor division, so that times before the epoch are rounded the same way.
+  qint64 microsToMsecs(qint64 micros)
+  {
+    micros+=500;
+    return micros>=0?micros/1000:-((-micros+999)/1000);
+  }
+}
+
+double Helper::julianDay(qint64 micros)
+{
+  return g_unixEpochJulianDay+micros/g_microsPerDay;
+}
+
+qint64 Helper::julianDayMicros(double day)
+{
+  // Near the current date a double has a resolution of about 40 microseconds: round to the millisecond, like the date functions of SQLite
+  return qint64(std::llround((day-g_unixEpochJulianDay)*(g_microsPerDay/1000)))*1000;
+}
+
+bool Helper::epochMicros(const QDateTime &value, qint64 &micros)
+{
+  if(!value.isValid())
+    return false;
+  micros=value.toMSecsSinceEpoch()*1000;
+  return true;
+}
+
+void Helper::fromEpochMicros(qint64 micros, QDateTime &value)
+{
+  value=QDateTime::fromMSecsSinceEpoch(microsToMsecs(micros), Qt::UTC);
+}
+
+bool Helper::fetchEpochMicros(CustomFetch &fetch, bool julian, qint64 &micros)
+{
+  if(fetch.isStrict())
+  {
+    if(!julian)
+      return fetch.fetchIndex(true, 0, micros)>0;
+    double day=0;
+    if(!fetch.fetchIndex(true, 0, day))
+      return false;
+    micros=julianDayMicros(day);
+    return true;
+  }
+  ValueRef cell;
+  if(!fetch.fetchIndex(false, 0, cell))
+    return false;
+  switch(cell.type())
+  {
+  case Type::Integer:
+  case Type::Float:
+    micros=julian?julianDayMicros(cell.toDouble()):cell.toInt64();
+    return true;
+  case Type::Text:
+  {
+    // Values written as ISO 8601 text, e.g. by datetime() or before the binary encoding was used.
+    // Like the date functions of SQLite, text without an offset ("YYYY-MM-DD HH:MM:SS") is UTC and not local time.
+    QString text=cell.toString();
+    if(text.size()>10 && text.at(10)==QLatin1Char(' '))
+      text[10]=QLatin1Char('T');
+    QDateTime parsed=QDateTime::fromString(text, Qt::ISODateWithMs);
+    if(!parsed.isValid())
+      return false;
+    if(parsed.timeSpec()==Qt::LocalTime)
+      parsed.setTimeSpec(Qt::UTC);
+    micros=parsed.toMSecsSinceEpoch()*1000;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+#ifdef HFSQTLI_ENABLE_QT_CODECS
+void HFSQtLi::customBindConst(CustomBind &bind, const QDateTime &value)
+{
+  qint64 micros;
+  if(Helper::epochMicros(value, micros))
+    bind.bind(micros);
+  else
+    bind.bind(nullptr);
+}
+
+void HFSQtLi::customFetch(CustomFetch &fetch, QDateTime &value)
+{
+  qint64 micros;
+  if(Helper::fetchEpochMicros(fetch, false, micros))
+    Helper::fromEpochMicros(micros, value);
+  else
+    value=QDateTime();
+}
+
+void HFSQtLi::customBindConst(CustomBind &bind, const QDate &value)
+{
+  if(value.isValid())
+    bind.bind(qint64(value.toJulianDay()));
+  else
+    bind.bind(nullptr);
+}
+
+void HFSQtLi::customFetch(CustomFetch &fetch, QDate &value)
+{
+  value=QDate();
+  qint64 day;
+  if(fetch.isStrict())
+  {
+    if(fetch.fetchIndex(true, 0, day))
+      value=QDate::fromJulianDay(day);
+    return;
+  }
+  ValueRef cell;
+  if(!fetch.fetchIndex(false, 0, cell))
+    return;
+  if(cell.isInt() || cell.isFloat())
+    value=QDate::fromJulianDay(cell.toInt64());
+  else if(cell.isText())
+    value=QDate::fromString(cell.toString(), Qt::ISODate);
+}
+
+void HFSQtLi::customBindConst(CustomBind &bind, const QTime &value)
+{
+  if(value.isValid())
+    bind.bind(qint64(value.msecsSinceStartOfDay()));
+  else
+    bind.bind(nullptr);
+}
+
+void HFSQtLi::customFetch(CustomFetch &fetch, QTime &value)
+{
+  value=QTime();
+  qint64 msecs;
+  if(fetch.isStrict())
+  {
+    if(fetch.fetchIndex(true, 0, msecs))
+      value=QTime::fromMSecsSinceStartOfDay(int(msecs));
+    return;
+  }
+  ValueRef cell;
+  if(!fetch.fetchIndex(false, 0, cell))
+    return;
+  if(cell.isInt() || cell.isFloat())
+    value=QTime::fromMSecsSinceStartOfDay(int(cell.toInt64()));
+  else if(cell.isText())
+    value=QTime::fromString(cell.toString(), Qt::ISODateWithMs);
+}
+
+void HFSQtLi::customBindConst(CustomBind &bind, const QUuid &value)
+{
+  // The temporary is moved into the query, not copied
+  bind.bind(value.toRfc4122());
+}
+
+void HFSQtLi::customFetch(CustomFetch &fetch, QUuid &value)
+{
+  value=QUuid();
+  if(fetch.isStrict())
+  {
+    BlobView blob;
+    if(fetch.fetchIndex(true, 0, blob) && blob.size()==16)
+      value=QUuid::fromRfc4122(QByteArray::fromRawData(blob.data(), 16));
+    return;
+  }
+  ValueRef cell;
+  if(!fetch.fetchIndex(false, 0, cell))
+    return;
+  if(cell.isBlob())
+  {
+    BlobView blob=cell.toBlob();
+    if(blob.size()==16)
+      value=QUuid::fromRfc4122(QByteArray::fromRawData(blob.data(), 16));
+  }
+  else if(cell.isText())
+    value=QUuid(cell.toString());
+}
+#endif
+
+
+using namespace HFSQtLi;
+
+Backup::Backup(Db *source, const char *sourceName, Db *destination, const char *destinationName, bool ownDestination, int pagesPerStep, int sleepBetweenSteps):
+  m_source(source), m_destination(destination), m_sourceName(sourceName?sourceName:"main"), m_destinationName(destinationName?destinationName:"main"),
+  m_pagesPerStep(pagesPerStep>0?pagesPerStep:-1), m_sleepBetweenSteps(qMax(sleepBetweenSteps, 0)), m_remaining(-1), m_pageCount(-1), m_error(SQLITE_OK)
+{
+  if(ownDestination)
+    m_ownedDestination.reset(destination);
+  if(m_source)
+    m_source->m_queryCount++;
+  if(m_destination)
+    m_destination->m_queryCount++;
+}
+
+Backup::~Backup()
+{
+  requestInterruption();
+  wait();
+  if(m_source)
+    m_source->m_queryCount--;
+  if(m_destination)
+    m_destination->m_queryCount--;
+}
+
+void Backup::run()
+{
+  sqlite3_backup *backup=nullptr;
+  if(!m_source || !m_source->m_db || !m_destination || !m_destination->m_db)
+  {
+    m_error=SQLITE_MISUSE;
+    m_errorMsg=SQLiteCode::errorString(m_error);
+    return;
+  }
+  {
+    // Note: errors of sqlite3_backup_init are stored in the destination connection
+    Db::Lock lock(m_destination, true);
+    backup=sqlite3_backup_init(m_destination->m_db, m_destinationName.constData(), m_source->m_db, m_sourceName.constData());
+    m_error=backup?SQLITE_OK:sqlite3_errcode(m_destination->m_db);
+    lock.release(m_error, m_errorMsg);
+  }
+  if(!backup)
+    return;
+  do
+  {
+    // Every step locks the source only for the pages it copies. Writes done by other connections between steps make SQLite restart the backup on the next step.
+    m_error=sqlite3_backup_step(backup, m_pagesPerStep);
+    m_remaining=sqlite3_backup_remaining(backup);
+    m_pageCount=sqlite3_backup_pagecount(backup);
+    emit progress(m_remaining, m_pageCount);
+    if(m_error!=SQLITE_DONE && m_sleepBetweenSteps>0)
+      msleep(m_sleepBetweenSteps);
+  } while((m_error==SQLITE_OK || m_error==SQLITE_BUSY || m_error==SQLITE_LOCKED) && !isInterruptionRequested());
+
+  int finishError=sqlite3_backup_finish(backup);
+  if(m_error==SQLITE_DONE)
+    m_error=finishError;
+  else if(m_error==SQLITE_OK || m_error==SQLITE_BUSY || m_error==SQLITE_LOCKED)
+    m_error=SQLITE_INTERRUPT;
+  {
+    Db::Lock lock(m_destination, true);
+    if(m_error==SQLITE_INTERRUPT)
+      lock.releaseInternal(m_error, m_errorMsg);
+    else
+      lock.release(m_error, m_errorMsg);
+  }
+}
+
+
+#ifndef SQLITE_DEFAULT_WAL_AUTOCHECKPOINT
+#define SQLITE_DEFAULT_WAL_AUTOCHECKPOINT 1000
+#endif
+
+using namespace HFSQtLi;
+
+namespace
+{
+  // The value set by sqlite3_wal_autocheckpoint can only be read back with the pragma
+  int autoCheckpointPages(sqlite3 *db)
+  {
+    int ret=SQLITE_DEFAULT_WAL_AUTOCHECKPOINT;
+    sqlite3_stmt *stmt=nullptr;
+    if(sqlite3_prepare_v2(db, "PRAGMA wal_autocheckpoint", -1, &stmt, nullptr)==SQLITE_OK && sqlite3_step(stmt)==SQLITE_ROW)
+      ret=sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return ret;
+  }
+}
+
+Checkpointer::Checkpointer(Db *source, Db *connection, const QString &walFilename, int interval, qint64 walSizeLimit):
+  m_source(source), m_connection(connection), m_walFilename(walFilename), m_interval(qMax(interval, 1)), m_walSizeLimit(walSizeLimit), m_escalation(Mode::Truncate),
+  m_stop(false), m_wakeRequested(false), m_previousAutoCheckpoint(SQLITE_DEFAULT_WAL_AUTOCHECKPOINT), m_error(SQLITE_OK), m_lastWalSize(0), m_lastDuration(0), m_maxDuration(0), m_checkpointCount(0), m_escalatedCount(0)
+{
+  if(m_source)
+    m_source->m_queryCount++;
+}
+
+Checkpointer::~Checkpointer()
+{
+  stop();
+  if(m_source)
+    m_source->m_queryCount--;
+}
+
+void Checkpointer::checkpointNow()
+{
+  QMutexLocker locker(&m_mutex);
+  m_wakeRequested=true;
+  m_wake.wakeAll();
+}
+
+void Checkpointer::stop()
+{
+  {
+    QMutexLocker locker(&m_mutex);
+    m_stop=true;
+    m_wake.wakeAll();
+  }
+  wait();
+}
+
+int Checkpointer::checkpoint(bool escalate, int &logFrames, int &checkpointedFrames)
+{
+  int mode=SQLITE_CHECKPOINT_PASSIVE;
+  if(escalate)
+  {
+    switch(m_escalation)
+    {
+      case Mode::Passive: mode=SQLITE_CHECKPOINT_PASSIVE; break;
+      case Mode::Full: mode=SQLITE_CHECKPOINT_FULL; break;
+      case Mode::Restart: mode=SQLITE_CHECKPOINT_RESTART; break;
+      case Mode::Truncate: mode=SQLITE_CHECKPOINT_TRUNCATE; break;
+    }
+  }
+  Db::Lock lock(m_connection.data(), true);
+  int ret=sqlite3_wal_checkpoint_v2(m_connection->m_db, nullptr, mode, &logFrames, &checkpointedFrames);
+  QMutexLocker locker(&m_mutex);
+  lock.release(ret, m_errorMsg);
+  return ret;
+}
+
+void Checkpointer::run()
+{
+  if(!m_source || !m_source->m_db || !m_connection || !m_connection->m_db)
+  {
+    m_error=SQLITE_MISUSE;
+    QMutexLocker locker(&m_mutex);
+    m_errorMsg=SQLiteCode::errorString(SQLITE_MISUSE);
+    return;
+  }
+  m_previousAutoCheckpoint=autoCheckpointPages(m_source->m_db);
+  sqlite3_wal_autocheckpoint(m_source->m_db, 0);
+  QMutexLocker locker(&m_mutex);
+  while(!m_stop)
+  {
+    if(!m_wakeRequested)
+      m_wake.wait(&m_mutex, m_interval);
+    m_wakeRequested=false;
+    if(m_stop)
+      break;
+    locker.unlock();
+
+    qint64 walSize=QFileInfo(m_walFilename).size();
+    bool escalate=(m_walSizeLimit>0 && walSize>m_walSizeLimit);
+    int logFrames=-1, checkpointedFrames=-1;
+    QElapsedTimer timer;
+    timer.start();
+    m_error=checkpoint(escalate, logFrames, checkpointedFrames);
+    qint64 duration=timer.nsecsElapsed()/1000;
+
+    m_lastWalSize=walSize;
+    m_lastDuration=duration;
+    if(duration>m_maxDuration)
+      m_maxDuration=duration;
+    m_checkpointCount++;
+    if(escalate)
+      m_escalatedCount++;
+    emit checkpointed(walSize, logFrames, checkpointedFrames, duration);
+    locker.relock();
+  }
+  locker.unlock();
+  sqlite3_wal_autocheckpoint(m_source->m_db, m_previousAutoCheckpoint);
+}
+
+
+using namespace HFSQtLi;
+
+QVector<qint64> ChangeSet::rowids(const QString &table, Operation operation) const
+{
+  QVector<qint64> ret;
+  int index=m_tables.indexOf(table);
+  if(index>=0)
+  {
+    for(const Change &change: m_changes)
+      if(change.table==index && change.operation==operation)
+        ret.append(change.rowid);
+  }
+  return ret;
+}
+
+ChangeNotifier::ChangeNotifier(Db *db): m_db(db), m_maxChanges(100000), m_transactions(0), m_committing(false), m_commitVersion(0), m_lastIndex(-1)
+{
+  qRegisterMetaType<ChangeSet>();
+  if(m_db && m_db->m_db)
+  {
+    sqlite3_update_hook(m_db->m_db, &ChangeNotifier::updateHook, this);
+    sqlite3_commit_hook(m_db->m_db, &ChangeNotifier::commitHook, this);
+    sqlite3_rollback_hook(m_db->m_db, &ChangeNotifier::rollbackHook, this);
+  }
+}
+
+ChangeNotifier::~ChangeNotifier()
+{
+  if(m_db && m_db->m_db)
+  {
+    sqlite3_update_hook(m_db->m_db, nullptr, nullptr);
+    sqlite3_commit_hook(m_db->m_db, nullptr, nullptr);
+    sqlite3_rollback_hook(m_db->m_db, nullptr, nullptr);
+  }
+}
+
+QStringList ChangeNotifier::tables() const
+{
+  QStringList ret;
+  for(const QByteArray &table: m_filter)
+    ret.append(QString::fromUtf8(table));
+  return ret;
+}
+
+void ChangeNotifier::setTables(const QStringList &tables)
+{
+  m_filter.clear();
+  for(const QString &table: tables)
+    m_filter.insert(table.toUtf8());
+  m_lastName.clear();
+  m_lastIndex=-1;
+}
+
+int ChangeNotifier::tableIndex(const char *table)
+{
+  if(!m_lastName.isNull() && strcmp(m_lastName.constData(), table)==0)
+    return m_lastIndex;
+  m_lastName=table;
+  m_lastIndex=-1;
+  if(m_filter.isEmpty() || m_filter.contains(m_lastName))
+  {
+    m_lastIndex=m_names.indexOf(m_lastName);
+    if(m_lastIndex<0)
+    {
+      m_lastIndex=m_names.size();
+      m_names.append(m_lastName);
+      m_pending.m_tables.append(QString::fromUtf8(m_lastName));
+    }
+  }
+  return m_lastIndex;
+}
+
+void ChangeNotifier::updateHook(void *notifier, int operation, const char *, const char *table, qint64 rowid)
+{
+  auto *self=static_cast<ChangeNotifier *>(notifier);
+  self->checkCommitted(false);
+  if(self->m_db->m_resultCache)
+    self->m_db->m_resultCache->tableChanged(table);
+  int index=self->tableIndex(table);
+  if(index<0)
+    return;
+  ChangeSet &pending=self->m_pending;
+  if(pending.m_truncated)
+    return;
+  if(pending.m_changes.size()>=self->m_maxChanges)
+  {
+    // Too many rows: report only the tables
+    pending.m_truncated=true;
+    pending.m_changes.clear();
+    pending.m_changes.squeeze();
+    return;
+  }
+  ChangeSet::Operation op=operation==SQLITE_INSERT?ChangeSet::Operation::Insert:(operation==SQLITE_DELETE?ChangeSet::Operation::Delete:ChangeSet::Operation::Update);
+  pending.m_changes.append(ChangeSet::Change{rowid, index, op});
+}
+
+int ChangeNotifier::commitHook(void *notifier)
+{
+  auto *self=static_cast<ChangeNotifier *>(notifier);
+  // The previous commit may have completed without any other hook being called since then
+  self->checkCommitted(false);
+  // The tables changed for the result cache are also released only once the commit is done
+  ResultCache *cache=self->m_db->m_resultCache;
+  if(!self->m_pending.isEmpty() || (cache && cache->hasDirtyTables()))
+  {
+    // The hook runs before the commit is written and the commit can still fail (e.g. COMMIT returning SQLITE_BUSY): hold the changes until it is done
+    self->m_committing=true;
+    self->m_commitVersion=self->dataVersion();
+    QMetaObject::invokeMethod(self, [self](){ self->checkCommitted(sqlite3_get_autocommit(self->m_db->m_db)!=0); }, Qt::QueuedConnection);
+  }
+  return 0;
+}
+
+void ChangeNotifier::rollbackHook(void *notifier)
+{
+  auto *self=static_cast<ChangeNotifier *>(notifier);
+  if(self->m_db->m_resultCache)
+    self->m_db->m_resultCache->transactionEnd(false);
+  // Changes held by a failed commit are dropped, those of a previous successful commit are still reported
+  self->checkCommitted(false);
+  self->clearPending();
+}
+
+unsigned int ChangeNotifier::dataVersion() const
+{
+  // Changed by SQLite every time a transaction is committed to the main database
+  unsigned int version=0;
+  sqlite3_file_control(m_db->m_db, "main", SQLITE_FCNTL_DATA_VERSION, &version);
+  return version;
+}
+
+void ChangeNotifier::checkCommitted(bool finished)
+{
+  if(!m_committing || (!finished && dataVersion()==m_commitVersion))
+    return;
+  if(m_db->m_resultCache)
+    m_db->m_resultCache->transactionEnd(true);
+  if(m_pending.isEmpty())
+  {
+    m_committing=false;
+    return;
+  }
+  m_transactions++;
+  ChangeSet changes=std::move(m_pending);
+  clearPending();
+  // The connection can't be used inside the hooks: deliver the signal from the event loop
+  QMetaObject::invokeMethod(this, [this, changes](){ emit changed(changes); }, Qt::QueuedConnection);
+}
+
+void ChangeNotifier::clearPending()
+{
+  m_pending=ChangeSet();
+  m_names.clear();
+  m_lastName.clear();
+  m_lastIndex=-1;
+  m_committing=false;
+}
+
+
+using namespace HFSQtLi;
+
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+namespace
+{
+  // Moves a buffer allocated by the session extension into result
+  void takeBuffer(void *buffer, int size, QByteArray &result)
+  {
+    result=QByteArray(static_cast<const char *>(buffer), size);
+    sqlite3_free(buffer);
+  }
+}
+#else
+namespace
+{
+  const char *sessionUnsupported="Sessions require SQLite compiled with SQLITE_ENABLE_SESSION and SQLITE_ENABLE_PREUPDATE_HOOK";
+}
+#endif
+
+Db::Session::Session(Db *db, const char *database): m_db(db), m_session(nullptr), m_error(SQLITE_OK)
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(!m_db || !m_db->m_db)
+    setError(SQLITE_MISUSE);
+  else
+    setError(sqlite3session_create(m_db->m_db, database, &m_session));
+#else
+  Q_UNUSED(database)
+  setError(SQLITE_MISUSE);
+#endif
+}
+
+Db::Session::~Session()
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(m_session)
+    sqlite3session_delete(m_session);
+#endif
+}
+
+bool Db::Session::setError(int code)
+{
+  m_error=code;
+  if(code==SQLITE_OK)
+    m_errorMsg.clear();
+#if !defined(SQLITE_ENABLE_SESSION) || !defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  else if(code==SQLITE_MISUSE)
+    m_errorMsg=QString::fromUtf8(sessionUnsupported);
+#endif
+  else if(m_db && m_db->m_db && sqlite3_errcode(m_db->m_db)==code)
+    m_errorMsg=QString::fromUtf8(sqlite3_errmsg(m_db->m_db));
+  else
+    m_errorMsg=SQLiteCode::errorString(code);
+  return code==SQLITE_OK;
+}
+
+bool Db::Session::attach(const QString &table)
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(!m_session)
+    return setError(SQLITE_MISUSE);
+  return setError(sqlite3session_attach(m_session, table.isNull()?nullptr:table.toUtf8().constData()));
+#else
+  Q_UNUSED(table)
+  return setError(SQLITE_MISUSE);
+#endif
+}
+
+bool Db::Session::isEnabled() const
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  return m_session && sqlite3session_enable(m_session, -1);
+#else
+  return false;
+#endif
+}
+
+void Db::Session::setEnabled(bool enabled)
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(m_session)
+    sqlite3session_enable(m_session, enabled?1:0);
+#else
+  Q_UNUSED(enabled)
+#endif
+}
+
+bool Db::Session::isEmpty() const
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  return !m_session || sqlite3session_isempty(m_session);
+#else
+  return true;
+#endif
+}
+
+bool Db::Session::changeset(QByteArray &changeset)
+{
+  changeset.clear();
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(!m_session)
+    return setError(SQLITE_MISUSE);
+  int size=0;
+  void *buffer=nullptr;
+  int code=sqlite3session_changeset(m_session, &size, &buffer);
+  if(code==SQLITE_OK)
+    takeBuffer(buffer, size, changeset);
+  return setError(code);
+#else
+  return setError(SQLITE_MISUSE);
+#endif
+}
+
+bool Db::Session::patchset(QByteArray &patchset)
+{
+  patchset.clear();
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(!m_session)
+    return setError(SQLITE_MISUSE);
+  int size=0;
+  void *buffer=nullptr;
+  int code=sqlite3session_patchset(m_session, &size, &buffer);
+  if(code==SQLITE_OK)
+    takeBuffer(buffer, size, patchset);
+  return setError(code);
+#else
+  return setError(SQLITE_MISUSE);
+#endif
+}
+
+bool Db::applyChangeset(const QByteArray &changeset, const std::function<ConflictAction(const ChangesetConflict &)> &onConflict, QString *errorMsg)
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  int code=SQLITE_MISUSE;
+  if(m_db)
+    code=sqlite3changeset_apply(m_db, int(changeset.size()), const_cast<char *>(changeset.constData()), nullptr, &changesetConflict,
+                                const_cast<std::function<ConflictAction(const ChangesetConflict &)> *>(&onConflict));
+  if(code!=SQLITE_OK && errorMsg)
+  {
+    if(code==SQLITE_ABORT)
+      *errorMsg=QString::fromUtf8("Changeset aborted on conflict");
+    else
+      *errorMsg=m_db && sqlite3_errcode(m_db)==code?QString::fromUtf8(sqlite3_errmsg(m_db)):SQLiteCode::errorString(code);
+  }
+  return code==SQLITE_OK;
+#else
+  Q_UNUSED(changeset)
+  Q_UNUSED(onConflict)
+  if(errorMsg)
+    *errorMsg=QString::fromUtf8(sessionUnsupported);
+  return false;
+#endif
+}
+
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+int Db::changesetConflict(void *context, int type, sqlite3_changeset_iter *iterator)
+{
+  auto &onConflict=*static_cast<const std::function<ConflictAction(const ChangesetConflict &)> *>(context);
+  if(!onConflict)
+    return SQLITE_CHANGESET_ABORT;
+  switch(onConflict(ChangesetConflict(iterator, type)))
+  {
+  case ConflictAction::Omit:
+    return SQLITE_CHANGESET_OMIT;
+  case ConflictAction::Replace:
+    return SQLITE_CHANGESET_REPLACE;
+  default:
+    return SQLITE_CHANGESET_ABORT;
+  }
+}
+#endif
+
+bool Db::concatChangesets(const QByteArray &first, const QByteArray &second, QByteArray &result, QString *errorMsg)
+{
+  result.clear();
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  int size=0;
+  void *buffer=nullptr;
+  int code=sqlite3changeset_concat(int(first.size()), const_cast<char *>(first.constData()), int(second.size()), const_cast<char *>(second.constData()), &size, &buffer);
+  if(code==SQLITE_OK)
+    takeBuffer(buffer, size, result);
+  else if(errorMsg)
+    *errorMsg=SQLiteCode::errorString(code);
+  return code==SQLITE_OK;
+#else
+  Q_UNUSED(first)
+  Q_UNUSED(second)
+  if(errorMsg)
+    *errorMsg=QString::fromUtf8(sessionUnsupported);
+  return false;
+#endif
+}
+
+bool Db::invertChangeset(const QByteArray &changeset, QByteArray &result, QString *errorMsg)
+{
+  result.clear();
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  int size=0;
+  void *buffer=nullptr;
+  int code=sqlite3changeset_invert(int(changeset.size()), changeset.constData(), &size, &buffer);
+  if(code==SQLITE_OK)
+    takeBuffer(buffer, size, result);
+  else if(errorMsg)
+    *errorMsg=SQLiteCode::errorString(code);
+  return code==SQLITE_OK;
+#else
+  Q_UNUSED(changeset)
+  if(errorMsg)
+    *errorMsg=QString::fromUtf8(sessionUnsupported);
+  return false;
+#endif
+}
+
+ChangesetConflict::ChangesetConflict(sqlite3_changeset_iter *iterator, int type): m_iterator(iterator)
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  switch(type)
+  {
+  case SQLITE_CHANGESET_DATA:
+    m_type=Type::Data;
+    break;
+  case SQLITE_CHANGESET_NOTFOUND:
+    m_type=Type::NotFound;
+    break;
+  case SQLITE_CHANGESET_CONFLICT:
+    m_type=Type::Conflict;
+    break;
+  case SQLITE_CHANGESET_FOREIGN_KEY:
+    m_type=Type::ForeignKey;
+    break;
+  default:
+    m_type=Type::Constraint;
+    break;
+  }
+#else
+  Q_UNUSED(type)
+  m_type=Type::Constraint;
+#endif
+}
+
+QString ChangesetConflict::table() const
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  const char *table=nullptr;
+  int columns=0;
+  int operation=0;
+  if(m_type!=Type::ForeignKey && sqlite3changeset_op(m_iterator, &table, &columns, &operation, nullptr)==SQLITE_OK)
+    return QString::fromUtf8(table);
+#endif
+  return QString();
+}
+
+ChangeSet::Operation ChangesetConflict::operation() const
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  const char *table=nullptr;
+  int columns=0;
+  int operation=0;
+  if(m_type!=Type::ForeignKey && sqlite3changeset_op(m_iterator, &table, &columns, &operation, nullptr)==SQLITE_OK)
+  {
+    if(operation==SQLITE_INSERT)
+      return ChangeSet::Operation::Insert;
+    if(operation==SQLITE_DELETE)
+      return ChangeSet::Operation::Delete;
+  }
+#endif
+  return ChangeSet::Operation::Update;
+}
+
+int ChangesetConflict::columnCount() const
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  const char *table=nullptr;
+  int columns=0;
+  int operation=0;
+  if(m_type!=Type::ForeignKey && sqlite3changeset_op(m_iterator, &table, &columns, &operation, nullptr)==SQLITE_OK)
+    return columns;
+#endif
+  return 0;
+}
+
+Value ChangesetConflict::oldValue(int column) const
+{
+  sqlite3_value *value=nullptr;
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(m_type==Type::ForeignKey || sqlite3changeset_old(m_iterator, column, &value)!=SQLITE_OK)
+    value=nullptr;
+#else
+  Q_UNUSED(column)
+#endif
+  return Value(value?sqlite3_value_dup(value):nullptr);
+}
+
+Value ChangesetConflict::newValue(int column) const
+{
+  sqlite3_value *value=nullptr;
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(m_type==Type::ForeignKey || sqlite3changeset_new(m_iterator, column, &value)!=SQLITE_OK)
+    value=nullptr;
+#else
+  Q_UNUSED(column)
+#endif
+  return Value(value?sqlite3_value_dup(value):nullptr);
+}
+
+Value ChangesetConflict::conflictingValue(int column) const
+{
+  sqlite3_value *value=nullptr;
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if((m_type!=Type::Data && m_type!=Type::Conflict) || sqlite3changeset_conflict(m_iterator, column, &value)!=SQLITE_OK)
+    value=nullptr;
+#else
+  Q_UNUSED(column)
+#endif
+  return Value(value?sqlite3_value_dup(value):nullptr);
+}
+
+
+using namespace HFSQtLi;
+
+namespace
+{
+  constexpr quint64 g_ones=0x0101010101010101ULL;
+  constexpr quint64 g_highs=0x8080808080808080ULL;
+
+  // Non zero if any byte of v is equal to the byte repeated in pattern
+  inline quint64 hasByte(quint64 v, quint64 pattern)
+  {
+    quint64 x=v^pattern;
+    return (x-g_ones)&~x&g_highs;
+  }
+}
+
+BulkImporter::BulkImporter(Db *db, Format format):
+  m_db(db), m_query(db, true), m_header(false), m_chunkSize(4*1024*1024), m_rowsPerTransaction(50000), m_emptyAsNull(false),
+  m_columns(0), m_inTransaction(false), m_pendingRows(0), m_rows(0), m_bytesRead(0), m_line(0), m_error(SQLITE_OK)
+{
+  setFormat(format);
+}
+
+BulkImporter::~BulkImporter()
+{
+}
+
+void BulkImporter::setFormat(Format format)
+{
+  switch(format)
+  {
+  case Format::Csv:
+    m_delimiter=',';
+    m_quote='"';
+    break;
+  case Format::Tsv:
+    m_delimiter='\t';
+    m_quote=0;
+    break;
+  }
+}
+
+bool BulkImporter::import(QIODevice *device, const QString &table, const QStringList &columns)
+{
+  m_rows=m_bytesRead=m_line=0;
+  m_pendingRows=0;
+  m_columns=0;
+  m_error=SQLITE_OK;
+  m_errorMsg.clear();
+  m_query.finalize();
+  if(!device || !device->isReadable() || !m_db || !m_db->isOk())
+  {
+    setError(SQLITE_MISUSE, SQLiteCode::errorString(SQLITE_MISUSE));
+    return false;
+  }
+  bool header=m_header;
+  bool atEnd=false;
+  qsizetype used=0; // Bytes in m_buffer still to be parsed
+  while(m_error==SQLITE_OK && !(atEnd && used==0))
+  {
+    // Read next chunk after the incomplete record left from previous one
+    if(!atEnd)
+    {
+      m_buffer.resize(used+m_chunkSize);
+      qint64 read=device->read(m_buffer.data()+used, m_chunkSize);
+      if(read<0)
+      {
+        setError(SQLITE_IOERR, device->errorString());
+        break;
+      }
+      // Sequential devices (sockets, processes) may have no data yet: wait for it, applying backpressure to the reader
+      if(read==0 && !(device->isSequential() && device->waitForReadyRead(-1)))
+        atEnd=true;
+      m_bytesRead+=read;
+      used+=read;
+    }
+    char *p=m_buffer.data();
+    char *end=p+used;
+    for(;;)
+    {
+      char *start=p;
+      Parse result=parseRecord(p, end, atEnd);
+      if(result==Parse::NeedMore)
+      {
+        p=start;
+        break;
+      }
+      if(result==Parse::Malformed)
+      {
+        setError(SQLITE_CONSTRAINT, QString("Malformed quoted field at line %1").arg(m_line+1));
+        break;
+      }
+      m_line++;
+      // Skip empty lines
+      if(m_fields.size()==1 && m_fields[0].size==0 && !m_fields[0].quoted)
+        continue;
+      for(Field &field: m_fields)
+        if(field.escaped)
+          unescape(field);
+      if(header)
+      {
+        header=false;
+        QStringList names=columns;
+        if(names.isEmpty())
+          for(const Field &field: qAsConst(m_fields))
+            names.append(QString::fromUtf8(field.data, field.size));
+        if(!prepare(table, names, m_fields.size()))
+          break;
+        continue;
+      }
+      if(!m_query.isPrepared() && !prepare(table, columns, m_fields.size()))
+        break;
+      if(!insert())
+        break;
+    }
+    if(m_error!=SQLITE_OK)
+      break;
+    // Keep the incomplete record at the beginning of the buffer
+    used=end-p;
+    if(used>0 && p!=m_buffer.data())
+      memmove(m_buffer.data(), p, used);
+    if(atEnd && used>0)
+    {
+      // Only possible if parseRecord could not complete a record at the end of data
+      setError(SQLITE_CONSTRAINT, QString("Unterminated quoted field at line %1").arg(m_line+1));
+      break;
+    }
+    if(m_progress && !m_progress(m_bytesRead, m_rows+m_pendingRows))
+      setError(SQLITE_INTERRUPT, "Import cancelled");
+  }
+  if(m_error==SQLITE_OK)
+    commit();
+  else
+    rollback();
+  m_buffer.clear();
+  m_buffer.squeeze();
+  m_query.finalize();
+  return m_error==SQLITE_OK;
+}
+
+BulkImporter::Parse BulkImporter::parseRecord(char *&p, char *end, bool atEnd)
+{
+  m_fields.resize(0);
+  if(p==end)
+    return Parse::NeedMore;
+  for(;;)
+  {
+    Field field{p, 0, false, false};
+    if(m_quote && p<end && *p==m_quote)
+    {
+      // Quoted field: find the closing quote, remembering if there are escaped quotes to remove later
+      field.quoted=true;
+      field.data=++p;
+      for(;;)
+      {
+        auto *q=static_cast<char *>(memchr(p, m_quote, end-p));
+        if(!q || q+1==end)
+        {
+          // The quote may be followed by another one in next chunk
+          if(!atEnd || !q)
+            return Parse::NeedMore;
+          p=q+1;
+          break;
+        }
+        if(q[1]==m_quote)
+        {
+          field.escaped=true;
+          p=q+2;
+          continue;
+        }
+        p=q+1;
+        break;
+      }
+      field.size=int(p-1-field.data);
+      if(p<end && *p!=m_delimiter && *p!='\n' && *p!='\r')
+        return Parse::Malformed;
+    }
+    else
+    {
+      p=findSpecial(p, end);
+      field.size=int(p-field.data);
+    }
+    if(p==end)
+    {
+      if(!atEnd)
+        return Parse::NeedMore;
+      m_fields.append(field);
+      return Parse::Record;
+    }
+    if(*p==m_delimiter)
+    {
+      m_fields.append(field);
+      p++;
+      continue;
+    }
+    if(*p=='\r')
+    {
+      if(p+1==end && !atEnd)
+        return Parse::NeedMore;
+      p++;
+    }
+    if(p<end && *p=='\n')
+      p++;
+    m_fields.append(field);
+    return Parse::Record;
+  }
 }
 
-bool BlobData::setRowId(qint64 value)
+char *BulkImporter::findSpecial(char *p, char *end) const
 {
-  bool ret=false;
-  if(m_hasRowId && m_rowId==value && (m_blob || !m_autoOpen)) // Not changing value on an already opened or a not auto-opening blob. No need to try to open it again.
-    ret=true;
+  // Check 8 bytes at a time for delimiter, CR and LF, then locate the exact byte
+  const quint64 delimiter=g_ones*quint8(m_delimiter);
+  const quint64 lf=g_ones*quint8('\n');
+  const quint64 cr=g_ones*quint8('\r');
+  while(end-p>=8)
+  {
+    quint64 v;
+    memcpy(&v, p, 8);
+    if(hasByte(v, delimiter)|hasByte(v, lf)|hasByte(v, cr))
+      break;
+    p+=8;
+  }
+  while(p<end && *p!=m_delimiter && *p!='\n' && *p!='\r')
+    p++;
+  return p;
+}
+
+void BulkImporter::unescape(Field &field) const
+{
+  char *in=field.data;
+  char *out=field.data;
+  char *end=field.data+field.size;
+  while(in<end)
+  {
+    if(*in==m_quote)
+      in++; // First of two quotes
+    *out++=*in++;
+  }
+  field.size=int(out-field.data);
+}
+
+bool BulkImporter::prepare(const QString &table, const QStringList &columns, int fieldCount)
+{
+  QString sql="INSERT INTO "+Helper::quoteIdentifier(table);
+  QStringList parameters;
+  m_columns=columns.isEmpty()?fieldCount:columns.size();
+  for(int i=1;i<=m_columns;i++)
+    parameters.append("?"+QString::number(i));
+  if(!columns.isEmpty())
+  {
+    QStringList quoted;
+    for(const QString &column: columns)
+      quoted.append(Helper::quoteIdentifier(column));
+    sql+=" ("+quoted.join(", ")+")";
+  }
+  sql+=" VALUES ("+parameters.join(", ")+")";
+  if(!m_query.prepare(sql, true))
+  {
+    setError(m_query.error(), m_query.errorMsg());
+    return false;
+  }
+  return true;
+}
+
+bool BulkImporter::insert()
+{
+  if(m_fields.size()>m_columns)
+  {
+    setError(SQLITE_CONSTRAINT, QString("Line %1 has %2 fields, expected %3").arg(m_line).arg(m_fields.size()).arg(m_columns));
+    return false;
+  }
+  if(m_rowsPerTransaction>0 && !m_inTransaction && !begin())
+    return false;
+  bool ok=m_query.reset();
+  // Missing fields are NULL
+  for(int i=0;ok && i<m_columns;i++)
+    ok=i<m_fields.size()?bindField(i, m_fields[i]):m_query.bindTemporary(i+1, nullptr);
+  if(ok && (m_query.stepNoFetch() || m_query.error()!=SQLITE_DONE))
+    ok=false;
+  if(!ok)
+  {
+    setError(m_query.error(), QString("Line %1: %2").arg(m_line).arg(m_query.errorMsg()));
+    return false;
+  }
+  m_pendingRows++;
+  if(m_rowsPerTransaction>0 && m_pendingRows>=m_rowsPerTransaction)
+    return commit();
+  if(m_rowsPerTransaction==0)
+  {
+    m_rows+=m_pendingRows;
+    m_pendingRows=0;
+  }
+  return true;
+}
+
+bool BulkImporter::bindField(int i, const Field &field)
+{
+  if(m_emptyAsNull && field.size==0 && !field.quoted)
+    return m_query.bindTemporary(i+1, nullptr);
+  Affinity affinity=i<m_affinities.size()?m_affinities[i]:Affinity::Text;
+  if(affinity!=Affinity::Text && affinity!=Affinity::Blob && field.size>0)
+  {
+    // fromRawData doesn't copy the field
+    QByteArray raw=QByteArray::fromRawData(field.data, field.size);
+    bool ok=false;
+    if(affinity!=Affinity::Real)
+    {
+      qint64 value=raw.toLongLong(&ok);
+      if(ok)
+        return m_query.bindTemporary(i+1, value);
+    }
+    if(affinity!=Affinity::Integer)
+    {
+      double value=raw.toDouble(&ok);
+      if(ok)
+        return m_query.bindTemporary(i+1, value);
+    }
+  }
+  if(affinity==Affinity::Blob)
+    return m_query.bindTemporary(i+1, QByteArray::fromRawData(field.data, field.size));
+  return m_query.bindTemporary(i+1, TextView(field.data, field.size));
+}
+
+bool BulkImporter::begin()
+{
+  QString msg;
+  if(!m_db->execute(&msg, "BEGIN"))
+  {
+    setError(m_db->error(), msg);
+    return false;
+  }
+  m_inTransaction=true;
+  return true;
+}
+
+bool BulkImporter::commit()
+{
+  if(m_inTransaction)
+  {
+    QString msg;
+    // Statement must not be running when committing
+    m_query.reset();
+    if(!m_db->execute(&msg, "COMMIT"))
+    {
+      setError(m_db->error(), msg);
+      rollback();
+      return false;
+    }
+    m_inTransaction=false;
+  }
+  m_rows+=m_pendingRows;
+  m_pendingRows=0;
+  return true;
+}
+
+void BulkImporter::rollback()
+{
+  m_query.reset();
+  if(m_inTransaction)
+  {
+    m_db->execute("ROLLBACK");
+    m_inTransaction=false;
+    m_pendingRows=0;
+  }
   else
   {
-    if(m_blob && m_autoOpen)
-      ret=reopenFast(value);
-    else if(close(nullptr))
+    // Without transactions every row is already committed
+    m_rows+=m_pendingRows;
+    m_pendingRows=0;
+  }
+}
+
+void BulkImporter::setError(int code, const QString &msg)
+{
+  m_error=code;
+  m_errorMsg=msg;
+}
+
+
+using namespace HFSQtLi;
+
+Helper::MultiInsertBase::MultiInsertBase(Db *db, const QString &table, const QStringList &columns, int columnCount):
+  m_db(db), m_columnCount(columnCount), m_rows(0), m_statements(0), m_error(SQLITE_OK)
+{
+  m_sql="INSERT INTO "+quoteIdentifier(table);
+  if(!columns.isEmpty())
+  {
+    QStringList quoted;
+    for(const QString &column: columns)
+      quoted.append(quoteIdentifier(column));
+    m_sql+=" ("+quoted.join(", ")+")";
+  }
+  m_sql+=" VALUES ";
+  QStringList parameters;
+  for(int i=0;i<m_columnCount;i++)
+    parameters.append("?");
+  m_rowSql="("+parameters.join(", ")+")";
+}
+
+Helper::MultiInsertBase::~MultiInsertBase()
+{
+  for(Query *query: qAsConst(m_queries))
+    delete query;
+}
+
+Query *Helper::MultiInsertBase::statement(int rows)
+{
+  Query *ret=m_queries.value(rows);
+  if(ret)
+  {
+    if(!ret->reset())
     {
-      m_rowId=value;
-      m_hasRowId=true;
-      if(!m_autoOpen || !isValid())
-        ret=true;
-      else
-        ret=open();
+      setError(ret->error(), ret->errorMsg());
+      return nullptr;
     }
+    return ret;
+  }
+  if(!m_db)
+  {
+    setError(SQLITE_MISUSE, SQLiteCode::errorString(SQLITE_MISUSE));
+    return nullptr;
+  }
+  QString sql=m_sql;
+  sql.reserve(m_sql.size()+rows*(m_rowSql.size()+2));
+  for(int i=0;i<rows;i++)
+  {
+    if(i>0)
+      sql+=", ";
+    sql+=m_rowSql;
+  }
+  ret=new Query(m_db, true);
+  if(!ret->prepare(sql, true))
+  {
+    setError(ret->error(), ret->errorMsg());
+    delete ret;
+    return nullptr;
   }
+  m_queries.insert(rows, ret);
   return ret;
 }
 
-bool BlobData::checkAutoOpen()
+void Helper::MultiInsertBase::bindFailed(Query *query, int count)
 {
-  bool ret=true;
-  if(m_autoOpen && m_db && m_table && m_column && m_hasRowId)
-    ret=open(nullptr);
+  if(count>=0)
+    setError(SQLITE_MISUSE, QString("A row bound %1 values instead of %2").arg(count).arg(m_columnCount));
+  else
+    setError(query->error(), query->errorMsg());
+}
+
+bool Helper::MultiInsertBase::execute(Query *query, int rows)
+{
+  bool ret=!query->stepNoFetch() && query->isDone();
+  if(ret)
+  {
+    m_rows+=rows;
+    m_statements++;
+  }
+  else
+    setError(query->error(), query->errorMsg());
+  query->reset();
+  query->clearBindings();
   return ret;
 }
 
-bool Blob::set(Db *db, const char *database, const char *table, const char *column, qint64 rowid)
+void Helper::MultiInsertBase::clearError()
 {
-  bool curAutoOpen=m_data->autoOpen();
-  bool ret;
-  ret=m_data->setAutoOpen(false) && m_data->setDbPointer(db) && m_data->setDatabase(database) && m_data->setTable(table) && m_data->setColumn(column) && m_data->setRowId(rowid);
-  m_data->setAutoOpen(curAutoOpen);
-  ret&=m_data->checkAutoOpen();
+  m_error=SQLITE_OK;
+  m_errorMsg.clear();
+}
+
+void Helper::MultiInsertBase::setError(int code, const QString &msg)
+{
+  m_error=code;
+  m_errorMsg=msg;
+}
+
+
+using namespace HFSQtLi;
+
+Helper::StatementBase::StatementBase(Db *db, const QString &sql, int parameters, int columns): Query(db, sql, true)
+{
+  if(m_stmt)
+  {
+    QString mismatch;
+    int count=sqlite3_bind_parameter_count(m_stmt);
+    if(count!=parameters)
+      mismatch=QString("Statement has %1 parameter(s), %2 declared").arg(count).arg(parameters);
+    else if((count=sqlite3_column_count(m_stmt))!=columns)
+      mismatch=QString("Statement returns %1 column(s), %2 declared").arg(count).arg(columns);
+    if(!mismatch.isEmpty())
+    {
+      // finalize() also drops the state built for the statement (parameter indexes, owned bindings...)
+      finalize();
+      setInternalError(SQLITE_CONSTRAINT, mismatch.toUtf8());
+    }
+  }
+}
+
+bool Helper::StatementBase::checkPrepared()
+{
+  if(m_stmt)
+    return true;
+  setInternalError(SQLITE_MISUSE);
+  return false;
+}
+
+bool Helper::StatementBase::stepFirst()
+{
+  if(stepNoFetch())
+    return true;
+  if(isDone())
+    setInternalError(SQLITE_CONSTRAINT, "Step single query returned no rows");
+  return false;
+}
+
+bool Helper::StatementBase::stepLast()
+{
+  if(stepNoFetch())
+  {
+    setInternalError(SQLITE_CONSTRAINT, "Step single query returned more than one row");
+    return false;
+  }
+  return isDone();
+}
+
+bool Helper::StatementBase::stepCommand()
+{
+  if(stepNoFetch())
+  {
+    setInternalError(SQLITE_CONSTRAINT, "Command query returned a row");
+    return false;
+  }
+  return isDone();
+}
+
+
+using namespace HFSQtLi;
+
+QueryModel::QueryModel(Db *db, QObject *parent):
+  QAbstractTableModel(parent), m_db(db), m_blockSize(256), m_prefetch(true), m_rows(0), m_query(db, true), m_cache(64),
+  m_lastBlock(-1), m_blockReads(0), m_prefetchHits(0), m_error(SQLITE_OK)
+{
+}
+
+QueryModel::~QueryModel()
+{
+  // The background connection must be closed before the model (and maybe the database) goes away
+  m_prefetcher.reset();
+}
+
+bool QueryModel::setSource(const QString &table, const QStringList &columns, const QString &where, const QString &key)
+{
+  m_table=table;
+  m_columns=columns;
+  m_where=where;
+  m_key=key;
+  return refresh();
+}
+
+bool QueryModel::refresh()
+{
+  beginResetModel();
+  clear();
+  bool ret=load();
+  if(!ret)
+    clear();
+  endResetModel();
   return ret;
 }
 
-bool Blob::set(Db *db, const char *database, const char *table, const char *column)
+void QueryModel::clear()
 {
-  bool curAutoOpen=m_data->autoOpen();
-  bool ret;
-  ret=m_data->setAutoOpen(false) && m_data->setDbPointer(db) && m_data->setDatabase(database) && m_data->setTable(table) && m_data->setColumn(column);
-  m_data->setAutoOpen(curAutoOpen);
-  ret&=m_data->checkAutoOpen();
+  m_prefetcher.reset();
+  m_query.finalize();
+  m_cache.clear();
+  m_blockKeys.clear();
+  m_headers.clear();
+  m_rows=0;
+  m_lastBlock=-1;
+  m_blockReads=m_prefetchHits=0;
+}
+
+bool QueryModel::load()
+{
+  m_error=SQLITE_OK;
+  m_errorMsg.clear();
+  if(!m_db || m_table.isEmpty() || m_columns.isEmpty())
+  {
+    setError(SQLITE_MISUSE, SQLiteCode::errorString(SQLITE_MISUSE));
+    return false;
+  }
+  QString where=m_where.isEmpty()?QString():"("+m_where+") AND ";
+  // Only the first key of every block is kept
+  {
+    Query keys(m_db, true);
+    if(!keys.prepare("SELECT "+m_key+" FROM "+m_table+(m_where.isEmpty()?QString():" WHERE "+m_where)+" ORDER BY "+m_key, false))
+    {
+      setError(keys.error(), keys.errorMsg());
+      return false;
+    }
+    qint64 key;
+    qint64 rows=0;
+    while(keys.step(key))
+    {
+      if(rows%m_blockSize==0)
+        m_blockKeys.append(key);
+      rows++;
+    }
+    if(!keys.isDone())
+    {
+      setError(keys.error(), keys.errorMsg());
+      return false;
+    }
+    if(rows>std::numeric_limits<int>::max())
+    {
+      setError(SQLITE_TOOBIG, "Too many rows for a model");
+      return false;
+    }
+    m_rows=int(rows);
+  }
+  QString sql="SELECT "+m_key+", "+m_columns.join(", ")+" FROM "+m_table+" WHERE "+where+m_key+">=?1 AND "+m_key+"<=?2 ORDER BY "+m_key+
+      " LIMIT "+QString::number(m_blockSize);
+  if(!m_query.prepare(sql, true))
+  {
+    setError(m_query.error(), m_query.errorMsg());
+    return false;
+  }
+  int columns=sqlite3_column_count(m_query.m_stmt)-1;
+  for(int i=1;i<=columns;i++)
+    m_headers.append(QString::fromUtf8(sqlite3_column_name(m_query.m_stmt, i)));
+  // The background connection needs a file that another connection can open
+  const char *filename=sqlite3_db_filename(m_db->internalDb(), "main");
+  if(m_prefetch && m_blockKeys.size()>1 && filename && *filename)
+  {
+    Db *connection=Db::open(QString::fromUtf8(filename), QIODevice::ReadOnly);
+    if(connection)
+    {
+      m_prefetcher.reset(new Prefetcher(connection, sql, m_blockSize, columns));
+      m_prefetcher->start();
+    }
+  }
+  return true;
+}
+
+qint64 QueryModel::blockEnd(int block) const
+{
+  // Keys are unique integers: the block ends right before the first key of the next one
+  return block+1<m_blockKeys.size()?m_blockKeys[block+1]-1:std::numeric_limits<qint64>::max();
+}
+
+bool QueryModel::readBlock(Query &query, qint64 from, qint64 to, int blockSize, int columns, Block &block)
+{
+  block.values.clear();
+  block.values.reserve(blockSize*columns);
+  block.rows=0;
+  if(!query.reset() || !query.bind(1, from, to))
+    return false;
+  while(query.stepNoFetch())
+  {
+    sqlite3_stmt *stmt=query.m_stmt;
+    for(int i=1;i<=columns;i++)
+    {
+      switch(sqlite3_column_type(stmt, i))
+      {
+      case SQLITE_INTEGER:
+        block.values.append(QVariant(qint64(sqlite3_column_int64(stmt, i))));
+        break;
+      case SQLITE_FLOAT:
+        block.values.append(QVariant(sqlite3_column_double(stmt, i)));
+        break;
+      case SQLITE_TEXT:
+        block.values.append(QVariant(QString::fromUtf8(reinterpret_cast<const char *>(sqlite3_column_text(stmt, i)), sqlite3_column_bytes(stmt, i))));
+        break;
+      case SQLITE_BLOB:
+        block.values.append(QVariant(QByteArray(static_cast<const char *>(sqlite3_column_blob(stmt, i)), sqlite3_column_bytes(stmt, i))));
+        break;
+      default:
+        block.values.append(QVariant());
+        break;
+      }
+    }
+    block.rows++;
+  }
+  bool ret=query.isDone();
+  // Don't keep a read transaction open between blocks
+  query.reset();
   return ret;
 }
 
-bool Blob::set(Db *db, const char *database, const char *table, qint64 rowid)
+const QueryModel::Block *QueryModel::block(int block) const
 {
-  bool curAutoOpen=m_data->autoOpen();
-  bool ret;
-  ret=m_data->setAutoOpen(false) && m_data->setDbPointer(db) && m_data->setDatabase(database) && m_data->setTable(table) && m_data->setRowId(rowid);
-  m_data->setAutoOpen(curAutoOpen);
-  ret&=m_data->checkAutoOpen();
+  const Block *ret=m_cache.object(block);
+  if(!ret)
+  {
+    auto *read=new Block;
+    if(m_prefetcher && m_prefetcher->take(block, *read))
+      m_prefetchHits++;
+    else
+    {
+      m_blockReads++;
+      if(!readBlock(m_query, m_blockKeys[block], blockEnd(block), m_blockSize, m_headers.size(), *read))
+      {
+        delete read;
+        return nullptr;
+      }
+    }
+    m_cache.insert(block, read, 1);
+    ret=read;
+  }
+  if(block!=m_lastBlock)
+  {
+    // Read in advance the next block in the direction of scrolling
+    int next=block+(block<m_lastBlock?-1:1);
+    if(next<0 || next>=m_blockKeys.size())
+      next=2*block-next; // At the first or last block only the other direction is possible
+    m_lastBlock=block;
+    if(m_prefetcher && next>=0 && next<m_blockKeys.size() && !m_cache.contains(next))
+      m_prefetcher->request(next, m_blockKeys[next], blockEnd(next));
+  }
   return ret;
 }
+
+int QueryModel::rowCount(const QModelIndex &parent) const
+{
+  return parent.isValid()?0:m_rows;
+}
+
+int QueryModel::columnCount(const QModelIndex &parent) const
+{
+  return parent.isValid()?0:m_headers.size();
+}
+
+QVariant QueryModel::data(const QModelIndex &index, int role) const
+{
+  if(!index.isValid() || (role!=Qt::DisplayRole && role!=Qt::EditRole) || index.row()>=m_rows || index.column()>=m_headers.size())
+    return QVariant();
+  const Block *rows=block(index.row()/m_blockSize);
+  int row=index.row()%m_blockSize;
+  // Rows deleted after the keys were loaded are missing from the block
+  if(!rows || row>=rows->rows)
+    return QVariant();
+  return rows->values.at(row*m_headers.size()+index.column());
+}
+
+QVariant QueryModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+  if(role==Qt::DisplayRole && orientation==Qt::Horizontal && section>=0 && section<m_headers.size())
+    return m_headers.at(section);
+  return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+void QueryModel::setError(int code, const QString &msg)
+{
+  m_error=code;
+  m_errorMsg=msg;
+}
+
+QueryModel::Prefetcher::Prefetcher(Db *connection, const QString &sql, int blockSize, int columns):
+  m_connection(connection), m_sql(sql), m_blockSize(blockSize), m_columns(columns), m_stop(false), m_running(true), m_requested(-1), m_inFlight(-1), m_from(0), m_to(0)
+{
+}
+
+QueryModel::Prefetcher::~Prefetcher()
+{
+  stop();
+}
+
+void QueryModel::Prefetcher::stop()
+{
+  {
+    QMutexLocker locker(&m_mutex);
+    m_stop=true;
+    m_wake.wakeAll();
+  }
+  wait();
+}
+
+void QueryModel::Prefetcher::request(int block, qint64 from, qint64 to)
+{
+  QMutexLocker locker(&m_mutex);
+  if(m_ready.contains(block))
+    return;
+  m_requested=block;
+  m_from=from;
+  m_to=to;
+  m_wake.wakeAll();
+}
+
+bool QueryModel::Prefetcher::take(int block, Block &result)
+{
+  QMutexLocker locker(&m_mutex);
+  // A block already requested is waited for instead of being read twice
+  while(m_running && (m_requested==block || m_inFlight==block))
+    m_readyWake.wait(&m_mutex);
+  auto it=m_ready.find(block);
+  if(it==m_ready.end())
+    return false;
+  result=std::move(it.value());
+  m_ready.erase(it);
+  return true;
+}
+
+void QueryModel::Prefetcher::run()
+{
+  // The query is created here so that the connection is only used by this thread
+  Query query(m_connection.data(), true);
+  bool ok=query.prepare(m_sql, true);
+  QMutexLocker locker(&m_mutex);
+  while(!m_stop && ok)
+  {
+    if(m_requested<0)
+      m_wake.wait(&m_mutex);
+    if(m_stop || m_requested<0)
+      continue;
+    int block=m_requested;
+    qint64 from=m_from;
+    qint64 to=m_to;
+    m_requested=-1;
+    m_inFlight=block;
+    locker.unlock();
+
+    Block result;
+    bool read=readBlock(query, from, to, m_blockSize, m_columns, result);
+
+    locker.relock();
+    m_inFlight=-1;
+    if(read)
+    {
+      // Blocks not taken are stale prefetches of a view scrolled elsewhere
+      if(m_ready.size()>=4)
+        m_ready.clear();
+      m_ready.insert(block, std::move(result));
+    }
+    m_readyWake.wakeAll();
+  }
+  m_running=false;
+  m_readyWake.wakeAll();
+}
@@ -14,13 +14,44 @@ limitations under the License.
 */
 #pragma once
 #include <Qt>
+#include <QString>
+#include <QByteArray>
 #include <utility>
 #include <functional>
 #include <tuple>
-#include <QString>
+#include <type_traits>
+#include <QVector>
+#include <QStringList>
+#include <QHash>
+#include <QScopedPointer>
+#include <chrono>
+#include <cstring>
+#include <optional>
 #include <QIODevice>
 #include <QSharedPointer>
+#include <QElapsedTimer>
+#include <limits>
+#include <new>
+#include <QSet>
+#include <QCache>
+#include <QPair>
 #include <QSharedData>
+#include <QVariant>
+#include <QVariantList>
+#include <QJsonValue>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QDate>
+#include <QTime>
+#include <QUuid>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QObject>
+#include <QMetaType>
+#include <iterator>
+#include <array>
+#include <QAbstractTableModel>
 
 
 
@@ -190,6 +221,7 @@ namespace HFSQtLi
 }
 
 struct sqlite3_value;
+struct sqlite3_stmt;
 /// @brief Global namespace for library
 namespace HFSQtLi
 {
@@ -237,9 +269,25 @@ namespace HFSQtLi
    * \endcode
    *
    */
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    struct ColumnSink;
+    template <typename ...T> int sinkColumns(ColumnSink *sink, int index, T &&...values);
+    // Quotes a table or column name to be used in generated SQL
+    QString quoteIdentifier(const QString &name);
+    // Conversions with the rules of SQLite: text is parsed up to the first character that is not part of the number (0 if there is none),
+    // floats out of the range of qint64 are clamped and NaN is 0
+    qint64 textToInt64(const char *text, qsizetype size);
+    double textToDouble(const char *text, qsizetype size);
+    qint64 doubleToInt64(double value);
+  }
+  /// \endcond INTERNAL
+
   class CustomBind
   {
     friend class Query;
+    template <typename ...T> friend int Helper::sinkColumns(Helper::ColumnSink *sink, int index, T &&...values);
   public:
     /**
      * @brief Binds some values
@@ -287,8 +335,11 @@ namespace HFSQtLi
      */
     constexpr int numBound() { return m_bound; }
   protected:
-    constexpr CustomBind(Query *query, int base): m_query(query), m_base(base), m_bound(0) { }
+    constexpr CustomBind(Query *query, int base): m_query(query), m_sink(nullptr), m_base(base), m_bound(0) { }
+    // Used by virtual tables (See Db::exposeTable) to extract a column from a custom type instead of binding it
+    constexpr CustomBind(Helper::ColumnSink *sink, int base): m_query(nullptr), m_sink(sink), m_base(base), m_bound(0) { }
     Query *m_query;
+    Helper::ColumnSink *m_sink;
     int m_base;
     int m_bound;
   };
@@ -371,6 +422,8 @@ namespace HFSQtLi
      * @return The number of columns fetched so far, or -1 if any error occoured in a fetch
      */
     constexpr int numFetched() { return m_fetched; }
+    /// @brief True if the types of the columns must match the fetched types (see Query::columnStrict)
+    constexpr bool isStrict() const { return m_strict; }
   protected:
     constexpr CustomFetch(Query *query, bool strict, int base): m_query(query), m_strict(strict), m_base(base), m_fetched(0) { }
     Query *m_query;
@@ -411,6 +464,12 @@ namespace HFSQtLi
     extern const int MISUSE;
     /// @brief Integer value corresonding to SQLITE_CONSTRAINT
     extern const int CONSTRAINT;
+    /// @brief Integer value corresonding to SQLITE_INTERRUPT
+    extern const int INTERRUPT;
+    /// @brief Integer value corresonding to SQLITE_ABORT
+    extern const int ABORT;
+    /// @brief Error code returned when a query deadline expires (see Query::setDeadline). Its primary code is SQLITE_INTERRUPT.
+    extern const int TIMEOUT;
     /**
      * @brief Converts an SQLite type to a \ref Type
      * @param type Type to convert
@@ -485,6 +544,96 @@ namespace HFSQtLi
     constexpr Null() { }
   };
 
+  /**
+   * @brief Non owning view over a contiguous array, bound as a carray table-valued parameter (See \ref bindarrays).
+   *
+   * T can be int, qint64, double or const char * (nul terminated UTF-8 strings).
+   *
+   * Example usage:
+   * \code
+   * std::vector<qint64> ids=...;
+   * qry.prepare("SELECT name FROM items WHERE id IN carray($1)");
+   * qry.bindTemporary(1, CArray<qint64>(ids.data(), ids.size())); // Zero-copy: ids must live until the bindings are cleared
+   * \endcode
+   */
+  template <typename T> class CArray
+  {
+    static_assert(std::is_same_v<T, int> || std::is_same_v<T, qint64> || std::is_same_v<T, double> || std::is_same_v<T, const char *>, "CArray supports only int, qint64, double and const char *");
+  public:
+    /**
+     * @brief Constructs a view over an array
+     * @param data Pointer to first element
+     * @param size Number of elements
+     */
+    constexpr CArray(const T *data, qsizetype size): m_data(data), m_size(size) { }
+    /// @brief Constructs a view over a contiguous container (e.g. QVector or std::vector)
+    template <typename C, typename=decltype(std::declval<const C &>().data())> constexpr CArray(const C &container): m_data(container.data()), m_size(container.size()) { }
+    constexpr const T *data() const { return m_data; }
+    constexpr qsizetype size() const { return m_size; }
+  protected:
+    const T *m_data;
+    qsizetype m_size;
+  };
+
+  /**
+   * @brief Non owning view over UTF-8 text of known size, bound as TEXT. The text does not need to be nul terminated.
+   *
+   * Together with Query::bindTemporary it binds text without any copy or conversion, e.g. fields parsed from a buffer (See \ref BulkImporter).
+   * When fetched it points to the memory of SQLite, valid until the next step or reset of the query, or to a \ref ResultArena (see Query::fetchAll).
+   * \code
+   * qry.bindTemporary(1, TextView(buffer.constData()+start, length)); // buffer must live until the bindings are cleared
+   * \endcode
+   */
+  class TextView
+  {
+  public:
+    /**
+     * @brief Constructs a view over a string
+     * @param data Pointer to first character
+     * @param size Size in bytes
+     */
+    constexpr TextView(const char *data, qsizetype size): m_data(data), m_size(size) { }
+    /// @brief Constructs a null view
+    constexpr TextView(): m_data(nullptr), m_size(0) { }
+    constexpr const char *data() const { return m_data; }
+    constexpr qsizetype size() const { return m_size; }
+    /// @brief True for a view over NULL (e.g. fetched from a NULL column)
+    constexpr bool isNull() const { return !m_data; }
+    /// @brief Converts the text to a QString
+    QString toString() const;
+  protected:
+    const char *m_data;
+    qsizetype m_size;
+  };
+
+  /**
+   * @brief Non owning view over binary data of known size, bound as BLOB.
+   *
+   * As TextView it binds data without copy (with Query::bindTemporary). When fetched it points to the memory of SQLite, valid until the next step or reset of the query,
+   * or to a \ref ResultArena (see Query::fetchAll).
+   */
+  class BlobView
+  {
+  public:
+    /**
+     * @brief Constructs a view over binary data
+     * @param data Pointer to first byte
+     * @param size Size in bytes
+     */
+    constexpr BlobView(const char *data, qsizetype size): m_data(data), m_size(size) { }
+    /// @brief Constructs a null view
+    constexpr BlobView(): m_data(nullptr), m_size(0) { }
+    constexpr const char *data() const { return m_data; }
+    constexpr qsizetype size() const { return m_size; }
+    /// @brief True for a view over NULL (e.g. fetched from a NULL column)
+    constexpr bool isNull() const { return !m_data; }
+    /// @brief Copies the data to a QByteArray
+    QByteArray toByteArray() const;
+  protected:
+    const char *m_data;
+    qsizetype m_size;
+  };
+
   /**
    * @brief Maps a sqlite3_value type
    */
@@ -514,12 +663,452 @@ namespace HFSQtLi
   protected:
     sqlite3_value *m_value;
   };
+
+  /**
+   * @brief Non owning view over a cell of the current row of a query or over a sqlite3_value (e.g. an argument of a SQL function).
+   *
+   * Fetching a \ref Value duplicates the cell (sqlite3_value_dup): text and blobs are allocated and copied. A ValueRef refers to the cell of the statement
+   * and reads it with the sqlite3_column_* functions, to inspect a cell of the current row at no cost (the value returned by sqlite3_column_value is unprotected
+   * and can't be read directly). It is valid until the next step or reset of the query, and it must be used in the thread running the query.
+   * Use OwnedValue or Value to keep the cell.
+   * \code
+   * ValueRef cell;
+   * while(qry.step(cell))
+   *   if(cell.type()==Type::Text)
+   *     out << cell.toText().toString();
+   * \endcode
+   */
+  class ValueRef
+  {
+  public:
+    /// @brief Wraps a protected value, e.g. an argument of a SQL function or a value returned by sqlite3_value_dup
+    inline constexpr ValueRef(sqlite3_value *value=nullptr): m_value(value), m_stmt(nullptr), m_column(0) { }
+    /// @brief Refers to a column of the current row of a statement
+    inline constexpr ValueRef(sqlite3_stmt *stmt, int column): m_value(nullptr), m_stmt(stmt), m_column(column) { }
+    /// @brief The value, to be passed only to sqlite3_bind_value, sqlite3_result_value or sqlite3_value_dup when the ValueRef refers to a column
+    sqlite3_value *pointer() const;
+    inline constexpr bool isValid() const { return m_value!=nullptr || m_stmt!=nullptr; }
+
+    Type type() const;
+    inline bool isNull() const { return type()==Type::Null; }
+    inline bool isInt() const { return type()==Type::Integer; }
+    inline bool isFloat() const { return type()==Type::Float; }
+    inline bool isText() const { return type()==Type::Text; }
+    inline bool isBlob() const { return type()==Type::Blob; }
+
+    double toDouble() const;
+    qint64 toInt64() const;
+    QString toString() const;
+    /// @brief View over the value as UTF-8 text, valid as the ValueRef. Numbers are converted to text in place as sqlite3_value_text does.
+    TextView toText() const;
+    /// @brief View over the value as a blob, valid as the ValueRef
+    BlobView toBlob() const;
+  protected:
+    sqlite3_value *m_value;
+    // Column of the current row, used instead of m_value when m_stmt is set
+    sqlite3_stmt *m_stmt;
+    int m_column;
+  };
+
+  /**
+   * @brief Owned copy of a SQLite value, stored without heap allocation when it is small.
+   *
+   * Integers, floats, NULL and text or blobs up to InlineSize bytes are stored inside the object; only longer text and blobs are copied to a QByteArray.
+   * Unlike \ref Value no sqlite3_value is allocated, so a vector of OwnedValue is a cheap way to keep generic rows (e.g. to dump a table of unknown schema).
+   * \code
+   * qry.prepare("SELECT * FROM "+table);
+   * QVector<OwnedValue> row(columns);
+   * while(qry.step())
+   * {
+   *   for(int i=0;i<row.size();i++)
+   *     qry.column(i, row[i]);
+   *   ...
+   * }
+   * \endcode
+   */
+  class OwnedValue
+  {
+  public:
+    /// @brief Maximum size in bytes of text and blobs stored in the object
+    static constexpr int InlineSize=15;
+    /// @brief Constructs a NULL value
+    inline OwnedValue(): m_type(Type::Null), m_size(0), m_int(0) { }
+    /// @brief Copies a value
+    explicit OwnedValue(const ValueRef &value);
+
+    void set(const ValueRef &value);
+    void setNull();
+    void setInt64(qint64 value);
+    void setDouble(double value);
+    /// @brief Sets UTF-8 text of size bytes
+    void setText(const char *data, qsizetype size);
+    void setBlob(const char *data, qsizetype size);
+
+    inline Type type() const { return m_type; }
+    inline bool isNull() const { return m_type==Type::Null; }
+    inline bool isInt() const { return m_type==Type::Integer; }
+    inline bool isFloat() const { return m_type==Type::Float; }
+    inline bool isText() const { return m_type==Type::Text; }
+    inline bool isBlob() const { return m_type==Type::Blob; }
+    /// @brief True if the value is stored in the object, without heap allocation
+    inline bool isInline() const { return m_heap.isNull(); }
+
+    /// @brief Converts the value to double: text is parsed, NULL and blobs are 0
+    double toDouble() const;
+    /// @brief Converts the value to integer: floats are truncated, text is parsed, NULL and blobs are 0
+    qint64 toInt64() const;
+    /// @brief Converts the value to a string: NULL is a null string
+    QString toString() const;
+    /// @brief View over text or blob data, nul terminated, valid until the value is changed or destroyed. Null for other types.
+    TextView toText() const;
+    /// @brief View over text or blob data, valid until the value is changed or destroyed. Null for other types.
+    BlobView toBlob() const;
+  protected:
+    void setData(Type type, const char *data, qsizetype size);
+    Type m_type;
+    // Size of text or blob stored in m_inline
+    int m_size;
+    union
+    {
+      qint64 m_int;
+      double m_double;
+      char m_inline[InlineSize+1];
+    };
+    // Text or blob longer than InlineSize
+    QByteArray m_heap;
+  };
+}
+
+
+
+
+class QIODevice;
+
+namespace HFSQtLi
+{
+  /// @brief Output formats of Query::exportTo
+  enum class ExportFormat: int
+  {
+    /// @brief RFC 4180 CSV: fields containing delimiter, quotes or line breaks are quoted, NULL is an empty field
+    Csv,
+    /// @brief Tab separated values: tab, line breaks and backslash are escaped as \\t, \\n, \\r, \\\\ and NULL is \\N
+    Tsv,
+    /// @brief A JSON array of objects, one per row, keyed by column name
+    Json,
+    /// @brief One JSON object per line (JSON Lines)
+    JsonLines
+  };
+
+  /**
+   * @brief Options of Query::exportTo
+   */
+  struct ExportOptions
+  {
+    /// @brief Writes the column names as first line (CSV and TSV only)
+    bool header=true;
+    /// @brief Compresses the output with gzip. Requires HFSQTLI_ENABLE_ZLIB, otherwise the export fails with SQLITE_MISUSE.
+    bool gzip=false;
+    /// @brief Size of the output buffer in bytes
+    int bufferSize=64*1024;
+    /// @brief Maximum number of bytes the device may hold unwritten (QIODevice::bytesToWrite) before the export waits for it to drain
+    qint64 maxPendingBytes=1024*1024;
+    /// @brief Maximum time in milliseconds to wait for a slow device to drain, the export fails when it expires (-1 to wait forever)
+    int writeTimeout=30000;
+  };
+
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    // Buffered writer used by Query::exportTo, optionally compressing the output with gzip
+    class ExportWriter
+    {
+    public:
+      ExportWriter(QIODevice *device, const ExportOptions &options);
+      ~ExportWriter();
+      inline bool isOk() const { return m_errorMsg.isEmpty(); }
+      inline const QString &errorMsg() const { return m_errorMsg; }
+      inline void write(const char *data, qsizetype size)
+      {
+        if(m_used+size>m_buffer.size())
+        {
+          flushBuffer();
+          if(size>m_buffer.size())
+          {
+            output(data, size);
+            return;
+          }
+        }
+        memcpy(m_buffer.data()+m_used, data, size);
+        m_used+=size;
+      }
+      inline void write(const char *data) { write(data, qsizetype(strlen(data))); }
+      inline void put(char c)
+      {
+        if(m_used==m_buffer.size())
+          flushBuffer();
+        m_buffer.data()[m_used++]=c;
+      }
+      // Writes all buffered data, ending the compressed stream. Returns false on error.
+      bool finish();
+    protected:
+      void flushBuffer();
+      // Compresses (if needed) and writes to device
+      void output(const char *data, qsizetype size, bool last=false);
+      void writeDevice(const char *data, qint64 size);
+      QIODevice *m_device;
+      ExportOptions m_options;
+      QByteArray m_buffer;
+      qsizetype m_used;
+      QByteArray m_compressed;
+      void *m_zstream;
+      QString m_errorMsg;
+    };
+  }
+  /// \endcond INTERNAL
 }
 
+/// \cond INTERNAL
+// Applies HFSQTLI_MAP_FIELDS_n to the n (up to 32) field names
+#define HFSQTLI_MAP_EXPAND(x) x
+#define HFSQTLI_MAP_CONCAT(a, b) HFSQTLI_MAP_CONCAT_(a, b)
+#define HFSQTLI_MAP_CONCAT_(a, b) a##b
+#define HFSQTLI_MAP_COUNT(...) HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_COUNT_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define HFSQTLI_MAP_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define HFSQTLI_MAP_FIELDS(v, ...) HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_CONCAT(HFSQTLI_MAP_FIELDS_, HFSQTLI_MAP_COUNT(__VA_ARGS__))(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_1(v, f) v.f
+#define HFSQTLI_MAP_FIELDS_2(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_1(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_3(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_2(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_4(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_3(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_5(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_4(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_6(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_5(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_7(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_6(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_8(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_7(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_9(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_8(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_10(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_9(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_11(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_10(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_12(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_11(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_13(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_12(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_14(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_13(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_15(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_14(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_16(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_15(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_17(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_16(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_18(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_17(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_19(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_18(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_20(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_19(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_21(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_20(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_22(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_21(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_23(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_22(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_24(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_23(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_25(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_24(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_26(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_25(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_27(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_26(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_28(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_27(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_29(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_28(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_30(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_29(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_31(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_30(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_32(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_31(v, __VA_ARGS__))
+/// \endcond INTERNAL
+
+/**
+ * @brief Maps the fields of a struct to columns, see \ref HFSQtLi::Mapping.
+ *
+ * Must be used in the namespace of the struct, after its definition. Fields are bound and fetched in the given order, up to 32 fields.
+ */
+#define HFSQTLI_MAP(Type, ...) \
+  inline auto hfsqtliMapFields(Type &value) { return std::tie(HFSQTLI_MAP_FIELDS(value, __VA_ARGS__)); } \
+  inline auto hfsqtliMapFields(const Type &value) { return std::tie(HFSQTLI_MAP_FIELDS(value, __VA_ARGS__)); } \
+  inline const char *hfsqtliMapNames(const Type *) { return #__VA_ARGS__; } \
+  inline const char *hfsqtliMapTable(const Type *) { return #Type; }
+
+namespace HFSQtLi
+{
+  template <typename T> class Interned;
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    template <typename T, typename=void> struct IsMapped: std::false_type { };
+    template <typename T> struct IsMapped<T, std::void_t<decltype(hfsqtliMapFields(std::declval<const T &>()))>>: std::true_type { };
+    // Tuple of references to the fields of a mapped type
+    template <typename T> using MappedFields=decltype(hfsqtliMapFields(std::declval<T &>()));
+    template <typename T> constexpr int mappedSize() { return int(std::tuple_size<MappedFields<T>>::value); }
+
+    template <typename T> struct IsOptional: std::false_type { };
+    template <typename T> struct IsOptional<std::optional<T>>: std::true_type { };
+
+    // Declared type of the column of a field. Fields that are not std::optional are NOT NULL.
+    // Column type of the types with a built-in codec, specialized in codecs.h
+    template <typename T> struct CodecSqlType { static constexpr const char *type=nullptr, *typeNotNull=nullptr; };
+
+    template <typename T> constexpr const char *mappedSqlType(bool notNull=true)
+    {
+      if constexpr(IsOptional<T>::value)
+        return mappedSqlType<typename T::value_type>(false);
+      else if constexpr(std::is_integral<T>::value)
+        return notNull?"INTEGER NOT NULL":"INTEGER";
+      else if constexpr(std::is_floating_point<T>::value)
+        return notNull?"REAL NOT NULL":"REAL";
+      else if constexpr(std::is_same<T, QString>::value || std::is_same<T, Interned<QString>>::value)
+        return notNull?"TEXT NOT NULL":"TEXT";
+      else if constexpr(std::is_same<T, QByteArray>::value)
+        return notNull?"BLOB NOT NULL":"BLOB";
+      else if constexpr(CodecSqlType<T>::type!=nullptr)
+        return notNull?CodecSqlType<T>::typeNotNull:CodecSqlType<T>::type;
+      else
+      {
+        static_assert(!std::is_same<T, T>::value, "Mapped fields must be integers, floating points, QString, Interned<QString>, QByteArray, types with a built-in codec (QDateTime, QDate, QTime, QUuid...) or std::optional of them");
+        return nullptr;
+      }
+    }
+
+    // Splits the stringified field list of HFSQTLI_MAP
+    QStringList mappedColumns(const char *names);
+    QVector<QByteArray> mappedColumnNames(const QStringList &columns);
+    QString mappedCreateTableSql(const QString &table, const QStringList &columns, const char *const *types, const QString &constraints);
+    QString mappedInsertSql(const QString &table, const QStringList &columns);
+    QString mappedSelectSql(const QString &table, const QStringList &columns, const QString &where);
+  }
+  /// \endcond INTERNAL
+
+  /**
+   * @brief Columns and SQL statements of a struct mapped with HFSQTLI_MAP.
+   *
+   * HFSQTLI_MAP(Type, field1, field2, ...) lists the fields of a struct stored as columns with the same names. A mapped struct can be bound and fetched
+   * as any other type (see \ref bindcustomtypes and \ref fetchcustomtypes) without writing customBind and customFetch: each field is bound or fetched
+   * at an offset known at compile time, with the native function of its type, and the whole struct counts as sizeof...(fields) columns.
+   * Fields can be integers (bool included), double, float, QString, Interned<QString>, QByteArray or std::optional of them (empty is NULL).
+   *
+   * The table of a mapped struct defaults to the name of the struct. Fields that are not std::optional are declared NOT NULL.
+   * \code
+   * struct Sensor { qint64 id; QString name; std::optional<double> reading; };
+   * HFSQTLI_MAP(Sensor, id, name, reading)
+   * ...
+   * db->execute(Mapping<Sensor>::createTableSql("sensors", "PRIMARY KEY(id)"));
+   * Query insert(db, Mapping<Sensor>::insertSql("sensors"));
+   * insert.bindAll(Sensor{1, "temperature", 21.5});
+   * Sensor s;
+   * db->executeSingleAll<1>(Mapping<Sensor>::selectSql("sensors", "id=?"), 1, s);
+   * \endcode
+   */
+  template <typename T> class Mapping
+  {
+    static_assert(Helper::IsMapped<T>::value, "Mapping requires a struct mapped with HFSQTLI_MAP");
+  public:
+    /// @brief Number of mapped fields
+    static constexpr int columnCount() { return Helper::mappedSize<T>(); }
+    /// @brief Default table name: the name of the struct
+    static QString table() { return QString(hfsqtliMapTable(static_cast<const T *>(nullptr))); }
+    /// @brief Names of the columns, in the order of the fields
+    static const QStringList &columns()
+    {
+      static const QStringList ret=Helper::mappedColumns(hfsqtliMapNames(static_cast<const T *>(nullptr)));
+      return ret;
+    }
+    /// @brief Names of the columns encoded in UTF-8, as looked up by Query::columnByName
+    static const QVector<QByteArray> &columnNames()
+    {
+      static const QVector<QByteArray> ret=Helper::mappedColumnNames(columns());
+      return ret;
+    }
+    /**
+     * @brief Statement creating the table, if it does not exist
+     * @param table Name of the table (quoted). If null table() is used.
+     * @param constraints Table constraints appended after the columns, e.g. "PRIMARY KEY(id)"
+     */
+    static QString createTableSql(const QString &table=QString(), const QString &constraints=QString())
+    {
+      return Helper::mappedCreateTableSql(tableName(table), columns(), types(Helper::make_int_sequence<columnCount()>()), constraints);
+    }
+    /// @brief Statement inserting a row, with one parameter for every field. Bind a T (or its fields in order).
+    static QString insertSql(const QString &table=QString()) { return Helper::mappedInsertSql(tableName(table), columns()); }
+    /// @brief Statement selecting the columns of all the fields, fetchable into a T. where, if not empty, is appended after WHERE.
+    static QString selectSql(const QString &table=QString(), const QString &where=QString()) { return Helper::mappedSelectSql(tableName(table), columns(), where); }
+  protected:
+    static QString tableName(const QString &table) { return table.isNull()?Mapping::table():table; }
+    template <int ...I> static const char *const *types(Helper::int_sequence<I...>)
+    {
+      static const char *const ret[]={Helper::mappedSqlType<std::decay_t<std::tuple_element_t<I, Helper::MappedFields<T>>>>()...};
+      return ret;
+    }
+  };
+}
 
+namespace HFSQtLi
+{
+  /**
+   * @brief Pool of strings shared by the Interned<QString> values fetched by queries (see Interned).
+   *
+   * Strings are keyed by their UTF-8 bytes: fetching a value already in the pool costs a hash lookup and returns a shared copy of the pooled QString,
+   * with no allocation and no UTF-8 decoding. Once the pool holds maxSize() strings new values are decoded without being added, so high cardinality columns
+   * do not grow it without limit.
+   *
+   * Every query has its own pool, created on first use. A pool can be shared by several queries (see Query::setInternPool) from the same thread.
+   */
+  class InternPool
+  {
+  public:
+    /**
+     * @brief Constructs an empty pool
+     * @param maxSize Maximum number of strings kept
+     */
+    explicit InternPool(int maxSize=4096);
+    /**
+     * @brief Gets the pooled string with the given UTF-8 content, adding it if needed
+     * @param utf8 Text, not nul terminated. If null a null string is returned.
+     * @param size Size in bytes
+     */
+    QString intern(const char *utf8, qsizetype size);
+    /// @brief Number of strings in the pool
+    int size() const { return int(m_strings.size()); }
+    /// @brief Maximum number of strings kept
+    int maxSize() const { return m_maxSize; }
+    /// @brief Sets the maximum number of strings kept. Strings already in the pool are not removed.
+    void setMaxSize(int maxSize) { m_maxSize=maxSize; }
+    /// @brief Removes all the strings
+    void clear() { m_strings.clear(); }
+    /// @brief Number of values found in the pool
+    quint64 hits() const { return m_hits; }
+    /// @brief Number of values decoded
+    quint64 misses() const { return m_misses; }
+  protected:
+    QHash<QByteArray, QString> m_strings;
+    int m_maxSize;
+    quint64 m_hits;
+    quint64 m_misses;
+  };
 
+  /**
+   * @brief Fetches a text column through the intern pool of the query (see InternPool).
+   *
+   * Meant for low cardinality columns (status, country, category, ...): all the rows with the same value share one QString, saving the allocation and the
+   * UTF-8 decoding of every repeated value and the memory of rows kept around. Binding an Interned<QString> is the same as binding the QString.
+   * \code
+   * QVector<std::tuple<qint64, Interned<QString>>> rows;
+   * std::tuple<qint64, Interned<QString>> row;
+   * while(qry.step(row))
+   *   rows.append(row);
+   * \endcode
+   */
+  template <typename T> class Interned
+  {
+    static_assert(std::is_same<T, QString>::value, "Only QString can be interned");
+  public:
+    /// @brief Constructs a null string
+    Interned() { }
+    /// @brief Constructs from a string
+    Interned(const T &value): m_value(value) { }
+    /// @brief Gets the string
+    const T &value() const { return m_value; }
+    operator const T &() const { return m_value; }
+    const T *operator->() const { return &m_value; }
+    bool operator==(const Interned &other) const { return m_value==other.m_value; }
+    bool operator!=(const Interned &other) const { return m_value!=other.m_value; }
+  protected:
+    T m_value;
+  };
+}
 
 struct sqlite3_stmt;
+struct sqlite3_value;
 //#define SQLITE3_UNIVERSALREF(T, Type) class T, class=typename std::enable_if<std::is_same<typename std::decay<T>::type, Type>::value>::type
 
 namespace HFSQtLi
@@ -529,7 +1118,14 @@ namespace HFSQtLi
   class ZeroBlob;
   class Blob;
   class Value;
+  class ValueRef;
+  class OwnedValue;
+  class RowBuffer;
+  class TextView;
+  class BlobView;
+  class ResultArena;
   template <typename ...T> struct Call;
+  template <typename T> class CArray;
 
   enum class Type: int;
   /**
@@ -541,6 +1137,8 @@ namespace HFSQtLi
     friend class SqliteDb;
     friend class CustomBind;
     friend class CustomFetch;
+    friend class QueryModel;
+    friend class ResultCache;
 
    /// @name Constructors
    /// @{
@@ -648,6 +1246,30 @@ namespace HFSQtLi
     bool keepErrorMsg() const;
     /// @}
 
+    /// @name Deadlines
+    /// A query with a deadline is interrupted (via sqlite3_progress_handler) if a step is still running when the deadline expires.
+    /// A progress handler of the connection must be set with \ref Db::setProgressHandler to be kept during these steps.
+    /// The step then fails with error \ref SQLiteCode::TIMEOUT and the query must be reset before being used again.
+    /// To cancel from another thread whatever is running on a connection see \ref Db::cancel.
+    /// @{
+    /**
+     * @brief Sets the deadline for all next steps of this query
+     * @param deadline Time after which any step will fail with SQLiteCode::TIMEOUT
+     */
+    inline void setDeadline(std::chrono::steady_clock::time_point deadline) { m_deadline=deadline; m_hasDeadline=true; }
+    /**
+     * @brief Sets the deadline to a given time from now
+     * @param timeout Time from now after which any step will fail with SQLiteCode::TIMEOUT
+     */
+    template <class Rep, class Period> inline void setTimeout(std::chrono::duration<Rep, Period> timeout) { setDeadline(std::chrono::steady_clock::now()+std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout)); }
+    /// @brief Removes the deadline
+    inline void clearDeadline() { m_hasDeadline=false; }
+    /// @brief Checks if a deadline is set
+    inline bool hasDeadline() const { return m_hasDeadline; }
+    /// @brief Gets current deadline. Valid only if hasDeadline() is true
+    inline std::chrono::steady_clock::time_point deadline() const { return m_deadline; }
+    /// @}
+
     /// @name Step-and-fetch functions
     /// All the function in this group advances the query to the next row and if this operation is successfull fetches some or all of its data.
     /// They are approximately equivalent to calling:
@@ -695,6 +1317,25 @@ namespace HFSQtLi
       if(ret)ret=columnAllHelper(strict, std::forward<Args>(args)...);
       return ret;
     }
+    /**
+     * @brief Steps the query until it is done, appending every row to a container.
+     *
+     * Rows can be of any type fetching all the columns (see \ref fetchtypes), usually a std::tuple or a struct mapped with HFSQTLI_MAP.
+     * Text and blob columns fetched as TextView and BlobView are copied into the arena, with no allocation per value: the views stay valid until the arena is cleared or destroyed.
+     * Other types (e.g. QString) are fetched as usual.
+     * \code
+     * ResultArena arena;
+     * QVector<std::tuple<qint64, TextView>> rows;
+     * qry.bind(1, owner);
+     * if(qry.fetchAll(arena, rows))
+     *   for(const auto &[id, name]: rows)
+     *     ...
+     * \endcode
+     * @param arena Arena receiving text and blob values
+     * @param rows Container of rows, e.g. QVector or std::vector. Rows are appended with push_back.
+     * @return 0 on error, 1+number of fetched rows on success. Rows fetched before an error are kept.
+     */
+    template <typename Container> int fetchAll(ResultArena &arena, Container &rows);
     /// @}
 
     /// @name Single row query execution
@@ -791,6 +1432,13 @@ namespace HFSQtLi
     /// @{
     /**
      * @brief Binds some values in a query.
+     *
+     * QString and QByteArray passed as rvalues (temporaries or std::move) are moved into the query and bound without copy: their data is released when the
+     * bindings are cleared, the parameter is bound again with an rvalue or the query is finalized.
+     * \code
+     * QByteArray payload=...; // Some MB
+     * qry.bind(1, std::move(payload)); // Not copied by SQLite
+     * \endcode
      * @param i First index to bind (1-based)
      * @param args Values to bind (see \ref bindtypes)
      * @return 0 on error, 1+number of bound columns on success
@@ -812,6 +1460,39 @@ namespace HFSQtLi
      * @copydetails bindAll
      */
     template <typename... Args> inline int bindTemporaryAll(Args &&...args) { int ret=bindSingleWithChecks(true, 1, std::forward_as_tuple<decltype(args)...>(std::forward<Args>(args)...)); return (ret<0)?0:(assertBindColumnCount(ret-1)+1); }
+    /**
+     * @brief Binds some values starting from a named parameter.
+     * \code
+     * qry.prepare("SELECT name FROM users WHERE id=:user");
+     * qry.bind(":user", id);
+     * \endcode
+     * @param name Name of the parameter, prefix included (e.g. ":user", "@user" or "$user"). See parameterIndex().
+     * @param args Values to bind (see \ref bindtypes)
+     * @return 0 on error, 1+number of bound columns on success
+     */
+    template <typename... Args> inline int bind(const char *name, Args &&...args) { int i=namedIndex(name); return i>0?bind(i, std::forward<Args>(args)...):0; }
+    /**
+     * @brief Binds some values starting from a named parameter. The existence of passed values must be guaranteed to persist until the binding is cleared (Query is destroyed or clearBindings() is called)
+     * @copydetails bind(const char *, Args &&...)
+     */
+    template <typename... Args> inline int bindTemporary(const char *name, Args &&...args) { int i=namedIndex(name); return i>0?bindTemporary(i, std::forward<Args>(args)...):0; }
+    /**
+     * @brief Binds named parameters given as pairs of a name and a value
+     * \code
+     * qry.bindNamed(":a", x, ":b", y);
+     * \endcode
+     * @param args Names (const char *, prefix included) each followed by the value to bind (see \ref bindtypes)
+     * @return 0 on error, 1+number of bound columns on success
+     */
+    template <typename... Args> inline int bindNamed(Args &&...args);
+    /**
+     * @brief Gets the index of a named parameter.
+     * Names are looked up in the prepared statement once, the first time this function is called after prepare, and then kept in a hash table:
+     * binding by name costs one hash lookup more than binding by index.
+     * @param name Name of the parameter, prefix included (e.g. ":user")
+     * @return The index (1-based) of the parameter or 0 if the statement has no parameter with this name
+     */
+    int parameterIndex(const char *name);
     /// @}
 
     /// @name Functions to fetch data
@@ -841,6 +1522,78 @@ namespace HFSQtLi
      * @copydetails columnAll
      */
     template <typename... Args> inline int columnStrictAll(Args &&...args) { return columnAllHelper(true, std::forward<Args>(args)...); }
+    /**
+     * @brief Retrieves some columns from a row, starting from the column with the given name.
+     * \code
+     * qry.prepare("SELECT id, price FROM items");
+     * while(qry.stepNoFetch())
+     *   qry.column("price", price);
+     * \endcode
+     * @param name Name of the column (see columnIndex())
+     * @param args Reference to data to retrive (see \ref fetchtypes)
+     * @return 0 on error, 1+number of fetched columns on success
+     */
+    template <typename... Args> inline int column(const char *name, Args &&...args) { int i=namedColumn(name); return i>=0?columnHelper(false, i, std::forward<Args>(args)...):0; }
+    /**
+     * @brief Retrieves some columns from a row, starting from the column with the given name, returning error if types do not match.
+     * @copydetails column(const char *, Args &&...)
+     */
+    template <typename... Args> inline int columnStrict(const char *name, Args &&...args) { int i=namedColumn(name); return i>=0?columnHelper(true, i, std::forward<Args>(args)...):0; }
+    /**
+     * @brief Retrieves a struct mapped with HFSQTLI_MAP from the columns named as its fields, in any order (see \ref Mapping).
+     * Columns not named as a field are ignored.
+     * @param value Struct to fill
+     * @return 0 on error (e.g. a field without a column), 1+number of fetched columns on success
+     */
+    template <typename T> inline int columnByName(T &value) { return readByName(false, value, Helper::make_int_sequence<Helper::mappedSize<T>()>()); }
+    /**
+     * @brief Retrieves a struct mapped with HFSQTLI_MAP from the columns named as its fields, returning error if types do not match.
+     * @copydetails columnByName
+     */
+    template <typename T> inline int columnByNameStrict(T &value) { return readByName(true, value, Helper::make_int_sequence<Helper::mappedSize<T>()>()); }
+    /**
+     * @brief Gets the index of a column of the result.
+     * Names (see sqlite3_column_name: the AS name if given) are read from the prepared statement once, the first time this function is called after prepare,
+     * and then kept in a hash table: fetching by name costs one hash lookup more than fetching by index. If more columns have the same name the first one is used.
+     * @param name Name of the column
+     * @return The index (0-based) of the column or -1 if the result has no column with this name
+     */
+    int columnIndex(const char *name);
+    /// @}
+
+    /// @name Interning
+    /// @{
+    /**
+     * @brief Sets the pool used to fetch Interned<QString> values
+     * @param pool Pool to use, it must outlive the query. If null the query uses its own pool.
+     */
+    void setInternPool(InternPool *pool);
+    /// @brief Gets the pool used to fetch Interned<QString> values, creating the own pool of the query if needed
+    InternPool *internPool();
+    /// @}
+
+    /// @name Export
+    /// @{
+    /**
+     * @brief Steps the query until it is done, writing every row to a device.
+     *
+     * Cells are written straight from the pointers returned by SQLite (sqlite3_column_text/sqlite3_column_blob) to a buffered writer: no QString, QByteArray or
+     * \ref Value is created per cell, so memory usage does not depend on the size of the result. Blobs are written as hexadecimal strings.
+     * When the device does not keep up (e.g. a socket to a slow client) the export waits for it to drain (see ExportOptions::maxPendingBytes).
+     *
+     * The query must be prepared with its parameters bound. If the query is positioned on a row (e.g. after step()) the export starts from that row, otherwise from the first one: usually it is called right after binding.
+     * \code
+     * qry.prepare("SELECT id, name, data FROM items WHERE owner=$1");
+     * qry.bind(1, owner);
+     * qry.exportTo(socket, ExportFormat::Json);
+     * \endcode
+     * @param device Device to write to, must be open for writing
+     * @param format Output format
+     * @param options Export options
+     * @param rows If not null it is filled with the number of rows exported
+     * @return True on success. On failure error() returns the SQLite error or SQLITE_IOERR if the device could not be written.
+     */
+    bool exportTo(QIODevice *device, ExportFormat format, const ExportOptions &options=ExportOptions(), qint64 *rows=nullptr);
     /// @}
 
     /// \cond INTERNAL
@@ -851,6 +1604,14 @@ namespace HFSQtLi
   protected:
     // Note: function guarantees 0 will be returned on error
     template <typename... Args> inline int bindSingleWithChecks(bool temporary, int i, const std::tuple<Args...> &args);
+    // Index of a named parameter, setting the error if it does not exist
+    int namedIndex(const char *name);
+    // Index of a named column, setting the error if it does not exist
+    int namedColumn(const char *name);
+    int namedColumn(const QByteArray &name);
+    int columnIndex(const QByteArray &name);
+    template <typename T, int ...I> inline int readByName(bool strict, T &value, Helper::int_sequence<I...>);
+    template <typename T, typename... Args> inline bool bindNamedHelper(int &count, const char *name, T &&value, Args &&...args);
 
     // Gets the error string from the database if m_error contains an error. Note: Mutex must be held when calling this function. Return true on success, false on failure
     inline bool fetchErrorString();
@@ -860,11 +1621,15 @@ namespace HFSQtLi
     int assertBindColumnCount(int i);
     // Note: all next function expects that the db mutex is hold when calling them and that the query is valid. If an error is returned m_errorString should be set (if necessary)
     template <typename T> inline int bindSingle(bool, int i, T &&value );
+    // Binds the fields of a struct mapped with HFSQTLI_MAP at consecutive indexes known at compile time
+    template <typename T, int ...I> inline int bindMapped(bool temporary, int i, const T &value, Helper::int_sequence<I...>);
+    template <typename F> inline bool bindMappedField(bool temporary, int i, const F &value);
 
 
     int bindSingle(bool, int i, std::nullptr_t);
 
-    inline int bindSingle(bool temporary, int i, QByteArray &&value) { return bindSingle(temporary, i, const_cast<const QByteArray &>(value)); }
+    // Rvalues are moved into the query and bound without copy (see Query::bind)
+    int bindSingle(bool temporary, int i, QByteArray &&value);
     inline int bindSingle(bool temporary, int i, QByteArray &value) { return bindSingle(temporary, i, const_cast<const QByteArray &>(value)); }
     int bindSingle(bool, int i, const QByteArray &value);
 
@@ -885,6 +1650,47 @@ namespace HFSQtLi
     inline int bindSingle(bool temporary, int i, int value) { return bindSingle(temporary, i, (qint64) value); }
     inline int bindSingle(bool temporary, int i, unsigned value) { return bindSingle(temporary, i, (qint64) value); }
     int bindSingle(bool temporary, int i, const QString &value);
+    inline int bindSingle(bool temporary, int i, QString &value) { return bindSingle(temporary, i, const_cast<const QString &>(value)); }
+    int bindSingle(bool temporary, int i, QString &&value);
+    inline int bindSingle(bool temporary, int i, TextView &&value) { return bindSingle(temporary, i, const_cast<const TextView &>(value)); }
+    inline int bindSingle(bool temporary, int i, TextView &value) { return bindSingle(temporary, i, const_cast<const TextView &>(value)); }
+    int bindSingle(bool temporary, int i, const TextView &value);
+    inline int bindSingle(bool temporary, int i, BlobView &&value) { return bindSingle(temporary, i, const_cast<const BlobView &>(value)); }
+    inline int bindSingle(bool temporary, int i, BlobView &value) { return bindSingle(temporary, i, const_cast<const BlobView &>(value)); }
+    int bindSingle(bool temporary, int i, const BlobView &value);
+    inline int bindSingle(bool temporary, int i, ValueRef &&value) { return bindSingle(temporary, i, const_cast<const ValueRef &>(value)); }
+    inline int bindSingle(bool temporary, int i, ValueRef &value) { return bindSingle(temporary, i, const_cast<const ValueRef &>(value)); }
+    int bindSingle(bool temporary, int i, const ValueRef &value);
+    inline int bindSingle(bool temporary, int i, OwnedValue &&value) { return bindSingle(temporary, i, const_cast<const OwnedValue &>(value)); }
+    inline int bindSingle(bool temporary, int i, OwnedValue &value) { return bindSingle(temporary, i, const_cast<const OwnedValue &>(value)); }
+    int bindSingle(bool temporary, int i, const OwnedValue &value);
+    inline int bindSingle(bool temporary, int i, const Interned<QString> &value) { return bindSingle(temporary, i, value.value()); }
+    inline int bindSingle(bool temporary, int i, Interned<QString> &value) { return bindSingle(temporary, i, value.value()); }
+    inline int bindSingle(bool temporary, int i, Interned<QString> &&value) { return bindSingle(temporary, i, value.value()); }
+    // Arrays bound via carray extension
+    enum class ArrayType: int { Int32, Int64, Double, Text };
+    int bindArray(bool temporary, int i, const void *data, qsizetype size, ArrayType type);
+    inline int bindSingle(bool temporary, int i, const CArray<int> &value);
+    inline int bindSingle(bool temporary, int i, const CArray<qint64> &value);
+    inline int bindSingle(bool temporary, int i, const CArray<double> &value);
+    inline int bindSingle(bool temporary, int i, const CArray<const char *> &value);
+    template <typename T> inline int bindSingle(bool temporary, int i, CArray<T> &value) { return bindSingle(temporary, i, const_cast<const CArray<T> &>(value)); }
+    template <typename T> inline int bindSingle(bool temporary, int i, CArray<T> &&value) { return bindSingle(temporary, i, const_cast<const CArray<T> &>(value)); }
+
+    inline int bindSingle(bool temporary, int i, const QVector<int> &value) { return bindArray(temporary, i, value.constData(), value.size(), ArrayType::Int32); }
+    inline int bindSingle(bool temporary, int i, QVector<int> &value) { return bindSingle(temporary, i, const_cast<const QVector<int> &>(value)); }
+    inline int bindSingle(bool temporary, int i, QVector<int> &&value) { return bindSingle(temporary, i, const_cast<const QVector<int> &>(value)); }
+    inline int bindSingle(bool temporary, int i, const QVector<qint64> &value) { return bindArray(temporary, i, value.constData(), value.size(), ArrayType::Int64); }
+    inline int bindSingle(bool temporary, int i, QVector<qint64> &value) { return bindSingle(temporary, i, const_cast<const QVector<qint64> &>(value)); }
+    inline int bindSingle(bool temporary, int i, QVector<qint64> &&value) { return bindSingle(temporary, i, const_cast<const QVector<qint64> &>(value)); }
+    inline int bindSingle(bool temporary, int i, const QVector<double> &value) { return bindArray(temporary, i, value.constData(), value.size(), ArrayType::Double); }
+    inline int bindSingle(bool temporary, int i, QVector<double> &value) { return bindSingle(temporary, i, const_cast<const QVector<double> &>(value)); }
+    inline int bindSingle(bool temporary, int i, QVector<double> &&value) { return bindSingle(temporary, i, const_cast<const QVector<double> &>(value)); }
+    // Strings are always converted to UTF-8 in a single block owned by SQLite
+    int bindSingle(bool temporary, int i, const QStringList &value);
+    inline int bindSingle(bool temporary, int i, QStringList &value) { return bindSingle(temporary, i, const_cast<const QStringList &>(value)); }
+    inline int bindSingle(bool temporary, int i, QStringList &&value) { return bindSingle(temporary, i, const_cast<const QStringList &>(value)); }
+
     template <class ...T> int bindSingle(bool temporary, int i, const std::tuple<T...> &value) { return bindSingleHelper(temporary, i, value, Helper::make_int_sequence<sizeof...(T)>()); }
     template <class ...T> int bindSingle(bool temporary, int i, std::tuple<T...> &&value) { return bindSingle(temporary, i, static_cast<const std::tuple<T...> &>(value)); }
     template <class ...T, int ...I> int bindSingleHelper(bool temporary, int i, const std::tuple<T...> &value, Helper::int_sequence<I...>);
@@ -904,6 +1710,9 @@ namespace HFSQtLi
     double readColumnDoubleSQLite(int i, bool &ok);
     // Helper function for reading an int
     template <class T> inline int readColumnInt(bool strict, int i, T &value);
+    // Fetches the fields of a struct mapped with HFSQTLI_MAP from consecutive columns
+    template <typename T, int ...I> inline int readMapped(bool strict, int i, T &value, Helper::int_sequence<I...>);
+    template <typename F> inline bool readMappedField(bool strict, int i, F &value);
 
   public:
     //    template <typename T> inline int readColumn(bool, int, T &&)=delete;
@@ -924,7 +1733,14 @@ namespace HFSQtLi
     int readColumn(bool strict, int i, QString &value);
     int readColumn(bool strict,int i, Blob &value);
     int readColumn(bool strict, int i, QByteArray &value);
+    // Views point to the memory of SQLite, or to m_arena when fetchAll is running
+    int readColumn(bool strict, int i, TextView &value);
+    int readColumn(bool strict, int i, BlobView &value);
+    int readColumn(bool strict, int i, Interned<QString> &value);
     int readColumn(bool, int i, Value &result);
+    int readColumn(bool, int i, ValueRef &result);
+    int readColumn(bool, int i, OwnedValue &result);
+    int readColumn(bool, int i, RowBuffer &row);
     template <class T> inline int readColumn(bool strict, int i, std::optional<T> &result);
 
     template <class ...T> inline int readColumn(bool strict, int i, Call<T...> &call) { return readColumn(strict, i, static_cast<const Call<T...> &>(call)); }
@@ -944,55 +1760,224 @@ namespace HFSQtLi
     template <class ...Args, int ...Index> int readColumnHelper(bool strict, int i, const std::tuple<Args...> &values, Helper::int_sequence<Index...>);
     template <class ...Args, int ...Index> int readColumnHelper(bool strict, int i, std::tuple<Args...> &values, Helper::int_sequence<Index...> seq);
     int readColumnInternal(int i, Blob &value, bool strict);
+    // Reads protected values (arguments of user defined functions, rows of the result cache) in place of the columns of m_stmt, see Helper::readValues
+    template <typename Tuple> int readValues(sqlite3_value **values, int count, Tuple &&result);
+    // Cell i of the current row: a column of m_stmt, or m_values[i] while readValues runs (NULL when out of range)
+    int cellType(int i);
+    qint64 cellInt64(int i);
+    double cellDouble(int i);
+    const char *cellText(int i);
+    const void *cellBlob(int i);
+    int cellBytes(int i);
 
     // Clears the bindings without changing m_error. Used for resetting after temporary bindings (e.g. exec(...); )
     int clearBindingInternal();
+    // Gets the holder of the value moved into parameter i, null if i is not a valid parameter
+    struct OwnedBinding;
+    OwnedBinding *ownedBinding(int i);
+    // Stores a type tag and the bytes of the value bound to parameter i in m_boundValues, if enabled
+    void recordBinding(int i, char tag, const void *data, qsizetype size);
+    void clearBoundValues();
 
     template <typename T> bool bindTemporary(int i, const T &v);
     template <typename T, typename... Args> bool bindTemporary(int i, const T &v, const Args &...args);
 
     void resetInternalError();
     void setInternalError(int code, const char *explicitMessag=nullptr);
+    // Step with a progress handler checking m_deadline installed
+    bool stepWithDeadline();
+    // Writes the current row with the given format
+    void exportRow(Helper::ExportWriter &writer, ExportFormat format, const QVector<QByteArray> &names, qint64 row);
+    static int progressDeadline(void *query);
     Db *m_db;
     sqlite3_stmt *m_stmt;
+    // Values read by readValues instead of the columns of m_stmt
+    sqlite3_value **m_values;
+    int m_valueCount;
     int m_error;
     QString m_errorMsg;
     bool m_keepErrorMsg;
+    bool m_hasDeadline;
+    bool m_deadlineExpired;
+    std::chrono::steady_clock::time_point m_deadline;
+    // Index of every named parameter, filled by the first call to parameterIndex after prepare
+    QHash<QByteArray, int> m_parameterIndexes;
+    bool m_parameterIndexesBuilt;
+    // Index of every column name, filled by the first call to columnIndex after prepare or after the statement was reprepared
+    QHash<QByteArray, int> m_columnIndexes;
+    // Number of times the statement was reprepared when m_columnIndexes was filled, -1 if not filled
+    int m_columnIndexesReprepare;
+    // Changed by every prepare and finalize, unique among all the queries: identifies the statement for caches outside the query (e.g. RowBuffer)
+    quint64 m_prepareGeneration;
+    // Arena receiving TextView and BlobView values while fetchAll runs
+    ResultArena *m_arena;
+    // Values moved into the query by rvalue binds, one per parameter, kept until the bindings are cleared or the statement is finalized
+    struct OwnedBinding
+    {
+      QByteArray blob;
+      QString text;
+    };
+    QVector<OwnedBinding> m_ownedBindings;
+    // Bound values in binary form, one per parameter, recorded only for the queries of ResultCache that use them as keys
+    QScopedPointer<QVector<QByteArray>> m_boundValues;
+    // Pool of Interned<QString> values: m_ownInternPool unless set by setInternPool
+    InternPool *m_internPool;
+    QScopedPointer<InternPool> m_ownInternPool;
   };
 }
 
 
-struct sqlite3;
-
 namespace HFSQtLi
 {
-  /// \cond INTERNAL
-  namespace Helper
-  {
-    class BlobData;
-  }
-  /// \endcond INTERNAL
-
-  class Query;
+  class Db;
   /**
-   * @brief Class that gives access to a SQLite connection (struct sqlite3).
+   * @brief Histogram with power of two buckets.
    *
-   * No public constructor is available, instance of the class must be created via Db::open.
+   * Bucket 0 counts the value 0, bucket i (i>0) counts values in [2^(i-1), 2^i - 1].
    */
-  class Db
+  class Histogram
   {
-    friend class Query;
-    friend class Helper::BlobData;
   public:
+    /// @brief Number of buckets
+    static constexpr int Buckets=64;
+    constexpr Histogram(): m_buckets{}, m_count(0), m_sum(0), m_max(0) { }
+    /// @brief Adds a sample
+    void add(quint64 value);
+    /// @brief Removes all samples
+    void reset() { *this=Histogram(); }
+    /// @brief Number of samples
+    constexpr quint64 count() const { return m_count; }
+    /// @brief Sum of all samples
+    constexpr quint64 sum() const { return m_sum; }
+    /// @brief Biggest sample
+    constexpr quint64 max() const { return m_max; }
+    /// @brief Average of samples (NaN if no sample was added)
+    double mean() const;
+    /// @brief Number of samples in bucket i
+    constexpr quint64 bucket(int i) const { return (i>=0 && i<Buckets)?m_buckets[i]:0; }
+    /// @brief Smallest value counted by bucket i
+    static constexpr quint64 bucketLowerBound(int i) { return i<=0?0:(quint64(1)<<(i-1)); }
+    /// @brief Biggest value counted by bucket i
+    static constexpr quint64 bucketUpperBound(int i) { return i<=0?0:(i>=Buckets?std::numeric_limits<quint64>::max():(quint64(1)<<i)-1); }
     /**
-     * @brief open Opens a database
-     * @param filename Path to filename to open
-     * @param An or between flags QIODevice::ReadWrite for a read/write database and QIODevice::Append to open only an existing database
-     * @param errorMsg Pointer to a string that will be filled with error message in case of error
-     * @param zVfs Virtual file system to open (See SQLite documentation)
-     * @return A pointer to the opened database in case of success
+     * @brief Estimates a percentile
+     * @param p Percentile in the range [0, 1]
+     * @return The upper bound of the bucket containing the percentile, capped to max()
      */
-    static Db *open(const QString &filename,
+    quint64 percentile(double p) const;
+  protected:
+    quint64 m_buckets[Buckets];
+    quint64 m_count;
+    quint64 m_sum;
+    quint64 m_max;
+  };
+
+  /**
+   * @brief Retry policy used by Db::runWrite
+   */
+  struct WritePolicy
+  {
+    /// @brief Maximum number of times the whole transaction is run again after failing with SQLITE_BUSY or SQLITE_LOCKED
+    int maxRetries=10;
+    /// @brief First backoff delay in microseconds. The delay doubles on every retry.
+    int initialBackoff=100;
+    /// @brief Maximum backoff delay in microseconds
+    int maxBackoff=100000;
+    /// @brief Maximum time in milliseconds spent waiting for a single lock in the busy handler before giving up
+    int busyTimeout=5000;
+  };
+
+  /**
+   * @brief Statistics collected by Db::runWrite. Each call of runWrite adds one sample to every histogram.
+   */
+  struct WriteStats
+  {
+    /// @brief Time spent waiting for locks (busy handler and backoff between retries) in microseconds
+    Histogram waitTime;
+    /// @brief Number of retries (busy handler invocations plus transaction retries)
+    Histogram retries;
+    /// @brief Number of runWrite calls that failed
+    quint64 failures=0;
+    /// @brief Clears all statistics
+    void reset() { waitTime.reset(); retries.reset(); failures=0; }
+  };
+
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    // Calls a runWrite function that may take a Db & or no parameter, and may return void (always successful) or a value convertible to bool
+    template <typename F> bool callWrite(Db &db, F &&function)
+    {
+      if constexpr(std::is_invocable_v<F, Db &>)
+      {
+        if constexpr(std::is_void_v<std::invoke_result_t<F, Db &>>)
+        {
+          std::forward<F>(function)(db);
+          return true;
+        }
+        else
+          return static_cast<bool>(std::forward<F>(function)(db));
+      }
+      else
+      {
+        Q_UNUSED(db);
+        if constexpr(std::is_void_v<std::invoke_result_t<F>>)
+        {
+          std::forward<F>(function)();
+          return true;
+        }
+        else
+          return static_cast<bool>(std::forward<F>(function)());
+      }
+    }
+  }
+  /// \endcond INTERNAL
+}
+
+struct sqlite3;
+struct sqlite3_context;
+struct sqlite3_value;
+struct sqlite3_changeset_iter;
+
+namespace HFSQtLi
+{
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    class BlobData;
+    class TableSource;
+  }
+  /// \endcond INTERNAL
+
+  class Query;
+  class Backup;
+  class Checkpointer;
+  class ChangeNotifier;
+  class ResultCache;
+  class ChangesetConflict;
+  /**
+   * @brief Class that gives access to a SQLite connection (struct sqlite3).
+   *
+   * No public constructor is available, instance of the class must be created via Db::open.
+   */
+  class Db
+  {
+    friend class Query;
+    friend class Backup;
+    friend class Checkpointer;
+    friend class ChangeNotifier;
+    friend class ResultCache;
+    friend class Helper::BlobData;
+  public:
+    /**
+     * @brief open Opens a database
+     * @param filename Path to filename to open
+     * @param An or between flags QIODevice::ReadWrite for a read/write database (QIODevice::ReadOnly for a read only one) and QIODevice::Append to open only an existing database
+     * @param errorMsg Pointer to a string that will be filled with error message in case of error
+     * @param zVfs Virtual file system to open (See SQLite documentation)
+     * @return A pointer to the opened database in case of success
+     */
+    static Db *open(const QString &filename,
                     QIODevice::OpenMode flags=QIODevice::ReadWrite, QString *errorMsg=nullptr,
                     const char *zVfs=nullptr);
     virtual ~Db();
@@ -1007,6 +1992,23 @@ namespace HFSQtLi
      */
     int error() const;
     QString errorMsg() const;
+    /**
+     * @brief Interrupts any query currently running on this connection (see sqlite3_interrupt).
+     *
+     * This function is thread safe: it is meant to be called from another thread to stop a long running step, which will fail with SQLiteCode::INTERRUPT.
+     * For a per-query time limit see \ref Query::setDeadline.
+     */
+    void cancel();
+    /**
+     * @brief Sets the progress handler of this connection (see sqlite3_progress_handler).
+     *
+     * Use it instead of sqlite3_progress_handler: a step of a query with a deadline installs its own handler, which also calls this one
+     * (every 1000 virtual machine instructions or less), and restores it when the step is done. A handler returning non zero interrupts the query.
+     * @param instructions Approximate number of virtual machine instructions between calls
+     * @param handler The callback, nullptr to remove it
+     * @param userData Argument passed to the callback
+     */
+    void setProgressHandler(int instructions, int (*handler)(void *), void *userData=nullptr);
     /**
      * @brief query Creates a new query
      * @param queryStr Query string
@@ -1055,6 +2057,254 @@ namespace HFSQtLi
     template <int I, typename... Args> int executeSingleAll(QString *error, const QString &query, Args &&... args);
     /// @}
 
+    /// @name Cached query execution
+    /// The following functions work like \ref executeSingleAll but answer from the \ref ResultCache when the same query was already run with the same bound values
+    /// and none of the tables it reads changed since. Without a cache (see \ref resultCache) they are the same as executeSingleAll.
+    ///
+    /// Fetched values can be of the types supported by the arguments of \ref registerFunction (integer types, double, float, QString, QByteArray, \ref Value, std::optional of them).
+    /// \code
+    /// db->resultCache()->setMemoryBudget(4*1024*1024);
+    /// double average;
+    /// db->executeCached<1>("SELECT AVG(value) FROM measures WHERE sensor=$1", sensorId, average);
+    /// \endcode
+    /// @{
+
+    /// @brief Executes a query returning one row, using the result cache
+    /// @param query A string containing the query to execute
+    /// @param args First I arguments are the values to bind, the ones after that are references to data to retrieve
+    /// @return 0 on error, 1+number of fetched columns on success
+    template <int I, typename... Args> int executeCached(const QString &query, Args &&... args) { return executeCached<I>(nullptr, query, std::forward<Args>(args)...); }
+    /// @copydoc executeCached(const QString &, Args &&...)
+    template <typename... Args> int executeCached(const QString &query, Args &&... args) { return executeCached<0>(nullptr, query, std::forward<Args>(args)...); }
+    /// @copydoc executeCached(const QString &, Args &&...)
+    /// @param error An optional pointer to a string to fill with the error message.
+    template <int I, typename... Args> int executeCached(QString *error, const QString &query, Args &&... args);
+    /**
+     * @brief Gets the result cache of this connection, enabling it. See \ref ResultCache.
+     *
+     * The cache is created on the first call and is owned by the database. It uses the hooks installed by \ref changes().
+     * @return The cache or nullptr if the database is not open
+     */
+    ResultCache *resultCache();
+    /// @}
+
+    /// @name Write transactions
+    /// @{
+    /**
+     * @brief Runs a function inside a BEGIN IMMEDIATE transaction, retrying on lock contention.
+     *
+     * The function can take a Db & or no parameter and can return void (always commit) or a value convertible to bool (true to commit, false to rollback).
+     * A function returning false is run again only if the last error of the connection is SQLITE_BUSY or SQLITE_LOCKED, i.e. one of its statements failed on a lock.
+     * While waiting for a lock a busy handler sleeps with a jittered exponential backoff (see \ref WritePolicy). If the transaction still fails with SQLITE_BUSY
+     * or SQLITE_LOCKED (e.g. the lock could not be obtained or the commit failed) it is rolled back and the whole function is run again, up to WritePolicy::maxRetries times.
+     * For this reason the function must not have side effects outside of the database.
+     *
+     * Time spent waiting and number of retries of every call are collected in \ref writeStats().
+     * \note The busy handler replaces any busy handler or busy timeout set on the connection while the function runs. When it returns the busy timeout
+     * (sqlite3_busy_timeout or PRAGMA busy_timeout) is restored, while a custom busy handler is removed.
+     * \code
+     * db->runWrite([&](Db &db){ return db.execute("UPDATE counters SET value=value+1 WHERE id=$1", id); });
+     * \endcode
+     * @param function Function to run
+     * @param errorMsg Optional pointer to a string that will be filled with the error message on failure
+     * @return True if the transaction was committed
+     */
+    template <typename F> bool runWrite(F &&function, QString *errorMsg=nullptr);
+    /// @brief Gets the retry policy of runWrite
+    const WritePolicy &writePolicy() const { return m_writePolicy; }
+    /// @brief Sets the retry policy of runWrite
+    void setWritePolicy(const WritePolicy &policy) { m_writePolicy=policy; }
+    /// @brief Statistics collected by runWrite
+    const WriteStats &writeStats() const { return m_writeStats; }
+    /// @brief Clears the statistics collected by runWrite
+    void resetWriteStats() { m_writeStats.reset(); }
+    /// @}
+
+    /// @name User defined functions
+    /// @{
+    /// @brief Flags of user defined functions, can be combined with |
+    enum FunctionFlag: int
+    {
+      /// @brief No flag
+      FunctionDefault=0,
+      /// @brief The function always returns the same result for the same arguments (SQLITE_DETERMINISTIC). Required to use it in indexes and CHECK constraints.
+      FunctionDeterministic=1,
+      /// @brief The function can be invoked only from top-level SQL, not from views, triggers or schema (SQLITE_DIRECTONLY)
+      FunctionDirectOnly=2,
+      /// @brief The function has no side effects and can safely be used from untrusted schema (SQLITE_INNOCUOUS)
+      FunctionInnocuous=4
+    };
+    /**
+     * @brief Registers a lambda, functor or function pointer as a scalar SQL function.
+     *
+     * Number and types of the arguments, as well as the result type, are deduced at compile time from the signature of the function.
+     * Arguments are converted from SQLite values like the non-strict fetches of \ref Query::step and \ref Query::executeSingle: integer types, bool, double, float, QString, QByteArray and \ref Value are supported,
+     * std::optional of any of them receives std::nullopt for NULL. The result can be any of the integer types, double, float, QString, const char *, QByteArray, \ref Null, std::optional of them,
+     * or void (the SQL function returns NULL).
+     *
+     * The function is copied (or moved) and destroyed when it is replaced or the database is closed.
+     * \code
+     * db->registerFunction("distance", [](double x, double y){ return std::sqrt(x*x+y*y); }, Db::FunctionDeterministic);
+     * db->executeSingleAll("SELECT distance(3, 4)", result);
+     * \endcode
+     * @param name Name of the SQL function
+     * @param function Function to call
+     * @param flags Combination of \ref FunctionFlag
+     * @return True on success
+     */
+    template <typename F> bool registerFunction(const char *name, F &&function, int flags=FunctionDefault);
+    /**
+     * @brief Registers an aggregate or window function whose state is an instance of State.
+     *
+     * State must be default constructible and provide:
+     * - step(args...): adds a row to the aggregate. Arguments are deduced and converted like in \ref registerFunction.
+     * - value(): returns the current result, with any of the result types supported by \ref registerFunction.
+     * - inverse(args...) (optional): removes a row previously added by step. When present the function can be used as an aggregate window function
+     *   (see sqlite3_create_window_function), otherwise it is a plain aggregate.
+     *
+     * A State is constructed in place in the memory SQLite reserves for each group (sqlite3_aggregate_context) at the first step and destroyed when the group is finalized.
+     * If the group contains no row, value() of a default constructed State is returned.
+     * \code
+     * struct SumSquares
+     * {
+     *   qint64 sum=0;
+     *   void step(qint64 v) { sum+=v*v; }
+     *   void inverse(qint64 v) { sum-=v*v; }
+     *   qint64 value() const { return sum; }
+     * };
+     * db->registerAggregate<SumSquares>("sumSquares");
+     * db->execute("SELECT sumSquares(x) OVER (ORDER BY id ROWS 10 PRECEDING) FROM points");
+     * \endcode
+     * @param name Name of the SQL function
+     * @param flags Combination of \ref FunctionFlag
+     * @return True on success
+     */
+    template <typename State> bool registerAggregate(const char *name, int flags=FunctionDefault);
+    /// @}
+
+    /// @name Virtual tables
+    /// @{
+    /**
+     * @brief Exposes a container as a read-only eponymous virtual table, so it can be queried and joined without copying it into the database.
+     *
+     * Columns are the values bound by the customBind (or customBindConst) function of T (See \ref bindcustomtypes), or its mapped fields (See \ref Mapping), in the same order.
+     * The number of columns is determined by binding a default constructed T. The rowid of each row is its index in the container:
+     * constraints on rowid (=, <, <=, >, >=) restrict the scan to the matching range, all other constraints are evaluated by SQLite on every row.
+     *
+     * The container is not copied: it must outlive the database connection (or the table must be replaced by exposing another container with the same name)
+     * and must not be modified while a statement reading it is running. Changes made between statements are visible to the following ones.
+     * For this reason temporaries are rejected at compile time.
+     * \code
+     * struct Sensor { qint64 id; QString name; double reading; };
+     * void customBindConst(CustomBind &bind, const Sensor &s) { bind.bind(s.id, s.name, s.reading); }
+     * ...
+     * QVector<Sensor> sensors=...;
+     * db->exposeTable("sensors", sensors, {"id", "name", "reading"});
+     * db->execute("INSERT INTO history SELECT id, reading FROM sensors WHERE reading>100");
+     * \endcode
+     * @param name Name of the table
+     * @param data Container to expose
+     * @param columnNames Names of the columns. Missing names default to c1, c2, ..., or to the names of the fields for a struct mapped with HFSQTLI_MAP (see \ref Mapping).
+     * @return True on success
+     */
+    template <typename T> bool exposeTable(const char *name, const QVector<T> &data, const QStringList &columnNames=QStringList());
+    /// @brief The container is not copied, so exposing a temporary would leave the table reading a destroyed container
+    template <typename T> bool exposeTable(const char *name, QVector<T> &&data, const QStringList &columnNames=QStringList())=delete;
+    /// @}
+
+    /// @name Online backup
+    /// @{
+    /**
+     * @brief Creates an online backup of this database into another connection. See \ref Backup.
+     *
+     * The backup is returned not started: connect to its signals and call Backup::start() to run it in a background thread.
+     * The caller takes ownership of the returned object, which must be destroyed before both databases.
+     * @param destination Database that will receive the copy
+     * @param pagesPerStep Number of pages copied on each step (-1 to copy everything in one step)
+     * @param sleepBetweenSteps Milliseconds to sleep between two steps, giving writers on the source a chance to run
+     * @param sourceName Name of the source database (e.g. "main", "temp" or an attached database)
+     * @param destinationName Name of the destination database
+     * @return The backup object or nullptr if destination is null
+     */
+    Backup *backupTo(Db *destination, int pagesPerStep=100, int sleepBetweenSteps=10, const char *sourceName="main", const char *destinationName="main");
+    /**
+     * @brief Creates an online backup of this database into a file. The file is created if needed and overwritten.
+     * @copydetails backupTo(Db *, int, int, const char *, const char *)
+     * @param filename Path of the file to write the backup to
+     * @param errorMsg Pointer to a string that will be filled with error message in case the file could not be opened
+     */
+    Backup *backupTo(const QString &filename, int pagesPerStep=100, int sleepBetweenSteps=10, QString *errorMsg=nullptr);
+    /// @}
+
+    /**
+     * @brief Creates a scheduler performing WAL checkpoints of this database on a background connection. See \ref Checkpointer.
+     *
+     * The database must be a file database in WAL mode (PRAGMA journal_mode=WAL). The scheduler is returned not started, call Checkpointer::start() to run it.
+     * The caller takes ownership of the returned object, which must be destroyed before the database.
+     * @param interval Milliseconds between two checkpoints
+     * @param walSizeLimit Size in bytes of the WAL file over which the checkpoint is escalated (0 to never escalate)
+     * @param busyTimeout Busy timeout in milliseconds of the background connection, used by escalated checkpoints to wait for readers and writers
+     * @param errorMsg Pointer to a string that will be filled with error message in case the background connection could not be opened
+     * @return The scheduler or nullptr on error
+     */
+    Checkpointer *checkpointer(int interval=1000, qint64 walSizeLimit=64*1024*1024, int busyTimeout=1000, QString *errorMsg=nullptr);
+
+    /**
+     * @brief Gets the notifier of the changes committed on this connection. See \ref ChangeNotifier.
+     *
+     * The notifier is created (installing the update, commit and rollback hooks) on the first call and is owned by the database.
+     * It lives in the thread calling this function for the first time, which needs an event loop to receive the notifications.
+     * @return The notifier or nullptr if the database is not open
+     */
+    ChangeNotifier *changes();
+
+    /// @name Sessions and changesets
+    /// Changesets are recorded by a \ref Session and can be shipped to another database with the same schema to replicate the changes.
+    /// All the functions in this group require SQLite compiled with SQLITE_ENABLE_SESSION and SQLITE_ENABLE_PREUPDATE_HOOK, otherwise they fail with SQLITE_MISUSE.
+    /// @{
+    class Session;
+    /// @brief Action taken by applyChangeset on a conflict
+    enum class ConflictAction: int
+    {
+      /// @brief Skips the change (SQLITE_CHANGESET_OMIT)
+      Omit,
+      /// @brief Overwrites the conflicting row with the change (SQLITE_CHANGESET_REPLACE). Allowed only for ChangesetConflict::Type::Data and Conflict.
+      Replace,
+      /// @brief Stops and rolls back all the changes applied (SQLITE_CHANGESET_ABORT)
+      Abort
+    };
+    /**
+     * @brief Applies a changeset or patchset to this database, in a single transaction (or savepoint, if a transaction is already open).
+     * \code
+     * db->applyChangeset(changes, [](const ChangesetConflict &conflict){
+     *   return conflict.type()==ChangesetConflict::Type::Data?Db::ConflictAction::Replace:Db::ConflictAction::Omit;
+     * });
+     * \endcode
+     * @param changeset Changeset or patchset to apply
+     * @param onConflict Function called for every conflict, returning the action to take. If empty any conflict aborts.
+     * @param errorMsg Optional pointer to a string that will be filled with the error message on failure
+     * @return True if the changeset was applied, false if it was aborted or an error occurred (no change is applied in this case)
+     */
+    bool applyChangeset(const QByteArray &changeset, const std::function<ConflictAction(const ChangesetConflict &)> &onConflict=nullptr, QString *errorMsg=nullptr);
+    /**
+     * @brief Concatenates two changesets (or two patchsets) into one, merging the changes made to the same rows. Applying the result is the same as applying first and then second.
+     * @param first First changeset
+     * @param second Changeset following first
+     * @param result Filled with the concatenated changeset
+     * @param errorMsg Optional pointer to a string that will be filled with the error message on failure
+     * @return True on success
+     */
+    static bool concatChangesets(const QByteArray &first, const QByteArray &second, QByteArray &result, QString *errorMsg=nullptr);
+    /**
+     * @brief Inverts a changeset: applying the result undoes the changes. Patchsets can't be inverted.
+     * @param changeset Changeset to invert
+     * @param result Filled with the inverted changeset
+     * @param errorMsg Optional pointer to a string that will be filled with the error message on failure
+     * @return True on success
+     */
+    static bool invertChangeset(const QByteArray &changeset, QByteArray &result, QString *errorMsg=nullptr);
+    /// @}
+
     /// \cond INTERNAL
     constexpr sqlite3 *internalDb() { return m_db; }
     class Lock
@@ -1084,95 +2334,658 @@ namespace HFSQtLi
     /// \endcond INTERNAL
   protected:
     Db(const QString &filename, QIODevice::OpenMode flags=QIODevice::ReadWrite, const char *zVfs=NULL);
+    // Registers a scalar function with sqlite3_create_function_v2. On failure destroy is called on data.
+    bool createFunction(const char *name, int argc, int flags, void *data, void (*function)(sqlite3_context *, int, sqlite3_value **), void (*destroy)(void *));
+    // Registers an aggregate (inverse and value null) or window function with sqlite3_create_window_function
+    bool createAggregate(const char *name, int argc, int flags, void (*step)(sqlite3_context *, int, sqlite3_value **), void (*final)(sqlite3_context *),
+                         void (*value)(sqlite3_context *), void (*inverse)(sqlite3_context *, int, sqlite3_value **));
+    static int functionFlags(int flags);
+    // Registers an eponymous virtual table reading from source. On failure source is deleted.
+    bool createTableModule(const char *name, Helper::TableSource *source);
+    // Conflict handler of sqlite3changeset_apply, context is the function passed to applyChangeset
+    static int changesetConflict(void *context, int type, sqlite3_changeset_iter *iterator);
+    // Helpers for runWrite
+    void writeStart();
+    int writeBegin(QString *errorMsg);
+    int writeCommit();
+    int writeAbortCode();
+    void writeRollback(int code, QString *errorMsg);
+    bool writeBackoff(int code, int attempt);
+    void writeFinish(bool success);
+    static int writeBusyHandler(void *db, int count);
+    qint64 writeDelay(int count);
     sqlite3 *m_db;
     std::atomic_int m_queryCount;
     // Note: these variables are used only when open fails (m_db is null)
     int m_openError;
     QString m_openErrorMsg;
+    WritePolicy m_writePolicy;
+    WriteStats m_writeStats;
+    ChangeNotifier *m_changes;
+    ResultCache *m_resultCache;
+    // State of the current runWrite call
+    QElapsedTimer m_writeBusyTimer;
+    qint64 m_writeWaited;
+    int m_writeRetries;
+    int m_writeSavedTimeout;
+    // Progress handler set with setProgressHandler
+    int m_progressInstructions;
+    int (*m_progressHandler)(void *);
+    void *m_progressData;
   };
 
 }
 
 
+
+struct sqlite3_context;
+struct sqlite3_value;
+
 namespace HFSQtLi
 {
-  template <typename... Args> inline int Db::execute(QString *message, const QString &query, Args &&... args)
+  /// \cond INTERNAL
+  namespace Helper
   {
-    int ret=0;
-    Query qry(this, message /*storeErrorMessage */);
-    if( !qry.prepare(query, false) || !(ret=qry.executeCommand(std::forward<Args>(args)...)))
+    // Non-template access to sqlite3_context, used by user defined functions
+    void *contextUserData(sqlite3_context *context);
+    void *aggregateContext(sqlite3_context *context, int bytes);
+    void resultNull(sqlite3_context *context);
+    void resultInt64(sqlite3_context *context, qint64 value);
+    void resultDouble(sqlite3_context *context, double value);
+    void resultText(sqlite3_context *context, const QString &value);
+    void resultText(sqlite3_context *context, const char *value);
+    void resultBlob(sqlite3_context *context, const QByteArray &value);
+    void resultError(sqlite3_context *context, const char *message);
+    void resultNoMemory(sqlite3_context *context);
+
+    // Decodes function arguments (and the rows of the result cache) with the non-strict Query::readColumn functions, so that custom types
+    // (customFetch, HFSQTLI_MAP) are read like columns. Returns false on error, filling errorMsg if not null. Defined in query_template.h
+    template <typename Tuple> bool readValues(sqlite3_value **values, int count, Tuple &&result, QString *errorMsg);
+
+    // Encoding of function results
+    template <typename T> inline std::enable_if_t<std::is_integral_v<T>> resultValue(sqlite3_context *context, T value) { resultInt64(context, static_cast<qint64>(value)); }
+    inline void resultValue(sqlite3_context *context, double value) { resultDouble(context, value); }
+    inline void resultValue(sqlite3_context *context, float value) { resultDouble(context, value); }
+    inline void resultValue(sqlite3_context *context, const QString &value) { resultText(context, value); }
+    inline void resultValue(sqlite3_context *context, const char *value) { resultText(context, value); }
+    inline void resultValue(sqlite3_context *context, const QByteArray &value) { resultBlob(context, value); }
+    inline void resultValue(sqlite3_context *context, std::nullptr_t) { resultNull(context); }
+    inline void resultValue(sqlite3_context *context, const Null &) { resultNull(context); }
+    template <typename T> inline void resultValue(sqlite3_context *context, const std::optional<T> &value)
     {
-      if(message)
-        *message=qry.errorMsg();
+      if(value)
+        resultValue(context, *value);
+      else
+        resultNull(context);
     }
-    return ret;
 
-  }
+    // Deduces result and argument types of a callable (lambda, functor or function pointer)
+    template <typename F> struct FunctionTraits: FunctionTraits<decltype(&F::operator())> { };
+    template <typename R, typename ...A> struct FunctionTraits<R (A...)>
+    {
+      typedef R Result;
+      typedef std::tuple<std::remove_const_t<std::remove_reference_t<A>>...> Args;
+      static constexpr int arity=sizeof...(A);
+    };
+    template <typename R, typename ...A> struct FunctionTraits<R (*)(A...)>: FunctionTraits<R (A...)> { };
+    template <typename R, typename C, typename ...A> struct FunctionTraits<R (C::*)(A...)>: FunctionTraits<R (A...)> { };
+    template <typename R, typename C, typename ...A> struct FunctionTraits<R (C::*)(A...) const>: FunctionTraits<R (A...)> { };
 
-  template <int I, typename... Args> int Db::executeSingleAll(QString *message, const QString &query, Args &&... args)
-  {
-    int ret=0;
-    Query qry(this, message /*storeErrorMessage */);
-    if( !qry.prepare(query, false) || !(ret=qry.executeSingle<I>(std::forward<Args>(args)...)))
+    // Holds a callable registered as a scalar SQL function
+    template <typename F> struct ScalarFunction
     {
-      if(message)
-        *message=qry.errorMsg();
+      typedef FunctionTraits<F> Traits;
+      F function;
+      static void call(sqlite3_context *context, int argc, sqlite3_value **argv)
+      {
+        Q_UNUSED(argc);
+        auto *self=static_cast<ScalarFunction *>(contextUserData(context));
+        typename Traits::Args args;
+        QString error;
+        if(!readValues(argv, Traits::arity, args, &error))
+        {
+          resultError(context, error.toUtf8().constData());
+          return;
+        }
+        if constexpr(std::is_void_v<typename Traits::Result>)
+        {
+          std::apply(self->function, args);
+          resultNull(context);
+        }
+        else
+          resultValue(context, std::apply(self->function, args));
+      }
+      static void destroy(void *function) { delete static_cast<ScalarFunction *>(function); }
+    };
+
+    // Calls a member function of an aggregate state with the arguments decoded from argv
+    template <typename S, typename M> inline void callState(sqlite3_context *context, S *state, M method, sqlite3_value **argv)
+    {
+      typedef FunctionTraits<M> Traits;
+      typename Traits::Args args;
+      QString error;
+      if(!readValues(argv, Traits::arity, args, &error))
+      {
+        resultError(context, error.toUtf8().constData());
+        return;
+      }
+      std::apply([state, method](auto &...values) { (state->*method)(values...); }, args);
     }
-    return ret;
+
+    template <typename S, typename=void> struct HasInverse: std::false_type { };
+    template <typename S> struct HasInverse<S, std::void_t<decltype(&S::inverse)>>: std::true_type { };
+
+    // Aggregate or window function whose state is an instance of S, constructed in place in the aggregate context
+    template <typename S> struct AggregateFunction
+    {
+      static_assert(std::is_default_constructible_v<S>, "Aggregate state must be default constructible");
+      static_assert(alignof(S)<=8, "Aggregate state alignment must not exceed 8 bytes");
+      typedef FunctionTraits<decltype(&S::step)> Traits;
+      static constexpr bool isWindow=HasInverse<S>::value;
+      // SQLite zeroes the aggregate context on allocation, so constructed is false until the first step
+      struct Storage
+      {
+        bool constructed;
+        alignas(S) unsigned char state[sizeof(S)];
+      };
+      static S *state(sqlite3_context *context, bool create)
+      {
+        auto *storage=static_cast<Storage *>(aggregateContext(context, create?int(sizeof(Storage)):0));
+        if(!storage || (!storage->constructed && !create))
+          return nullptr;
+        if(!storage->constructed)
+        {
+          new(storage->state) S();
+          storage->constructed=true;
+        }
+        return std::launder(reinterpret_cast<S *>(storage->state));
+      }
+      static void step(sqlite3_context *context, int, sqlite3_value **argv)
+      {
+        S *current=state(context, true);
+        if(current)
+          callState(context, current, &S::step, argv);
+        else
+          resultNoMemory(context);
+      }
+      static void inverse(sqlite3_context *context, int, sqlite3_value **argv)
+      {
+        S *current=state(context, true);
+        if(current)
+          callState(context, current, &S::inverse, argv);
+        else
+          resultNoMemory(context);
+      }
+      static void value(sqlite3_context *context)
+      {
+        S *current=state(context, false);
+        if(current)
+          resultValue(context, current->value());
+        else
+          resultValue(context, S().value()); // No row was aggregated
+      }
+      static void final(sqlite3_context *context)
+      {
+        value(context);
+        S *current=state(context, false);
+        if(current)
+          current->~S();
+      }
+    };
   }
+  /// \endcond INTERNAL
 }
+
 namespace HFSQtLi
 {
-  bool Query::isDbValid()
-  {
-    return m_db && m_db->m_db;
-  }
-
-  bool Query::fetchErrorString()
-  {
-    bool ret=SQLiteCode::isSuccess(m_error);
-    if(m_keepErrorMsg && !ret) forceFetchErrorString();
-    return ret;
-  }
-
-  template <typename T> int Query::bindSingle(bool, int i, T &&value )
+  /// \cond INTERNAL
+  namespace Helper
   {
-    CustomBind custom(this, i);
-    using Custom::customBind;
-    customBind(custom, std::forward<T>(value));
-    return custom.numBound()+1;
-  }
+    // Receives the values bound by a customBind function and returns the one of the requested column to SQLite
+    struct ColumnSink
+    {
+      sqlite3_context *context;
+      int column;
+      bool found;
+    };
 
-  template <typename T> int Query::readColumn(bool strict, int i, T &&value)
-  {
-    CustomFetch custom(this, strict, i);
-    using Custom::customFetch;
-    customFetch(custom, std::forward<T>(value));
-    return custom.numFetched()+1;
-  }
+    template <typename T, typename=void> struct IsResultType: std::false_type { };
+    template <typename T> struct IsResultType<T, std::void_t<decltype(resultValue(std::declval<sqlite3_context *>(), std::declval<const T &>()))>>: std::true_type { };
 
-  template <class T> inline int Query::readColumn(bool strict, int i, std::optional<T> &result)
-  {
-    int ret=2;
-    if(columnType(i)==Type::Null)
-      result.reset();
-    else
+    // Same semantic of Query::bindSingle: returns 1+number of columns
+    template <typename ...T> int sinkColumns(ColumnSink *sink, int index, T &&...values)
     {
-      result.emplace();
-      ret=readColumn(strict, i, *result);
+      int count=0;
+      auto sinkColumn=[sink, index, &count](auto &&value)
+      {
+        typedef std::decay_t<decltype(value)> Type;
+        if(count<0)
+          return;
+        if constexpr(IsResultType<Type>::value)
+        {
+          if(index+count==sink->column)
+          {
+            resultValue(sink->context, value);
+            sink->found=true;
+          }
+          count++;
+        }
+        else if constexpr(IsMapped<Type>::value)
+        {
+          int sunk=std::apply([sink, index, count](const auto &...fields) { return sinkColumns(sink, index+count, fields...); }, hfsqtliMapFields(value));
+          count=sunk>0?count+sunk-1:-1;
+        }
+        else
+        {
+          CustomBind custom(sink, index+count);
+          using Custom::customBind;
+          customBind(custom, std::forward<decltype(value)>(value));
+          count=custom.numBound()>=0?count+custom.numBound():-1;
+        }
+      };
+      (sinkColumn(std::forward<T>(values)), ...);
+      return count+1;
     }
-    return ret;
-  }
 
-  template <typename... Args> int Query::columnHelper(bool strict, int i, Args &&...args)
-  {
-    int ret=0;
-    if(!m_stmt) setInternalError(SQLiteCode::MISUSE);
-    else
+    // Type erased content of a virtual table created by Db::exposeTable
+    class TableSource
     {
-      ret=readColumn(strict, i, std::tuple<Args...>(std::forward<Args>(args)...));
-    }
-    return ret;
+    public:
+      TableSource(int columns, const QStringList &names);
+      virtual ~TableSource();
+      virtual qint64 rowCount() const=0;
+      // Sets the result of context to the value of the given row and column
+      virtual void column(sqlite3_context *context, qint64 row, int column) const=0;
+      int columnCount() const { return m_columns; }
+      // CREATE TABLE statement passed to sqlite3_declare_vtab
+      QByteArray schema() const;
+      static void destroy(void *source);
+    protected:
+      int m_columns;
+      QStringList m_names;
+    };
+
+    template <typename T> class ContainerSource: public TableSource
+    {
+    public:
+      ContainerSource(const QVector<T> *data, const QStringList &names): TableSource(countColumns(), names), m_data(data) { }
+      qint64 rowCount() const override { return m_data->size(); }
+      void column(sqlite3_context *context, qint64 row, int column) const override
+      {
+        ColumnSink sink{context, column, false};
+        sinkColumns(&sink, 0, m_data->at(row));
+        if(!sink.found)
+          resultNull(context);
+      }
+    protected:
+      static int countColumns()
+      {
+        ColumnSink sink{nullptr, -1, false};
+        return sinkColumns(&sink, 0, T())-1;
+      }
+      const QVector<T> *m_data;
+    };
+  }
+  /// \endcond INTERNAL
+}
+
+struct sqlite3_value;
+
+namespace HFSQtLi
+{
+  class Db;
+  class Query;
+  class ChangeNotifier;
+  /**
+   * @brief Cache of the results of single row read queries, see Db::executeCached.
+   *
+   * Entries are keyed by the SQL text and the bound values in binary form, and store a copy of the values of the row.
+   * While a statement is prepared an authorizer records the tables it reads (views and subqueries included): an entry is valid as long as none of these tables changed.
+   * - Changes made through this connection are tracked with the update hook, which bumps a version number of the table. Changes rolled back bump it again.
+   * - Changes made by other connections or processes are detected with PRAGMA data_version before every lookup, and clear the whole cache.
+   * - Schema changes (e.g. a table dropped and created again) are detected with PRAGMA schema_version before every lookup, and clear the whole cache.
+   * - ROLLBACK TO a savepoint calls no hook: rows read from a table after the running transaction changed it are returned but not cached.
+   *
+   * To make DELETE without WHERE visible to the update hook the authorizer disables the truncate optimization while the cache exists, so these deletes are done row by row.
+   * Changes to WITHOUT ROWID tables and to virtual tables are not tracked: call invalidate() after changing them.
+   * Queries using non deterministic functions (random(), date('now'), ...) should not be cached.
+   * Entries are evicted in LRU order when their total size exceeds memoryBudget().
+   *
+   * The cache is created by Db::resultCache() and owned by the database. It installs its own authorizer on the connection, replacing any authorizer set
+   * with sqlite3_set_authorizer: install authorizers with setAuthorizer() instead, the cache calls them first.
+   */
+  class ResultCache
+  {
+    friend class Db;
+    friend class ChangeNotifier;
+  public:
+    ~ResultCache();
+    /// @brief Maximum size in bytes of the cached rows
+    qint64 memoryBudget() const { return m_entries.maxCost(); }
+    /// @brief Sets the maximum size in bytes of the cached rows (default 16 MiB). Least recently used entries are evicted to fit.
+    void setMemoryBudget(qint64 bytes) { m_entries.setMaxCost(qMax<qint64>(bytes, 0)); }
+    /// @brief Approximate size in bytes of the cached rows
+    qint64 memoryUsed() const { return m_entries.totalCost(); }
+    /// @brief Number of cached rows
+    int size() const { return int(m_entries.size()); }
+    /// @brief Removes all entries
+    void clear();
+    /// @brief Invalidates the entries reading a table. Needed only for changes not seen by the update hook (see \ref ResultCache).
+    void invalidate(const QString &table);
+    /// @brief Authorizer callback, with the arguments of the sqlite3_set_authorizer callback
+    typedef int (*Authorizer)(void *userData, int action, const char *arg1, const char *arg2, const char *database, const char *trigger);
+    /**
+     * @brief Sets an authorizer called by the authorizer of the cache, in place of sqlite3_set_authorizer (see \ref ResultCache)
+     * @param authorizer The callback, nullptr to remove it. Actions it denies or ignores are not tracked by the cache.
+     * @param userData First argument passed to the callback
+     */
+    void setAuthorizer(Authorizer authorizer, void *userData=nullptr);
+
+    /// @name Metrics
+    /// @{
+    /// @brief Number of lookups answered from the cache
+    quint64 hits() const { return m_hits; }
+    /// @brief Number of lookups that executed the query
+    quint64 misses() const { return m_misses; }
+    /// @brief Number of entries found stale because a table they read changed
+    quint64 invalidations() const { return m_invalidations; }
+    /// @brief Fraction of lookups answered from the cache (0 if there was no lookup)
+    double hitRatio() const { return m_hits+m_misses?double(m_hits)/double(m_hits+m_misses):0; }
+    /// @brief Clears the metrics
+    void resetStats() { m_hits=m_misses=m_invalidations=0; }
+    /// @}
+  protected:
+    struct Entry
+    {
+      ~Entry();
+      QVector<sqlite3_value *> values;
+      // Version of every table read when the query was executed
+      QVector<QPair<int, quint64>> versions;
+    };
+    struct Statement
+    {
+      Query *query;
+      QVector<int> tables;
+    };
+    explicit ResultCache(Db *db);
+    // Gets the prepared statement of sql, preparing it if needed. Returns null on error.
+    Statement *statement(const QString &sql, QString *errorMsg);
+    // Returns the values of the row of the bound statement, from the cache or executing it. Returns null on error.
+    sqlite3_value **fetch(Statement *statement, int columns);
+    int tableIndex(const char *table);
+    bool checkDataVersion();
+    // Called by the hooks installed by ChangeNotifier, which confirm commits
+    void tableChanged(const char *table);
+    // Called when the running transaction is rolled back or its commit is done
+    void transactionEnd(bool committed);
+    bool hasDirtyTables() const { return !m_dirty.isEmpty(); }
+    static int authorizer(void *cache, int action, const char *arg1, const char *arg2, const char *database, const char *trigger);
+    Db *m_db;
+    QCache<QByteArray, Entry> m_entries;
+    // Entry bigger than the budget, kept only until next fetch
+    QScopedPointer<Entry> m_uncached;
+    QHash<QString, Statement> m_statements;
+    Query *m_dataVersionQuery;
+    qint64 m_dataVersion;
+    Query *m_schemaVersionQuery;
+    qint64 m_schemaVersion;
+    QHash<QByteArray, int> m_tableIndexes;
+    QVector<quint64> m_versions;
+    // Tables changed by the running transaction
+    QSet<int> m_dirty;
+    // Tables read by the statement being prepared
+    QVector<int> *m_recording;
+    // Table or view named by the DROP statement being prepared
+    QByteArray m_dropping;
+    // Authorizer set with setAuthorizer
+    Authorizer m_userAuthorizer;
+    void *m_userAuthorizerData;
+    quint64 m_hits;
+    quint64 m_misses;
+    quint64 m_invalidations;
+  };
+}
+namespace HFSQtLi
+{
+  template <typename... Args> inline int Db::execute(QString *message, const QString &query, Args &&... args)
+  {
+    int ret=0;
+    Query qry(this, message /*storeErrorMessage */);
+    if( !qry.prepare(query, false) || !(ret=qry.executeCommand(std::forward<Args>(args)...)))
+    {
+      if(message)
+        *message=qry.errorMsg();
+    }
+    return ret;
+
+  }
+
+  template <int I, typename... Args> int Db::executeSingleAll(QString *message, const QString &query, Args &&... args)
+  {
+    int ret=0;
+    Query qry(this, message /*storeErrorMessage */);
+    if( !qry.prepare(query, false) || !(ret=qry.executeSingle<I>(std::forward<Args>(args)...)))
+    {
+      if(message)
+        *message=qry.errorMsg();
+    }
+    return ret;
+  }
+
+  template <int I, typename... Args> int Db::executeCached(QString *message, const QString &query, Args &&... args)
+  {
+    static_assert (I<=sizeof...(Args), "executeCached<I> number of bound parameters is greater than number of arguments");
+    if(!m_resultCache)
+      return executeSingleAll<I>(message, query, std::forward<Args>(args)...);
+    constexpr int fetched=int(sizeof...(Args))-I;
+    int ret=0;
+    // Statements, entries and table versions of the cache are shared by all the threads using the connection
+    Lock lock(this, true);
+    ResultCache::Statement *statement=m_resultCache->statement(query, message);
+    if(!statement)
+      return 0;
+    Query *qry=statement->query;
+    std::tuple<decltype(args)...> ref(std::forward<Args>(args)...);
+    auto toFetch=Helper::select(ref, Helper::make_int_sequence<I, fetched>());
+    if(qry->reset() && qry->bindTemporaryAll(Helper::select(ref, Helper::make_int_sequence<I>())))
+    {
+      if(sqlite3_value **values=m_resultCache->fetch(statement, fetched))
+      {
+        // Cached values are decoded like the columns of the query, custom types included
+        if(Helper::readValues(values, fetched, toFetch, message))
+          ret=fetched+1;
+        else
+          message=nullptr; // Already filled with the decoding error
+      }
+    }
+    if(!ret && message)
+      *message=qry->errorMsg();
+    qry->reset();
+    qry->clearBindings();
+    return ret;
+  }
+
+  template <typename F> bool Db::runWrite(F &&function, QString *errorMsg)
+  {
+    bool ret=false;
+    writeStart();
+    for(int attempt=0;;attempt++)
+    {
+      int code=writeBegin(errorMsg);
+      if(code==SQLiteCode::OK)
+      {
+        // A function returning false is retried only if one of its statements failed on a lock
+        code=Helper::callWrite(*this, function)?writeCommit():writeAbortCode();
+        if(code==SQLiteCode::OK)
+        {
+          ret=true;
+          break;
+        }
+        writeRollback(code, errorMsg);
+      }
+      if(!writeBackoff(code, attempt))
+        break;
+    }
+    writeFinish(ret);
+    if(ret && errorMsg)
+      errorMsg->clear();
+    return ret;
+  }
+
+  template <typename F> bool Db::registerFunction(const char *name, F &&function, int flags)
+  {
+    typedef Helper::ScalarFunction<std::decay_t<F>> Function;
+    return createFunction(name, Function::Traits::arity, flags, new Function{std::forward<F>(function)}, &Function::call, &Function::destroy);
+  }
+
+  template <typename State> bool Db::registerAggregate(const char *name, int flags)
+  {
+    typedef Helper::AggregateFunction<State> Function;
+    if constexpr(Function::isWindow)
+      return createAggregate(name, Function::Traits::arity, flags, &Function::step, &Function::final, &Function::value, &Function::inverse);
+    else
+      return createAggregate(name, Function::Traits::arity, flags, &Function::step, &Function::final, nullptr, nullptr);
+  }
+
+  template <typename T> bool Db::exposeTable(const char *name, const QVector<T> &data, const QStringList &columnNames)
+  {
+    if constexpr(Helper::IsMapped<T>::value)
+    {
+      if(columnNames.isEmpty())
+        return createTableModule(name, new Helper::ContainerSource<T>(&data, Mapping<T>::columns()));
+    }
+    return createTableModule(name, new Helper::ContainerSource<T>(&data, columnNames));
+  }
+}
+namespace HFSQtLi
+{
+  bool Query::isDbValid()
+  {
+    return m_db && m_db->m_db;
+  }
+
+  bool Query::fetchErrorString()
+  {
+    bool ret=SQLiteCode::isSuccess(m_error);
+    if(m_keepErrorMsg && !ret) forceFetchErrorString();
+    return ret;
+  }
+
+  template <typename T> int Query::bindSingle(bool temporary, int i, T &&value )
+  {
+    if constexpr(Helper::IsMapped<std::decay_t<T>>::value)
+      return bindMapped(temporary, i, value, Helper::make_int_sequence<Helper::mappedSize<std::decay_t<T>>()>());
+    else
+    {
+      CustomBind custom(this, i);
+      using Custom::customBind;
+      customBind(custom, std::forward<T>(value));
+      return custom.numBound()+1;
+    }
+  }
+
+  template <typename T, int ...I> int Query::bindMapped(bool temporary, int i, const T &value, Helper::int_sequence<I...>)
+  {
+    auto fields=hfsqtliMapFields(value);
+    bool ok=true;
+    (void)((ok=bindMappedField(temporary, i+I, std::get<I>(fields))) && ...);
+    return ok?int(sizeof...(I))+1:0;
+  }
+
+  template <typename F> bool Query::bindMappedField(bool temporary, int i, const F &value)
+  {
+    if constexpr(Helper::IsOptional<F>::value)
+      return value?bindMappedField(temporary, i, *value):bindSingle(temporary, i, nullptr)>0;
+    else if constexpr(std::is_integral<F>::value)
+      return bindSingle(temporary, i, qint64(value))>0;
+    else if constexpr(std::is_floating_point<F>::value)
+      return bindSingle(temporary, i, double(value))>0;
+    else
+      return bindSingle(temporary, i, value)>0;
+  }
+
+  inline int Query::bindSingle(bool temporary, int i, const CArray<int> &value) { return bindArray(temporary, i, value.data(), value.size(), ArrayType::Int32); }
+  inline int Query::bindSingle(bool temporary, int i, const CArray<qint64> &value) { return bindArray(temporary, i, value.data(), value.size(), ArrayType::Int64); }
+  inline int Query::bindSingle(bool temporary, int i, const CArray<double> &value) { return bindArray(temporary, i, value.data(), value.size(), ArrayType::Double); }
+  inline int Query::bindSingle(bool temporary, int i, const CArray<const char *> &value) { return bindArray(temporary, i, value.data(), value.size(), ArrayType::Text); }
+
+  template <typename T> int Query::readColumn(bool strict, int i, T &&value)
+  {
+    if constexpr(Helper::IsMapped<std::decay_t<T>>::value)
+      return readMapped(strict, i, value, Helper::make_int_sequence<Helper::mappedSize<std::decay_t<T>>()>());
+    else if constexpr(std::is_same<std::decay_t<T>, bool>::value)
+    {
+      qint64 read=0;
+      int ret=readColumnInt(strict, i, read);
+      value=read!=0;
+      return ret;
+    }
+    else if constexpr(std::is_integral<std::decay_t<T>>::value)
+      return readColumnInt(strict, i, value); // Integer types without an overload, e.g. long
+    else
+    {
+      CustomFetch custom(this, strict, i);
+      using Custom::customFetch;
+      customFetch(custom, std::forward<T>(value));
+      return custom.numFetched()+1;
+    }
+  }
+
+  template <typename T, int ...I> int Query::readMapped(bool strict, int i, T &value, Helper::int_sequence<I...>)
+  {
+    auto fields=hfsqtliMapFields(value);
+    bool ok=true;
+    (void)((ok=readMappedField(strict, i+I, std::get<I>(fields))) && ...);
+    return ok?int(sizeof...(I))+1:0;
+  }
+
+  template <typename F> bool Query::readMappedField(bool strict, int i, F &value)
+  {
+    if constexpr(Helper::IsOptional<F>::value)
+    {
+      if(columnType(i)==Type::Null)
+      {
+        value.reset();
+        return true;
+      }
+      value.emplace();
+      return readMappedField(strict, i, *value);
+    }
+    else if constexpr(std::is_same<F, bool>::value)
+    {
+      qint64 read=0;
+      bool ok=readColumnInt(strict, i, read)>0;
+      value=read!=0;
+      return ok;
+    }
+    else if constexpr(std::is_integral<F>::value)
+      return readColumnInt(strict, i, value)>0;
+    else
+      return readColumn(strict, i, value)>0;
+  }
+
+  template <class T> inline int Query::readColumn(bool strict, int i, std::optional<T> &result)
+  {
+    int ret=2;
+    if(columnType(i)==Type::Null)
+      result.reset();
+    else
+    {
+      result.emplace();
+      ret=readColumn(strict, i, *result);
+    }
+    return ret;
+  }
+
+  template <typename... Args> int Query::columnHelper(bool strict, int i, Args &&...args)
+  {
+    int ret=0;
+    if(!m_stmt) setInternalError(SQLiteCode::MISUSE);
+    else
+    {
+      ret=readColumn(strict, i, std::tuple<Args...>(std::forward<Args>(args)...));
+    }
+    return ret;
   }
 
   template <class T> inline int Query::readColumnInt(bool strict, int i, T &value)
@@ -1347,6 +3160,90 @@ namespace HFSQtLi
     return ret;
   }
 
+  template <typename T, int ...I> int Query::readByName(bool strict, T &value, Helper::int_sequence<I...>)
+  {
+    const QVector<QByteArray> &names=Mapping<T>::columnNames();
+    const int indexes[]={namedColumn(names[I])...};
+    for(int index: indexes)
+    {
+      if(index<0)
+        return 0;
+    }
+    auto fields=hfsqtliMapFields(value);
+    bool ok=true;
+    (void)((ok=readMappedField(strict, indexes[I], std::get<I>(fields))) && ...);
+    return ok?int(sizeof...(I))+1:0;
+  }
+
+  template <typename Container> int Query::fetchAll(ResultArena &arena, Container &rows)
+  {
+    typename Container::value_type row{};
+    ResultArena *previous=m_arena;
+    m_arena=&arena;
+    int count=0;
+    bool ok=true;
+    while(ok && stepNoFetch())
+    {
+      int fetched=readColumn(false, 0, row);
+      // Number of columns is checked on the first row only
+      if(fetched<=0 || (count==0 && assertFetchColumnCount(fetched-1)<0))
+        ok=false;
+      else
+      {
+        rows.push_back(row);
+        count++;
+      }
+    }
+    m_arena=previous;
+    return ok && isDone()?count+1:0;
+  }
+
+  template <typename Tuple> int Query::readValues(sqlite3_value **values, int count, Tuple &&result)
+  {
+    m_values=values;
+    m_valueCount=count;
+    int ret=readColumn(false, 0, std::forward<Tuple>(result));
+    m_values=nullptr;
+    m_valueCount=0;
+    return ret;
+  }
+
+  namespace Helper
+  {
+    template <typename Tuple> bool readValues(sqlite3_value **values, int count, Tuple &&result, QString *errorMsg)
+    {
+      Query reader(nullptr, errorMsg!=nullptr);
+      bool ret=reader.readValues(values, count, std::forward<Tuple>(result))>0;
+      if(!ret && errorMsg)
+        *errorMsg=reader.errorMsg();
+      return ret;
+    }
+  }
+
+  template <typename... Args> int Query::bindNamed(Args &&...args)
+  {
+    static_assert(sizeof...(Args)%2==0, "bindNamed requires pairs of names and values");
+    int count=0;
+    if constexpr(sizeof...(Args)>0)
+    {
+      if(!bindNamedHelper(count, std::forward<Args>(args)...))
+        return 0;
+    }
+    return count+1;
+  }
+
+  template <typename T, typename... Args> bool Query::bindNamedHelper(int &count, const char *name, T &&value, Args &&...args)
+  {
+    int bound=bind(name, std::forward<T>(value));
+    if(bound<=0)
+      return false;
+    count+=bound-1;
+    if constexpr(sizeof...(Args)>0)
+      return bindNamedHelper(count, std::forward<Args>(args)...);
+    else
+      return true;
+  }
+
   template <typename... Args> inline int Query::executeCommand(Args &&... args)
   {
     int ret=0;
@@ -1379,13 +3276,17 @@ namespace HFSQtLi
     {
       if(i<=0)
       {
-        m_query->setInternalError(SQLiteCode::MISUSE, "Custom bind with index <=0");
+        if(m_query)
+          m_query->setInternalError(SQLiteCode::MISUSE, "Custom bind with index <=0");
         m_bound=-1;
       }
       else
       {
         ret=0;
-        ret=m_query->bindSingle(false, m_base+i-1, std::tuple<decltype(value)...>(std::forward<T>(value)...));
+        if(m_sink)
+          ret=Helper::sinkColumns(m_sink, m_base+i-1, std::forward<T>(value)...);
+        else
+          ret=m_query->bindSingle(false, m_base+i-1, std::tuple<decltype(value)...>(std::forward<T>(value)...));
         if(ret)
           m_bound=qMax(m_bound, i+ret-2);
         else
@@ -1637,115 +3538,1502 @@ namespace HFSQtLi
      * @param offset Offset in the blob to write
      * @return True on success, false on error
      */
-    inline bool write(const QByteArray &data, qsizetype offset=0) { return write(data.data(), data.size(), offset); }
+    inline bool write(const QByteArray &data, qsizetype offset=0) { return write(data.data(), data.size(), offset); }
+
+    /**
+    *   @name Functions to set parameters
+    *   The functions here are used to set all parameters needed for succesfully opening a blob.
+    *   \warning Calling any function in this group with values differents from the ones already set closes the Blob if autoOpen is not true or reopens it if it is false
+    * @{ */
+    /**
+     * @brief Sets several parameters at once
+     * @param db Database pointer
+     * @param database Name of the database
+     * @param table Name of table
+     * @param column Name of column
+     * @param rowid Row id
+     * @return True on success, false on error
+     */
+    bool set(Db *db, const char *database, const char *table, const char *column, qint64 rowid);
+    /**
+     * @brief Sets several parameters at once
+     * @param db Database pointer
+     * @param database Name of the database
+     * @param table Name of table
+     * @param column Name of column
+     * @return True on success, false on error
+     */
+    bool set(Db *db, const char *database, const char *table, const char *column);
+    /**
+     * @brief Sets several parameters at once
+     * @param db Database pointer
+     * @param database Name of the database
+     * @param table Name of table
+     * @param rowid Row id
+     * @return True on success, false on error
+     */
+    bool set(Db *db, const char *database, const char *table, qint64 rowid);
+
+    /**
+     * @brief Sets the database name. If not set it will "main"
+     *
+     * @param database String pointing to database name or NULL to unset.
+     * @return True on success, false on error
+     */
+    inline bool setDatabase(const char *database) { return m_data->setDatabase(database); }
+    /**
+     * @brief Sets the table name.
+     *
+     * @param table String pointing to table name or NULL to unset.
+     * @return True on success, false on error
+     */
+    inline bool setTable(const char *table) { return m_data->setTable(table); }
+    /**
+     * @brief Sets the column name.
+     *
+     * @param table String pointing to column name or NULL to unset.
+     * @return True on success, false on error
+     */
+    inline bool setColumn(const char *column) { return m_data->setColumn(column); }
+    /**
+     * @brief Sets the row id.
+     *
+     * @param rowid Integer of the row id.
+     * @return True on success, false on error
+     */
+    inline bool setRowId(qint64 rowId) { return m_data->setRowId(rowId); }
+    /**
+     * @brief Sets the read/write mode.
+     *
+     * @param readWrite New value.
+     * @return True on success, false on error
+     */
+    inline bool setReadWrite(bool readWrite) { return m_data->setReadWrite(readWrite); }
+    /**
+     * @brief Sets the connection this blob refers to
+     * @param db Pointer to an open connection
+     * @return True on success
+     */
+    inline bool setDbPointer(Db *db) { return m_data->setDbPointer(db); }
+
+    /**
+     * @brief Sets the autoOpen mode
+     *
+     * Note that setting autoOpen to true will not try to open the blob until the next call to setXXX.
+     * @param newAutoOpen New value.
+     */
+    inline void setAutoOpen(bool newAutoOpen) { m_data->setAutoOpen(newAutoOpen); }
+    /// @}
+
+    /**
+     * @brief Returns current database name
+     * @return String with database name
+     */
+    inline QString database() { return QString::fromUtf8(m_data->database()?m_data->database():"main"); }
+    /**
+     * @brief Returns current table name
+     * @return String with table name or empty string if unset
+     */
+    inline QString table() { return QString::fromUtf8(m_data->table()); }
+    /**
+     * @brief Returns current column name
+     * @return String with column name or empty string if unset
+     */
+    inline QString column() { return QString::fromUtf8(m_data->column()); }
+    /**
+     * @brief Returns current row id
+     * @return Current row id. Result is undefined if no row-id was set.
+     */
+    inline qint64 rowId() { return m_data->rowId(); }
+  protected:
+    QExplicitlySharedDataPointer<Helper::BlobData> m_data;
+  };
+}
+
+namespace HFSQtLi
+{
+  /**
+   * @brief Bump allocator holding the text and blob values of a result set, see Query::fetchAll.
+   *
+   * Memory is taken from large slabs: allocating is a pointer increment and all the values are freed at once when the arena is cleared or destroyed,
+   * instead of one QString or QByteArray allocated and freed per value. Values larger than a quarter of a slab get a slab of their own.
+   * \code
+   * ResultArena arena;
+   * QVector<std::tuple<qint64, TextView>> rows;
+   * qry.fetchAll(arena, rows); // Views point to the arena, valid until it is cleared or destroyed
+   * \endcode
+   */
+  class ResultArena
+  {
+  public:
+    /**
+     * @brief Constructs an empty arena. No memory is allocated until the first value is stored.
+     * @param slabSize Size in bytes of the slabs
+     */
+    explicit ResultArena(qsizetype slabSize=1024*1024);
+    ResultArena(const ResultArena &other)=delete;
+    ResultArena &operator=(const ResultArena &other)=delete;
+    ~ResultArena();
+    /// @brief Allocates size bytes, not aligned
+    inline char *allocate(qsizetype size);
+    /**
+     * @brief Copies data in the arena
+     * @param data Data to copy
+     * @param size Size in bytes
+     * @param terminate If true a nul character is added after the data
+     * @return Pointer to the copy
+     */
+    const char *store(const char *data, qsizetype size, bool terminate=false);
+    /// @brief Frees all the values. The first slab is kept for reuse.
+    void clear();
+    /// @brief Bytes used by the stored values
+    qsizetype bytesUsed() const { return m_used; }
+    /// @brief Bytes allocated for the slabs
+    qsizetype bytesAllocated() const { return m_allocated; }
+  protected:
+    char *allocateSlab(qsizetype size);
+    qsizetype m_slabSize;
+    QVector<char *> m_slabs;
+    // Values larger than a quarter of a slab
+    QVector<char *> m_large;
+    char *m_next;
+    qsizetype m_left;
+    qsizetype m_used;
+    qsizetype m_allocated;
+  };
+
+  char *ResultArena::allocate(qsizetype size)
+  {
+    m_used+=size;
+    if(size<=m_left)
+    {
+      char *ret=m_next;
+      m_next+=size;
+      m_left-=size;
+      return ret;
+    }
+    return allocateSlab(size);
+  }
+}
+
+struct sqlite3_stmt;
+
+namespace HFSQtLi
+{
+  class Query;
+
+  /**
+   * @brief Reusable buffer holding a row of a query whose columns are known only at run time.
+   *
+   * Fetching a RowBuffer reads all the columns left in the row (from the first fetched one to the last column of the query), whatever their number and types.
+   * Cells are stored in a flat array of typed values and text and blobs are copied in a single byte pool: both are sized on the first row and reused by the
+   * following ones, so once the largest row has been seen stepping allocates nothing. Values are converted (to QString, QVariant, QJsonValue...) only when accessed.
+   * \code
+   * Query qry(db, sql); // Any query, e.g. typed by a user
+   * RowBuffer row;
+   * while(qry.step(row))
+   * {
+   *   for(int i=0;i<row.columnCount();i++)
+   *     out << row.columnName(i) << "=" << row.toString(i);
+   *   json.append(row.toJsonObject());
+   * }
+   * \endcode
+   */
+  class RowBuffer
+  {
+  public:
+    /// @brief Constructs an empty buffer
+    RowBuffer();
+    /// @brief Number of cells of the last fetched row
+    int columnCount() const { return m_cells.size(); }
+    /// @brief Name of a column, as returned by sqlite3_column_name. Names are read again only when the buffer is fetched from another statement or after it was prepared again.
+    QString columnName(int i) const { return m_names.value(i); }
+    /// @brief Type of a cell, Type::Invalid if i is out of range
+    Type type(int i) const { return (i>=0 && i<m_cells.size())?m_cells[i].type:Type::Invalid; }
+    bool isNull(int i) const { return type(i)==Type::Null; }
+
+    /// @brief Converts a cell to integer: floats are truncated, text is parsed, NULL and blobs are 0
+    qint64 toInt64(int i) const;
+    /// @brief Converts a cell to double: text is parsed, NULL and blobs are 0
+    double toDouble(int i) const;
+    /// @brief View over a text or blob cell, nul terminated, valid until the next fetch. Null for other types.
+    TextView text(int i) const;
+    /// @brief View over a text or blob cell, valid until the next fetch. Null for other types.
+    BlobView blob(int i) const;
+    /// @brief Converts a cell to a string: NULL is a null string
+    QString toString(int i) const;
+    /// @brief Converts a cell to a QVariant: qint64, double, QString, QByteArray or an invalid QVariant for NULL
+    QVariant toVariant(int i) const;
+    /// @brief Converts a cell to a QJsonValue. Blobs are hexadecimal strings, as in Query::exportTo.
+    QJsonValue toJsonValue(int i) const;
+    /// @brief Converts all the cells to QVariant
+    QVariantList toVariantList() const;
+    /// @brief Converts the row to a JSON object, the keys are the column names
+    QJsonObject toJsonObject() const;
+
+    /// @brief Bytes reserved for text and blobs
+    qsizetype poolCapacity() const { return m_pool.size(); }
+    /// @brief Frees the cells and the byte pool
+    void clear();
+  protected:
+    friend class Query;
+    // Reads the columns of the current row of stmt from first. generation is Query::m_prepareGeneration. Returns 1+number of columns read.
+    int fetch(sqlite3_stmt *stmt, int first, quint64 generation);
+    // Copies data to the pool, with a nul terminator, and returns its offset
+    qsizetype store(const char *data, qsizetype size);
+    struct Cell
+    {
+      Type type;
+      // Size of text and blobs
+      int size;
+      union
+      {
+        qint64 integer;
+        double real;
+        // Offset of text and blobs in m_pool
+        qsizetype offset;
+      };
+    };
+    QVector<Cell> m_cells;
+    // Text and blobs of the row; only m_poolUsed bytes are used, the rest is kept for the next rows
+    QByteArray m_pool;
+    qsizetype m_poolUsed;
+    QVector<QString> m_names;
+    // Prepare generation, reprepare count (SQLITE_STMTSTATUS_REPREPARE) and first column of the statement the names were read from
+    quint64 m_namesGeneration;
+    int m_namesReprepare;
+    int m_namesFirst;
+  };
+}
+
+namespace HFSQtLi
+{
+  /**
+   * @brief Wrapper storing a point in time as a Julian day (REAL) instead of microseconds since the Unix epoch (INTEGER), see \ref bindcodecs.
+   *
+   * T can be QDateTime or a std::chrono::system_clock::time_point. The encoding is chosen per column: wrap the values of the columns that are used with
+   * the date and time functions of SQLite, which read Julian days directly (e.g. date(column)). Values are fetched with millisecond precision.
+   * \code
+   * qry.prepare("INSERT INTO events(time, scheduled) VALUES ($1, $2)");
+   * qry.bind(1, QDateTime::currentDateTimeUtc(), JulianDay<QDateTime>(scheduled)); // INTEGER and REAL
+   * JulianDay<QDateTime> when;
+   * db->executeSingleAll("SELECT scheduled FROM events WHERE date(scheduled)=date('now')", when);
+   * \endcode
+   */
+  template <typename T> class JulianDay
+  {
+  public:
+    JulianDay(): m_value() { }
+    JulianDay(const T &value): m_value(value) { }
+    const T &value() const { return m_value; }
+    operator const T &() const { return m_value; }
+    bool operator==(const JulianDay &other) const { return m_value==other.m_value; }
+    bool operator!=(const JulianDay &other) const { return m_value!=other.m_value; }
+  protected:
+    T m_value;
+  };
+
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    template <class D> struct CodecSqlType<std::chrono::time_point<std::chrono::system_clock, D>> { static constexpr const char *type="INTEGER", *typeNotNull="INTEGER NOT NULL"; };
+    template <typename T> struct CodecSqlType<JulianDay<T>> { static constexpr const char *type="REAL", *typeNotNull="REAL NOT NULL"; };
+#ifdef HFSQTLI_ENABLE_QT_CODECS
+    template <> struct CodecSqlType<QDateTime> { static constexpr const char *type="INTEGER", *typeNotNull="INTEGER NOT NULL"; };
+    template <> struct CodecSqlType<QDate> { static constexpr const char *type="INTEGER", *typeNotNull="INTEGER NOT NULL"; };
+    template <> struct CodecSqlType<QTime> { static constexpr const char *type="INTEGER", *typeNotNull="INTEGER NOT NULL"; };
+    template <> struct CodecSqlType<QUuid> { static constexpr const char *type="BLOB", *typeNotNull="BLOB NOT NULL"; };
+#endif
+
+    double julianDay(qint64 micros);
+    qint64 julianDayMicros(double day);
+    // Microseconds since the Unix epoch, false for invalid values (bound as NULL)
+    bool epochMicros(const QDateTime &value, qint64 &micros);
+    template <class D> inline bool epochMicros(const std::chrono::time_point<std::chrono::system_clock, D> &value, qint64 &micros)
+    {
+      micros=std::chrono::floor<std::chrono::microseconds>(value).time_since_epoch().count();
+      return true;
+    }
+    // Rounds to the nearest millisecond. Julian days are already rounded to the millisecond by julianDayMicros, also for std::chrono time points.
+    void fromEpochMicros(qint64 micros, QDateTime &value);
+    template <class D> inline void fromEpochMicros(qint64 micros, std::chrono::time_point<std::chrono::system_clock, D> &value)
+    {
+      value=std::chrono::floor<D>(std::chrono::time_point<std::chrono::system_clock, std::chrono::microseconds>(std::chrono::microseconds(micros)));
+    }
+    // Reads a point in time stored as microseconds (julian false) or as a Julian day (julian true). Non strict fetches convert numbers and parse ISO 8601 text.
+    // Returns false for NULL, text that is not a date and time and on error.
+    bool fetchEpochMicros(CustomFetch &fetch, bool julian, qint64 &micros);
+  }
+  /// \endcond INTERNAL
+
+  /// @name Built-in codecs (see \ref bindcodecs)
+  /// @{
+#ifdef HFSQTLI_ENABLE_QT_CODECS
+  // Opt-in: projects often define their own codecs for these types, which would be ambiguous with these ones
+  void customBindConst(CustomBind &bind, const QDateTime &value);
+  void customFetch(CustomFetch &fetch, QDateTime &value);
+  void customBindConst(CustomBind &bind, const QDate &value);
+  void customFetch(CustomFetch &fetch, QDate &value);
+  void customBindConst(CustomBind &bind, const QTime &value);
+  void customFetch(CustomFetch &fetch, QTime &value);
+  void customBindConst(CustomBind &bind, const QUuid &value);
+  void customFetch(CustomFetch &fetch, QUuid &value);
+#endif
+
+  template <class D> void customBindConst(CustomBind &bind, const std::chrono::time_point<std::chrono::system_clock, D> &value)
+  {
+    qint64 micros;
+    Helper::epochMicros(value, micros);
+    bind.bind(micros);
+  }
+
+  template <class D> void customFetch(CustomFetch &fetch, std::chrono::time_point<std::chrono::system_clock, D> &value)
+  {
+    qint64 micros;
+    if(Helper::fetchEpochMicros(fetch, false, micros))
+      Helper::fromEpochMicros(micros, value);
+    else
+      value={};
+  }
+
+  template <typename T> void customBindConst(CustomBind &bind, const JulianDay<T> &value)
+  {
+    qint64 micros;
+    if(Helper::epochMicros(value.value(), micros))
+      bind.bind(Helper::julianDay(micros));
+    else
+      bind.bind(nullptr);
+  }
+
+  template <typename T> void customFetch(CustomFetch &fetch, JulianDay<T> &value)
+  {
+    qint64 micros;
+    T result{};
+    if(Helper::fetchEpochMicros(fetch, true, micros))
+      Helper::fromEpochMicros(micros, result);
+    value=JulianDay<T>(result);
+  }
+  /// @}
+}
+
+namespace HFSQtLi
+{
+  class Db;
+  /**
+   * @brief Online backup of a database (struct sqlite3_backup) running in a background thread.
+   *
+   * The backup copies a fixed number of pages per step and releases the source database between steps, so writers on the source are never blocked for the whole copy.
+   * If the source is modified during the backup SQLite takes care of the consistency of the copy: changes made through the same connection are applied to the destination too,
+   * while changes made by other connections or processes restart the backup automatically at the next step.
+   *
+   * No public constructor is available, instances are created via Db::backupTo. The backup is not started until start() is called, giving a chance to connect to the signals.
+   *
+   * Example usage:
+   * \code
+   * Backup *backup=db->backupTo("copy.sqlite", 256, 5);
+   * QObject::connect(backup, &Backup::progress, [](int remaining, int pageCount){ qDebug()<<remaining<<"/"<<pageCount; });
+   * QObject::connect(backup, &QThread::finished, backup, &QObject::deleteLater);
+   * backup->start();
+   * \endcode
+   */
+  class Backup: public QThread
+  {
+    Q_OBJECT
+    friend class Db;
+  public:
+    ~Backup();
+    /**
+     * @brief Error code of the backup.
+     *
+     * Valid only once the thread has finished.
+     * @return SQLITE_OK when the backup completed successfully, SQLITE_INTERRUPT if it was cancelled, another error code on failure
+     */
+    int error() const { return m_error; }
+    /**
+     * @brief Error message of the backup
+     * @return The error message or an empty string on success.
+     */
+    QString errorMsg() const { return m_errorMsg; }
+    /**
+     * @brief Checks if the backup completed successfully
+     * @return True if the backup has finished copying all pages
+     */
+    bool isOk() const { return isFinished() && m_error==SQLiteCode::OK; }
+    /// @brief Number of pages still to be copied after last step
+    int remaining() const { return m_remaining; }
+    /// @brief Total number of pages in the source database after last step
+    int pageCount() const { return m_pageCount; }
+    /// @brief Requests the backup to stop at the end of the current step. The destination is left in an undefined state.
+    void cancel() { requestInterruption(); }
+  signals:
+    /**
+     * @brief Emitted after every step of the backup
+     * @param remaining Number of pages still to be copied
+     * @param pageCount Total number of pages of source database
+     */
+    void progress(int remaining, int pageCount);
+  protected:
+    Backup(Db *source, const char *sourceName, Db *destination, const char *destinationName, bool ownDestination, int pagesPerStep, int sleepBetweenSteps);
+    void run() override;
+    Db *m_source;
+    Db *m_destination;
+    QScopedPointer<Db> m_ownedDestination;
+    QByteArray m_sourceName;
+    QByteArray m_destinationName;
+    int m_pagesPerStep;
+    int m_sleepBetweenSteps;
+    std::atomic_int m_remaining;
+    std::atomic_int m_pageCount;
+    int m_error;
+    QString m_errorMsg;
+  };
+}
+
+namespace HFSQtLi
+{
+  class Db;
+  /**
+   * @brief Scheduler running WAL checkpoints of a database in a background thread.
+   *
+   * While running, the automatic checkpoint of the source connection is disabled (see sqlite3_wal_autocheckpoint), so no commit done on the source pays the cost of a checkpoint.
+   * Checkpoints are instead performed periodically on a separate connection to the same file. A PASSIVE checkpoint is done on every round; if the WAL file grew over the given limit
+   * the checkpoint escalates to the mode given by escalation() (TRUNCATE by default), which waits for readers and writers using the busy timeout of the background connection.
+   *
+   * When the scheduler stops, the automatic checkpoint of the source is restored to the value it had when the scheduler started.
+   *
+   * No public constructor is available, instances are created via Db::checkpointer. The scheduler is not started until start() is called.
+   * \code
+   * Checkpointer *checkpointer=db->checkpointer(500, 64*1024*1024);
+   * QObject::connect(checkpointer, &Checkpointer::checkpointed, [](qint64 walSize, int, int, qint64 duration){ qDebug()<<walSize<<duration; });
+   * checkpointer->start();
+   * \endcode
+   */
+  class Checkpointer: public QThread
+  {
+    Q_OBJECT
+    friend class Db;
+  public:
+    /// @brief Checkpoint modes (see sqlite3_wal_checkpoint_v2)
+    enum class Mode: int
+    {
+      Passive,
+      Full,
+      Restart,
+      Truncate
+    };
+    ~Checkpointer();
+    /**
+     * @brief Error code of the last checkpoint
+     * @return SQLITE_OK on success. SQLITE_BUSY is returned when an escalated checkpoint could not complete and will be retried on next round.
+     */
+    int error() const { return m_error; }
+    /// @brief Error message of last checkpoint
+    QString errorMsg() const { QMutexLocker locker(&m_mutex); return m_errorMsg; }
+
+    /// @brief Mode used when WAL grows over walSizeLimit()
+    Mode escalation() const { return m_escalation; }
+    /// @brief Sets the mode used when WAL grows over walSizeLimit(). Must be called before start().
+    void setEscalation(Mode mode) { m_escalation=mode; }
+    /// @brief Size of WAL file (in bytes) over which the checkpoint will be escalated
+    qint64 walSizeLimit() const { return m_walSizeLimit; }
+    /// @brief Interval between two checkpoints in milliseconds
+    int interval() const { return m_interval; }
+
+    /// @name Metrics
+    /// @{
+    /// @brief Size in bytes of the WAL file measured before last checkpoint
+    qint64 lastWalSize() const { return m_lastWalSize; }
+    /// @brief Duration of last checkpoint in microseconds
+    qint64 lastDuration() const { return m_lastDuration; }
+    /// @brief Longest checkpoint duration in microseconds
+    qint64 maxDuration() const { return m_maxDuration; }
+    /// @brief Number of checkpoints performed
+    int checkpointCount() const { return m_checkpointCount; }
+    /// @brief Number of checkpoints that were escalated because the WAL exceeded walSizeLimit()
+    int escalatedCount() const { return m_escalatedCount; }
+    /// @}
+
+    /// @brief Wakes the scheduler to perform a checkpoint immediately
+    void checkpointNow();
+    /// @brief Stops the scheduler and waits for it to finish
+    void stop();
+  signals:
+    /**
+     * @brief Emitted after each checkpoint
+     * @param walSize Size in bytes of the WAL before the checkpoint
+     * @param logFrames Number of frames in the WAL (or -1 on error)
+     * @param checkpointedFrames Number of frames checkpointed (or -1 on error)
+     * @param duration Duration of the checkpoint in microseconds
+     */
+    void checkpointed(qint64 walSize, int logFrames, int checkpointedFrames, qint64 duration);
+  protected:
+    Checkpointer(Db *source, Db *connection, const QString &walFilename, int interval, qint64 walSizeLimit);
+    void run() override;
+    int checkpoint(bool escalate, int &logFrames, int &checkpointedFrames);
+    Db *m_source;
+    QScopedPointer<Db> m_connection;
+    QString m_walFilename;
+    int m_interval;
+    qint64 m_walSizeLimit;
+    Mode m_escalation;
+    mutable QMutex m_mutex;
+    QWaitCondition m_wake;
+    bool m_stop;
+    bool m_wakeRequested;
+    // Automatic checkpoint of the source before the scheduler started, restored when it stops
+    int m_previousAutoCheckpoint;
+    std::atomic_int m_error;
+    QString m_errorMsg;
+    std::atomic<qint64> m_lastWalSize;
+    std::atomic<qint64> m_lastDuration;
+    std::atomic<qint64> m_maxDuration;
+    std::atomic_int m_checkpointCount;
+    std::atomic_int m_escalatedCount;
+  };
+}
+
+namespace HFSQtLi
+{
+  class Db;
+  class ChangeNotifier;
+  /**
+   * @brief Rows changed by a committed transaction, as reported by ChangeNotifier::changed.
+   *
+   * Every change is stored as a table index, an operation and a rowid (16 bytes), table names are stored once.
+   * If the transaction changed more than ChangeNotifier::maxChanges() rows the rowids are dropped: only the tables are reported and isTruncated() is true.
+   */
+  class ChangeSet
+  {
+    friend class ChangeNotifier;
+  public:
+    /// @brief Type of change
+    enum class Operation: int
+    {
+      Insert,
+      Update,
+      Delete
+    };
+    /// @brief True if no change is reported
+    bool isEmpty() const { return m_tables.isEmpty(); }
+    /// @brief True if the rowids were dropped because the transaction changed too many rows
+    bool isTruncated() const { return m_truncated; }
+    /// @brief Tables changed by the transaction
+    const QStringList &tables() const { return m_tables; }
+    /// @brief True if table was changed by the transaction
+    bool contains(const QString &table) const { return m_tables.contains(table); }
+    /// @brief Number of changed rows reported
+    int size() const { return m_changes.size(); }
+    /// @brief Table of change i
+    const QString &table(int i) const { return m_tables.at(m_changes.at(i).table); }
+    /// @brief Operation of change i
+    Operation operation(int i) const { return m_changes.at(i).operation; }
+    /// @brief Rowid of change i
+    qint64 rowid(int i) const { return m_changes.at(i).rowid; }
+    /**
+     * @brief Rowids changed in a table
+     * @param table Name of the table
+     * @param operation Type of change
+     * @return The rowids in the order the changes were done. A row changed more than once is reported more than once.
+     */
+    QVector<qint64> rowids(const QString &table, Operation operation) const;
+  protected:
+    struct Change
+    {
+      qint64 rowid;
+      int table;
+      Operation operation;
+    };
+    QStringList m_tables;
+    QVector<Change> m_changes;
+    bool m_truncated=false;
+  };
+
+  /**
+   * @brief Notifies the rows changed by every transaction committed on a connection.
+   *
+   * The notifier installs the update, commit and rollback hooks of the connection (sqlite3_update_hook, sqlite3_commit_hook, sqlite3_rollback_hook):
+   * changes are accumulated while the transaction runs, dropped on rollback and delivered with a single changed() signal per committed transaction.
+   * This replaces polling the tables to discover new data.
+   *
+   * The commit hook is called before the commit is written: the changes are held until the commit is known to be done (the data version of the main database
+   * changed or, when the signal is delivered, no transaction is open) and are dropped if the commit fails, e.g. when COMMIT returns SQLITE_BUSY and the
+   * transaction is then rolled back.
+   *
+   * The signal is delivered through the event loop of the thread of the notifier, so slots can safely use the connection and run after the commit completed.
+   * Note the limits of the hooks:
+   * - Changes made by other connections or processes are not reported.
+   * - WITHOUT ROWID tables and changes done by the truncate optimization (DELETE without WHERE) are not reported.
+   * - Rows changed by a statement or savepoint rolled back inside a transaction that is then committed are still reported.
+   *
+   * Only one instance exists per connection, returned by Db::changes(), and it is owned by the database.
+   * Any hook installed on the connection in other ways is replaced.
+   * \code
+   * db->changes()->setTables({"messages"});
+   * QObject::connect(db->changes(), &ChangeNotifier::changed, view, [view](const ChangeSet &changes){
+   *   view->append(changes.rowids("messages", ChangeSet::Operation::Insert));
+   * });
+   * \endcode
+   */
+  class ChangeNotifier: public QObject
+  {
+    Q_OBJECT
+    friend class Db;
+    friend class ResultCache;
+  public:
+    ~ChangeNotifier();
+    /// @brief Tables whose changes are reported, empty to report all tables
+    QStringList tables() const;
+    /// @brief Sets the tables whose changes are reported (empty to report all tables). Call it from the thread writing to the connection or while no transaction is running.
+    void setTables(const QStringList &tables);
+    /// @brief Maximum number of rowids reported for a transaction
+    int maxChanges() const { return m_maxChanges; }
+    /// @brief Sets the maximum number of rowids reported for a transaction (default 100000), over which the ChangeSet is truncated
+    void setMaxChanges(int changes) { m_maxChanges=qMax(changes, 0); }
+    /// @brief Number of transactions reported
+    qint64 transactionCount() const { return m_transactions; }
+  signals:
+    /**
+     * @brief Emitted once for every committed transaction that changed at least one row of the tables in tables()
+     * @param changes The changed rows
+     */
+    void changed(const HFSQtLi::ChangeSet &changes);
+  protected:
+    explicit ChangeNotifier(Db *db);
+    static void updateHook(void *notifier, int operation, const char *database, const char *table, qint64 rowid);
+    static int commitHook(void *notifier);
+    static void rollbackHook(void *notifier);
+    int tableIndex(const char *table);
+    void clearPending();
+    // Data version of the main database (SQLITE_FCNTL_DATA_VERSION)
+    unsigned int dataVersion() const;
+    // Reports the held changes if the commit is done: finished is true if the transaction is known to be ended, otherwise the data version is checked
+    void checkCommitted(bool finished);
+    Db *m_db;
+    QSet<QByteArray> m_filter;
+    int m_maxChanges;
+    qint64 m_transactions;
+    // True if the commit hook was called for m_pending (or for the tables changed for the result cache) and the commit is not known to be done yet
+    bool m_committing;
+    unsigned int m_commitVersion;
+    // Changes of the running transaction
+    ChangeSet m_pending;
+    // UTF-8 names of m_pending.tables()
+    QVector<QByteArray> m_names;
+    // Consecutive changes are usually to the same table: cache the result of the last lookup (-1 if filtered out)
+    QByteArray m_lastName;
+    int m_lastIndex;
+  };
+}
+
+Q_DECLARE_METATYPE(HFSQtLi::ChangeSet)
+
+struct sqlite3_session;
+struct sqlite3_changeset_iter;
+
+namespace HFSQtLi
+{
+  /**
+   * @brief Records the changes made to the tables of a connection as a changeset or a patchset (see the SQLite session extension).
+   *
+   * A changeset is a compact binary description of the rows inserted, updated and deleted, with their primary key and the old and new values of the changed columns.
+   * It can be applied to another database with the same schema by Db::applyChangeset, inverted to undo the changes (Db::invertChangeset) and concatenated with other changesets
+   * (Db::concatChangesets). A patchset is smaller (only the primary key of deleted rows and the new values of updated ones are stored) but can't be inverted and reports fewer conflicts.
+   *
+   * Only tables with a declared PRIMARY KEY are recorded. Changes made to the same row are merged: a row inserted and then deleted is not reported at all.
+   *
+   * Requires SQLite compiled with SQLITE_ENABLE_SESSION and SQLITE_ENABLE_PREUPDATE_HOOK (see \ref howtocompile), otherwise all operations fail with SQLITE_MISUSE.
+   * The session must be destroyed before the database.
+   * \code
+   * Db::Session session(db);
+   * session.attach("measures");
+   * db->runWrite([](Db &db){ ... });
+   * QByteArray changes;
+   * if(session.changeset(changes))
+   *   central->applyChangeset(changes);
+   * \endcode
+   */
+  class Db::Session
+  {
+  public:
+    /**
+     * @brief Creates a session recording changes to a database of a connection. No table is recorded until attach() is called.
+     * @param db Database connection
+     * @param database Name of the database (e.g. "main", "temp" or an attached database)
+     */
+    explicit Session(Db *db, const char *database="main");
+    Session(const Session &other)=delete;
+    Session &operator=(const Session &other)=delete;
+    ~Session();
+
+    /// @brief True if the last operation succeeded
+    bool isOk() const { return m_error==SQLiteCode::OK; }
+    /// @brief Error code of the last operation
+    int error() const { return m_error; }
+    /// @brief Error message of the last operation
+    QString errorMsg() const { return m_errorMsg; }
+
+    /**
+     * @brief Starts recording changes to a table
+     * @param table Name of the table. A null string records all the tables, including the ones created later.
+     * @return True on success
+     */
+    bool attach(const QString &table=QString());
+    /// @brief True if changes are being recorded
+    bool isEnabled() const;
+    /// @brief Pauses (false) or resumes (true) recording. Changes made while paused are not recorded, even to rows already in the changeset.
+    void setEnabled(bool enabled);
+    /// @brief True if no change was recorded
+    bool isEmpty() const;
+
+    /**
+     * @brief Gets the changes recorded so far as a changeset. Recording continues.
+     * @param changeset Filled with the changeset
+     * @return True on success
+     */
+    bool changeset(QByteArray &changeset);
+    /**
+     * @brief Gets the changes recorded so far as a patchset. Recording continues.
+     * @param patchset Filled with the patchset
+     * @return True on success
+     */
+    bool patchset(QByteArray &patchset);
+  protected:
+    bool setError(int code);
+    Db *m_db;
+    sqlite3_session *m_session;
+    int m_error;
+    QString m_errorMsg;
+  };
+
+  /**
+   * @brief Conflict found by Db::applyChangeset, passed to the conflict handler.
+   *
+   * Values can be read only while the handler runs.
+   */
+  class ChangesetConflict
+  {
+    friend class Db;
+  public:
+    /// @brief Kind of conflict (see sqlite3changeset_apply)
+    enum class Type: int
+    {
+      /// @brief The row to update or delete exists but its values are not the expected old ones. conflictingValue() gives the current values.
+      Data,
+      /// @brief The row to update or delete does not exist
+      NotFound,
+      /// @brief The row to insert already exists. conflictingValue() gives the current values.
+      Conflict,
+      /// @brief The change violates a constraint (NOT NULL, UNIQUE, CHECK, ...)
+      Constraint,
+      /// @brief Applying the whole changeset leaves foreign key violations. Only Abort or Omit (commit anyway) are allowed.
+      ForeignKey
+    };
+    /// @brief Kind of conflict
+    Type type() const { return m_type; }
+    /// @brief Table of the change
+    QString table() const;
+    /// @brief Operation of the change
+    ChangeSet::Operation operation() const;
+    /// @brief Number of columns of the table
+    int columnCount() const;
+    /// @brief Old value of a column of an update or delete. Invalid if not available (e.g. columns not changed by an update).
+    Value oldValue(int column) const;
+    /// @brief New value of a column of an insert or update. Invalid if not available (e.g. columns not changed by an update).
+    Value newValue(int column) const;
+    /// @brief Value of a column of the row in the database conflicting with the change, for Data and Conflict conflicts
+    Value conflictingValue(int column) const;
+  protected:
+    ChangesetConflict(sqlite3_changeset_iter *iterator, int type);
+    sqlite3_changeset_iter *m_iterator;
+    Type m_type;
+  };
+}
+
+class QIODevice;
+
+namespace HFSQtLi
+{
+  class Db;
+  /**
+   * @brief Imports delimited text (CSV, TSV) from a QIODevice into a table.
+   *
+   * The device is read in large chunks. Records are split in place in the read buffer, scanning 8 bytes at a time for delimiters and line ends,
+   * and every field is bound with Query::bindTemporary directly from the buffer (quoted fields are unescaped in place), so no QString or QByteArray is created per field.
+   * Rows are inserted with a single prepared statement and grouped in transactions of rowsPerTransaction() rows.
+   *
+   * Quoting follows RFC 4180: fields may be enclosed in quote() characters, which allows delimiters and line breaks inside them, and a quote inside a quoted field is written twice.
+   * Both LF and CRLF line ends are accepted, empty lines are skipped.
+   *
+   * Example usage:
+   * \code
+   * QFile file("data.csv");
+   * file.open(QIODevice::ReadOnly);
+   * BulkImporter importer(db);
+   * importer.setHeader(true);
+   * importer.setAffinities({BulkImporter::Affinity::Integer, BulkImporter::Affinity::Text, BulkImporter::Affinity::Real});
+   * importer.setProgressCallback([](qint64 bytes, qint64 rows){ qDebug()<<bytes<<rows; return true; });
+   * if(!importer.import(&file, "measures"))
+   *   qDebug()<<importer.errorMsg();
+   * \endcode
+   */
+  class BulkImporter
+  {
+  public:
+    /// @brief Input formats
+    enum class Format: int
+    {
+      /// @brief Comma separated, fields can be quoted with "
+      Csv,
+      /// @brief Tab separated, no quoting
+      Tsv
+    };
+    /**
+     * @brief Conversion applied to the fields of a column before binding them.
+     *
+     * Fields that can't be converted are bound as text, so the column affinity of the table still applies.
+     */
+    enum class Affinity: int
+    {
+      /// @brief Bound as text (default)
+      Text,
+      /// @brief Bound as a 64 bit integer
+      Integer,
+      /// @brief Bound as a double
+      Real,
+      /// @brief Bound as an integer if possible, otherwise as a double
+      Numeric,
+      /// @brief Bound as a blob with the raw bytes of the field
+      Blob
+    };
+    /**
+     * @brief Progress callback
+     *
+     * Receives the number of bytes read from the device and the number of rows inserted so far. Returning false stops the import with SQLiteCode::INTERRUPT.
+     */
+    typedef std::function<bool(qint64 bytesRead, qint64 rows)> ProgressCallback;
+
+    /**
+     * @brief Constructs an importer writing into a database
+     * @param db Database to write to
+     * @param format Initial format, sets delimiter() and quote()
+     */
+    BulkImporter(Db *db, Format format=Format::Csv);
+    ~BulkImporter();
+
+    /// @name Settings
+    /// @{
+    /// @brief Sets delimiter and quote for the given format
+    void setFormat(Format format);
+    /// @brief Character separating fields
+    char delimiter() const { return m_delimiter; }
+    /// @brief Sets the character separating fields
+    void setDelimiter(char delimiter) { m_delimiter=delimiter; }
+    /// @brief Character used to quote fields, 0 if quoting is disabled
+    char quote() const { return m_quote; }
+    /// @brief Sets the character used to quote fields (0 to disable quoting)
+    void setQuote(char quote) { m_quote=quote; }
+    /// @brief True if the first record contains the column names
+    bool header() const { return m_header; }
+    /// @brief Sets if the first record contains the column names. The names are used when no column is passed to import(), otherwise the record is skipped.
+    void setHeader(bool header) { m_header=header; }
+    /// @brief Size in bytes of the chunks read from the device
+    int chunkSize() const { return m_chunkSize; }
+    /// @brief Sets the size in bytes of the chunks read from the device (default 4 MiB)
+    void setChunkSize(int size) { m_chunkSize=qMax(size, 1024); }
+    /// @brief Number of rows inserted in a transaction
+    int rowsPerTransaction() const { return m_rowsPerTransaction; }
+    /// @brief Sets the number of rows inserted in a transaction (default 50000). With 0 no transaction is started, leaving the control to the caller.
+    void setRowsPerTransaction(int rows) { m_rowsPerTransaction=qMax(rows, 0); }
+    /// @brief Conversions applied to the columns
+    const QVector<Affinity> &affinities() const { return m_affinities; }
+    /// @brief Sets the conversions applied to the columns, in order. Columns without an entry use Affinity::Text.
+    void setAffinities(const QVector<Affinity> &affinities) { m_affinities=affinities; }
+    /// @brief True if empty unquoted fields are bound as NULL
+    bool emptyAsNull() const { return m_emptyAsNull; }
+    /// @brief Sets if empty unquoted fields are bound as NULL (default false, they are bound as empty strings)
+    void setEmptyAsNull(bool emptyAsNull) { m_emptyAsNull=emptyAsNull; }
+    /// @brief Sets the function called after each chunk
+    void setProgressCallback(const ProgressCallback &callback) { m_progress=callback; }
+    /// @}
+
+    /**
+     * @brief Imports all the records of a device
+     *
+     * On failure the transaction in progress is rolled back, rows of transactions already committed are kept.
+     * @param device Device to read, must be open for reading
+     * @param table Name of the table, it will be quoted
+     * @param columns Columns to insert. If empty the names in the header are used, or all the columns of the table if there is no header.
+     * @return True on success
+     */
+    bool import(QIODevice *device, const QString &table, const QStringList &columns=QStringList());
+
+    /// @brief Number of rows inserted by last import. On failure only the rows committed are counted.
+    qint64 rowsImported() const { return m_rows; }
+    /// @brief Number of bytes read by last import
+    qint64 bytesRead() const { return m_bytesRead; }
+    /// @brief Error code of last import
+    int error() const { return m_error; }
+    /// @brief Error message of last import
+    QString errorMsg() const { return m_errorMsg; }
+  protected:
+    struct Field
+    {
+      char *data;
+      int size;
+      bool quoted;
+      bool escaped;
+    };
+    // Result of parsing a record
+    enum class Parse { Record, NeedMore, Malformed };
+    Parse parseRecord(char *&p, char *end, bool atEnd);
+    char *findSpecial(char *p, char *end) const;
+    void unescape(Field &field) const;
+    bool prepare(const QString &table, const QStringList &columns, int fieldCount);
+    bool insert();
+    bool bindField(int i, const Field &field);
+    bool begin();
+    bool commit();
+    void rollback();
+    void setError(int code, const QString &msg);
+    Db *m_db;
+    Query m_query;
+    char m_delimiter;
+    char m_quote;
+    bool m_header;
+    int m_chunkSize;
+    int m_rowsPerTransaction;
+    QVector<Affinity> m_affinities;
+    bool m_emptyAsNull;
+    ProgressCallback m_progress;
+    // State of current import
+    QByteArray m_buffer;
+    QVector<Field> m_fields;
+    int m_columns;
+    bool m_inTransaction;
+    int m_pendingRows;
+    qint64 m_rows;
+    qint64 m_bytesRead;
+    qint64 m_line;
+    int m_error;
+    QString m_errorMsg;
+  };
+}
+
+namespace HFSQtLi
+{
+  class Db;
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    // Non-template part of MultiInsert: generates, prepares and caches the statement for every number of rows and runs them
+    class MultiInsertBase
+    {
+    public:
+      ~MultiInsertBase();
+      /// @brief Number of rows inserted since the object was created
+      qint64 rowsInserted() const { return m_rows; }
+      /// @brief Number of INSERT statements executed since the object was created
+      qint64 statementsExecuted() const { return m_statements; }
+      /// @brief Error code of last operation
+      int error() const { return m_error; }
+      /// @brief Error message of last operation
+      QString errorMsg() const { return m_errorMsg; }
+    protected:
+      MultiInsertBase(Db *db, const QString &table, const QStringList &columns, int columnCount);
+      MultiInsertBase(const MultiInsertBase &other)=delete;
+      MultiInsertBase &operator=(const MultiInsertBase &other)=delete;
+      // Returns the statement inserting rows rows, reset and ready to be bound, or null on error
+      Query *statement(int rows);
+      // Sets the error of a failed bind of a row: binding count values instead of m_columnCount
+      void bindFailed(Query *query, int count);
+      // Runs a statement with all the parameters bound and clears the bindings
+      bool execute(Query *query, int rows);
+      void clearError();
+      void setError(int code, const QString &msg);
+      Db *m_db;
+      int m_columnCount;
+      // INSERT INTO table(columns) VALUES, followed by one group of parameters per row
+      QString m_sql;
+      QString m_rowSql;
+      QHash<int, Query *> m_queries;
+      qint64 m_rows;
+      qint64 m_statements;
+      int m_error;
+      QString m_errorMsg;
+    };
+  }
+  /// \endcond INTERNAL
 
+  /**
+   * @brief Inserts rows into a table with multi-row INSERT statements, N rows per step.
+   *
+   * The statement INSERT INTO table(columns) VALUES (?, ...), (?, ...), ... with N groups of parameters is generated and prepared once, and every step inserts N rows:
+   * the cost of starting the statement and of every step is paid once every N rows instead of for every row. Rows left over (less than N) are inserted with statements
+   * of N/2, N/4, ..., 1 rows, also prepared once and cached. The parameters of every row are bound at offsets computed at compile time.
+   *
+   * A row is a std::tuple<Cols...> or any type binding sizeof...(Cols) values (see \ref bindcustomtypes). Values are bound without copy (see Query::bindTemporary).
+   * The number of parameters of a statement (N*sizeof...(Cols)) must not exceed the SQLite limit (SQLITE_MAX_VARIABLE_NUMBER, 32766 by default).
+   *
+   * Statements are run as they are: wrap a bulk load in a transaction (e.g. with Db::runWrite) to avoid a commit per statement.
+   * \code
+   * MultiInsert<64, qint64, QString, double> insert(db, "measures", {"time", "sensor", "value"});
+   * QVector<std::tuple<qint64, QString, double>> rows=...;
+   * db->runWrite([&]{ return insert.insert(rows); });
+   * // Or row by row, N rows are inserted at a time
+   * insert.add(time, "temperature", 21.5);
+   * ...
+   * insert.flush();
+   * \endcode
+   */
+  template <int N, typename ...Cols> class MultiInsert: public Helper::MultiInsertBase
+  {
+    static_assert(N>0, "MultiInsert must insert at least one row per statement");
+    static_assert(sizeof...(Cols)>0, "MultiInsert must insert at least one column");
+  public:
+    /// @brief Type of the rows buffered by add()
+    typedef std::tuple<Cols...> Row;
     /**
-    *   @name Functions to set parameters
-    *   The functions here are used to set all parameters needed for succesfully opening a blob.
-    *   \warning Calling any function in this group with values differents from the ones already set closes the Blob if autoOpen is not true or reopens it if it is false
-    * @{ */
+     * @brief Constructs the inserter. Statements are prepared when first used.
+     * @param db Database to write to
+     * @param table Name of the table, it will be quoted
+     * @param columns Columns to insert, one for each of Cols. If empty all the columns of the table are inserted, in order.
+     */
+    MultiInsert(Db *db, const QString &table, const QStringList &columns=QStringList()): Helper::MultiInsertBase(db, table, columns, int(sizeof...(Cols))) { m_pending.reserve(N); }
     /**
-     * @brief Sets several parameters at once
-     * @param db Database pointer
-     * @param database Name of the database
-     * @param table Name of table
-     * @param column Name of column
-     * @param rowid Row id
-     * @return True on success, false on error
+     * @brief Inserts all the rows of a container
+     * @param rows Container of rows, e.g. a QVector<std::tuple<Cols...>>
+     * @return True on success. On failure the rows of the statements executed before the error are kept.
      */
-    bool set(Db *db, const char *database, const char *table, const char *column, qint64 rowid);
+    template <typename Container> bool insert(const Container &rows);
     /**
-     * @brief Sets several parameters at once
-     * @param db Database pointer
-     * @param database Name of the database
-     * @param table Name of table
-     * @param column Name of column
-     * @return True on success, false on error
+     * @brief Adds a row to the buffer, inserting the buffered rows when there are N of them
+     * @return True on success
      */
-    bool set(Db *db, const char *database, const char *table, const char *column);
+    bool add(const Cols &...values);
     /**
-     * @brief Sets several parameters at once
-     * @param db Database pointer
-     * @param database Name of the database
-     * @param table Name of table
-     * @param rowid Row id
-     * @return True on success, false on error
+     * @brief Inserts the rows left in the buffer by add()
+     * @return True on success. The buffer is cleared anyway.
      */
-    bool set(Db *db, const char *database, const char *table, qint64 rowid);
+    bool flush();
+    /// @brief Number of rows in the buffer, not inserted yet
+    int pending() const { return m_pending.size(); }
+  protected:
+    template <typename T> bool bindRow(Query *query, int index, const T &row);
+    template <typename It, int ...I> bool bindRows(Query *query, It &it, Helper::int_sequence<I...>);
+    // Inserts M rows with one statement
+    template <int M, typename It> bool insertBlock(It &it);
+    // Inserts remaining rows with statements of M, M/2, ..., 1 rows
+    template <int M, typename It> bool insertRemaining(It &it, qint64 remaining);
+    QVector<Row> m_pending;
+  };
 
+  template <int N, typename ...Cols> template <typename Container> bool MultiInsert<N, Cols...>::insert(const Container &rows)
+  {
+    clearError();
+    auto it=std::begin(rows);
+    return insertRemaining<N>(it, qint64(std::size(rows)));
+  }
+
+  template <int N, typename ...Cols> bool MultiInsert<N, Cols...>::add(const Cols &...values)
+  {
+    m_pending.append(Row(values...));
+    return m_pending.size()<N || flush();
+  }
+
+  template <int N, typename ...Cols> bool MultiInsert<N, Cols...>::flush()
+  {
+    bool ret=insert(m_pending);
+    m_pending.clear();
+    return ret;
+  }
+
+  template <int N, typename ...Cols> template <typename T> bool MultiInsert<N, Cols...>::bindRow(Query *query, int index, const T &row)
+  {
+    int bound=query->bindTemporary(index, row);
+    if(bound==int(sizeof...(Cols))+1)
+      return true;
+    bindFailed(query, bound-1);
+    return false;
+  }
+
+  template <int N, typename ...Cols> template <typename It, int ...I> bool MultiInsert<N, Cols...>::bindRows(Query *query, It &it, Helper::int_sequence<I...>)
+  {
+    bool ok=true;
+    // Row I starts at parameter I*columns+1
+    (void)((ok=bindRow(query, I*int(sizeof...(Cols))+1, *it), void(++it), ok) && ...);
+    return ok;
+  }
+
+  template <int N, typename ...Cols> template <int M, typename It> bool MultiInsert<N, Cols...>::insertBlock(It &it)
+  {
+    Query *query=statement(M);
+    if(!query)
+      return false;
+    if(!bindRows(query, it, Helper::make_int_sequence<M>()))
+    {
+      query->clearBindings();
+      return false;
+    }
+    return execute(query, M);
+  }
+
+  template <int N, typename ...Cols> template <int M, typename It> bool MultiInsert<N, Cols...>::insertRemaining(It &it, qint64 remaining)
+  {
+    if constexpr(M>0)
+    {
+      for(;remaining>=M;remaining-=M)
+      {
+        if(!insertBlock<M>(it))
+          return false;
+      }
+      return insertRemaining<M/2>(it, remaining);
+    }
+    else
+      return true;
+  }
+}
+
+namespace HFSQtLi
+{
+  /// @brief Types of the parameters of a \ref Statement
+  template <typename ...T> struct In { };
+  /// @brief Types of the columns of a \ref Statement
+  template <typename ...T> struct Out { };
+
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    template <typename T> struct IsStatementValue: std::integral_constant<bool, std::is_integral<T>::value || std::is_floating_point<T>::value ||
+                                                                                std::is_same<T, QString>::value || std::is_same<T, Interned<QString>>::value ||
+                                                                                std::is_same<T, QByteArray>::value || CodecSqlType<T>::type!=nullptr> { };
+    template <typename T> struct IsStatementValue<std::optional<T>>: IsStatementValue<T> { };
+
+    // Number of parameters or columns used by a value of a Statement
+    template <typename T> constexpr int statementColumns()
+    {
+      if constexpr(IsMapped<T>::value)
+        return mappedSize<T>();
+      else
+      {
+        static_assert(IsStatementValue<T>::value, "Statement values must be integers, floating points, QString, Interned<QString>, QByteArray, types with a built-in codec, std::optional of them or structs mapped with HFSQTLI_MAP");
+        return 1;
+      }
+    }
+
+    // Offset of the first parameter or column of every value, followed by the total
+    template <typename ...T> constexpr std::array<int, sizeof...(T)+1> statementOffsets()
+    {
+      constexpr int sizes[]={0, statementColumns<T>()...};
+      std::array<int, sizeof...(T)+1> ret{};
+      for(std::size_t i=1;i<ret.size();i++)
+        ret[i]=ret[i-1]+sizes[i];
+      return ret;
+    }
+
+    // Non-template part of Statement: prepare time checks and single row execution
+    class StatementBase: protected Query
+    {
+    public:
+      using Query::error;
+      using Query::errorMsg;
+      using Query::isOk;
+      using Query::isDone;
+      using Query::isPrepared;
+      using Query::reset;
+      using Query::clearBindings;
+      using Query::setKeepErrorMsg;
+      using Query::keepErrorMsg;
+      using Query::setDeadline;
+      using Query::setTimeout;
+      using Query::clearDeadline;
+      using Query::hasDeadline;
+      using Query::deadline;
+      /// \cond INTERNAL
+      using Query::pointerStatement;
+      /// \endcond INTERNAL
+    protected:
+      StatementBase(Db *db, const QString &sql, int parameters, int columns);
+      StatementBase(const StatementBase &other)=delete;
+      StatementBase &operator=(const StatementBase &other)=delete;
+      // Sets the error and returns false if the statement is not prepared
+      bool checkPrepared();
+      // First step of a single row execution: true if a row was returned
+      bool stepFirst();
+      // Last step of a single row execution: true if the statement is done
+      bool stepLast();
+      // Last step of a command: true if the statement is done without returning a row
+      bool stepCommand();
+    };
+  }
+  /// \endcond INTERNAL
+
+  template <typename Inputs, typename Outputs=Out<>> class Statement;
+
+  /**
+   * @brief Prepared statement with the types of its parameters and columns fixed at compile time.
+   *
+   * Statement<In<Params...>, Out<Columns...>> checks when prepared that the statement has as many parameters and columns as declared: if not the statement is
+   * not prepared and error() is SQLITE_CONSTRAINT. After that every value is bound or fetched at an offset computed at compile time with the native function of its type:
+   * no tuple is built, no count of bound parameters or fetched columns is checked on every call and columns are always fetched as in Query::column (not strict).
+   *
+   * Values can be integers, floating points, QString, Interned<QString>, QByteArray, std::optional of them (empty is NULL) and structs mapped with HFSQTLI_MAP (see \ref Mapping),
+   * which use one parameter or column for each field.
+   * \code
+   * Statement<In<qint64>, Out<QString, double>> lookup(db, "SELECT name, reading FROM sensors WHERE id=?");
+   * QString name;
+   * double reading;
+   * if(lookup.executeSingle(id, name, reading))
+   *   ...
+   * Statement<In<qint64, double>> insert(db, "INSERT INTO readings(sensor, value) VALUES (?, ?)");
+   * insert.execute(id, 21.5);
+   * \endcode
+   */
+  template <typename ...Params, typename ...Columns> class Statement<In<Params...>, Out<Columns...>>: public Helper::StatementBase
+  {
+  public:
+    /// @brief Number of parameters of the statement
+    static constexpr int parameterCount() { return s_params.back(); }
+    /// @brief Number of columns of the statement
+    static constexpr int columnCount() { return s_columns.back(); }
     /**
-     * @brief Sets the database name. If not set it will "main"
-     *
-     * @param database String pointing to database name or NULL to unset.
-     * @return True on success, false on error
+     * @brief Prepares the statement (persistent) and checks its number of parameters and columns
+     * @param db Database
+     * @param sql Statement to prepare
      */
-    inline bool setDatabase(const char *database) { return m_data->setDatabase(database); }
+    Statement(Db *db, const QString &sql): Helper::StatementBase(db, sql, parameterCount(), columnCount()) { }
     /**
-     * @brief Sets the table name.
-     *
-     * @param table String pointing to table name or NULL to unset.
-     * @return True on success, false on error
+     * @brief Binds all the parameters. Values are copied, the statement must be reset before binding again after a step.
+     * @return True on success
      */
-    inline bool setTable(const char *table) { return m_data->setTable(table); }
+    bool bind(const Params &...values) { return bindValues(false, values...); }
     /**
-     * @brief Sets the column name.
-     *
-     * @param table String pointing to column name or NULL to unset.
-     * @return True on success, false on error
+     * @brief Steps to the next row and fetches it
+     * @return True if a row was fetched. At the end isDone() is true, otherwise there was an error.
      */
-    inline bool setColumn(const char *column) { return m_data->setColumn(column); }
+    bool step(Columns &...values) { return stepNoFetch() && fetchValues(Helper::make_int_sequence<sizeof...(Columns)>(), values...); }
     /**
-     * @brief Sets the row id.
-     *
-     * @param rowid Integer of the row id.
-     * @return True on success, false on error
+     * @brief Fetches the current row
+     * @return True on success
      */
-    inline bool setRowId(qint64 rowId) { return m_data->setRowId(rowId); }
+    bool fetch(Columns &...values) { return checkPrepared() && fetchValues(Helper::make_int_sequence<sizeof...(Columns)>(), values...); }
     /**
-     * @brief Sets the read/write mode.
-     *
-     * @param readWrite New value.
-     * @return True on success, false on error
+     * @brief Resets the statement, binds the parameters and fetches the only row returned
+     * @return True on success. Fails if the statement returns no rows or more than one row.
+     * \warning Values are bound without copy and cleared before returning
      */
-    inline bool setReadWrite(bool readWrite) { return m_data->setReadWrite(readWrite); }
+    bool executeSingle(const Params &...params, Columns &...values);
     /**
-     * @brief Sets the connection this blob refers to
-     * @param db Pointer to an open connection
+     * @brief Resets the statement, binds the parameters and runs it. The statement must return no rows.
      * @return True on success
+     * \warning Values are bound without copy and cleared before returning
      */
-    inline bool setDbPointer(Db *db) { return m_data->setDbPointer(db); }
+    bool execute(const Params &...params);
+  protected:
+    static constexpr std::array<int, sizeof...(Params)+1> s_params=Helper::statementOffsets<Params...>();
+    static constexpr std::array<int, sizeof...(Columns)+1> s_columns=Helper::statementOffsets<Columns...>();
+    bool bindValues(bool temporary, const Params &...values);
+    template <int ...I> bool bindAt(bool temporary, Helper::int_sequence<I...>, const Params &...values);
+    template <typename T> bool bindValue(bool temporary, int i, const T &value);
+    template <int ...I> bool fetchValues(Helper::int_sequence<I...>, Columns &...values);
+    template <typename T> bool fetchValue(int i, T &value);
+  };
 
-    /**
-     * @brief Sets the autoOpen mode
-     *
-     * Note that setting autoOpen to true will not try to open the blob until the next call to setXXX.
-     * @param newAutoOpen New value.
-     */
-    inline void setAutoOpen(bool newAutoOpen) { m_data->setAutoOpen(newAutoOpen); }
-    /// @}
+  template <typename ...Params, typename ...Columns> bool Statement<In<Params...>, Out<Columns...>>::executeSingle(const Params &...params, Columns &...values)
+  {
+    bool ret=reset() && bindValues(true, params...) && stepFirst() && fetchValues(Helper::make_int_sequence<sizeof...(Columns)>(), values...) && stepLast();
+    clearBindingInternal();
+    return ret;
+  }
 
+  template <typename ...Params, typename ...Columns> bool Statement<In<Params...>, Out<Columns...>>::execute(const Params &...params)
+  {
+    bool ret=reset() && bindValues(true, params...) && stepCommand();
+    clearBindingInternal();
+    return ret;
+  }
+
+  template <typename ...Params, typename ...Columns> bool Statement<In<Params...>, Out<Columns...>>::bindValues(bool temporary, const Params &...values)
+  {
+    if(!checkPrepared())
+      return false;
+    Db::Lock lock(m_db, m_keepErrorMsg);
+    return bindAt(temporary, Helper::make_int_sequence<sizeof...(Params)>(), values...);
+  }
+
+  template <typename ...Params, typename ...Columns> template <int ...I> bool Statement<In<Params...>, Out<Columns...>>::bindAt(bool temporary, Helper::int_sequence<I...>, const Params &...values)
+  {
+    bool ok=true;
+    (void)((ok=bindValue(temporary, s_params[I]+1, values)) && ...);
+    return ok;
+  }
+
+  template <typename ...Params, typename ...Columns> template <typename T> bool Statement<In<Params...>, Out<Columns...>>::bindValue(bool temporary, int i, const T &value)
+  {
+    if constexpr(Helper::IsMapped<T>::value)
+      return bindMapped(temporary, i, value, Helper::make_int_sequence<Helper::mappedSize<T>()>())>0;
+    else
+      return bindMappedField(temporary, i, value);
+  }
+
+  template <typename ...Params, typename ...Columns> template <int ...I> bool Statement<In<Params...>, Out<Columns...>>::fetchValues(Helper::int_sequence<I...>, Columns &...values)
+  {
+    bool ok=true;
+    (void)((ok=fetchValue(s_columns[I], values)) && ...);
+    return ok;
+  }
+
+  template <typename ...Params, typename ...Columns> template <typename T> bool Statement<In<Params...>, Out<Columns...>>::fetchValue(int i, T &value)
+  {
+    if constexpr(Helper::IsMapped<T>::value)
+      return readMapped(false, i, value, Helper::make_int_sequence<Helper::mappedSize<T>()>())>0;
+    else
+      return readMappedField(false, i, value);
+  }
+}
+
+namespace HFSQtLi
+{
+  class Db;
+  /**
+   * @brief Read-only table model showing a table or view of any size, keeping in memory only the rows around the visible ones.
+   *
+   * Rows are ordered by an integer key, unique for every row (rowid by default, or an indexed INTEGER column). When the source is set the model scans the keys once,
+   * storing only the first key of every block of blockSize() rows: this gives rowCount() and allows any block to be read with a single keyset query
+   * (WHERE key>=first AND key<next) on a prepared statement, without the growing cost of OFFSET. Scrolling to any position therefore costs the same as reading the first rows.
+   *
+   * Decoded blocks are kept in a LRU cache of cacheSize() blocks, so memory is bounded whatever the size of the result.
+   * For file databases the block following the one last accessed (in the direction of scrolling) is read in advance on a background connection, opened read-only on the same file.
+   * The background connection sees only committed data.
+   *
+   * The model shows the data as it was when the keys were scanned: call refresh() after modifying the source. Rows deleted in the meantime are shown empty.
+   * \code
+   * QueryModel *model=new QueryModel(db, view);
+   * model->setSource("measures", {"time", "sensor", "value"}, "sensor<>0");
+   * view->setModel(model);
+   * \endcode
+   */
+  class QueryModel: public QAbstractTableModel
+  {
+    Q_OBJECT
+  public:
     /**
-     * @brief Returns current database name
-     * @return String with database name
-     */
-    inline QString database() { return QString::fromUtf8(m_data->database()?m_data->database():"main"); }
-    /**
-     * @brief Returns current table name
-     * @return String with table name or empty string if unset
+     * @brief Constructs an empty model
+     * @param db Database to read from. It must outlive the model.
+     * @param parent Parent object
      */
-    inline QString table() { return QString::fromUtf8(m_data->table()); }
+    QueryModel(Db *db, QObject *parent=nullptr);
+    ~QueryModel();
+
     /**
-     * @brief Returns current column name
-     * @return String with column name or empty string if unset
+     * @brief Sets the rows shown by the model and loads their keys
+     * @param table Table or view to read, used verbatim in the FROM clause
+     * @param columns Columns or expressions to show, used verbatim in the SELECT
+     * @param where Optional condition filtering the rows
+     * @param key Unique integer column ordering the rows. It should be indexed.
+     * @return True on success. On failure the model is empty and error() and errorMsg() describe the error.
      */
-    inline QString column() { return QString::fromUtf8(m_data->column()); }
+    bool setSource(const QString &table, const QStringList &columns, const QString &where=QString(), const QString &key="rowid");
     /**
-     * @brief Returns current row id
-     * @return Current row id. Result is undefined if no row-id was set.
+     * @brief Scans the keys again and clears the cache, showing the current content of the source
+     * @return True on success
      */
-    inline qint64 rowId() { return m_data->rowId(); }
+    bool refresh();
+
+    /// @name Settings
+    /// @{
+    /// @brief Number of rows read with a single query
+    int blockSize() const { return m_blockSize; }
+    /// @brief Sets the number of rows read with a single query (default 256). Takes effect on next setSource() or refresh().
+    void setBlockSize(int size) { m_blockSize=qMax(size, 1); }
+    /// @brief Maximum number of blocks kept in memory
+    int cacheSize() const { return m_cache.maxCost(); }
+    /// @brief Sets the maximum number of blocks kept in memory (default 64)
+    void setCacheSize(int blocks) { m_cache.setMaxCost(qMax(blocks, 2)); }
+    /// @brief True if blocks are read in advance on a background connection
+    bool prefetch() const { return m_prefetch; }
+    /// @brief Enables or disables reading blocks in advance (default true). Ignored for in-memory and temporary databases. Takes effect on next setSource() or refresh().
+    void setPrefetch(bool prefetch) { m_prefetch=prefetch; }
+    /// @}
+
+    /// @name Metrics
+    /// @{
+    /// @brief Number of blocks read by the model thread because they were not in the cache
+    int blockReads() const { return m_blockReads; }
+    /// @brief Number of blocks taken from the background connection instead of being read by the model thread
+    int prefetchHits() const { return m_prefetchHits; }
+    /// @}
+
+    /// @brief Error code of last operation
+    int error() const { return m_error; }
+    /// @brief Error message of last operation
+    QString errorMsg() const { return m_errorMsg; }
+
+    int rowCount(const QModelIndex &parent=QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent=QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role=Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role=Qt::DisplayRole) const override;
   protected:
-    QExplicitlySharedDataPointer<Helper::BlobData> m_data;
+    // Decoded rows of a block, row by row
+    struct Block
+    {
+      QVector<QVariant> values;
+      int rows=0;
+    };
+    // Reads blocks requested by the model on its own connection
+    class Prefetcher: public QThread
+    {
+    public:
+      Prefetcher(Db *connection, const QString &sql, int blockSize, int columns);
+      ~Prefetcher();
+      // Replaces any pending request
+      void request(int block, qint64 from, qint64 to);
+      // Moves a block already read to result, waiting for it if it is requested or being read. Returns false if it is not available
+      bool take(int block, Block &result);
+      void stop();
+    protected:
+      void run() override;
+      QScopedPointer<Db> m_connection;
+      QString m_sql;
+      int m_blockSize;
+      int m_columns;
+      QMutex m_mutex;
+      QWaitCondition m_wake;
+      QWaitCondition m_readyWake;
+      bool m_stop;
+      bool m_running;
+      int m_requested;
+      int m_inFlight;
+      qint64 m_from;
+      qint64 m_to;
+      QHash<int, Block> m_ready;
+    };
+    // Reads the rows with key in [from, to) into block, decoding columns 1 to columns (column 0 is the key)
+    static bool readBlock(Query &query, qint64 from, qint64 to, int blockSize, int columns, Block &block);
+    bool load();
+    void clear();
+    const Block *block(int block) const;
+    qint64 blockEnd(int block) const;
+    void setError(int code, const QString &msg);
+    Db *m_db;
+    QString m_table;
+    QStringList m_columns;
+    QString m_where;
+    QString m_key;
+    int m_blockSize;
+    bool m_prefetch;
+    // First key of every block
+    QVector<qint64> m_blockKeys;
+    int m_rows;
+    QStringList m_headers;
+    // State changed by data(), which is const for the view
+    mutable Query m_query;
+    mutable QCache<int, Block> m_cache;
+    mutable int m_lastBlock;
+    mutable int m_blockReads;
+    mutable int m_prefetchHits;
+    QScopedPointer<Prefetcher> m_prefetcher;
+    int m_error;
+    QString m_errorMsg;
   };
 }
 
@@ -1833,6 +5121,21 @@ namespace HFSQtLi
  *  - QByteArray
  *
  *  Text and blob data can be read respectively with QString and QByteArray
+ *  @subsection fetchviews TextView and BlobView
+ *  Text and blob data can also be read without copy as TextView (UTF-8) and BlobView. The views point to the memory of SQLite and are valid until the next step or reset of the query.
+ *  A NULL column gives a null view (isNull()). With Query::fetchAll the values are copied into a ResultArena instead, and stay valid as long as the arena.
+ *  @subsection fetchinterned Interned<QString>
+ *  Text read as Interned<QString> is looked up in the InternPool of the query: repeated values share the same QString, without allocation or UTF-8 decoding.
+ *  @subsection fetchvalues Value, ValueRef and OwnedValue
+ *  A cell of any type can be read as a \ref Value, a copy of the sqlite3_value allocated by SQLite (sqlite3_value_dup). To inspect a cell without any copy read a ValueRef,
+ *  valid until the next step or reset of the query. To keep it read an OwnedValue: numbers and short text or blobs (up to OwnedValue::InlineSize bytes) are stored without heap allocation.
+ *  ValueRef and OwnedValue can also be bound, e.g. to copy a cell from a query to another.
+ *  @subsection fetchcodecs Dates, times and UUIDs
+ *  QDateTime, std::chrono::system_clock::time_point, JulianDay<T>, QDate, QTime and QUuid are fetched from their binary encodings, see \ref bindcodecs
+ *  (QDateTime, QDate, QTime and QUuid only with HFSQTLI_ENABLE_QT_CODECS defined).
+ *  @subsection fetchrowbuffer RowBuffer
+ *  A RowBuffer reads all the remaining columns of the row, for queries whose columns are known only at run time. The buffer is reused across steps,
+ *  and its cells are converted to QString, QVariant or QJsonValue only when accessed.
  *  @section fetchcpptypes C++ data types
  *  @subsection fetchoptional std::optional<T>
  *  If the fetched column is NULL the result is cleared, othewise the value will be read as if the type T was read diredtly.
@@ -1877,6 +5180,8 @@ namespace HFSQtLi
  *
  *  This function will have to use the passed accessor to retrive the needed column(s) and set data
  *  \see CustomFetch
+ *
+ *  Structs whose fields are stored as consecutive columns can be declared with HFSQTLI_MAP instead, without writing customFetch (see \ref Mapping).
  */
 
   /** @page bindtypes Bounded data types
@@ -1940,6 +5245,42 @@ namespace HFSQtLi
    *  \code
    *   qry.bind(ZeroBlob(50));
    * \endcode
+   *  @section bindarrays Arrays
+   *  The following types are bound as a single pointer that can be used as a table with the carray table-valued function (see https://sqlite.org/carray.html):
+   *  - QVector<int>, QVector<qint64>, QVector<double>
+   *  - QStringList
+   *  - CArray<T>, a view over any contiguous array of int, qint64, double or const char *
+   *
+   *  This allows one prepared statement to serve any number of values, e.g. for IN lists:
+   *  \code
+   *   QVector<qint64> ids{4, 8, 15, 16, 23, 42};
+   *   qry.prepare("SELECT name FROM items WHERE id IN carray($1)");
+   *   qry.bind(1, ids);
+   * \endcode
+   *  With the standard version of the bind functions the array is copied by SQLite. With the temporary version no copy is made, so the array must not be
+   *  modified or destroyed until the bindings are cleared. QStringList is always converted to UTF-8 in a single block owned by SQLite.
+   *
+   *  Binding arrays requires SQLite to be compiled with SQLITE_ENABLE_CARRAY (see \ref howtocompile), otherwise the bind fails with SQLITE_MISUSE.
+   *  @section bindcodecs Dates, times and UUIDs
+   *  The following Qt and standard types are bound and fetched with compact binary encodings, which keep keys small and index B-trees dense:
+   *  - QDateTime and std::chrono::system_clock::time_point: INTEGER, microseconds since 1970-01-01T00:00:00Z (QDateTime has millisecond precision,
+   *    values are rounded to the nearest millisecond when fetched). Wrapped in JulianDay<T> they are bound as REAL Julian days instead, directly usable by
+   *    the date and time functions of SQLite (a double has a resolution of about 40 µs, so they are rounded to the nearest millisecond when fetched,
+   *    also for std::chrono time points).
+   *  - QDate: INTEGER, the Julian day number (QDate::toJulianDay)
+   *  - QTime: INTEGER, milliseconds since midnight
+   *  - QUuid: 16 bytes BLOB (QUuid::toRfc4122)
+   *
+   *  Invalid QDateTime, QDate and QTime are bound as NULL, and NULL is fetched as an invalid value. Non strict fetches also convert numbers of the other
+   *  encoding and parse ISO 8601 text, so columns written as text can still be read (text without an offset, e.g. written by datetime(), is UTC). These types can be fields of structs mapped with HFSQTLI_MAP.
+   *
+   *  The codecs of QDateTime, QDate, QTime and QUuid are enabled by defining HFSQTLI_ENABLE_QT_CODECS (see \ref howtocompile): projects that already
+   *  declare customBindConst/customFetch for these types would otherwise get ambiguous overloads. std::chrono time points and JulianDay<T> are always
+   *  available, JulianDay<QDateTime> included.
+   *  \code
+   *   qry.prepare("SELECT count(*) FROM events WHERE time BETWEEN $1 AND $2"); // Integer comparison, no string parsing
+   *   qry.bind(1, from, to); // QDateTime
+   * \endcode
  *  @section bindcustomtypes Custom data types
  *  It is possible to handle the binding of any data type T by implementing one of the following functions:
  *
@@ -1948,6 +5289,9 @@ namespace HFSQtLi
  *
  *  This function will have to use the passed accessor to bind the needed column(s) using data
  *  \see CustomBind
+ *
+ *  Structs whose fields are bound as consecutive parameters can be declared with HFSQTLI_MAP instead, without writing customBind (see \ref Mapping).
+ *  Mapped fields are bound at offsets computed at compile time, without the bookkeeping of CustomBind.
  */
 
   /** @page howtocompile Build instruction and requirements
@@ -1966,6 +5310,19 @@ namespace HFSQtLi
    *   m_db->executeSingle("SELECT blobColumn, rowid FROM TestTable WHERE name="Foo", b, b);
    * \endcode
    * Will not automatically set the Blob parameters
+   *
+   * Binding of arrays (see \ref bindarrays) requires the carray extension and the library to be compiled with SQLITE_ENABLE_CARRAY. Amalgamations that include carray
+   * (SQLite 3.51 or later) enable it with the same define. With older versions ext/misc/carray.c must be compiled and registered (sqlite3_carray_init) separately.
+   *
+   * Gzip compression of exports (Query::exportTo) requires zlib: define HFSQTLI_ENABLE_ZLIB and link the project with zlib (e.g. LIBS += -lz), otherwise the
+   * export fails with SQLITE_MISUSE.
+   *
+   * The binary codecs of QDateTime, QDate, QTime and QUuid (see \ref bindcodecs) are compiled only with HFSQTLI_ENABLE_QT_CODECS defined.
+   *
+ * Sessions and changesets (Db::Session, Db::applyChangeset) require the session extension: compile the library and the amalgamation with SQLITE_ENABLE_SESSION and
+ * SQLITE_ENABLE_PREUPDATE_HOOK, otherwise they fail with SQLITE_MISUSE.
+ *
+ * Some classes (e.g. \ref Backup) are QObject and declare signals, so HFSQtLi/HFSQtLi.h must be listed in the HEADERS of the project to be processed by moc.
   */
 
 }
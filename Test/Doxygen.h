@@ -97,6 +97,21 @@ namespace HFSQtLi
  *  - QByteArray
  *
  *  Text and blob data can be read respectively with QString and QByteArray
+ *  @subsection fetchviews TextView and BlobView
+ *  Text and blob data can also be read without copy as TextView (UTF-8) and BlobView. The views point to the memory of SQLite and are valid until the next step or reset of the query.
+ *  A NULL column gives a null view (isNull()). With Query::fetchAll the values are copied into a ResultArena instead, and stay valid as long as the arena.
+ *  @subsection fetchinterned Interned<QString>
+ *  Text read as Interned<QString> is looked up in the InternPool of the query: repeated values share the same QString, without allocation or UTF-8 decoding.
+ *  @subsection fetchvalues Value, ValueRef and OwnedValue
+ *  A cell of any type can be read as a \ref Value, a copy of the sqlite3_value allocated by SQLite (sqlite3_value_dup). To inspect a cell without any copy read a ValueRef,
+ *  valid until the next step or reset of the query. To keep it read an OwnedValue: numbers and short text or blobs (up to OwnedValue::InlineSize bytes) are stored without heap allocation.
+ *  ValueRef and OwnedValue can also be bound, e.g. to copy a cell from a query to another.
+ *  @subsection fetchcodecs Dates, times and UUIDs
+ *  QDateTime, std::chrono::system_clock::time_point, JulianDay<T>, QDate, QTime and QUuid are fetched from their binary encodings, see \ref bindcodecs
+ *  (QDateTime, QDate, QTime and QUuid only with HFSQTLI_ENABLE_QT_CODECS defined).
+ *  @subsection fetchrowbuffer RowBuffer
+ *  A RowBuffer reads all the remaining columns of the row, for queries whose columns are known only at run time. The buffer is reused across steps,
+ *  and its cells are converted to QString, QVariant or QJsonValue only when accessed.
  *  @section fetchcpptypes C++ data types
  *  @subsection fetchoptional std::optional<T>
  *  If the fetched column is NULL the result is cleared, othewise the value will be read as if the type T was read diredtly.
@@ -141,6 +156,8 @@ namespace HFSQtLi
  *
  *  This function will have to use the passed accessor to retrive the needed column(s) and set data
  *  \see CustomFetch
+ *
+ *  Structs whose fields are stored as consecutive columns can be declared with HFSQTLI_MAP instead, without writing customFetch (see \ref Mapping).
  */
 
   /** @page bindtypes Bounded data types
@@ -204,6 +221,42 @@ namespace HFSQtLi
    *  \code
    *   qry.bind(ZeroBlob(50));
    * \endcode
+   *  @section bindarrays Arrays
+   *  The following types are bound as a single pointer that can be used as a table with the carray table-valued function (see https://sqlite.org/carray.html):
+   *  - QVector<int>, QVector<qint64>, QVector<double>
+   *  - QStringList
+   *  - CArray<T>, a view over any contiguous array of int, qint64, double or const char *
+   *
+   *  This allows one prepared statement to serve any number of values, e.g. for IN lists:
+   *  \code
+   *   QVector<qint64> ids{4, 8, 15, 16, 23, 42};
+   *   qry.prepare("SELECT name FROM items WHERE id IN carray($1)");
+   *   qry.bind(1, ids);
+   * \endcode
+   *  With the standard version of the bind functions the array is copied by SQLite. With the temporary version no copy is made, so the array must not be
+   *  modified or destroyed until the bindings are cleared. QStringList is always converted to UTF-8 in a single block owned by SQLite.
+   *
+   *  Binding arrays requires SQLite to be compiled with SQLITE_ENABLE_CARRAY (see \ref howtocompile), otherwise the bind fails with SQLITE_MISUSE.
+   *  @section bindcodecs Dates, times and UUIDs
+   *  The following Qt and standard types are bound and fetched with compact binary encodings, which keep keys small and index B-trees dense:
+   *  - QDateTime and std::chrono::system_clock::time_point: INTEGER, microseconds since 1970-01-01T00:00:00Z (QDateTime has millisecond precision,
+   *    values are rounded to the nearest millisecond when fetched). Wrapped in JulianDay<T> they are bound as REAL Julian days instead, directly usable by
+   *    the date and time functions of SQLite (a double has a resolution of about 40 µs, so they are rounded to the nearest millisecond when fetched,
+   *    also for std::chrono time points).
+   *  - QDate: INTEGER, the Julian day number (QDate::toJulianDay)
+   *  - QTime: INTEGER, milliseconds since midnight
+   *  - QUuid: 16 bytes BLOB (QUuid::toRfc4122)
+   *
+   *  Invalid QDateTime, QDate and QTime are bound as NULL, and NULL is fetched as an invalid value. Non strict fetches also convert numbers of the other
+   *  encoding and parse ISO 8601 text, so columns written as text can still be read (text without an offset, e.g. written by datetime(), is UTC). These types can be fields of structs mapped with HFSQTLI_MAP.
+   *
+   *  The codecs of QDateTime, QDate, QTime and QUuid are enabled by defining HFSQTLI_ENABLE_QT_CODECS (see \ref howtocompile): projects that already
+   *  declare customBindConst/customFetch for these types would otherwise get ambiguous overloads. std::chrono time points and JulianDay<T> are always
+   *  available, JulianDay<QDateTime> included.
+   *  \code
+   *   qry.prepare("SELECT count(*) FROM events WHERE time BETWEEN $1 AND $2"); // Integer comparison, no string parsing
+   *   qry.bind(1, from, to); // QDateTime
+   * \endcode
  *  @section bindcustomtypes Custom data types
  *  It is possible to handle the binding of any data type T by implementing one of the following functions:
  *
@@ -212,6 +265,9 @@ namespace HFSQtLi
  *
  *  This function will have to use the passed accessor to bind the needed column(s) using data
  *  \see CustomBind
+ *
+ *  Structs whose fields are bound as consecutive parameters can be declared with HFSQTLI_MAP instead, without writing customBind (see \ref Mapping).
+ *  Mapped fields are bound at offsets computed at compile time, without the bookkeeping of CustomBind.
  */
 
   /** @page howtocompile Build instruction and requirements
@@ -230,6 +286,19 @@ namespace HFSQtLi
    *   m_db->executeSingle("SELECT blobColumn, rowid FROM TestTable WHERE name="Foo", b, b);
    * \endcode
    * Will not automatically set the Blob parameters
+   *
+   * Binding of arrays (see \ref bindarrays) requires the carray extension and the library to be compiled with SQLITE_ENABLE_CARRAY. Amalgamations that include carray
+   * (SQLite 3.51 or later) enable it with the same define. With older versions ext/misc/carray.c must be compiled and registered (sqlite3_carray_init) separately.
+   *
+   * Gzip compression of exports (Query::exportTo) requires zlib: define HFSQTLI_ENABLE_ZLIB and link the project with zlib (e.g. LIBS += -lz), otherwise the
+   * export fails with SQLITE_MISUSE.
+   *
+   * The binary codecs of QDateTime, QDate, QTime and QUuid (see \ref bindcodecs) are compiled only with HFSQTLI_ENABLE_QT_CODECS defined.
+   *
+ * Sessions and changesets (Db::Session, Db::applyChangeset) require the session extension: compile the library and the amalgamation with SQLITE_ENABLE_SESSION and
+ * SQLITE_ENABLE_PREUPDATE_HOOK, otherwise they fail with SQLITE_MISUSE.
+ *
+ * Some classes (e.g. \ref Backup) are QObject and declare signals, so HFSQtLi/HFSQtLi.h must be listed in the HEADERS of the project to be processed by moc.
   */
 
 }
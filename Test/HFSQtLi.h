@@ -16,7 +16,19 @@ limitations under the License.
 #pragma once
 #include "util.h"
 #include "blob.h"
+#include "arena.h"
+#include "intern.h"
+#include "rowbuffer.h"
 #include "database.h"
 #include "query.h"
+#include "codecs.h"
+#include "backup.h"
+#include "checkpoint.h"
+#include "changes.h"
+#include "session.h"
+#include "importer.h"
+#include "multiinsert.h"
+#include "statement.h"
+#include "querymodel.h"
 #include "Doxygen.h"
 #include "license.h"
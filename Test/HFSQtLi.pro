@@ -2,28 +2,70 @@ QT       += core testlib
 
 # Needed for blob select queries
 DEFINES += SQLITE_ENABLE_COLUMN_METADATA
+# Needed for sessions and changesets
+DEFINES += SQLITE_ENABLE_SESSION SQLITE_ENABLE_PREUPDATE_HOOK
+# Needed for binding arrays
+DEFINES += SQLITE_ENABLE_CARRAY
+# Codecs of QDateTime, QDate, QTime and QUuid
+DEFINES += HFSQTLI_ENABLE_QT_CODECS
 
 
 SOURCES += \
+    arena.cpp \
+    backup.cpp \
     blob.cpp \
+    changes.cpp \
+    checkpoint.cpp \
+    codecs.cpp \
     database.cpp \
+    exporter.cpp \
+    function.cpp \
+    importer.cpp \
+    intern.cpp \
+    mapping.cpp \
+    multiinsert.cpp \
     query.cpp \
+    querymodel.cpp \
+    resultcache.cpp \
+    rowbuffer.cpp \
+    session.cpp \
     sqlite3.c \
+    statement.cpp \
     test.cpp \
-    util.cpp
+    util.cpp \
+    vtable.cpp \
+    writer.cpp
 
 HEADERS += \
     Doxygen.h \
     HFSQtLi.h \
     NameType.h \
+    arena.h \
+    backup.h \
     blob.h \
+    changes.h \
+    checkpoint.h \
+    codecs.h \
     database.h \
     database_template.h \
+    exporter.h \
+    function.h \
+    importer.h \
+    intern.h \
+    multiinsert.h \
     license.h \
+    mapping.h \
     query.h \
     query_template.h \
+    querymodel.h \
+    resultcache.h \
+    rowbuffer.h \
+    session.h \
     sqlite3.h \
+    statement.h \
     templatehelper.h \
     test.h \
     util.h \
-    util_template.h
+    util_template.h \
+    vtable.h \
+    writer.h
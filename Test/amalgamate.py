@@ -25,6 +25,8 @@ def parseUniversal(fname, opened, exclude, outHeader, outBody, included=None, fi
   hadInitialComment=False
   inInitialComment=False
   initialComment=""
+  # Depth of the #if blocks: includes inside them are conditional and are kept in place
+  conditional=0
   for line in f:
     if inInitialComment:
       initialComment+=line
@@ -42,6 +44,11 @@ def parseUniversal(fname, opened, exclude, outHeader, outBody, included=None, fi
         continue
       else:
         hadInitialComment=True
+    directive=line.strip()
+    if re.match(r"#\s*if", directive):
+      conditional+=1
+    elif re.match(r"#\s*endif", directive):
+      conditional-=1
     if line.startswith("#pragma") and "once" in line:
       if first:
         outHeader.write(line)
@@ -53,7 +60,9 @@ def parseUniversal(fname, opened, exclude, outHeader, outBody, included=None, fi
           used=False
         else:
           used=parseUniversal(refinclude.group(1), opened, exclude, outHeader, outBody, included=included, directory=directory)
-      if not used and not line.strip() in included:
+      if not used and conditional>0:
+        outBody.write(line)
+      elif not used and not line.strip() in included:
         outHeader.write(line)
         included.add(line.strip())
     else:
@@ -0,0 +1,75 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "arena.h"
+#include <cstring>
+
+using namespace HFSQtLi;
+
+ResultArena::ResultArena(qsizetype slabSize): m_slabSize(qMax<qsizetype>(slabSize, 64)), m_next(nullptr), m_left(0), m_used(0), m_allocated(0)
+{
+}
+
+ResultArena::~ResultArena()
+{
+  for(char *slab: qAsConst(m_slabs))
+    delete[] slab;
+  for(char *large: qAsConst(m_large))
+    delete[] large;
+}
+
+const char *ResultArena::store(const char *data, qsizetype size, bool terminate)
+{
+  if(size==0 && !terminate)
+    return "";
+  char *ret=allocate(size+(terminate?1:0));
+  if(size>0)
+    memcpy(ret, data, size);
+  if(terminate)
+    ret[size]=0;
+  return ret;
+}
+
+void ResultArena::clear()
+{
+  for(char *large: qAsConst(m_large))
+    delete[] large;
+  m_large.clear();
+  for(int i=1;i<m_slabs.size();i++)
+    delete[] m_slabs[i];
+  m_slabs.resize(qMin<qsizetype>(m_slabs.size(), 1));
+  m_next=m_slabs.isEmpty()?nullptr:m_slabs[0];
+  m_left=m_slabs.isEmpty()?0:m_slabSize;
+  m_allocated=m_left;
+  m_used=0;
+}
+
+char *ResultArena::allocateSlab(qsizetype size)
+{
+  if(size>m_slabSize/4)
+  {
+    // The current slab keeps serving small values
+    char *ret=new char[size];
+    m_large.append(ret);
+    m_allocated+=size;
+    return ret;
+  }
+  char *slab=new char[m_slabSize];
+  m_slabs.append(slab);
+  m_allocated+=m_slabSize;
+  m_next=slab+size;
+  m_left=m_slabSize-size;
+  return slab;
+}
@@ -0,0 +1,83 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QVector>
+
+namespace HFSQtLi
+{
+  /**
+   * @brief Bump allocator holding the text and blob values of a result set, see Query::fetchAll.
+   *
+   * Memory is taken from large slabs: allocating is a pointer increment and all the values are freed at once when the arena is cleared or destroyed,
+   * instead of one QString or QByteArray allocated and freed per value. Values larger than a quarter of a slab get a slab of their own.
+   * \code
+   * ResultArena arena;
+   * QVector<std::tuple<qint64, TextView>> rows;
+   * qry.fetchAll(arena, rows); // Views point to the arena, valid until it is cleared or destroyed
+   * \endcode
+   */
+  class ResultArena
+  {
+  public:
+    /**
+     * @brief Constructs an empty arena. No memory is allocated until the first value is stored.
+     * @param slabSize Size in bytes of the slabs
+     */
+    explicit ResultArena(qsizetype slabSize=1024*1024);
+    ResultArena(const ResultArena &other)=delete;
+    ResultArena &operator=(const ResultArena &other)=delete;
+    ~ResultArena();
+    /// @brief Allocates size bytes, not aligned
+    inline char *allocate(qsizetype size);
+    /**
+     * @brief Copies data in the arena
+     * @param data Data to copy
+     * @param size Size in bytes
+     * @param terminate If true a nul character is added after the data
+     * @return Pointer to the copy
+     */
+    const char *store(const char *data, qsizetype size, bool terminate=false);
+    /// @brief Frees all the values. The first slab is kept for reuse.
+    void clear();
+    /// @brief Bytes used by the stored values
+    qsizetype bytesUsed() const { return m_used; }
+    /// @brief Bytes allocated for the slabs
+    qsizetype bytesAllocated() const { return m_allocated; }
+  protected:
+    char *allocateSlab(qsizetype size);
+    qsizetype m_slabSize;
+    QVector<char *> m_slabs;
+    // Values larger than a quarter of a slab
+    QVector<char *> m_large;
+    char *m_next;
+    qsizetype m_left;
+    qsizetype m_used;
+    qsizetype m_allocated;
+  };
+
+  char *ResultArena::allocate(qsizetype size)
+  {
+    m_used+=size;
+    if(size<=m_left)
+    {
+      char *ret=m_next;
+      m_next+=size;
+      m_left-=size;
+      return ret;
+    }
+    return allocateSlab(size);
+  }
+}
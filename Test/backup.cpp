@@ -0,0 +1,85 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "backup.h"
+#include "database.h"
+#include "sqlite3.h"
+
+using namespace HFSQtLi;
+
+Backup::Backup(Db *source, const char *sourceName, Db *destination, const char *destinationName, bool ownDestination, int pagesPerStep, int sleepBetweenSteps):
+  m_source(source), m_destination(destination), m_sourceName(sourceName?sourceName:"main"), m_destinationName(destinationName?destinationName:"main"),
+  m_pagesPerStep(pagesPerStep>0?pagesPerStep:-1), m_sleepBetweenSteps(qMax(sleepBetweenSteps, 0)), m_remaining(-1), m_pageCount(-1), m_error(SQLITE_OK)
+{
+  if(ownDestination)
+    m_ownedDestination.reset(destination);
+  if(m_source)
+    m_source->m_queryCount++;
+  if(m_destination)
+    m_destination->m_queryCount++;
+}
+
+Backup::~Backup()
+{
+  requestInterruption();
+  wait();
+  if(m_source)
+    m_source->m_queryCount--;
+  if(m_destination)
+    m_destination->m_queryCount--;
+}
+
+void Backup::run()
+{
+  sqlite3_backup *backup=nullptr;
+  if(!m_source || !m_source->m_db || !m_destination || !m_destination->m_db)
+  {
+    m_error=SQLITE_MISUSE;
+    m_errorMsg=SQLiteCode::errorString(m_error);
+    return;
+  }
+  {
+    // Note: errors of sqlite3_backup_init are stored in the destination connection
+    Db::Lock lock(m_destination, true);
+    backup=sqlite3_backup_init(m_destination->m_db, m_destinationName.constData(), m_source->m_db, m_sourceName.constData());
+    m_error=backup?SQLITE_OK:sqlite3_errcode(m_destination->m_db);
+    lock.release(m_error, m_errorMsg);
+  }
+  if(!backup)
+    return;
+  do
+  {
+    // Every step locks the source only for the pages it copies. Writes done by other connections between steps make SQLite restart the backup on the next step.
+    m_error=sqlite3_backup_step(backup, m_pagesPerStep);
+    m_remaining=sqlite3_backup_remaining(backup);
+    m_pageCount=sqlite3_backup_pagecount(backup);
+    emit progress(m_remaining, m_pageCount);
+    if(m_error!=SQLITE_DONE && m_sleepBetweenSteps>0)
+      msleep(m_sleepBetweenSteps);
+  } while((m_error==SQLITE_OK || m_error==SQLITE_BUSY || m_error==SQLITE_LOCKED) && !isInterruptionRequested());
+
+  int finishError=sqlite3_backup_finish(backup);
+  if(m_error==SQLITE_DONE)
+    m_error=finishError;
+  else if(m_error==SQLITE_OK || m_error==SQLITE_BUSY || m_error==SQLITE_LOCKED)
+    m_error=SQLITE_INTERRUPT;
+  {
+    Db::Lock lock(m_destination, true);
+    if(m_error==SQLITE_INTERRUPT)
+      lock.releaseInternal(m_error, m_errorMsg);
+    else
+      lock.release(m_error, m_errorMsg);
+  }
+}
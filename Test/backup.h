@@ -0,0 +1,93 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QThread>
+#include <QScopedPointer>
+#include <QByteArray>
+#include "util.h"
+
+namespace HFSQtLi
+{
+  class Db;
+  /**
+   * @brief Online backup of a database (struct sqlite3_backup) running in a background thread.
+   *
+   * The backup copies a fixed number of pages per step and releases the source database between steps, so writers on the source are never blocked for the whole copy.
+   * If the source is modified during the backup SQLite takes care of the consistency of the copy: changes made through the same connection are applied to the destination too,
+   * while changes made by other connections or processes restart the backup automatically at the next step.
+   *
+   * No public constructor is available, instances are created via Db::backupTo. The backup is not started until start() is called, giving a chance to connect to the signals.
+   *
+   * Example usage:
+   * \code
+   * Backup *backup=db->backupTo("copy.sqlite", 256, 5);
+   * QObject::connect(backup, &Backup::progress, [](int remaining, int pageCount){ qDebug()<<remaining<<"/"<<pageCount; });
+   * QObject::connect(backup, &QThread::finished, backup, &QObject::deleteLater);
+   * backup->start();
+   * \endcode
+   */
+  class Backup: public QThread
+  {
+    Q_OBJECT
+    friend class Db;
+  public:
+    ~Backup();
+    /**
+     * @brief Error code of the backup.
+     *
+     * Valid only once the thread has finished.
+     * @return SQLITE_OK when the backup completed successfully, SQLITE_INTERRUPT if it was cancelled, another error code on failure
+     */
+    int error() const { return m_error; }
+    /**
+     * @brief Error message of the backup
+     * @return The error message or an empty string on success.
+     */
+    QString errorMsg() const { return m_errorMsg; }
+    /**
+     * @brief Checks if the backup completed successfully
+     * @return True if the backup has finished copying all pages
+     */
+    bool isOk() const { return isFinished() && m_error==SQLiteCode::OK; }
+    /// @brief Number of pages still to be copied after last step
+    int remaining() const { return m_remaining; }
+    /// @brief Total number of pages in the source database after last step
+    int pageCount() const { return m_pageCount; }
+    /// @brief Requests the backup to stop at the end of the current step. The destination is left in an undefined state.
+    void cancel() { requestInterruption(); }
+  signals:
+    /**
+     * @brief Emitted after every step of the backup
+     * @param remaining Number of pages still to be copied
+     * @param pageCount Total number of pages of source database
+     */
+    void progress(int remaining, int pageCount);
+  protected:
+    Backup(Db *source, const char *sourceName, Db *destination, const char *destinationName, bool ownDestination, int pagesPerStep, int sleepBetweenSteps);
+    void run() override;
+    Db *m_source;
+    Db *m_destination;
+    QScopedPointer<Db> m_ownedDestination;
+    QByteArray m_sourceName;
+    QByteArray m_destinationName;
+    int m_pagesPerStep;
+    int m_sleepBetweenSteps;
+    std::atomic_int m_remaining;
+    std::atomic_int m_pageCount;
+    int m_error;
+    QString m_errorMsg;
+  };
+}
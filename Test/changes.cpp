@@ -0,0 +1,178 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "changes.h"
+#include "database.h"
+#include "resultcache.h"
+#include "sqlite3.h"
+#include <cstring>
+
+using namespace HFSQtLi;
+
+QVector<qint64> ChangeSet::rowids(const QString &table, Operation operation) const
+{
+  QVector<qint64> ret;
+  int index=m_tables.indexOf(table);
+  if(index>=0)
+  {
+    for(const Change &change: m_changes)
+      if(change.table==index && change.operation==operation)
+        ret.append(change.rowid);
+  }
+  return ret;
+}
+
+ChangeNotifier::ChangeNotifier(Db *db): m_db(db), m_maxChanges(100000), m_transactions(0), m_committing(false), m_commitVersion(0), m_lastIndex(-1)
+{
+  qRegisterMetaType<ChangeSet>();
+  if(m_db && m_db->m_db)
+  {
+    sqlite3_update_hook(m_db->m_db, &ChangeNotifier::updateHook, this);
+    sqlite3_commit_hook(m_db->m_db, &ChangeNotifier::commitHook, this);
+    sqlite3_rollback_hook(m_db->m_db, &ChangeNotifier::rollbackHook, this);
+  }
+}
+
+ChangeNotifier::~ChangeNotifier()
+{
+  if(m_db && m_db->m_db)
+  {
+    sqlite3_update_hook(m_db->m_db, nullptr, nullptr);
+    sqlite3_commit_hook(m_db->m_db, nullptr, nullptr);
+    sqlite3_rollback_hook(m_db->m_db, nullptr, nullptr);
+  }
+}
+
+QStringList ChangeNotifier::tables() const
+{
+  QStringList ret;
+  for(const QByteArray &table: m_filter)
+    ret.append(QString::fromUtf8(table));
+  return ret;
+}
+
+void ChangeNotifier::setTables(const QStringList &tables)
+{
+  m_filter.clear();
+  for(const QString &table: tables)
+    m_filter.insert(table.toUtf8());
+  m_lastName.clear();
+  m_lastIndex=-1;
+}
+
+int ChangeNotifier::tableIndex(const char *table)
+{
+  if(!m_lastName.isNull() && strcmp(m_lastName.constData(), table)==0)
+    return m_lastIndex;
+  m_lastName=table;
+  m_lastIndex=-1;
+  if(m_filter.isEmpty() || m_filter.contains(m_lastName))
+  {
+    m_lastIndex=m_names.indexOf(m_lastName);
+    if(m_lastIndex<0)
+    {
+      m_lastIndex=m_names.size();
+      m_names.append(m_lastName);
+      m_pending.m_tables.append(QString::fromUtf8(m_lastName));
+    }
+  }
+  return m_lastIndex;
+}
+
+void ChangeNotifier::updateHook(void *notifier, int operation, const char *, const char *table, qint64 rowid)
+{
+  auto *self=static_cast<ChangeNotifier *>(notifier);
+  self->checkCommitted(false);
+  if(self->m_db->m_resultCache)
+    self->m_db->m_resultCache->tableChanged(table);
+  int index=self->tableIndex(table);
+  if(index<0)
+    return;
+  ChangeSet &pending=self->m_pending;
+  if(pending.m_truncated)
+    return;
+  if(pending.m_changes.size()>=self->m_maxChanges)
+  {
+    // Too many rows: report only the tables
+    pending.m_truncated=true;
+    pending.m_changes.clear();
+    pending.m_changes.squeeze();
+    return;
+  }
+  ChangeSet::Operation op=operation==SQLITE_INSERT?ChangeSet::Operation::Insert:(operation==SQLITE_DELETE?ChangeSet::Operation::Delete:ChangeSet::Operation::Update);
+  pending.m_changes.append(ChangeSet::Change{rowid, index, op});
+}
+
+int ChangeNotifier::commitHook(void *notifier)
+{
+  auto *self=static_cast<ChangeNotifier *>(notifier);
+  // The previous commit may have completed without any other hook being called since then
+  self->checkCommitted(false);
+  // The tables changed for the result cache are also released only once the commit is done
+  ResultCache *cache=self->m_db->m_resultCache;
+  if(!self->m_pending.isEmpty() || (cache && cache->hasDirtyTables()))
+  {
+    // The hook runs before the commit is written and the commit can still fail (e.g. COMMIT returning SQLITE_BUSY): hold the changes until it is done
+    self->m_committing=true;
+    self->m_commitVersion=self->dataVersion();
+    QMetaObject::invokeMethod(self, [self](){ self->checkCommitted(sqlite3_get_autocommit(self->m_db->m_db)!=0); }, Qt::QueuedConnection);
+  }
+  return 0;
+}
+
+void ChangeNotifier::rollbackHook(void *notifier)
+{
+  auto *self=static_cast<ChangeNotifier *>(notifier);
+  if(self->m_db->m_resultCache)
+    self->m_db->m_resultCache->transactionEnd(false);
+  // Changes held by a failed commit are dropped, those of a previous successful commit are still reported
+  self->checkCommitted(false);
+  self->clearPending();
+}
+
+unsigned int ChangeNotifier::dataVersion() const
+{
+  // Changed by SQLite every time a transaction is committed to the main database
+  unsigned int version=0;
+  sqlite3_file_control(m_db->m_db, "main", SQLITE_FCNTL_DATA_VERSION, &version);
+  return version;
+}
+
+void ChangeNotifier::checkCommitted(bool finished)
+{
+  if(!m_committing || (!finished && dataVersion()==m_commitVersion))
+    return;
+  if(m_db->m_resultCache)
+    m_db->m_resultCache->transactionEnd(true);
+  if(m_pending.isEmpty())
+  {
+    m_committing=false;
+    return;
+  }
+  m_transactions++;
+  ChangeSet changes=std::move(m_pending);
+  clearPending();
+  // The connection can't be used inside the hooks: deliver the signal from the event loop
+  QMetaObject::invokeMethod(this, [this, changes](){ emit changed(changes); }, Qt::QueuedConnection);
+}
+
+void ChangeNotifier::clearPending()
+{
+  m_pending=ChangeSet();
+  m_names.clear();
+  m_lastName.clear();
+  m_lastIndex=-1;
+  m_committing=false;
+}
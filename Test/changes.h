@@ -0,0 +1,158 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <QSet>
+#include <QMetaType>
+
+namespace HFSQtLi
+{
+  class Db;
+  class ChangeNotifier;
+  /**
+   * @brief Rows changed by a committed transaction, as reported by ChangeNotifier::changed.
+   *
+   * Every change is stored as a table index, an operation and a rowid (16 bytes), table names are stored once.
+   * If the transaction changed more than ChangeNotifier::maxChanges() rows the rowids are dropped: only the tables are reported and isTruncated() is true.
+   */
+  class ChangeSet
+  {
+    friend class ChangeNotifier;
+  public:
+    /// @brief Type of change
+    enum class Operation: int
+    {
+      Insert,
+      Update,
+      Delete
+    };
+    /// @brief True if no change is reported
+    bool isEmpty() const { return m_tables.isEmpty(); }
+    /// @brief True if the rowids were dropped because the transaction changed too many rows
+    bool isTruncated() const { return m_truncated; }
+    /// @brief Tables changed by the transaction
+    const QStringList &tables() const { return m_tables; }
+    /// @brief True if table was changed by the transaction
+    bool contains(const QString &table) const { return m_tables.contains(table); }
+    /// @brief Number of changed rows reported
+    int size() const { return m_changes.size(); }
+    /// @brief Table of change i
+    const QString &table(int i) const { return m_tables.at(m_changes.at(i).table); }
+    /// @brief Operation of change i
+    Operation operation(int i) const { return m_changes.at(i).operation; }
+    /// @brief Rowid of change i
+    qint64 rowid(int i) const { return m_changes.at(i).rowid; }
+    /**
+     * @brief Rowids changed in a table
+     * @param table Name of the table
+     * @param operation Type of change
+     * @return The rowids in the order the changes were done. A row changed more than once is reported more than once.
+     */
+    QVector<qint64> rowids(const QString &table, Operation operation) const;
+  protected:
+    struct Change
+    {
+      qint64 rowid;
+      int table;
+      Operation operation;
+    };
+    QStringList m_tables;
+    QVector<Change> m_changes;
+    bool m_truncated=false;
+  };
+
+  /**
+   * @brief Notifies the rows changed by every transaction committed on a connection.
+   *
+   * The notifier installs the update, commit and rollback hooks of the connection (sqlite3_update_hook, sqlite3_commit_hook, sqlite3_rollback_hook):
+   * changes are accumulated while the transaction runs, dropped on rollback and delivered with a single changed() signal per committed transaction.
+   * This replaces polling the tables to discover new data.
+   *
+   * The commit hook is called before the commit is written: the changes are held until the commit is known to be done (the data version of the main database
+   * changed or, when the signal is delivered, no transaction is open) and are dropped if the commit fails, e.g. when COMMIT returns SQLITE_BUSY and the
+   * transaction is then rolled back.
+   *
+   * The signal is delivered through the event loop of the thread of the notifier, so slots can safely use the connection and run after the commit completed.
+   * Note the limits of the hooks:
+   * - Changes made by other connections or processes are not reported.
+   * - WITHOUT ROWID tables and changes done by the truncate optimization (DELETE without WHERE) are not reported.
+   * - Rows changed by a statement or savepoint rolled back inside a transaction that is then committed are still reported.
+   *
+   * Only one instance exists per connection, returned by Db::changes(), and it is owned by the database.
+   * Any hook installed on the connection in other ways is replaced.
+   * \code
+   * db->changes()->setTables({"messages"});
+   * QObject::connect(db->changes(), &ChangeNotifier::changed, view, [view](const ChangeSet &changes){
+   *   view->append(changes.rowids("messages", ChangeSet::Operation::Insert));
+   * });
+   * \endcode
+   */
+  class ChangeNotifier: public QObject
+  {
+    Q_OBJECT
+    friend class Db;
+    friend class ResultCache;
+  public:
+    ~ChangeNotifier();
+    /// @brief Tables whose changes are reported, empty to report all tables
+    QStringList tables() const;
+    /// @brief Sets the tables whose changes are reported (empty to report all tables). Call it from the thread writing to the connection or while no transaction is running.
+    void setTables(const QStringList &tables);
+    /// @brief Maximum number of rowids reported for a transaction
+    int maxChanges() const { return m_maxChanges; }
+    /// @brief Sets the maximum number of rowids reported for a transaction (default 100000), over which the ChangeSet is truncated
+    void setMaxChanges(int changes) { m_maxChanges=qMax(changes, 0); }
+    /// @brief Number of transactions reported
+    qint64 transactionCount() const { return m_transactions; }
+  signals:
+    /**
+     * @brief Emitted once for every committed transaction that changed at least one row of the tables in tables()
+     * @param changes The changed rows
+     */
+    void changed(const HFSQtLi::ChangeSet &changes);
+  protected:
+    explicit ChangeNotifier(Db *db);
+    static void updateHook(void *notifier, int operation, const char *database, const char *table, qint64 rowid);
+    static int commitHook(void *notifier);
+    static void rollbackHook(void *notifier);
+    int tableIndex(const char *table);
+    void clearPending();
+    // Data version of the main database (SQLITE_FCNTL_DATA_VERSION)
+    unsigned int dataVersion() const;
+    // Reports the held changes if the commit is done: finished is true if the transaction is known to be ended, otherwise the data version is checked
+    void checkCommitted(bool finished);
+    Db *m_db;
+    QSet<QByteArray> m_filter;
+    int m_maxChanges;
+    qint64 m_transactions;
+    // True if the commit hook was called for m_pending (or for the tables changed for the result cache) and the commit is not known to be done yet
+    bool m_committing;
+    unsigned int m_commitVersion;
+    // Changes of the running transaction
+    ChangeSet m_pending;
+    // UTF-8 names of m_pending.tables()
+    QVector<QByteArray> m_names;
+    // Consecutive changes are usually to the same table: cache the result of the last lookup (-1 if filtered out)
+    QByteArray m_lastName;
+    int m_lastIndex;
+  };
+}
+
+Q_DECLARE_METATYPE(HFSQtLi::ChangeSet)
@@ -0,0 +1,135 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "checkpoint.h"
+#include "database.h"
+#include "sqlite3.h"
+#include <QFileInfo>
+#include <QElapsedTimer>
+
+#ifndef SQLITE_DEFAULT_WAL_AUTOCHECKPOINT
+#define SQLITE_DEFAULT_WAL_AUTOCHECKPOINT 1000
+#endif
+
+using namespace HFSQtLi;
+
+namespace
+{
+  // The value set by sqlite3_wal_autocheckpoint can only be read back with the pragma
+  int autoCheckpointPages(sqlite3 *db)
+  {
+    int ret=SQLITE_DEFAULT_WAL_AUTOCHECKPOINT;
+    sqlite3_stmt *stmt=nullptr;
+    if(sqlite3_prepare_v2(db, "PRAGMA wal_autocheckpoint", -1, &stmt, nullptr)==SQLITE_OK && sqlite3_step(stmt)==SQLITE_ROW)
+      ret=sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return ret;
+  }
+}
+
+Checkpointer::Checkpointer(Db *source, Db *connection, const QString &walFilename, int interval, qint64 walSizeLimit):
+  m_source(source), m_connection(connection), m_walFilename(walFilename), m_interval(qMax(interval, 1)), m_walSizeLimit(walSizeLimit), m_escalation(Mode::Truncate),
+  m_stop(false), m_wakeRequested(false), m_previousAutoCheckpoint(SQLITE_DEFAULT_WAL_AUTOCHECKPOINT), m_error(SQLITE_OK), m_lastWalSize(0), m_lastDuration(0), m_maxDuration(0), m_checkpointCount(0), m_escalatedCount(0)
+{
+  if(m_source)
+    m_source->m_queryCount++;
+}
+
+Checkpointer::~Checkpointer()
+{
+  stop();
+  if(m_source)
+    m_source->m_queryCount--;
+}
+
+void Checkpointer::checkpointNow()
+{
+  QMutexLocker locker(&m_mutex);
+  m_wakeRequested=true;
+  m_wake.wakeAll();
+}
+
+void Checkpointer::stop()
+{
+  {
+    QMutexLocker locker(&m_mutex);
+    m_stop=true;
+    m_wake.wakeAll();
+  }
+  wait();
+}
+
+int Checkpointer::checkpoint(bool escalate, int &logFrames, int &checkpointedFrames)
+{
+  int mode=SQLITE_CHECKPOINT_PASSIVE;
+  if(escalate)
+  {
+    switch(m_escalation)
+    {
+      case Mode::Passive: mode=SQLITE_CHECKPOINT_PASSIVE; break;
+      case Mode::Full: mode=SQLITE_CHECKPOINT_FULL; break;
+      case Mode::Restart: mode=SQLITE_CHECKPOINT_RESTART; break;
+      case Mode::Truncate: mode=SQLITE_CHECKPOINT_TRUNCATE; break;
+    }
+  }
+  Db::Lock lock(m_connection.data(), true);
+  int ret=sqlite3_wal_checkpoint_v2(m_connection->m_db, nullptr, mode, &logFrames, &checkpointedFrames);
+  QMutexLocker locker(&m_mutex);
+  lock.release(ret, m_errorMsg);
+  return ret;
+}
+
+void Checkpointer::run()
+{
+  if(!m_source || !m_source->m_db || !m_connection || !m_connection->m_db)
+  {
+    m_error=SQLITE_MISUSE;
+    QMutexLocker locker(&m_mutex);
+    m_errorMsg=SQLiteCode::errorString(SQLITE_MISUSE);
+    return;
+  }
+  m_previousAutoCheckpoint=autoCheckpointPages(m_source->m_db);
+  sqlite3_wal_autocheckpoint(m_source->m_db, 0);
+  QMutexLocker locker(&m_mutex);
+  while(!m_stop)
+  {
+    if(!m_wakeRequested)
+      m_wake.wait(&m_mutex, m_interval);
+    m_wakeRequested=false;
+    if(m_stop)
+      break;
+    locker.unlock();
+
+    qint64 walSize=QFileInfo(m_walFilename).size();
+    bool escalate=(m_walSizeLimit>0 && walSize>m_walSizeLimit);
+    int logFrames=-1, checkpointedFrames=-1;
+    QElapsedTimer timer;
+    timer.start();
+    m_error=checkpoint(escalate, logFrames, checkpointedFrames);
+    qint64 duration=timer.nsecsElapsed()/1000;
+
+    m_lastWalSize=walSize;
+    m_lastDuration=duration;
+    if(duration>m_maxDuration)
+      m_maxDuration=duration;
+    m_checkpointCount++;
+    if(escalate)
+      m_escalatedCount++;
+    emit checkpointed(walSize, logFrames, checkpointedFrames, duration);
+    locker.relock();
+  }
+  locker.unlock();
+  sqlite3_wal_autocheckpoint(m_source->m_db, m_previousAutoCheckpoint);
+}
@@ -0,0 +1,124 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QScopedPointer>
+#include "util.h"
+
+namespace HFSQtLi
+{
+  class Db;
+  /**
+   * @brief Scheduler running WAL checkpoints of a database in a background thread.
+   *
+   * While running, the automatic checkpoint of the source connection is disabled (see sqlite3_wal_autocheckpoint), so no commit done on the source pays the cost of a checkpoint.
+   * Checkpoints are instead performed periodically on a separate connection to the same file. A PASSIVE checkpoint is done on every round; if the WAL file grew over the given limit
+   * the checkpoint escalates to the mode given by escalation() (TRUNCATE by default), which waits for readers and writers using the busy timeout of the background connection.
+   *
+   * When the scheduler stops, the automatic checkpoint of the source is restored to the value it had when the scheduler started.
+   *
+   * No public constructor is available, instances are created via Db::checkpointer. The scheduler is not started until start() is called.
+   * \code
+   * Checkpointer *checkpointer=db->checkpointer(500, 64*1024*1024);
+   * QObject::connect(checkpointer, &Checkpointer::checkpointed, [](qint64 walSize, int, int, qint64 duration){ qDebug()<<walSize<<duration; });
+   * checkpointer->start();
+   * \endcode
+   */
+  class Checkpointer: public QThread
+  {
+    Q_OBJECT
+    friend class Db;
+  public:
+    /// @brief Checkpoint modes (see sqlite3_wal_checkpoint_v2)
+    enum class Mode: int
+    {
+      Passive,
+      Full,
+      Restart,
+      Truncate
+    };
+    ~Checkpointer();
+    /**
+     * @brief Error code of the last checkpoint
+     * @return SQLITE_OK on success. SQLITE_BUSY is returned when an escalated checkpoint could not complete and will be retried on next round.
+     */
+    int error() const { return m_error; }
+    /// @brief Error message of last checkpoint
+    QString errorMsg() const { QMutexLocker locker(&m_mutex); return m_errorMsg; }
+
+    /// @brief Mode used when WAL grows over walSizeLimit()
+    Mode escalation() const { return m_escalation; }
+    /// @brief Sets the mode used when WAL grows over walSizeLimit(). Must be called before start().
+    void setEscalation(Mode mode) { m_escalation=mode; }
+    /// @brief Size of WAL file (in bytes) over which the checkpoint will be escalated
+    qint64 walSizeLimit() const { return m_walSizeLimit; }
+    /// @brief Interval between two checkpoints in milliseconds
+    int interval() const { return m_interval; }
+
+    /// @name Metrics
+    /// @{
+    /// @brief Size in bytes of the WAL file measured before last checkpoint
+    qint64 lastWalSize() const { return m_lastWalSize; }
+    /// @brief Duration of last checkpoint in microseconds
+    qint64 lastDuration() const { return m_lastDuration; }
+    /// @brief Longest checkpoint duration in microseconds
+    qint64 maxDuration() const { return m_maxDuration; }
+    /// @brief Number of checkpoints performed
+    int checkpointCount() const { return m_checkpointCount; }
+    /// @brief Number of checkpoints that were escalated because the WAL exceeded walSizeLimit()
+    int escalatedCount() const { return m_escalatedCount; }
+    /// @}
+
+    /// @brief Wakes the scheduler to perform a checkpoint immediately
+    void checkpointNow();
+    /// @brief Stops the scheduler and waits for it to finish
+    void stop();
+  signals:
+    /**
+     * @brief Emitted after each checkpoint
+     * @param walSize Size in bytes of the WAL before the checkpoint
+     * @param logFrames Number of frames in the WAL (or -1 on error)
+     * @param checkpointedFrames Number of frames checkpointed (or -1 on error)
+     * @param duration Duration of the checkpoint in microseconds
+     */
+    void checkpointed(qint64 walSize, int logFrames, int checkpointedFrames, qint64 duration);
+  protected:
+    Checkpointer(Db *source, Db *connection, const QString &walFilename, int interval, qint64 walSizeLimit);
+    void run() override;
+    int checkpoint(bool escalate, int &logFrames, int &checkpointedFrames);
+    Db *m_source;
+    QScopedPointer<Db> m_connection;
+    QString m_walFilename;
+    int m_interval;
+    qint64 m_walSizeLimit;
+    Mode m_escalation;
+    mutable QMutex m_mutex;
+    QWaitCondition m_wake;
+    bool m_stop;
+    bool m_wakeRequested;
+    // Automatic checkpoint of the source before the scheduler started, restored when it stops
+    int m_previousAutoCheckpoint;
+    std::atomic_int m_error;
+    QString m_errorMsg;
+    std::atomic<qint64> m_lastWalSize;
+    std::atomic<qint64> m_lastDuration;
+    std::atomic<qint64> m_maxDuration;
+    std::atomic_int m_checkpointCount;
+    std::atomic_int m_escalatedCount;
+  };
+}
@@ -0,0 +1,202 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "codecs.h"
+#include <cmath>
+
+using namespace HFSQtLi;
+
+namespace
+{
+  // Julian day of 1970-01-01T00:00:00Z, as returned by julianday('1970-01-01')
+  const double g_unixEpochJulianDay=2440587.5;
+  const double g_microsPerDay=86400000000.0;
+
+  // Rounds to the nearest millisecond: Julian days read back as doubles are a few microseconds off, truncating would lose a millisecond.
+  // Floor division, so that times before the epoch are rounded the same way.
+  qint64 microsToMsecs(qint64 micros)
+  {
+    micros+=500;
+    return micros>=0?micros/1000:-((-micros+999)/1000);
+  }
+}
+
+double Helper::julianDay(qint64 micros)
+{
+  return g_unixEpochJulianDay+micros/g_microsPerDay;
+}
+
+qint64 Helper::julianDayMicros(double day)
+{
+  // Near the current date a double has a resolution of about 40 microseconds: round to the millisecond, like the date functions of SQLite
+  return qint64(std::llround((day-g_unixEpochJulianDay)*(g_microsPerDay/1000)))*1000;
+}
+
+bool Helper::epochMicros(const QDateTime &value, qint64 &micros)
+{
+  if(!value.isValid())
+    return false;
+  micros=value.toMSecsSinceEpoch()*1000;
+  return true;
+}
+
+void Helper::fromEpochMicros(qint64 micros, QDateTime &value)
+{
+  value=QDateTime::fromMSecsSinceEpoch(microsToMsecs(micros), Qt::UTC);
+}
+
+bool Helper::fetchEpochMicros(CustomFetch &fetch, bool julian, qint64 &micros)
+{
+  if(fetch.isStrict())
+  {
+    if(!julian)
+      return fetch.fetchIndex(true, 0, micros)>0;
+    double day=0;
+    if(!fetch.fetchIndex(true, 0, day))
+      return false;
+    micros=julianDayMicros(day);
+    return true;
+  }
+  ValueRef cell;
+  if(!fetch.fetchIndex(false, 0, cell))
+    return false;
+  switch(cell.type())
+  {
+  case Type::Integer:
+  case Type::Float:
+    micros=julian?julianDayMicros(cell.toDouble()):cell.toInt64();
+    return true;
+  case Type::Text:
+  {
+    // Values written as ISO 8601 text, e.g. by datetime() or before the binary encoding was used.
+    // Like the date functions of SQLite, text without an offset ("YYYY-MM-DD HH:MM:SS") is UTC and not local time.
+    QString text=cell.toString();
+    if(text.size()>10 && text.at(10)==QLatin1Char(' '))
+      text[10]=QLatin1Char('T');
+    QDateTime parsed=QDateTime::fromString(text, Qt::ISODateWithMs);
+    if(!parsed.isValid())
+      return false;
+    if(parsed.timeSpec()==Qt::LocalTime)
+      parsed.setTimeSpec(Qt::UTC);
+    micros=parsed.toMSecsSinceEpoch()*1000;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+#ifdef HFSQTLI_ENABLE_QT_CODECS
+void HFSQtLi::customBindConst(CustomBind &bind, const QDateTime &value)
+{
+  qint64 micros;
+  if(Helper::epochMicros(value, micros))
+    bind.bind(micros);
+  else
+    bind.bind(nullptr);
+}
+
+void HFSQtLi::customFetch(CustomFetch &fetch, QDateTime &value)
+{
+  qint64 micros;
+  if(Helper::fetchEpochMicros(fetch, false, micros))
+    Helper::fromEpochMicros(micros, value);
+  else
+    value=QDateTime();
+}
+
+void HFSQtLi::customBindConst(CustomBind &bind, const QDate &value)
+{
+  if(value.isValid())
+    bind.bind(qint64(value.toJulianDay()));
+  else
+    bind.bind(nullptr);
+}
+
+void HFSQtLi::customFetch(CustomFetch &fetch, QDate &value)
+{
+  value=QDate();
+  qint64 day;
+  if(fetch.isStrict())
+  {
+    if(fetch.fetchIndex(true, 0, day))
+      value=QDate::fromJulianDay(day);
+    return;
+  }
+  ValueRef cell;
+  if(!fetch.fetchIndex(false, 0, cell))
+    return;
+  if(cell.isInt() || cell.isFloat())
+    value=QDate::fromJulianDay(cell.toInt64());
+  else if(cell.isText())
+    value=QDate::fromString(cell.toString(), Qt::ISODate);
+}
+
+void HFSQtLi::customBindConst(CustomBind &bind, const QTime &value)
+{
+  if(value.isValid())
+    bind.bind(qint64(value.msecsSinceStartOfDay()));
+  else
+    bind.bind(nullptr);
+}
+
+void HFSQtLi::customFetch(CustomFetch &fetch, QTime &value)
+{
+  value=QTime();
+  qint64 msecs;
+  if(fetch.isStrict())
+  {
+    if(fetch.fetchIndex(true, 0, msecs))
+      value=QTime::fromMSecsSinceStartOfDay(int(msecs));
+    return;
+  }
+  ValueRef cell;
+  if(!fetch.fetchIndex(false, 0, cell))
+    return;
+  if(cell.isInt() || cell.isFloat())
+    value=QTime::fromMSecsSinceStartOfDay(int(cell.toInt64()));
+  else if(cell.isText())
+    value=QTime::fromString(cell.toString(), Qt::ISODateWithMs);
+}
+
+void HFSQtLi::customBindConst(CustomBind &bind, const QUuid &value)
+{
+  // The temporary is moved into the query, not copied
+  bind.bind(value.toRfc4122());
+}
+
+void HFSQtLi::customFetch(CustomFetch &fetch, QUuid &value)
+{
+  value=QUuid();
+  if(fetch.isStrict())
+  {
+    BlobView blob;
+    if(fetch.fetchIndex(true, 0, blob) && blob.size()==16)
+      value=QUuid::fromRfc4122(QByteArray::fromRawData(blob.data(), 16));
+    return;
+  }
+  ValueRef cell;
+  if(!fetch.fetchIndex(false, 0, cell))
+    return;
+  if(cell.isBlob())
+  {
+    BlobView blob=cell.toBlob();
+    if(blob.size()==16)
+      value=QUuid::fromRfc4122(QByteArray::fromRawData(blob.data(), 16));
+  }
+  else if(cell.isText())
+    value=QUuid(cell.toString());
+}
+#endif
@@ -0,0 +1,135 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QDateTime>
+#include <QDate>
+#include <QTime>
+#include <QUuid>
+#include <chrono>
+#include <type_traits>
+#include "util.h"
+#include "mapping.h"
+#include "query.h"
+
+namespace HFSQtLi
+{
+  /**
+   * @brief Wrapper storing a point in time as a Julian day (REAL) instead of microseconds since the Unix epoch (INTEGER), see \ref bindcodecs.
+   *
+   * T can be QDateTime or a std::chrono::system_clock::time_point. The encoding is chosen per column: wrap the values of the columns that are used with
+   * the date and time functions of SQLite, which read Julian days directly (e.g. date(column)). Values are fetched with millisecond precision.
+   * \code
+   * qry.prepare("INSERT INTO events(time, scheduled) VALUES ($1, $2)");
+   * qry.bind(1, QDateTime::currentDateTimeUtc(), JulianDay<QDateTime>(scheduled)); // INTEGER and REAL
+   * JulianDay<QDateTime> when;
+   * db->executeSingleAll("SELECT scheduled FROM events WHERE date(scheduled)=date('now')", when);
+   * \endcode
+   */
+  template <typename T> class JulianDay
+  {
+  public:
+    JulianDay(): m_value() { }
+    JulianDay(const T &value): m_value(value) { }
+    const T &value() const { return m_value; }
+    operator const T &() const { return m_value; }
+    bool operator==(const JulianDay &other) const { return m_value==other.m_value; }
+    bool operator!=(const JulianDay &other) const { return m_value!=other.m_value; }
+  protected:
+    T m_value;
+  };
+
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    template <class D> struct CodecSqlType<std::chrono::time_point<std::chrono::system_clock, D>> { static constexpr const char *type="INTEGER", *typeNotNull="INTEGER NOT NULL"; };
+    template <typename T> struct CodecSqlType<JulianDay<T>> { static constexpr const char *type="REAL", *typeNotNull="REAL NOT NULL"; };
+#ifdef HFSQTLI_ENABLE_QT_CODECS
+    template <> struct CodecSqlType<QDateTime> { static constexpr const char *type="INTEGER", *typeNotNull="INTEGER NOT NULL"; };
+    template <> struct CodecSqlType<QDate> { static constexpr const char *type="INTEGER", *typeNotNull="INTEGER NOT NULL"; };
+    template <> struct CodecSqlType<QTime> { static constexpr const char *type="INTEGER", *typeNotNull="INTEGER NOT NULL"; };
+    template <> struct CodecSqlType<QUuid> { static constexpr const char *type="BLOB", *typeNotNull="BLOB NOT NULL"; };
+#endif
+
+    double julianDay(qint64 micros);
+    qint64 julianDayMicros(double day);
+    // Microseconds since the Unix epoch, false for invalid values (bound as NULL)
+    bool epochMicros(const QDateTime &value, qint64 &micros);
+    template <class D> inline bool epochMicros(const std::chrono::time_point<std::chrono::system_clock, D> &value, qint64 &micros)
+    {
+      micros=std::chrono::floor<std::chrono::microseconds>(value).time_since_epoch().count();
+      return true;
+    }
+    // Rounds to the nearest millisecond. Julian days are already rounded to the millisecond by julianDayMicros, also for std::chrono time points.
+    void fromEpochMicros(qint64 micros, QDateTime &value);
+    template <class D> inline void fromEpochMicros(qint64 micros, std::chrono::time_point<std::chrono::system_clock, D> &value)
+    {
+      value=std::chrono::floor<D>(std::chrono::time_point<std::chrono::system_clock, std::chrono::microseconds>(std::chrono::microseconds(micros)));
+    }
+    // Reads a point in time stored as microseconds (julian false) or as a Julian day (julian true). Non strict fetches convert numbers and parse ISO 8601 text.
+    // Returns false for NULL, text that is not a date and time and on error.
+    bool fetchEpochMicros(CustomFetch &fetch, bool julian, qint64 &micros);
+  }
+  /// \endcond INTERNAL
+
+  /// @name Built-in codecs (see \ref bindcodecs)
+  /// @{
+#ifdef HFSQTLI_ENABLE_QT_CODECS
+  // Opt-in: projects often define their own codecs for these types, which would be ambiguous with these ones
+  void customBindConst(CustomBind &bind, const QDateTime &value);
+  void customFetch(CustomFetch &fetch, QDateTime &value);
+  void customBindConst(CustomBind &bind, const QDate &value);
+  void customFetch(CustomFetch &fetch, QDate &value);
+  void customBindConst(CustomBind &bind, const QTime &value);
+  void customFetch(CustomFetch &fetch, QTime &value);
+  void customBindConst(CustomBind &bind, const QUuid &value);
+  void customFetch(CustomFetch &fetch, QUuid &value);
+#endif
+
+  template <class D> void customBindConst(CustomBind &bind, const std::chrono::time_point<std::chrono::system_clock, D> &value)
+  {
+    qint64 micros;
+    Helper::epochMicros(value, micros);
+    bind.bind(micros);
+  }
+
+  template <class D> void customFetch(CustomFetch &fetch, std::chrono::time_point<std::chrono::system_clock, D> &value)
+  {
+    qint64 micros;
+    if(Helper::fetchEpochMicros(fetch, false, micros))
+      Helper::fromEpochMicros(micros, value);
+    else
+      value={};
+  }
+
+  template <typename T> void customBindConst(CustomBind &bind, const JulianDay<T> &value)
+  {
+    qint64 micros;
+    if(Helper::epochMicros(value.value(), micros))
+      bind.bind(Helper::julianDay(micros));
+    else
+      bind.bind(nullptr);
+  }
+
+  template <typename T> void customFetch(CustomFetch &fetch, JulianDay<T> &value)
+  {
+    qint64 micros;
+    T result{};
+    if(Helper::fetchEpochMicros(fetch, true, micros))
+      Helper::fromEpochMicros(micros, result);
+    value=JulianDay<T>(result);
+  }
+  /// @}
+}
@@ -14,7 +14,13 @@ limitations under the License.
 */
 
 #include "database.h"
+#include "backup.h"
+#include "checkpoint.h"
+#include "changes.h"
+#include "resultcache.h"
 #include "sqlite3.h"
+#include <QThread>
+#include <QRandomGenerator>
 using namespace HFSQtLi;
 
 Db *Db::open(const QString &filename, QIODevice::OpenMode flags, QString *errorMsg, const char *zVfs)
@@ -33,25 +39,40 @@ Db *Db::open(const QString &filename, QIODevice::OpenMode flags, QString *errorM
 Db::Db(const QString &filename, QIODevice::OpenMode flags, const char *zVfs)
 {
   int sqliteFlags=SQLITE_OPEN_EXRESCODE;
-  if(flags&QIODevice::ReadWrite)
+  // QIODevice::ReadOnly is a bit of QIODevice::ReadWrite: only the write bit selects a read/write database.
+  // SQLite accepts SQLITE_OPEN_CREATE only together with SQLITE_OPEN_READWRITE.
+  if(flags&QIODevice::WriteOnly)
+  {
     sqliteFlags|=SQLITE_OPEN_READWRITE;
+    if(!(flags&QIODevice::Append))
+      sqliteFlags|=SQLITE_OPEN_CREATE;
+  }
   else
     sqliteFlags|=SQLITE_OPEN_READONLY;
-  if(!(flags&QIODevice::Append))
-    sqliteFlags|=SQLITE_OPEN_CREATE;
 
   m_openError=sqlite3_open_v2(filename.toUtf8(),
                           &m_db,
                           sqliteFlags,
                           zVfs);
   m_queryCount=0;
+  m_changes=nullptr;
+  m_resultCache=nullptr;
+  m_writeWaited=0;
+  m_writeRetries=0;
+  m_writeSavedTimeout=0;
+  m_progressInstructions=0;
+  m_progressHandler=nullptr;
+  m_progressData=nullptr;
   if(!m_db)
     m_openErrorMsg=SQLiteCode::errorString(m_openError);
 }
 
 Db::~Db()
 {
+  // The cache holds prepared statements
+  delete m_resultCache;
   Q_ASSERT(m_queryCount==0);
+  delete m_changes;
   if(m_db)
     sqlite3_close_v2(m_db);
 }
@@ -72,12 +93,218 @@ QString Db::errorMsg() const
   return m_db?QString::fromUtf8(sqlite3_errmsg(m_db)):m_openErrorMsg;
 }
 
+void Db::cancel()
+{
+  if(m_db)
+    sqlite3_interrupt(m_db);
+}
+
+void Db::setProgressHandler(int instructions, int (*handler)(void *), void *userData)
+{
+  // Queries with a deadline read the handler while they step, holding the mutex
+  Lock lock(this, true);
+  m_progressInstructions=handler?instructions:0;
+  m_progressHandler=handler;
+  m_progressData=handler?userData:nullptr;
+  if(m_db)
+    sqlite3_progress_handler(m_db, m_progressInstructions, m_progressHandler, m_progressData);
+}
+
 Query *Db::query(const char *queryStr, bool persistent, bool keepErrorMessage)
 {
   auto ret=new Query(this, queryStr, persistent, keepErrorMessage);
   return ret;
 }
 
+void Db::writeStart()
+{
+  m_writeWaited=0;
+  m_writeRetries=0;
+  m_writeBusyTimer.invalidate();
+  m_writeSavedTimeout=0;
+  if(m_db)
+  {
+    // SQLite has no getter for the busy handler, but the busy timeout can be read back to restore it at the end
+    sqlite3_stmt *stmt=nullptr;
+    if(sqlite3_prepare_v2(m_db, "PRAGMA busy_timeout", -1, &stmt, nullptr)==SQLITE_OK && sqlite3_step(stmt)==SQLITE_ROW)
+      m_writeSavedTimeout=sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    sqlite3_busy_handler(m_db, &Db::writeBusyHandler, this);
+  }
+}
+
+int Db::writeBegin(QString *errorMsg)
+{
+  int ret=SQLITE_MISUSE;
+  if(m_db)
+  {
+    m_writeBusyTimer.invalidate();
+    ret=sqlite3_exec(m_db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr);
+  }
+  if(ret!=SQLITE_OK && errorMsg)
+    *errorMsg=m_db?QString::fromUtf8(sqlite3_errmsg(m_db)):SQLiteCode::errorString(ret);
+  return ret;
+}
+
+int Db::writeCommit()
+{
+  m_writeBusyTimer.invalidate();
+  return sqlite3_exec(m_db, "COMMIT", nullptr, nullptr, nullptr);
+}
+
+int Db::writeAbortCode()
+{
+  int code=sqlite3_extended_errcode(m_db);
+  int primary=code&0xff;
+  return (primary==SQLITE_BUSY || primary==SQLITE_LOCKED)?code:SQLITE_ABORT;
+}
+
+void Db::writeRollback(int code, QString *errorMsg)
+{
+  if(errorMsg)
+  {
+    // A function returning false without a failed statement has no error message of its own
+    int last=sqlite3_errcode(m_db);
+    if(code==SQLITE_ABORT && (last==SQLITE_OK || last==SQLITE_ROW || last==SQLITE_DONE))
+      *errorMsg=QString::fromUtf8("Write function aborted the transaction");
+    else
+      *errorMsg=QString::fromUtf8(sqlite3_errmsg(m_db));
+  }
+  if(!sqlite3_get_autocommit(m_db))
+    sqlite3_exec(m_db, "ROLLBACK", nullptr, nullptr, nullptr);
+}
+
+qint64 Db::writeDelay(int count)
+{
+  // Exponential backoff with "equal jitter": a random delay between half and the full exponential value
+  qint64 delay=qMin<qint64>(m_writePolicy.maxBackoff, qint64(qMax(m_writePolicy.initialBackoff, 1))<<qMin(count, 30));
+  return delay/2+QRandomGenerator::global()->bounded(delay/2+1);
+}
+
+bool Db::writeBackoff(int code, int attempt)
+{
+  bool ret=false;
+  int primary=code&0xff;
+  if((primary==SQLITE_BUSY || primary==SQLITE_LOCKED) && attempt<m_writePolicy.maxRetries)
+  {
+    qint64 delay=writeDelay(attempt);
+    QThread::usleep(delay);
+    m_writeWaited+=delay;
+    m_writeRetries++;
+    ret=true;
+  }
+  return ret;
+}
+
+void Db::writeFinish(bool success)
+{
+  if(m_db)
+    sqlite3_busy_timeout(m_db, m_writeSavedTimeout);
+  m_writeStats.waitTime.add(m_writeWaited);
+  m_writeStats.retries.add(m_writeRetries);
+  if(!success)
+    m_writeStats.failures++;
+}
+
+int Db::writeBusyHandler(void *db, int count)
+{
+  Db *self=static_cast<Db *>(db);
+  if(count==0 || !self->m_writeBusyTimer.isValid())
+    self->m_writeBusyTimer.start();
+  else if(self->m_writeBusyTimer.hasExpired(self->m_writePolicy.busyTimeout))
+    return 0;
+  qint64 delay=self->writeDelay(count);
+  QThread::usleep(delay);
+  self->m_writeWaited+=delay;
+  self->m_writeRetries++;
+  return 1;
+}
+
+bool Db::createFunction(const char *name, int argc, int flags, void *data, void (*function)(sqlite3_context *, int, sqlite3_value **), void (*destroy)(void *))
+{
+  if(!m_db)
+  {
+    destroy(data);
+    return false;
+  }
+  return sqlite3_create_function_v2(m_db, name, argc, SQLITE_UTF8|functionFlags(flags), data, function, nullptr, nullptr, destroy)==SQLITE_OK;
+}
+
+bool Db::createAggregate(const char *name, int argc, int flags, void (*step)(sqlite3_context *, int, sqlite3_value **), void (*final)(sqlite3_context *),
+                         void (*value)(sqlite3_context *), void (*inverse)(sqlite3_context *, int, sqlite3_value **))
+{
+  if(!m_db)
+    return false;
+  return sqlite3_create_window_function(m_db, name, argc, SQLITE_UTF8|functionFlags(flags), nullptr, step, final, value, inverse, nullptr)==SQLITE_OK;
+}
+
+int Db::functionFlags(int flags)
+{
+  int ret=0;
+  if(flags&FunctionDeterministic)
+    ret|=SQLITE_DETERMINISTIC;
+#ifdef SQLITE_DIRECTONLY
+  if(flags&FunctionDirectOnly)
+    ret|=SQLITE_DIRECTONLY;
+#endif
+#ifdef SQLITE_INNOCUOUS
+  if(flags&FunctionInnocuous)
+    ret|=SQLITE_INNOCUOUS;
+#endif
+  return ret;
+}
+
+Backup *Db::backupTo(Db *destination, int pagesPerStep, int sleepBetweenSteps, const char *sourceName, const char *destinationName)
+{
+  return destination?new Backup(this, sourceName, destination, destinationName, false, pagesPerStep, sleepBetweenSteps):nullptr;
+}
+
+Backup *Db::backupTo(const QString &filename, int pagesPerStep, int sleepBetweenSteps, QString *errorMsg)
+{
+  Db *destination=Db::open(filename, QIODevice::ReadWrite, errorMsg);
+  return destination?new Backup(this, "main", destination, "main", true, pagesPerStep, sleepBetweenSteps):nullptr;
+}
+
+Checkpointer *Db::checkpointer(int interval, qint64 walSizeLimit, int busyTimeout, QString *errorMsg)
+{
+  Checkpointer *ret=nullptr;
+  const char *filename=m_db?sqlite3_db_filename(m_db, "main"):nullptr;
+  if(!filename || !*filename)
+  {
+    if(errorMsg)
+      *errorMsg=SQLiteCode::errorString(SQLITE_MISUSE);
+  }
+  else
+  {
+    QString name=QString::fromUtf8(filename);
+    Db *connection=Db::open(name, QIODevice::ReadWrite|QIODevice::Append, errorMsg);
+    if(connection)
+    {
+      sqlite3_busy_timeout(connection->m_db, busyTimeout);
+      ret=new Checkpointer(this, connection, name+"-wal", interval, walSizeLimit);
+    }
+  }
+  return ret;
+}
+
+ChangeNotifier *Db::changes()
+{
+  if(!m_changes && m_db)
+    m_changes=new ChangeNotifier(this);
+  return m_changes;
+}
+
+ResultCache *Db::resultCache()
+{
+  if(!m_resultCache && m_db)
+  {
+    // Changes are tracked by the hooks of the change notifier
+    changes();
+    m_resultCache=new ResultCache(this);
+  }
+  return m_resultCache;
+}
+
 Db::Lock::Lock(Db *db, bool lock)
 {
   Q_ASSERT(db);
@@ -16,8 +16,15 @@ limitations under the License.
 #include <Qt>
 #include <QIODevice>
 #include <QSharedPointer>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <functional>
+#include "writer.h"
 
 struct sqlite3;
+struct sqlite3_context;
+struct sqlite3_value;
+struct sqlite3_changeset_iter;
 
 namespace HFSQtLi
 {
@@ -25,10 +32,16 @@ namespace HFSQtLi
   namespace Helper
   {
     class BlobData;
+    class TableSource;
   }
   /// \endcond INTERNAL
 
   class Query;
+  class Backup;
+  class Checkpointer;
+  class ChangeNotifier;
+  class ResultCache;
+  class ChangesetConflict;
   /**
    * @brief Class that gives access to a SQLite connection (struct sqlite3).
    *
@@ -37,12 +50,16 @@ namespace HFSQtLi
   class Db
   {
     friend class Query;
+    friend class Backup;
+    friend class Checkpointer;
+    friend class ChangeNotifier;
+    friend class ResultCache;
     friend class Helper::BlobData;
   public:
     /**
      * @brief open Opens a database
      * @param filename Path to filename to open
-     * @param An or between flags QIODevice::ReadWrite for a read/write database and QIODevice::Append to open only an existing database
+     * @param An or between flags QIODevice::ReadWrite for a read/write database (QIODevice::ReadOnly for a read only one) and QIODevice::Append to open only an existing database
      * @param errorMsg Pointer to a string that will be filled with error message in case of error
      * @param zVfs Virtual file system to open (See SQLite documentation)
      * @return A pointer to the opened database in case of success
@@ -62,6 +79,23 @@ namespace HFSQtLi
      */
     int error() const;
     QString errorMsg() const;
+    /**
+     * @brief Interrupts any query currently running on this connection (see sqlite3_interrupt).
+     *
+     * This function is thread safe: it is meant to be called from another thread to stop a long running step, which will fail with SQLiteCode::INTERRUPT.
+     * For a per-query time limit see \ref Query::setDeadline.
+     */
+    void cancel();
+    /**
+     * @brief Sets the progress handler of this connection (see sqlite3_progress_handler).
+     *
+     * Use it instead of sqlite3_progress_handler: a step of a query with a deadline installs its own handler, which also calls this one
+     * (every 1000 virtual machine instructions or less), and restores it when the step is done. A handler returning non zero interrupts the query.
+     * @param instructions Approximate number of virtual machine instructions between calls
+     * @param handler The callback, nullptr to remove it
+     * @param userData Argument passed to the callback
+     */
+    void setProgressHandler(int instructions, int (*handler)(void *), void *userData=nullptr);
     /**
      * @brief query Creates a new query
      * @param queryStr Query string
@@ -110,6 +144,254 @@ namespace HFSQtLi
     template <int I, typename... Args> int executeSingleAll(QString *error, const QString &query, Args &&... args);
     /// @}
 
+    /// @name Cached query execution
+    /// The following functions work like \ref executeSingleAll but answer from the \ref ResultCache when the same query was already run with the same bound values
+    /// and none of the tables it reads changed since. Without a cache (see \ref resultCache) they are the same as executeSingleAll.
+    ///
+    /// Fetched values can be of the types supported by the arguments of \ref registerFunction (integer types, double, float, QString, QByteArray, \ref Value, std::optional of them).
+    /// \code
+    /// db->resultCache()->setMemoryBudget(4*1024*1024);
+    /// double average;
+    /// db->executeCached<1>("SELECT AVG(value) FROM measures WHERE sensor=$1", sensorId, average);
+    /// \endcode
+    /// @{
+
+    /// @brief Executes a query returning one row, using the result cache
+    /// @param query A string containing the query to execute
+    /// @param args First I arguments are the values to bind, the ones after that are references to data to retrieve
+    /// @return 0 on error, 1+number of fetched columns on success
+    template <int I, typename... Args> int executeCached(const QString &query, Args &&... args) { return executeCached<I>(nullptr, query, std::forward<Args>(args)...); }
+    /// @copydoc executeCached(const QString &, Args &&...)
+    template <typename... Args> int executeCached(const QString &query, Args &&... args) { return executeCached<0>(nullptr, query, std::forward<Args>(args)...); }
+    /// @copydoc executeCached(const QString &, Args &&...)
+    /// @param error An optional pointer to a string to fill with the error message.
+    template <int I, typename... Args> int executeCached(QString *error, const QString &query, Args &&... args);
+    /**
+     * @brief Gets the result cache of this connection, enabling it. See \ref ResultCache.
+     *
+     * The cache is created on the first call and is owned by the database. It uses the hooks installed by \ref changes().
+     * @return The cache or nullptr if the database is not open
+     */
+    ResultCache *resultCache();
+    /// @}
+
+    /// @name Write transactions
+    /// @{
+    /**
+     * @brief Runs a function inside a BEGIN IMMEDIATE transaction, retrying on lock contention.
+     *
+     * The function can take a Db & or no parameter and can return void (always commit) or a value convertible to bool (true to commit, false to rollback).
+     * A function returning false is run again only if the last error of the connection is SQLITE_BUSY or SQLITE_LOCKED, i.e. one of its statements failed on a lock.
+     * While waiting for a lock a busy handler sleeps with a jittered exponential backoff (see \ref WritePolicy). If the transaction still fails with SQLITE_BUSY
+     * or SQLITE_LOCKED (e.g. the lock could not be obtained or the commit failed) it is rolled back and the whole function is run again, up to WritePolicy::maxRetries times.
+     * For this reason the function must not have side effects outside of the database.
+     *
+     * Time spent waiting and number of retries of every call are collected in \ref writeStats().
+     * \note The busy handler replaces any busy handler or busy timeout set on the connection while the function runs. When it returns the busy timeout
+     * (sqlite3_busy_timeout or PRAGMA busy_timeout) is restored, while a custom busy handler is removed.
+     * \code
+     * db->runWrite([&](Db &db){ return db.execute("UPDATE counters SET value=value+1 WHERE id=$1", id); });
+     * \endcode
+     * @param function Function to run
+     * @param errorMsg Optional pointer to a string that will be filled with the error message on failure
+     * @return True if the transaction was committed
+     */
+    template <typename F> bool runWrite(F &&function, QString *errorMsg=nullptr);
+    /// @brief Gets the retry policy of runWrite
+    const WritePolicy &writePolicy() const { return m_writePolicy; }
+    /// @brief Sets the retry policy of runWrite
+    void setWritePolicy(const WritePolicy &policy) { m_writePolicy=policy; }
+    /// @brief Statistics collected by runWrite
+    const WriteStats &writeStats() const { return m_writeStats; }
+    /// @brief Clears the statistics collected by runWrite
+    void resetWriteStats() { m_writeStats.reset(); }
+    /// @}
+
+    /// @name User defined functions
+    /// @{
+    /// @brief Flags of user defined functions, can be combined with |
+    enum FunctionFlag: int
+    {
+      /// @brief No flag
+      FunctionDefault=0,
+      /// @brief The function always returns the same result for the same arguments (SQLITE_DETERMINISTIC). Required to use it in indexes and CHECK constraints.
+      FunctionDeterministic=1,
+      /// @brief The function can be invoked only from top-level SQL, not from views, triggers or schema (SQLITE_DIRECTONLY)
+      FunctionDirectOnly=2,
+      /// @brief The function has no side effects and can safely be used from untrusted schema (SQLITE_INNOCUOUS)
+      FunctionInnocuous=4
+    };
+    /**
+     * @brief Registers a lambda, functor or function pointer as a scalar SQL function.
+     *
+     * Number and types of the arguments, as well as the result type, are deduced at compile time from the signature of the function.
+     * Arguments are converted from SQLite values like the non-strict fetches of \ref Query::step and \ref Query::executeSingle: integer types, bool, double, float, QString, QByteArray and \ref Value are supported,
+     * std::optional of any of them receives std::nullopt for NULL. The result can be any of the integer types, double, float, QString, const char *, QByteArray, \ref Null, std::optional of them,
+     * or void (the SQL function returns NULL).
+     *
+     * The function is copied (or moved) and destroyed when it is replaced or the database is closed.
+     * \code
+     * db->registerFunction("distance", [](double x, double y){ return std::sqrt(x*x+y*y); }, Db::FunctionDeterministic);
+     * db->executeSingleAll("SELECT distance(3, 4)", result);
+     * \endcode
+     * @param name Name of the SQL function
+     * @param function Function to call
+     * @param flags Combination of \ref FunctionFlag
+     * @return True on success
+     */
+    template <typename F> bool registerFunction(const char *name, F &&function, int flags=FunctionDefault);
+    /**
+     * @brief Registers an aggregate or window function whose state is an instance of State.
+     *
+     * State must be default constructible and provide:
+     * - step(args...): adds a row to the aggregate. Arguments are deduced and converted like in \ref registerFunction.
+     * - value(): returns the current result, with any of the result types supported by \ref registerFunction.
+     * - inverse(args...) (optional): removes a row previously added by step. When present the function can be used as an aggregate window function
+     *   (see sqlite3_create_window_function), otherwise it is a plain aggregate.
+     *
+     * A State is constructed in place in the memory SQLite reserves for each group (sqlite3_aggregate_context) at the first step and destroyed when the group is finalized.
+     * If the group contains no row, value() of a default constructed State is returned.
+     * \code
+     * struct SumSquares
+     * {
+     *   qint64 sum=0;
+     *   void step(qint64 v) { sum+=v*v; }
+     *   void inverse(qint64 v) { sum-=v*v; }
+     *   qint64 value() const { return sum; }
+     * };
+     * db->registerAggregate<SumSquares>("sumSquares");
+     * db->execute("SELECT sumSquares(x) OVER (ORDER BY id ROWS 10 PRECEDING) FROM points");
+     * \endcode
+     * @param name Name of the SQL function
+     * @param flags Combination of \ref FunctionFlag
+     * @return True on success
+     */
+    template <typename State> bool registerAggregate(const char *name, int flags=FunctionDefault);
+    /// @}
+
+    /// @name Virtual tables
+    /// @{
+    /**
+     * @brief Exposes a container as a read-only eponymous virtual table, so it can be queried and joined without copying it into the database.
+     *
+     * Columns are the values bound by the customBind (or customBindConst) function of T (See \ref bindcustomtypes), or its mapped fields (See \ref Mapping), in the same order.
+     * The number of columns is determined by binding a default constructed T. The rowid of each row is its index in the container:
+     * constraints on rowid (=, <, <=, >, >=) restrict the scan to the matching range, all other constraints are evaluated by SQLite on every row.
+     *
+     * The container is not copied: it must outlive the database connection (or the table must be replaced by exposing another container with the same name)
+     * and must not be modified while a statement reading it is running. Changes made between statements are visible to the following ones.
+     * For this reason temporaries are rejected at compile time.
+     * \code
+     * struct Sensor { qint64 id; QString name; double reading; };
+     * void customBindConst(CustomBind &bind, const Sensor &s) { bind.bind(s.id, s.name, s.reading); }
+     * ...
+     * QVector<Sensor> sensors=...;
+     * db->exposeTable("sensors", sensors, {"id", "name", "reading"});
+     * db->execute("INSERT INTO history SELECT id, reading FROM sensors WHERE reading>100");
+     * \endcode
+     * @param name Name of the table
+     * @param data Container to expose
+     * @param columnNames Names of the columns. Missing names default to c1, c2, ..., or to the names of the fields for a struct mapped with HFSQTLI_MAP (see \ref Mapping).
+     * @return True on success
+     */
+    template <typename T> bool exposeTable(const char *name, const QVector<T> &data, const QStringList &columnNames=QStringList());
+    /// @brief The container is not copied, so exposing a temporary would leave the table reading a destroyed container
+    template <typename T> bool exposeTable(const char *name, QVector<T> &&data, const QStringList &columnNames=QStringList())=delete;
+    /// @}
+
+    /// @name Online backup
+    /// @{
+    /**
+     * @brief Creates an online backup of this database into another connection. See \ref Backup.
+     *
+     * The backup is returned not started: connect to its signals and call Backup::start() to run it in a background thread.
+     * The caller takes ownership of the returned object, which must be destroyed before both databases.
+     * @param destination Database that will receive the copy
+     * @param pagesPerStep Number of pages copied on each step (-1 to copy everything in one step)
+     * @param sleepBetweenSteps Milliseconds to sleep between two steps, giving writers on the source a chance to run
+     * @param sourceName Name of the source database (e.g. "main", "temp" or an attached database)
+     * @param destinationName Name of the destination database
+     * @return The backup object or nullptr if destination is null
+     */
+    Backup *backupTo(Db *destination, int pagesPerStep=100, int sleepBetweenSteps=10, const char *sourceName="main", const char *destinationName="main");
+    /**
+     * @brief Creates an online backup of this database into a file. The file is created if needed and overwritten.
+     * @copydetails backupTo(Db *, int, int, const char *, const char *)
+     * @param filename Path of the file to write the backup to
+     * @param errorMsg Pointer to a string that will be filled with error message in case the file could not be opened
+     */
+    Backup *backupTo(const QString &filename, int pagesPerStep=100, int sleepBetweenSteps=10, QString *errorMsg=nullptr);
+    /// @}
+
+    /**
+     * @brief Creates a scheduler performing WAL checkpoints of this database on a background connection. See \ref Checkpointer.
+     *
+     * The database must be a file database in WAL mode (PRAGMA journal_mode=WAL). The scheduler is returned not started, call Checkpointer::start() to run it.
+     * The caller takes ownership of the returned object, which must be destroyed before the database.
+     * @param interval Milliseconds between two checkpoints
+     * @param walSizeLimit Size in bytes of the WAL file over which the checkpoint is escalated (0 to never escalate)
+     * @param busyTimeout Busy timeout in milliseconds of the background connection, used by escalated checkpoints to wait for readers and writers
+     * @param errorMsg Pointer to a string that will be filled with error message in case the background connection could not be opened
+     * @return The scheduler or nullptr on error
+     */
+    Checkpointer *checkpointer(int interval=1000, qint64 walSizeLimit=64*1024*1024, int busyTimeout=1000, QString *errorMsg=nullptr);
+
+    /**
+     * @brief Gets the notifier of the changes committed on this connection. See \ref ChangeNotifier.
+     *
+     * The notifier is created (installing the update, commit and rollback hooks) on the first call and is owned by the database.
+     * It lives in the thread calling this function for the first time, which needs an event loop to receive the notifications.
+     * @return The notifier or nullptr if the database is not open
+     */
+    ChangeNotifier *changes();
+
+    /// @name Sessions and changesets
+    /// Changesets are recorded by a \ref Session and can be shipped to another database with the same schema to replicate the changes.
+    /// All the functions in this group require SQLite compiled with SQLITE_ENABLE_SESSION and SQLITE_ENABLE_PREUPDATE_HOOK, otherwise they fail with SQLITE_MISUSE.
+    /// @{
+    class Session;
+    /// @brief Action taken by applyChangeset on a conflict
+    enum class ConflictAction: int
+    {
+      /// @brief Skips the change (SQLITE_CHANGESET_OMIT)
+      Omit,
+      /// @brief Overwrites the conflicting row with the change (SQLITE_CHANGESET_REPLACE). Allowed only for ChangesetConflict::Type::Data and Conflict.
+      Replace,
+      /// @brief Stops and rolls back all the changes applied (SQLITE_CHANGESET_ABORT)
+      Abort
+    };
+    /**
+     * @brief Applies a changeset or patchset to this database, in a single transaction (or savepoint, if a transaction is already open).
+     * \code
+     * db->applyChangeset(changes, [](const ChangesetConflict &conflict){
+     *   return conflict.type()==ChangesetConflict::Type::Data?Db::ConflictAction::Replace:Db::ConflictAction::Omit;
+     * });
+     * \endcode
+     * @param changeset Changeset or patchset to apply
+     * @param onConflict Function called for every conflict, returning the action to take. If empty any conflict aborts.
+     * @param errorMsg Optional pointer to a string that will be filled with the error message on failure
+     * @return True if the changeset was applied, false if it was aborted or an error occurred (no change is applied in this case)
+     */
+    bool applyChangeset(const QByteArray &changeset, const std::function<ConflictAction(const ChangesetConflict &)> &onConflict=nullptr, QString *errorMsg=nullptr);
+    /**
+     * @brief Concatenates two changesets (or two patchsets) into one, merging the changes made to the same rows. Applying the result is the same as applying first and then second.
+     * @param first First changeset
+     * @param second Changeset following first
+     * @param result Filled with the concatenated changeset
+     * @param errorMsg Optional pointer to a string that will be filled with the error message on failure
+     * @return True on success
+     */
+    static bool concatChangesets(const QByteArray &first, const QByteArray &second, QByteArray &result, QString *errorMsg=nullptr);
+    /**
+     * @brief Inverts a changeset: applying the result undoes the changes. Patchsets can't be inverted.
+     * @param changeset Changeset to invert
+     * @param result Filled with the inverted changeset
+     * @param errorMsg Optional pointer to a string that will be filled with the error message on failure
+     * @return True on success
+     */
+    static bool invertChangeset(const QByteArray &changeset, QByteArray &result, QString *errorMsg=nullptr);
+    /// @}
+
     /// \cond INTERNAL
     constexpr sqlite3 *internalDb() { return m_db; }
     class Lock
@@ -139,11 +421,44 @@ namespace HFSQtLi
     /// \endcond INTERNAL
   protected:
     Db(const QString &filename, QIODevice::OpenMode flags=QIODevice::ReadWrite, const char *zVfs=NULL);
+    // Registers a scalar function with sqlite3_create_function_v2. On failure destroy is called on data.
+    bool createFunction(const char *name, int argc, int flags, void *data, void (*function)(sqlite3_context *, int, sqlite3_value **), void (*destroy)(void *));
+    // Registers an aggregate (inverse and value null) or window function with sqlite3_create_window_function
+    bool createAggregate(const char *name, int argc, int flags, void (*step)(sqlite3_context *, int, sqlite3_value **), void (*final)(sqlite3_context *),
+                         void (*value)(sqlite3_context *), void (*inverse)(sqlite3_context *, int, sqlite3_value **));
+    static int functionFlags(int flags);
+    // Registers an eponymous virtual table reading from source. On failure source is deleted.
+    bool createTableModule(const char *name, Helper::TableSource *source);
+    // Conflict handler of sqlite3changeset_apply, context is the function passed to applyChangeset
+    static int changesetConflict(void *context, int type, sqlite3_changeset_iter *iterator);
+    // Helpers for runWrite
+    void writeStart();
+    int writeBegin(QString *errorMsg);
+    int writeCommit();
+    int writeAbortCode();
+    void writeRollback(int code, QString *errorMsg);
+    bool writeBackoff(int code, int attempt);
+    void writeFinish(bool success);
+    static int writeBusyHandler(void *db, int count);
+    qint64 writeDelay(int count);
     sqlite3 *m_db;
     std::atomic_int m_queryCount;
     // Note: these variables are used only when open fails (m_db is null)
     int m_openError;
     QString m_openErrorMsg;
+    WritePolicy m_writePolicy;
+    WriteStats m_writeStats;
+    ChangeNotifier *m_changes;
+    ResultCache *m_resultCache;
+    // State of the current runWrite call
+    QElapsedTimer m_writeBusyTimer;
+    qint64 m_writeWaited;
+    int m_writeRetries;
+    int m_writeSavedTimeout;
+    // Progress handler set with setProgressHandler
+    int m_progressInstructions;
+    int (*m_progressHandler)(void *);
+    void *m_progressData;
   };
 
 }
@@ -16,6 +16,10 @@ limitations under the License.
 #pragma once
 #include "database.h"
 #include "query.h"
+#include "util.h"
+#include "function.h"
+#include "vtable.h"
+#include "resultcache.h"
 namespace HFSQtLi
 {
   template <typename... Args> inline int Db::execute(QString *message, const QString &query, Args &&... args)
@@ -42,4 +46,89 @@ namespace HFSQtLi
     }
     return ret;
   }
+
+  template <int I, typename... Args> int Db::executeCached(QString *message, const QString &query, Args &&... args)
+  {
+    static_assert (I<=sizeof...(Args), "executeCached<I> number of bound parameters is greater than number of arguments");
+    if(!m_resultCache)
+      return executeSingleAll<I>(message, query, std::forward<Args>(args)...);
+    constexpr int fetched=int(sizeof...(Args))-I;
+    int ret=0;
+    // Statements, entries and table versions of the cache are shared by all the threads using the connection
+    Lock lock(this, true);
+    ResultCache::Statement *statement=m_resultCache->statement(query, message);
+    if(!statement)
+      return 0;
+    Query *qry=statement->query;
+    std::tuple<decltype(args)...> ref(std::forward<Args>(args)...);
+    auto toFetch=Helper::select(ref, Helper::make_int_sequence<I, fetched>());
+    if(qry->reset() && qry->bindTemporaryAll(Helper::select(ref, Helper::make_int_sequence<I>())))
+    {
+      if(sqlite3_value **values=m_resultCache->fetch(statement, fetched))
+      {
+        // Cached values are decoded like the columns of the query, custom types included
+        if(Helper::readValues(values, fetched, toFetch, message))
+          ret=fetched+1;
+        else
+          message=nullptr; // Already filled with the decoding error
+      }
+    }
+    if(!ret && message)
+      *message=qry->errorMsg();
+    qry->reset();
+    qry->clearBindings();
+    return ret;
+  }
+
+  template <typename F> bool Db::runWrite(F &&function, QString *errorMsg)
+  {
+    bool ret=false;
+    writeStart();
+    for(int attempt=0;;attempt++)
+    {
+      int code=writeBegin(errorMsg);
+      if(code==SQLiteCode::OK)
+      {
+        // A function returning false is retried only if one of its statements failed on a lock
+        code=Helper::callWrite(*this, function)?writeCommit():writeAbortCode();
+        if(code==SQLiteCode::OK)
+        {
+          ret=true;
+          break;
+        }
+        writeRollback(code, errorMsg);
+      }
+      if(!writeBackoff(code, attempt))
+        break;
+    }
+    writeFinish(ret);
+    if(ret && errorMsg)
+      errorMsg->clear();
+    return ret;
+  }
+
+  template <typename F> bool Db::registerFunction(const char *name, F &&function, int flags)
+  {
+    typedef Helper::ScalarFunction<std::decay_t<F>> Function;
+    return createFunction(name, Function::Traits::arity, flags, new Function{std::forward<F>(function)}, &Function::call, &Function::destroy);
+  }
+
+  template <typename State> bool Db::registerAggregate(const char *name, int flags)
+  {
+    typedef Helper::AggregateFunction<State> Function;
+    if constexpr(Function::isWindow)
+      return createAggregate(name, Function::Traits::arity, flags, &Function::step, &Function::final, &Function::value, &Function::inverse);
+    else
+      return createAggregate(name, Function::Traits::arity, flags, &Function::step, &Function::final, nullptr, nullptr);
+  }
+
+  template <typename T> bool Db::exposeTable(const char *name, const QVector<T> &data, const QStringList &columnNames)
+  {
+    if constexpr(Helper::IsMapped<T>::value)
+    {
+      if(columnNames.isEmpty())
+        return createTableModule(name, new Helper::ContainerSource<T>(&data, Mapping<T>::columns()));
+    }
+    return createTableModule(name, new Helper::ContainerSource<T>(&data, columnNames));
+  }
 }
@@ -0,0 +1,417 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "exporter.h"
+#include "query.h"
+#include "sqlite3.h"
+#include <QIODevice>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifdef HFSQTLI_ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace HFSQtLi;
+
+namespace
+{
+  const char g_hexDigits[]="0123456789abcdef";
+
+  // Writes a CSV field, quoting it only when needed
+  void writeCsvText(Helper::ExportWriter &writer, const char *text, int size)
+  {
+    const char *end=text+size;
+    const char *p=text;
+    while(p<end && *p!='"' && *p!=',' && *p!='\n' && *p!='\r')
+      p++;
+    if(p==end)
+    {
+      writer.write(text, size);
+      return;
+    }
+    writer.put('"');
+    while(text<end)
+    {
+      p=static_cast<const char *>(memchr(text, '"', end-text));
+      if(!p)
+      {
+        writer.write(text, end-text);
+        break;
+      }
+      writer.write(text, p+1-text);
+      writer.put('"');
+      text=p+1;
+    }
+    writer.put('"');
+  }
+
+  void writeTsvText(Helper::ExportWriter &writer, const char *text, int size)
+  {
+    const char *end=text+size;
+    const char *start=text;
+    for(const char *p=text;p<end;p++)
+    {
+      const char *escape;
+      switch(*p)
+      {
+      case '\t': escape="\\t"; break;
+      case '\n': escape="\\n"; break;
+      case '\r': escape="\\r"; break;
+      case '\\': escape="\\\\"; break;
+      default: continue;
+      }
+      writer.write(start, p-start);
+      writer.write(escape, 2);
+      start=p+1;
+    }
+    writer.write(start, end-start);
+  }
+
+  void writeJsonString(Helper::ExportWriter &writer, const char *text, int size)
+  {
+    const char *end=text+size;
+    const char *start=text;
+    writer.put('"');
+    for(const char *p=text;p<end;p++)
+    {
+      unsigned char c=static_cast<unsigned char>(*p);
+      if(c>=0x20 && c!='"' && c!='\\')
+        continue;
+      writer.write(start, p-start);
+      switch(c)
+      {
+      case '"': writer.write("\\\"", 2); break;
+      case '\\': writer.write("\\\\", 2); break;
+      case '\n': writer.write("\\n", 2); break;
+      case '\r': writer.write("\\r", 2); break;
+      case '\t': writer.write("\\t", 2); break;
+      default:
+        {
+          char escape[6]={'\\', 'u', '0', '0', g_hexDigits[c>>4], g_hexDigits[c&15]};
+          writer.write(escape, 6);
+        }
+        break;
+      }
+      start=p+1;
+    }
+    writer.write(start, end-start);
+    writer.put('"');
+  }
+
+  // Writes a REAL with the shortest of %.15g/%.17g that reads back to the same value: sqlite3_column_text only keeps 15 digits.
+  // Like SQLite a ".0" is appended to integral values so that they are imported back as REAL. Infinities are null in JSON.
+  void writeDouble(Helper::ExportWriter &writer, double value, bool json)
+  {
+    if(!std::isfinite(value))
+    {
+      if(json)
+        writer.write("null", 4);
+      else
+        writer.write(value<0?"-Inf":"Inf", value<0?4:3);
+      return;
+    }
+    char text[32];
+    int size=snprintf(text, sizeof(text), "%.15g", value);
+    if(strtod(text, nullptr)!=value)
+      size=snprintf(text, sizeof(text), "%.17g", value);
+    if(!strpbrk(text, ".eE"))
+    {
+      text[size++]='.';
+      text[size++]='0';
+    }
+    writer.write(text, size);
+  }
+
+  void writeHex(Helper::ExportWriter &writer, const unsigned char *data, int size)
+  {
+    char chunk[256];
+    while(size>0)
+    {
+      int n=qMin(size, int(sizeof(chunk)/2));
+      for(int i=0;i<n;i++)
+      {
+        chunk[2*i]=g_hexDigits[data[i]>>4];
+        chunk[2*i+1]=g_hexDigits[data[i]&15];
+      }
+      writer.write(chunk, 2*n);
+      data+=n;
+      size-=n;
+    }
+  }
+}
+
+Helper::ExportWriter::ExportWriter(QIODevice *device, const ExportOptions &options):
+  m_device(device), m_options(options), m_used(0), m_zstream(nullptr)
+{
+  m_buffer.resize(qMax(options.bufferSize, 1024));
+#ifdef HFSQTLI_ENABLE_ZLIB
+  if(options.gzip)
+  {
+    auto *stream=new z_stream;
+    memset(stream, 0, sizeof(z_stream));
+    // 16 added to window bits writes gzip header and trailer instead of zlib ones
+    if(deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+    {
+      delete stream;
+      m_errorMsg="Cannot initialize gzip compression";
+    }
+    else
+    {
+      m_zstream=stream;
+      m_compressed.resize(m_buffer.size());
+    }
+  }
+#else
+  if(options.gzip)
+    m_errorMsg="gzip compression requires HFSQTLI_ENABLE_ZLIB";
+#endif
+}
+
+Helper::ExportWriter::~ExportWriter()
+{
+#ifdef HFSQTLI_ENABLE_ZLIB
+  if(m_zstream)
+  {
+    deflateEnd(static_cast<z_stream *>(m_zstream));
+    delete static_cast<z_stream *>(m_zstream);
+  }
+#endif
+}
+
+bool Helper::ExportWriter::finish()
+{
+  flushBuffer();
+  if(m_zstream)
+    output(nullptr, 0, true);
+  return isOk();
+}
+
+void Helper::ExportWriter::flushBuffer()
+{
+  if(m_used>0)
+  {
+    output(m_buffer.constData(), m_used);
+    m_used=0;
+  }
+}
+
+void Helper::ExportWriter::output(const char *data, qsizetype size, bool last)
+{
+  if(!isOk())
+    return;
+#ifdef HFSQTLI_ENABLE_ZLIB
+  if(m_zstream)
+  {
+    auto *stream=static_cast<z_stream *>(m_zstream);
+    stream->next_in=reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream->avail_in=uInt(size);
+    int ret;
+    // Without Z_FINISH deflate is done when all input is consumed, i.e. some output space is left
+    do
+    {
+      stream->next_out=reinterpret_cast<Bytef *>(m_compressed.data());
+      stream->avail_out=uInt(m_compressed.size());
+      ret=deflate(stream, last?Z_FINISH:Z_NO_FLUSH);
+      if(ret==Z_STREAM_ERROR)
+      {
+        m_errorMsg="gzip compression failed";
+        return;
+      }
+      writeDevice(m_compressed.constData(), m_compressed.size()-stream->avail_out);
+    } while(isOk() && (stream->avail_out==0 || (last && ret!=Z_STREAM_END)));
+    return;
+  }
+#else
+  Q_UNUSED(last);
+#endif
+  writeDevice(data, size);
+}
+
+void Helper::ExportWriter::writeDevice(const char *data, qint64 size)
+{
+  while(size>0 && isOk())
+  {
+    qint64 written=m_device->write(data, size);
+    if(written<0)
+    {
+      m_errorMsg=m_device->errorString();
+      if(m_errorMsg.isEmpty())
+        m_errorMsg="Error writing to device";
+      return;
+    }
+    data+=written;
+    size-=written;
+    // Backpressure: don't let a slow device (e.g. a socket) accumulate the whole result in its write buffer
+    while(isOk() && (written==0 || m_device->bytesToWrite()>m_options.maxPendingBytes))
+    {
+      if(!m_device->waitForBytesWritten(m_options.writeTimeout))
+        m_errorMsg="Timeout writing to device";
+      written=1;
+    }
+  }
+}
+
+bool Query::exportTo(QIODevice *device, ExportFormat format, const ExportOptions &options, qint64 *rows)
+{
+  qint64 count=0;
+  if(rows)
+    *rows=0;
+  if(!isPrepared() || !device || !device->isWritable())
+  {
+    setInternalError(SQLITE_MISUSE);
+    return false;
+  }
+  Helper::ExportWriter writer(device, options);
+  if(!writer.isOk())
+  {
+    setInternalError(SQLITE_MISUSE, writer.errorMsg().toUtf8().constData());
+    return false;
+  }
+  int columns=sqlite3_column_count(m_stmt);
+  // Column names, already escaped: JSON keys include quotes and colon
+  QVector<QByteArray> names(columns);
+  bool json=format==ExportFormat::Json || format==ExportFormat::JsonLines;
+  for(int i=0;i<columns;i++)
+  {
+    const char *name=sqlite3_column_name(m_stmt, i);
+    int size=name?int(strlen(name)):0;
+    if(json)
+    {
+      QByteArray key=(i?",":"")+QByteArray("\"");
+      for(int j=0;j<size;j++)
+      {
+        unsigned char c=static_cast<unsigned char>(name[j]);
+        if(c=='"' || c=='\\')
+          key+='\\';
+        if(c<0x20)
+          key+="\\u00"+QByteArray(1, g_hexDigits[c>>4])+QByteArray(1, g_hexDigits[c&15]);
+        else
+          key+=char(c);
+      }
+      names[i]=key+"\":";
+    }
+    else if(options.header)
+    {
+      if(i)
+        writer.put(format==ExportFormat::Csv?',':'\t');
+      if(format==ExportFormat::Csv)
+        writeCsvText(writer, name, size);
+      else
+        writeTsvText(writer, name, size);
+    }
+  }
+  if(!json && options.header)
+    writer.write(format==ExportFormat::Csv?"\r\n":"\n");
+  if(format==ExportFormat::Json)
+    writer.put('[');
+  // A query already positioned on a row (stepped but not done nor reset) starts from that row
+  if(m_error==SQLITE_ROW && sqlite3_stmt_busy(m_stmt))
+    exportRow(writer, format, names, count++);
+  while(writer.isOk() && stepNoFetch())
+    exportRow(writer, format, names, count++);
+  bool ret=writer.isOk() && m_error==SQLITE_DONE;
+  if(ret && format==ExportFormat::Json)
+    writer.write(count?"\n]\n":"]\n");
+  if(!writer.finish())
+  {
+    setInternalError(SQLITE_IOERR, writer.errorMsg().toUtf8().constData());
+    ret=false;
+  }
+  if(rows)
+    *rows=count;
+  return ret;
+}
+
+void Query::exportRow(Helper::ExportWriter &writer, ExportFormat format, const QVector<QByteArray> &names, qint64 row)
+{
+  int columns=names.size();
+  switch(format)
+  {
+  case ExportFormat::Csv:
+  case ExportFormat::Tsv:
+    {
+      bool csv=format==ExportFormat::Csv;
+      for(int i=0;i<columns;i++)
+      {
+        if(i)
+          writer.put(csv?',':'\t');
+        switch(sqlite3_column_type(m_stmt, i))
+        {
+        case SQLITE_NULL:
+          if(!csv)
+            writer.write("\\N", 2);
+          break;
+        case SQLITE_BLOB:
+          writeHex(writer, static_cast<const unsigned char *>(sqlite3_column_blob(m_stmt, i)), sqlite3_column_bytes(m_stmt, i));
+          break;
+        case SQLITE_TEXT:
+          {
+            auto text=reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, i));
+            int size=sqlite3_column_bytes(m_stmt, i);
+            if(csv)
+              writeCsvText(writer, text, size);
+            else
+              writeTsvText(writer, text, size);
+          }
+          break;
+        case SQLITE_FLOAT:
+          writeDouble(writer, sqlite3_column_double(m_stmt, i), false);
+          break;
+        default:
+          // Integers never need quoting or escaping
+          writer.write(reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, i)), sqlite3_column_bytes(m_stmt, i));
+          break;
+        }
+      }
+      writer.write(csv?"\r\n":"\n", csv?2:1);
+    }
+    break;
+  case ExportFormat::Json:
+  case ExportFormat::JsonLines:
+    if(format==ExportFormat::Json)
+      writer.write(row?",\n":"\n", row?2:1);
+    writer.put('{');
+    for(int i=0;i<columns;i++)
+    {
+      writer.write(names[i].constData(), names[i].size());
+      switch(sqlite3_column_type(m_stmt, i))
+      {
+      case SQLITE_NULL:
+        writer.write("null", 4);
+        break;
+      case SQLITE_BLOB:
+        writer.put('"');
+        writeHex(writer, static_cast<const unsigned char *>(sqlite3_column_blob(m_stmt, i)), sqlite3_column_bytes(m_stmt, i));
+        writer.put('"');
+        break;
+      case SQLITE_TEXT:
+        writeJsonString(writer, reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, i)), sqlite3_column_bytes(m_stmt, i));
+        break;
+      case SQLITE_FLOAT:
+        writeDouble(writer, sqlite3_column_double(m_stmt, i), true);
+        break;
+      default:
+        writer.write(reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, i)), sqlite3_column_bytes(m_stmt, i));
+        break;
+      }
+    }
+    writer.put('}');
+    if(format==ExportFormat::JsonLines)
+      writer.put('\n');
+    break;
+  }
+}
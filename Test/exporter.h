@@ -0,0 +1,104 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QString>
+#include <QByteArray>
+#include <cstring>
+
+class QIODevice;
+
+namespace HFSQtLi
+{
+  /// @brief Output formats of Query::exportTo
+  enum class ExportFormat: int
+  {
+    /// @brief RFC 4180 CSV: fields containing delimiter, quotes or line breaks are quoted, NULL is an empty field
+    Csv,
+    /// @brief Tab separated values: tab, line breaks and backslash are escaped as \\t, \\n, \\r, \\\\ and NULL is \\N
+    Tsv,
+    /// @brief A JSON array of objects, one per row, keyed by column name
+    Json,
+    /// @brief One JSON object per line (JSON Lines)
+    JsonLines
+  };
+
+  /**
+   * @brief Options of Query::exportTo
+   */
+  struct ExportOptions
+  {
+    /// @brief Writes the column names as first line (CSV and TSV only)
+    bool header=true;
+    /// @brief Compresses the output with gzip. Requires HFSQTLI_ENABLE_ZLIB, otherwise the export fails with SQLITE_MISUSE.
+    bool gzip=false;
+    /// @brief Size of the output buffer in bytes
+    int bufferSize=64*1024;
+    /// @brief Maximum number of bytes the device may hold unwritten (QIODevice::bytesToWrite) before the export waits for it to drain
+    qint64 maxPendingBytes=1024*1024;
+    /// @brief Maximum time in milliseconds to wait for a slow device to drain, the export fails when it expires (-1 to wait forever)
+    int writeTimeout=30000;
+  };
+
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    // Buffered writer used by Query::exportTo, optionally compressing the output with gzip
+    class ExportWriter
+    {
+    public:
+      ExportWriter(QIODevice *device, const ExportOptions &options);
+      ~ExportWriter();
+      inline bool isOk() const { return m_errorMsg.isEmpty(); }
+      inline const QString &errorMsg() const { return m_errorMsg; }
+      inline void write(const char *data, qsizetype size)
+      {
+        if(m_used+size>m_buffer.size())
+        {
+          flushBuffer();
+          if(size>m_buffer.size())
+          {
+            output(data, size);
+            return;
+          }
+        }
+        memcpy(m_buffer.data()+m_used, data, size);
+        m_used+=size;
+      }
+      inline void write(const char *data) { write(data, qsizetype(strlen(data))); }
+      inline void put(char c)
+      {
+        if(m_used==m_buffer.size())
+          flushBuffer();
+        m_buffer.data()[m_used++]=c;
+      }
+      // Writes all buffered data, ending the compressed stream. Returns false on error.
+      bool finish();
+    protected:
+      void flushBuffer();
+      // Compresses (if needed) and writes to device
+      void output(const char *data, qsizetype size, bool last=false);
+      void writeDevice(const char *data, qint64 size);
+      QIODevice *m_device;
+      ExportOptions m_options;
+      QByteArray m_buffer;
+      qsizetype m_used;
+      QByteArray m_compressed;
+      void *m_zstream;
+      QString m_errorMsg;
+    };
+  }
+  /// \endcond INTERNAL
+}
@@ -0,0 +1,74 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "database.h"
+#include "function.h"
+#include "sqlite3.h"
+
+using namespace HFSQtLi;
+
+void *Helper::contextUserData(sqlite3_context *context)
+{
+  return sqlite3_user_data(context);
+}
+
+void *Helper::aggregateContext(sqlite3_context *context, int bytes)
+{
+  return sqlite3_aggregate_context(context, bytes);
+}
+
+void Helper::resultNull(sqlite3_context *context)
+{
+  sqlite3_result_null(context);
+}
+
+void Helper::resultInt64(sqlite3_context *context, qint64 value)
+{
+  sqlite3_result_int64(context, value);
+}
+
+void Helper::resultDouble(sqlite3_context *context, double value)
+{
+  sqlite3_result_double(context, value);
+}
+
+void Helper::resultText(sqlite3_context *context, const QString &value)
+{
+  QByteArray utf8=value.toUtf8();
+  sqlite3_result_text64(context, utf8.constData(), utf8.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
+}
+
+void Helper::resultText(sqlite3_context *context, const char *value)
+{
+  if(value)
+    sqlite3_result_text(context, value, -1, SQLITE_TRANSIENT);
+  else
+    sqlite3_result_null(context);
+}
+
+void Helper::resultBlob(sqlite3_context *context, const QByteArray &value)
+{
+  sqlite3_result_blob64(context, value.constData(), value.size(), SQLITE_TRANSIENT);
+}
+
+void Helper::resultError(sqlite3_context *context, const char *message)
+{
+  sqlite3_result_error(context, message, -1);
+}
+
+void Helper::resultNoMemory(sqlite3_context *context)
+{
+  sqlite3_result_error_nomem(context);
+}
@@ -0,0 +1,181 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QString>
+#include <QByteArray>
+#include <optional>
+#include <type_traits>
+#include <new>
+#include "templatehelper.h"
+#include "util.h"
+
+struct sqlite3_context;
+struct sqlite3_value;
+
+namespace HFSQtLi
+{
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    // Non-template access to sqlite3_context, used by user defined functions
+    void *contextUserData(sqlite3_context *context);
+    void *aggregateContext(sqlite3_context *context, int bytes);
+    void resultNull(sqlite3_context *context);
+    void resultInt64(sqlite3_context *context, qint64 value);
+    void resultDouble(sqlite3_context *context, double value);
+    void resultText(sqlite3_context *context, const QString &value);
+    void resultText(sqlite3_context *context, const char *value);
+    void resultBlob(sqlite3_context *context, const QByteArray &value);
+    void resultError(sqlite3_context *context, const char *message);
+    void resultNoMemory(sqlite3_context *context);
+
+    // Decodes function arguments (and the rows of the result cache) with the non-strict Query::readColumn functions, so that custom types
+    // (customFetch, HFSQTLI_MAP) are read like columns. Returns false on error, filling errorMsg if not null. Defined in query_template.h
+    template <typename Tuple> bool readValues(sqlite3_value **values, int count, Tuple &&result, QString *errorMsg);
+
+    // Encoding of function results
+    template <typename T> inline std::enable_if_t<std::is_integral_v<T>> resultValue(sqlite3_context *context, T value) { resultInt64(context, static_cast<qint64>(value)); }
+    inline void resultValue(sqlite3_context *context, double value) { resultDouble(context, value); }
+    inline void resultValue(sqlite3_context *context, float value) { resultDouble(context, value); }
+    inline void resultValue(sqlite3_context *context, const QString &value) { resultText(context, value); }
+    inline void resultValue(sqlite3_context *context, const char *value) { resultText(context, value); }
+    inline void resultValue(sqlite3_context *context, const QByteArray &value) { resultBlob(context, value); }
+    inline void resultValue(sqlite3_context *context, std::nullptr_t) { resultNull(context); }
+    inline void resultValue(sqlite3_context *context, const Null &) { resultNull(context); }
+    template <typename T> inline void resultValue(sqlite3_context *context, const std::optional<T> &value)
+    {
+      if(value)
+        resultValue(context, *value);
+      else
+        resultNull(context);
+    }
+
+    // Deduces result and argument types of a callable (lambda, functor or function pointer)
+    template <typename F> struct FunctionTraits: FunctionTraits<decltype(&F::operator())> { };
+    template <typename R, typename ...A> struct FunctionTraits<R (A...)>
+    {
+      typedef R Result;
+      typedef std::tuple<std::remove_const_t<std::remove_reference_t<A>>...> Args;
+      static constexpr int arity=sizeof...(A);
+    };
+    template <typename R, typename ...A> struct FunctionTraits<R (*)(A...)>: FunctionTraits<R (A...)> { };
+    template <typename R, typename C, typename ...A> struct FunctionTraits<R (C::*)(A...)>: FunctionTraits<R (A...)> { };
+    template <typename R, typename C, typename ...A> struct FunctionTraits<R (C::*)(A...) const>: FunctionTraits<R (A...)> { };
+
+    // Holds a callable registered as a scalar SQL function
+    template <typename F> struct ScalarFunction
+    {
+      typedef FunctionTraits<F> Traits;
+      F function;
+      static void call(sqlite3_context *context, int argc, sqlite3_value **argv)
+      {
+        Q_UNUSED(argc);
+        auto *self=static_cast<ScalarFunction *>(contextUserData(context));
+        typename Traits::Args args;
+        QString error;
+        if(!readValues(argv, Traits::arity, args, &error))
+        {
+          resultError(context, error.toUtf8().constData());
+          return;
+        }
+        if constexpr(std::is_void_v<typename Traits::Result>)
+        {
+          std::apply(self->function, args);
+          resultNull(context);
+        }
+        else
+          resultValue(context, std::apply(self->function, args));
+      }
+      static void destroy(void *function) { delete static_cast<ScalarFunction *>(function); }
+    };
+
+    // Calls a member function of an aggregate state with the arguments decoded from argv
+    template <typename S, typename M> inline void callState(sqlite3_context *context, S *state, M method, sqlite3_value **argv)
+    {
+      typedef FunctionTraits<M> Traits;
+      typename Traits::Args args;
+      QString error;
+      if(!readValues(argv, Traits::arity, args, &error))
+      {
+        resultError(context, error.toUtf8().constData());
+        return;
+      }
+      std::apply([state, method](auto &...values) { (state->*method)(values...); }, args);
+    }
+
+    template <typename S, typename=void> struct HasInverse: std::false_type { };
+    template <typename S> struct HasInverse<S, std::void_t<decltype(&S::inverse)>>: std::true_type { };
+
+    // Aggregate or window function whose state is an instance of S, constructed in place in the aggregate context
+    template <typename S> struct AggregateFunction
+    {
+      static_assert(std::is_default_constructible_v<S>, "Aggregate state must be default constructible");
+      static_assert(alignof(S)<=8, "Aggregate state alignment must not exceed 8 bytes");
+      typedef FunctionTraits<decltype(&S::step)> Traits;
+      static constexpr bool isWindow=HasInverse<S>::value;
+      // SQLite zeroes the aggregate context on allocation, so constructed is false until the first step
+      struct Storage
+      {
+        bool constructed;
+        alignas(S) unsigned char state[sizeof(S)];
+      };
+      static S *state(sqlite3_context *context, bool create)
+      {
+        auto *storage=static_cast<Storage *>(aggregateContext(context, create?int(sizeof(Storage)):0));
+        if(!storage || (!storage->constructed && !create))
+          return nullptr;
+        if(!storage->constructed)
+        {
+          new(storage->state) S();
+          storage->constructed=true;
+        }
+        return std::launder(reinterpret_cast<S *>(storage->state));
+      }
+      static void step(sqlite3_context *context, int, sqlite3_value **argv)
+      {
+        S *current=state(context, true);
+        if(current)
+          callState(context, current, &S::step, argv);
+        else
+          resultNoMemory(context);
+      }
+      static void inverse(sqlite3_context *context, int, sqlite3_value **argv)
+      {
+        S *current=state(context, true);
+        if(current)
+          callState(context, current, &S::inverse, argv);
+        else
+          resultNoMemory(context);
+      }
+      static void value(sqlite3_context *context)
+      {
+        S *current=state(context, false);
+        if(current)
+          resultValue(context, current->value());
+        else
+          resultValue(context, S().value()); // No row was aggregated
+      }
+      static void final(sqlite3_context *context)
+      {
+        value(context);
+        S *current=state(context, false);
+        if(current)
+          current->~S();
+      }
+    };
+  }
+  /// \endcond INTERNAL
+}
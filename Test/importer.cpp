@@ -0,0 +1,397 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "importer.h"
+#include "database.h"
+#include "sqlite3.h"
+#include <QIODevice>
+#include <cstring>
+
+using namespace HFSQtLi;
+
+namespace
+{
+  constexpr quint64 g_ones=0x0101010101010101ULL;
+  constexpr quint64 g_highs=0x8080808080808080ULL;
+
+  // Non zero if any byte of v is equal to the byte repeated in pattern
+  inline quint64 hasByte(quint64 v, quint64 pattern)
+  {
+    quint64 x=v^pattern;
+    return (x-g_ones)&~x&g_highs;
+  }
+}
+
+BulkImporter::BulkImporter(Db *db, Format format):
+  m_db(db), m_query(db, true), m_header(false), m_chunkSize(4*1024*1024), m_rowsPerTransaction(50000), m_emptyAsNull(false),
+  m_columns(0), m_inTransaction(false), m_pendingRows(0), m_rows(0), m_bytesRead(0), m_line(0), m_error(SQLITE_OK)
+{
+  setFormat(format);
+}
+
+BulkImporter::~BulkImporter()
+{
+}
+
+void BulkImporter::setFormat(Format format)
+{
+  switch(format)
+  {
+  case Format::Csv:
+    m_delimiter=',';
+    m_quote='"';
+    break;
+  case Format::Tsv:
+    m_delimiter='\t';
+    m_quote=0;
+    break;
+  }
+}
+
+bool BulkImporter::import(QIODevice *device, const QString &table, const QStringList &columns)
+{
+  m_rows=m_bytesRead=m_line=0;
+  m_pendingRows=0;
+  m_columns=0;
+  m_error=SQLITE_OK;
+  m_errorMsg.clear();
+  m_query.finalize();
+  if(!device || !device->isReadable() || !m_db || !m_db->isOk())
+  {
+    setError(SQLITE_MISUSE, SQLiteCode::errorString(SQLITE_MISUSE));
+    return false;
+  }
+  bool header=m_header;
+  bool atEnd=false;
+  qsizetype used=0; // Bytes in m_buffer still to be parsed
+  while(m_error==SQLITE_OK && !(atEnd && used==0))
+  {
+    // Read next chunk after the incomplete record left from previous one
+    if(!atEnd)
+    {
+      m_buffer.resize(used+m_chunkSize);
+      qint64 read=device->read(m_buffer.data()+used, m_chunkSize);
+      if(read<0)
+      {
+        setError(SQLITE_IOERR, device->errorString());
+        break;
+      }
+      // Sequential devices (sockets, processes) may have no data yet: wait for it, applying backpressure to the reader
+      if(read==0 && !(device->isSequential() && device->waitForReadyRead(-1)))
+        atEnd=true;
+      m_bytesRead+=read;
+      used+=read;
+    }
+    char *p=m_buffer.data();
+    char *end=p+used;
+    for(;;)
+    {
+      char *start=p;
+      Parse result=parseRecord(p, end, atEnd);
+      if(result==Parse::NeedMore)
+      {
+        p=start;
+        break;
+      }
+      if(result==Parse::Malformed)
+      {
+        setError(SQLITE_CONSTRAINT, QString("Malformed quoted field at line %1").arg(m_line+1));
+        break;
+      }
+      m_line++;
+      // Skip empty lines
+      if(m_fields.size()==1 && m_fields[0].size==0 && !m_fields[0].quoted)
+        continue;
+      for(Field &field: m_fields)
+        if(field.escaped)
+          unescape(field);
+      if(header)
+      {
+        header=false;
+        QStringList names=columns;
+        if(names.isEmpty())
+          for(const Field &field: qAsConst(m_fields))
+            names.append(QString::fromUtf8(field.data, field.size));
+        if(!prepare(table, names, m_fields.size()))
+          break;
+        continue;
+      }
+      if(!m_query.isPrepared() && !prepare(table, columns, m_fields.size()))
+        break;
+      if(!insert())
+        break;
+    }
+    if(m_error!=SQLITE_OK)
+      break;
+    // Keep the incomplete record at the beginning of the buffer
+    used=end-p;
+    if(used>0 && p!=m_buffer.data())
+      memmove(m_buffer.data(), p, used);
+    if(atEnd && used>0)
+    {
+      // Only possible if parseRecord could not complete a record at the end of data
+      setError(SQLITE_CONSTRAINT, QString("Unterminated quoted field at line %1").arg(m_line+1));
+      break;
+    }
+    if(m_progress && !m_progress(m_bytesRead, m_rows+m_pendingRows))
+      setError(SQLITE_INTERRUPT, "Import cancelled");
+  }
+  if(m_error==SQLITE_OK)
+    commit();
+  else
+    rollback();
+  m_buffer.clear();
+  m_buffer.squeeze();
+  m_query.finalize();
+  return m_error==SQLITE_OK;
+}
+
+BulkImporter::Parse BulkImporter::parseRecord(char *&p, char *end, bool atEnd)
+{
+  m_fields.resize(0);
+  if(p==end)
+    return Parse::NeedMore;
+  for(;;)
+  {
+    Field field{p, 0, false, false};
+    if(m_quote && p<end && *p==m_quote)
+    {
+      // Quoted field: find the closing quote, remembering if there are escaped quotes to remove later
+      field.quoted=true;
+      field.data=++p;
+      for(;;)
+      {
+        auto *q=static_cast<char *>(memchr(p, m_quote, end-p));
+        if(!q || q+1==end)
+        {
+          // The quote may be followed by another one in next chunk
+          if(!atEnd || !q)
+            return Parse::NeedMore;
+          p=q+1;
+          break;
+        }
+        if(q[1]==m_quote)
+        {
+          field.escaped=true;
+          p=q+2;
+          continue;
+        }
+        p=q+1;
+        break;
+      }
+      field.size=int(p-1-field.data);
+      if(p<end && *p!=m_delimiter && *p!='\n' && *p!='\r')
+        return Parse::Malformed;
+    }
+    else
+    {
+      p=findSpecial(p, end);
+      field.size=int(p-field.data);
+    }
+    if(p==end)
+    {
+      if(!atEnd)
+        return Parse::NeedMore;
+      m_fields.append(field);
+      return Parse::Record;
+    }
+    if(*p==m_delimiter)
+    {
+      m_fields.append(field);
+      p++;
+      continue;
+    }
+    if(*p=='\r')
+    {
+      if(p+1==end && !atEnd)
+        return Parse::NeedMore;
+      p++;
+    }
+    if(p<end && *p=='\n')
+      p++;
+    m_fields.append(field);
+    return Parse::Record;
+  }
+}
+
+char *BulkImporter::findSpecial(char *p, char *end) const
+{
+  // Check 8 bytes at a time for delimiter, CR and LF, then locate the exact byte
+  const quint64 delimiter=g_ones*quint8(m_delimiter);
+  const quint64 lf=g_ones*quint8('\n');
+  const quint64 cr=g_ones*quint8('\r');
+  while(end-p>=8)
+  {
+    quint64 v;
+    memcpy(&v, p, 8);
+    if(hasByte(v, delimiter)|hasByte(v, lf)|hasByte(v, cr))
+      break;
+    p+=8;
+  }
+  while(p<end && *p!=m_delimiter && *p!='\n' && *p!='\r')
+    p++;
+  return p;
+}
+
+void BulkImporter::unescape(Field &field) const
+{
+  char *in=field.data;
+  char *out=field.data;
+  char *end=field.data+field.size;
+  while(in<end)
+  {
+    if(*in==m_quote)
+      in++; // First of two quotes
+    *out++=*in++;
+  }
+  field.size=int(out-field.data);
+}
+
+bool BulkImporter::prepare(const QString &table, const QStringList &columns, int fieldCount)
+{
+  QString sql="INSERT INTO "+Helper::quoteIdentifier(table);
+  QStringList parameters;
+  m_columns=columns.isEmpty()?fieldCount:columns.size();
+  for(int i=1;i<=m_columns;i++)
+    parameters.append("?"+QString::number(i));
+  if(!columns.isEmpty())
+  {
+    QStringList quoted;
+    for(const QString &column: columns)
+      quoted.append(Helper::quoteIdentifier(column));
+    sql+=" ("+quoted.join(", ")+")";
+  }
+  sql+=" VALUES ("+parameters.join(", ")+")";
+  if(!m_query.prepare(sql, true))
+  {
+    setError(m_query.error(), m_query.errorMsg());
+    return false;
+  }
+  return true;
+}
+
+bool BulkImporter::insert()
+{
+  if(m_fields.size()>m_columns)
+  {
+    setError(SQLITE_CONSTRAINT, QString("Line %1 has %2 fields, expected %3").arg(m_line).arg(m_fields.size()).arg(m_columns));
+    return false;
+  }
+  if(m_rowsPerTransaction>0 && !m_inTransaction && !begin())
+    return false;
+  bool ok=m_query.reset();
+  // Missing fields are NULL
+  for(int i=0;ok && i<m_columns;i++)
+    ok=i<m_fields.size()?bindField(i, m_fields[i]):m_query.bindTemporary(i+1, nullptr);
+  if(ok && (m_query.stepNoFetch() || m_query.error()!=SQLITE_DONE))
+    ok=false;
+  if(!ok)
+  {
+    setError(m_query.error(), QString("Line %1: %2").arg(m_line).arg(m_query.errorMsg()));
+    return false;
+  }
+  m_pendingRows++;
+  if(m_rowsPerTransaction>0 && m_pendingRows>=m_rowsPerTransaction)
+    return commit();
+  if(m_rowsPerTransaction==0)
+  {
+    m_rows+=m_pendingRows;
+    m_pendingRows=0;
+  }
+  return true;
+}
+
+bool BulkImporter::bindField(int i, const Field &field)
+{
+  if(m_emptyAsNull && field.size==0 && !field.quoted)
+    return m_query.bindTemporary(i+1, nullptr);
+  Affinity affinity=i<m_affinities.size()?m_affinities[i]:Affinity::Text;
+  if(affinity!=Affinity::Text && affinity!=Affinity::Blob && field.size>0)
+  {
+    // fromRawData doesn't copy the field
+    QByteArray raw=QByteArray::fromRawData(field.data, field.size);
+    bool ok=false;
+    if(affinity!=Affinity::Real)
+    {
+      qint64 value=raw.toLongLong(&ok);
+      if(ok)
+        return m_query.bindTemporary(i+1, value);
+    }
+    if(affinity!=Affinity::Integer)
+    {
+      double value=raw.toDouble(&ok);
+      if(ok)
+        return m_query.bindTemporary(i+1, value);
+    }
+  }
+  if(affinity==Affinity::Blob)
+    return m_query.bindTemporary(i+1, QByteArray::fromRawData(field.data, field.size));
+  return m_query.bindTemporary(i+1, TextView(field.data, field.size));
+}
+
+bool BulkImporter::begin()
+{
+  QString msg;
+  if(!m_db->execute(&msg, "BEGIN"))
+  {
+    setError(m_db->error(), msg);
+    return false;
+  }
+  m_inTransaction=true;
+  return true;
+}
+
+bool BulkImporter::commit()
+{
+  if(m_inTransaction)
+  {
+    QString msg;
+    // Statement must not be running when committing
+    m_query.reset();
+    if(!m_db->execute(&msg, "COMMIT"))
+    {
+      setError(m_db->error(), msg);
+      rollback();
+      return false;
+    }
+    m_inTransaction=false;
+  }
+  m_rows+=m_pendingRows;
+  m_pendingRows=0;
+  return true;
+}
+
+void BulkImporter::rollback()
+{
+  m_query.reset();
+  if(m_inTransaction)
+  {
+    m_db->execute("ROLLBACK");
+    m_inTransaction=false;
+    m_pendingRows=0;
+  }
+  else
+  {
+    // Without transactions every row is already committed
+    m_rows+=m_pendingRows;
+    m_pendingRows=0;
+  }
+}
+
+void BulkImporter::setError(int code, const QString &msg)
+{
+  m_error=code;
+  m_errorMsg=msg;
+}
@@ -0,0 +1,192 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <functional>
+#include "query.h"
+
+class QIODevice;
+
+namespace HFSQtLi
+{
+  class Db;
+  /**
+   * @brief Imports delimited text (CSV, TSV) from a QIODevice into a table.
+   *
+   * The device is read in large chunks. Records are split in place in the read buffer, scanning 8 bytes at a time for delimiters and line ends,
+   * and every field is bound with Query::bindTemporary directly from the buffer (quoted fields are unescaped in place), so no QString or QByteArray is created per field.
+   * Rows are inserted with a single prepared statement and grouped in transactions of rowsPerTransaction() rows.
+   *
+   * Quoting follows RFC 4180: fields may be enclosed in quote() characters, which allows delimiters and line breaks inside them, and a quote inside a quoted field is written twice.
+   * Both LF and CRLF line ends are accepted, empty lines are skipped.
+   *
+   * Example usage:
+   * \code
+   * QFile file("data.csv");
+   * file.open(QIODevice::ReadOnly);
+   * BulkImporter importer(db);
+   * importer.setHeader(true);
+   * importer.setAffinities({BulkImporter::Affinity::Integer, BulkImporter::Affinity::Text, BulkImporter::Affinity::Real});
+   * importer.setProgressCallback([](qint64 bytes, qint64 rows){ qDebug()<<bytes<<rows; return true; });
+   * if(!importer.import(&file, "measures"))
+   *   qDebug()<<importer.errorMsg();
+   * \endcode
+   */
+  class BulkImporter
+  {
+  public:
+    /// @brief Input formats
+    enum class Format: int
+    {
+      /// @brief Comma separated, fields can be quoted with "
+      Csv,
+      /// @brief Tab separated, no quoting
+      Tsv
+    };
+    /**
+     * @brief Conversion applied to the fields of a column before binding them.
+     *
+     * Fields that can't be converted are bound as text, so the column affinity of the table still applies.
+     */
+    enum class Affinity: int
+    {
+      /// @brief Bound as text (default)
+      Text,
+      /// @brief Bound as a 64 bit integer
+      Integer,
+      /// @brief Bound as a double
+      Real,
+      /// @brief Bound as an integer if possible, otherwise as a double
+      Numeric,
+      /// @brief Bound as a blob with the raw bytes of the field
+      Blob
+    };
+    /**
+     * @brief Progress callback
+     *
+     * Receives the number of bytes read from the device and the number of rows inserted so far. Returning false stops the import with SQLiteCode::INTERRUPT.
+     */
+    typedef std::function<bool(qint64 bytesRead, qint64 rows)> ProgressCallback;
+
+    /**
+     * @brief Constructs an importer writing into a database
+     * @param db Database to write to
+     * @param format Initial format, sets delimiter() and quote()
+     */
+    BulkImporter(Db *db, Format format=Format::Csv);
+    ~BulkImporter();
+
+    /// @name Settings
+    /// @{
+    /// @brief Sets delimiter and quote for the given format
+    void setFormat(Format format);
+    /// @brief Character separating fields
+    char delimiter() const { return m_delimiter; }
+    /// @brief Sets the character separating fields
+    void setDelimiter(char delimiter) { m_delimiter=delimiter; }
+    /// @brief Character used to quote fields, 0 if quoting is disabled
+    char quote() const { return m_quote; }
+    /// @brief Sets the character used to quote fields (0 to disable quoting)
+    void setQuote(char quote) { m_quote=quote; }
+    /// @brief True if the first record contains the column names
+    bool header() const { return m_header; }
+    /// @brief Sets if the first record contains the column names. The names are used when no column is passed to import(), otherwise the record is skipped.
+    void setHeader(bool header) { m_header=header; }
+    /// @brief Size in bytes of the chunks read from the device
+    int chunkSize() const { return m_chunkSize; }
+    /// @brief Sets the size in bytes of the chunks read from the device (default 4 MiB)
+    void setChunkSize(int size) { m_chunkSize=qMax(size, 1024); }
+    /// @brief Number of rows inserted in a transaction
+    int rowsPerTransaction() const { return m_rowsPerTransaction; }
+    /// @brief Sets the number of rows inserted in a transaction (default 50000). With 0 no transaction is started, leaving the control to the caller.
+    void setRowsPerTransaction(int rows) { m_rowsPerTransaction=qMax(rows, 0); }
+    /// @brief Conversions applied to the columns
+    const QVector<Affinity> &affinities() const { return m_affinities; }
+    /// @brief Sets the conversions applied to the columns, in order. Columns without an entry use Affinity::Text.
+    void setAffinities(const QVector<Affinity> &affinities) { m_affinities=affinities; }
+    /// @brief True if empty unquoted fields are bound as NULL
+    bool emptyAsNull() const { return m_emptyAsNull; }
+    /// @brief Sets if empty unquoted fields are bound as NULL (default false, they are bound as empty strings)
+    void setEmptyAsNull(bool emptyAsNull) { m_emptyAsNull=emptyAsNull; }
+    /// @brief Sets the function called after each chunk
+    void setProgressCallback(const ProgressCallback &callback) { m_progress=callback; }
+    /// @}
+
+    /**
+     * @brief Imports all the records of a device
+     *
+     * On failure the transaction in progress is rolled back, rows of transactions already committed are kept.
+     * @param device Device to read, must be open for reading
+     * @param table Name of the table, it will be quoted
+     * @param columns Columns to insert. If empty the names in the header are used, or all the columns of the table if there is no header.
+     * @return True on success
+     */
+    bool import(QIODevice *device, const QString &table, const QStringList &columns=QStringList());
+
+    /// @brief Number of rows inserted by last import. On failure only the rows committed are counted.
+    qint64 rowsImported() const { return m_rows; }
+    /// @brief Number of bytes read by last import
+    qint64 bytesRead() const { return m_bytesRead; }
+    /// @brief Error code of last import
+    int error() const { return m_error; }
+    /// @brief Error message of last import
+    QString errorMsg() const { return m_errorMsg; }
+  protected:
+    struct Field
+    {
+      char *data;
+      int size;
+      bool quoted;
+      bool escaped;
+    };
+    // Result of parsing a record
+    enum class Parse { Record, NeedMore, Malformed };
+    Parse parseRecord(char *&p, char *end, bool atEnd);
+    char *findSpecial(char *p, char *end) const;
+    void unescape(Field &field) const;
+    bool prepare(const QString &table, const QStringList &columns, int fieldCount);
+    bool insert();
+    bool bindField(int i, const Field &field);
+    bool begin();
+    bool commit();
+    void rollback();
+    void setError(int code, const QString &msg);
+    Db *m_db;
+    Query m_query;
+    char m_delimiter;
+    char m_quote;
+    bool m_header;
+    int m_chunkSize;
+    int m_rowsPerTransaction;
+    QVector<Affinity> m_affinities;
+    bool m_emptyAsNull;
+    ProgressCallback m_progress;
+    // State of current import
+    QByteArray m_buffer;
+    QVector<Field> m_fields;
+    int m_columns;
+    bool m_inTransaction;
+    int m_pendingRows;
+    qint64 m_rows;
+    qint64 m_bytesRead;
+    qint64 m_line;
+    int m_error;
+    QString m_errorMsg;
+  };
+}
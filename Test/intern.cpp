@@ -0,0 +1,39 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "intern.h"
+
+using namespace HFSQtLi;
+
+InternPool::InternPool(int maxSize): m_maxSize(maxSize), m_hits(0), m_misses(0)
+{
+}
+
+QString InternPool::intern(const char *utf8, qsizetype size)
+{
+  if(!utf8)
+    return QString();
+  auto it=m_strings.constFind(QByteArray::fromRawData(utf8, size));
+  if(it!=m_strings.constEnd())
+  {
+    m_hits++;
+    return it.value();
+  }
+  m_misses++;
+  QString ret=QString::fromUtf8(utf8, size);
+  if(m_strings.size()<m_maxSize)
+    m_strings.insert(QByteArray(utf8, size), ret);
+  return ret;
+}
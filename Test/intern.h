@@ -0,0 +1,95 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <type_traits>
+
+namespace HFSQtLi
+{
+  /**
+   * @brief Pool of strings shared by the Interned<QString> values fetched by queries (see Interned).
+   *
+   * Strings are keyed by their UTF-8 bytes: fetching a value already in the pool costs a hash lookup and returns a shared copy of the pooled QString,
+   * with no allocation and no UTF-8 decoding. Once the pool holds maxSize() strings new values are decoded without being added, so high cardinality columns
+   * do not grow it without limit.
+   *
+   * Every query has its own pool, created on first use. A pool can be shared by several queries (see Query::setInternPool) from the same thread.
+   */
+  class InternPool
+  {
+  public:
+    /**
+     * @brief Constructs an empty pool
+     * @param maxSize Maximum number of strings kept
+     */
+    explicit InternPool(int maxSize=4096);
+    /**
+     * @brief Gets the pooled string with the given UTF-8 content, adding it if needed
+     * @param utf8 Text, not nul terminated. If null a null string is returned.
+     * @param size Size in bytes
+     */
+    QString intern(const char *utf8, qsizetype size);
+    /// @brief Number of strings in the pool
+    int size() const { return int(m_strings.size()); }
+    /// @brief Maximum number of strings kept
+    int maxSize() const { return m_maxSize; }
+    /// @brief Sets the maximum number of strings kept. Strings already in the pool are not removed.
+    void setMaxSize(int maxSize) { m_maxSize=maxSize; }
+    /// @brief Removes all the strings
+    void clear() { m_strings.clear(); }
+    /// @brief Number of values found in the pool
+    quint64 hits() const { return m_hits; }
+    /// @brief Number of values decoded
+    quint64 misses() const { return m_misses; }
+  protected:
+    QHash<QByteArray, QString> m_strings;
+    int m_maxSize;
+    quint64 m_hits;
+    quint64 m_misses;
+  };
+
+  /**
+   * @brief Fetches a text column through the intern pool of the query (see InternPool).
+   *
+   * Meant for low cardinality columns (status, country, category, ...): all the rows with the same value share one QString, saving the allocation and the
+   * UTF-8 decoding of every repeated value and the memory of rows kept around. Binding an Interned<QString> is the same as binding the QString.
+   * \code
+   * QVector<std::tuple<qint64, Interned<QString>>> rows;
+   * std::tuple<qint64, Interned<QString>> row;
+   * while(qry.step(row))
+   *   rows.append(row);
+   * \endcode
+   */
+  template <typename T> class Interned
+  {
+    static_assert(std::is_same<T, QString>::value, "Only QString can be interned");
+  public:
+    /// @brief Constructs a null string
+    Interned() { }
+    /// @brief Constructs from a string
+    Interned(const T &value): m_value(value) { }
+    /// @brief Gets the string
+    const T &value() const { return m_value; }
+    operator const T &() const { return m_value; }
+    const T *operator->() const { return &m_value; }
+    bool operator==(const Interned &other) const { return m_value==other.m_value; }
+    bool operator!=(const Interned &other) const { return m_value!=other.m_value; }
+  protected:
+    T m_value;
+  };
+}
@@ -0,0 +1,68 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "mapping.h"
+#include "util.h"
+
+using namespace HFSQtLi;
+
+QStringList Helper::mappedColumns(const char *names)
+{
+  QStringList ret;
+  for(const QString &name: QString(names).split(','))
+    ret.append(name.trimmed());
+  return ret;
+}
+
+QVector<QByteArray> Helper::mappedColumnNames(const QStringList &columns)
+{
+  QVector<QByteArray> ret;
+  ret.reserve(columns.size());
+  for(const QString &column: columns)
+    ret.append(column.toUtf8());
+  return ret;
+}
+
+QString Helper::mappedCreateTableSql(const QString &table, const QStringList &columns, const char *const *types, const QString &constraints)
+{
+  QStringList definitions;
+  for(int i=0;i<columns.size();i++)
+    definitions.append(quoteIdentifier(columns[i])+" "+types[i]);
+  if(!constraints.isEmpty())
+    definitions.append(constraints);
+  return "CREATE TABLE IF NOT EXISTS "+quoteIdentifier(table)+" ("+definitions.join(", ")+")";
+}
+
+QString Helper::mappedInsertSql(const QString &table, const QStringList &columns)
+{
+  QStringList quoted, parameters;
+  for(const QString &column: columns)
+  {
+    quoted.append(quoteIdentifier(column));
+    parameters.append("?");
+  }
+  return "INSERT INTO "+quoteIdentifier(table)+" ("+quoted.join(", ")+") VALUES ("+parameters.join(", ")+")";
+}
+
+QString Helper::mappedSelectSql(const QString &table, const QStringList &columns, const QString &where)
+{
+  QStringList quoted;
+  for(const QString &column: columns)
+    quoted.append(quoteIdentifier(column));
+  QString ret="SELECT "+quoted.join(", ")+" FROM "+quoteIdentifier(table);
+  if(!where.isEmpty())
+    ret+=" WHERE "+where;
+  return ret;
+}
@@ -0,0 +1,189 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include "templatehelper.h"
+
+/// \cond INTERNAL
+// Applies HFSQTLI_MAP_FIELDS_n to the n (up to 32) field names
+#define HFSQTLI_MAP_EXPAND(x) x
+#define HFSQTLI_MAP_CONCAT(a, b) HFSQTLI_MAP_CONCAT_(a, b)
+#define HFSQTLI_MAP_CONCAT_(a, b) a##b
+#define HFSQTLI_MAP_COUNT(...) HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_COUNT_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define HFSQTLI_MAP_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define HFSQTLI_MAP_FIELDS(v, ...) HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_CONCAT(HFSQTLI_MAP_FIELDS_, HFSQTLI_MAP_COUNT(__VA_ARGS__))(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_1(v, f) v.f
+#define HFSQTLI_MAP_FIELDS_2(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_1(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_3(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_2(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_4(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_3(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_5(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_4(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_6(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_5(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_7(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_6(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_8(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_7(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_9(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_8(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_10(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_9(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_11(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_10(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_12(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_11(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_13(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_12(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_14(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_13(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_15(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_14(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_16(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_15(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_17(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_16(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_18(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_17(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_19(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_18(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_20(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_19(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_21(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_20(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_22(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_21(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_23(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_22(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_24(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_23(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_25(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_24(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_26(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_25(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_27(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_26(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_28(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_27(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_29(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_28(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_30(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_29(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_31(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_30(v, __VA_ARGS__))
+#define HFSQTLI_MAP_FIELDS_32(v, f, ...) v.f, HFSQTLI_MAP_EXPAND(HFSQTLI_MAP_FIELDS_31(v, __VA_ARGS__))
+/// \endcond INTERNAL
+
+/**
+ * @brief Maps the fields of a struct to columns, see \ref HFSQtLi::Mapping.
+ *
+ * Must be used in the namespace of the struct, after its definition. Fields are bound and fetched in the given order, up to 32 fields.
+ */
+#define HFSQTLI_MAP(Type, ...) \
+  inline auto hfsqtliMapFields(Type &value) { return std::tie(HFSQTLI_MAP_FIELDS(value, __VA_ARGS__)); } \
+  inline auto hfsqtliMapFields(const Type &value) { return std::tie(HFSQTLI_MAP_FIELDS(value, __VA_ARGS__)); } \
+  inline const char *hfsqtliMapNames(const Type *) { return #__VA_ARGS__; } \
+  inline const char *hfsqtliMapTable(const Type *) { return #Type; }
+
+namespace HFSQtLi
+{
+  template <typename T> class Interned;
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    template <typename T, typename=void> struct IsMapped: std::false_type { };
+    template <typename T> struct IsMapped<T, std::void_t<decltype(hfsqtliMapFields(std::declval<const T &>()))>>: std::true_type { };
+    // Tuple of references to the fields of a mapped type
+    template <typename T> using MappedFields=decltype(hfsqtliMapFields(std::declval<T &>()));
+    template <typename T> constexpr int mappedSize() { return int(std::tuple_size<MappedFields<T>>::value); }
+
+    template <typename T> struct IsOptional: std::false_type { };
+    template <typename T> struct IsOptional<std::optional<T>>: std::true_type { };
+
+    // Declared type of the column of a field. Fields that are not std::optional are NOT NULL.
+    // Column type of the types with a built-in codec, specialized in codecs.h
+    template <typename T> struct CodecSqlType { static constexpr const char *type=nullptr, *typeNotNull=nullptr; };
+
+    template <typename T> constexpr const char *mappedSqlType(bool notNull=true)
+    {
+      if constexpr(IsOptional<T>::value)
+        return mappedSqlType<typename T::value_type>(false);
+      else if constexpr(std::is_integral<T>::value)
+        return notNull?"INTEGER NOT NULL":"INTEGER";
+      else if constexpr(std::is_floating_point<T>::value)
+        return notNull?"REAL NOT NULL":"REAL";
+      else if constexpr(std::is_same<T, QString>::value || std::is_same<T, Interned<QString>>::value)
+        return notNull?"TEXT NOT NULL":"TEXT";
+      else if constexpr(std::is_same<T, QByteArray>::value)
+        return notNull?"BLOB NOT NULL":"BLOB";
+      else if constexpr(CodecSqlType<T>::type!=nullptr)
+        return notNull?CodecSqlType<T>::typeNotNull:CodecSqlType<T>::type;
+      else
+      {
+        static_assert(!std::is_same<T, T>::value, "Mapped fields must be integers, floating points, QString, Interned<QString>, QByteArray, types with a built-in codec (QDateTime, QDate, QTime, QUuid...) or std::optional of them");
+        return nullptr;
+      }
+    }
+
+    // Splits the stringified field list of HFSQTLI_MAP
+    QStringList mappedColumns(const char *names);
+    QVector<QByteArray> mappedColumnNames(const QStringList &columns);
+    QString mappedCreateTableSql(const QString &table, const QStringList &columns, const char *const *types, const QString &constraints);
+    QString mappedInsertSql(const QString &table, const QStringList &columns);
+    QString mappedSelectSql(const QString &table, const QStringList &columns, const QString &where);
+  }
+  /// \endcond INTERNAL
+
+  /**
+   * @brief Columns and SQL statements of a struct mapped with HFSQTLI_MAP.
+   *
+   * HFSQTLI_MAP(Type, field1, field2, ...) lists the fields of a struct stored as columns with the same names. A mapped struct can be bound and fetched
+   * as any other type (see \ref bindcustomtypes and \ref fetchcustomtypes) without writing customBind and customFetch: each field is bound or fetched
+   * at an offset known at compile time, with the native function of its type, and the whole struct counts as sizeof...(fields) columns.
+   * Fields can be integers (bool included), double, float, QString, Interned<QString>, QByteArray or std::optional of them (empty is NULL).
+   *
+   * The table of a mapped struct defaults to the name of the struct. Fields that are not std::optional are declared NOT NULL.
+   * \code
+   * struct Sensor { qint64 id; QString name; std::optional<double> reading; };
+   * HFSQTLI_MAP(Sensor, id, name, reading)
+   * ...
+   * db->execute(Mapping<Sensor>::createTableSql("sensors", "PRIMARY KEY(id)"));
+   * Query insert(db, Mapping<Sensor>::insertSql("sensors"));
+   * insert.bindAll(Sensor{1, "temperature", 21.5});
+   * Sensor s;
+   * db->executeSingleAll<1>(Mapping<Sensor>::selectSql("sensors", "id=?"), 1, s);
+   * \endcode
+   */
+  template <typename T> class Mapping
+  {
+    static_assert(Helper::IsMapped<T>::value, "Mapping requires a struct mapped with HFSQTLI_MAP");
+  public:
+    /// @brief Number of mapped fields
+    static constexpr int columnCount() { return Helper::mappedSize<T>(); }
+    /// @brief Default table name: the name of the struct
+    static QString table() { return QString(hfsqtliMapTable(static_cast<const T *>(nullptr))); }
+    /// @brief Names of the columns, in the order of the fields
+    static const QStringList &columns()
+    {
+      static const QStringList ret=Helper::mappedColumns(hfsqtliMapNames(static_cast<const T *>(nullptr)));
+      return ret;
+    }
+    /// @brief Names of the columns encoded in UTF-8, as looked up by Query::columnByName
+    static const QVector<QByteArray> &columnNames()
+    {
+      static const QVector<QByteArray> ret=Helper::mappedColumnNames(columns());
+      return ret;
+    }
+    /**
+     * @brief Statement creating the table, if it does not exist
+     * @param table Name of the table (quoted). If null table() is used.
+     * @param constraints Table constraints appended after the columns, e.g. "PRIMARY KEY(id)"
+     */
+    static QString createTableSql(const QString &table=QString(), const QString &constraints=QString())
+    {
+      return Helper::mappedCreateTableSql(tableName(table), columns(), types(Helper::make_int_sequence<columnCount()>()), constraints);
+    }
+    /// @brief Statement inserting a row, with one parameter for every field. Bind a T (or its fields in order).
+    static QString insertSql(const QString &table=QString()) { return Helper::mappedInsertSql(tableName(table), columns()); }
+    /// @brief Statement selecting the columns of all the fields, fetchable into a T. where, if not empty, is appended after WHERE.
+    static QString selectSql(const QString &table=QString(), const QString &where=QString()) { return Helper::mappedSelectSql(tableName(table), columns(), where); }
+  protected:
+    static QString tableName(const QString &table) { return table.isNull()?Mapping::table():table; }
+    template <int ...I> static const char *const *types(Helper::int_sequence<I...>)
+    {
+      static const char *const ret[]={Helper::mappedSqlType<std::decay_t<std::tuple_element_t<I, Helper::MappedFields<T>>>>()...};
+      return ret;
+    }
+  };
+}
@@ -0,0 +1,115 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "multiinsert.h"
+#include "database.h"
+#include "sqlite3.h"
+
+using namespace HFSQtLi;
+
+Helper::MultiInsertBase::MultiInsertBase(Db *db, const QString &table, const QStringList &columns, int columnCount):
+  m_db(db), m_columnCount(columnCount), m_rows(0), m_statements(0), m_error(SQLITE_OK)
+{
+  m_sql="INSERT INTO "+quoteIdentifier(table);
+  if(!columns.isEmpty())
+  {
+    QStringList quoted;
+    for(const QString &column: columns)
+      quoted.append(quoteIdentifier(column));
+    m_sql+=" ("+quoted.join(", ")+")";
+  }
+  m_sql+=" VALUES ";
+  QStringList parameters;
+  for(int i=0;i<m_columnCount;i++)
+    parameters.append("?");
+  m_rowSql="("+parameters.join(", ")+")";
+}
+
+Helper::MultiInsertBase::~MultiInsertBase()
+{
+  for(Query *query: qAsConst(m_queries))
+    delete query;
+}
+
+Query *Helper::MultiInsertBase::statement(int rows)
+{
+  Query *ret=m_queries.value(rows);
+  if(ret)
+  {
+    if(!ret->reset())
+    {
+      setError(ret->error(), ret->errorMsg());
+      return nullptr;
+    }
+    return ret;
+  }
+  if(!m_db)
+  {
+    setError(SQLITE_MISUSE, SQLiteCode::errorString(SQLITE_MISUSE));
+    return nullptr;
+  }
+  QString sql=m_sql;
+  sql.reserve(m_sql.size()+rows*(m_rowSql.size()+2));
+  for(int i=0;i<rows;i++)
+  {
+    if(i>0)
+      sql+=", ";
+    sql+=m_rowSql;
+  }
+  ret=new Query(m_db, true);
+  if(!ret->prepare(sql, true))
+  {
+    setError(ret->error(), ret->errorMsg());
+    delete ret;
+    return nullptr;
+  }
+  m_queries.insert(rows, ret);
+  return ret;
+}
+
+void Helper::MultiInsertBase::bindFailed(Query *query, int count)
+{
+  if(count>=0)
+    setError(SQLITE_MISUSE, QString("A row bound %1 values instead of %2").arg(count).arg(m_columnCount));
+  else
+    setError(query->error(), query->errorMsg());
+}
+
+bool Helper::MultiInsertBase::execute(Query *query, int rows)
+{
+  bool ret=!query->stepNoFetch() && query->isDone();
+  if(ret)
+  {
+    m_rows+=rows;
+    m_statements++;
+  }
+  else
+    setError(query->error(), query->errorMsg());
+  query->reset();
+  query->clearBindings();
+  return ret;
+}
+
+void Helper::MultiInsertBase::clearError()
+{
+  m_error=SQLITE_OK;
+  m_errorMsg.clear();
+}
+
+void Helper::MultiInsertBase::setError(int code, const QString &msg)
+{
+  m_error=code;
+  m_errorMsg=msg;
+}
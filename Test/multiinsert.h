@@ -0,0 +1,197 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <tuple>
+#include <iterator>
+#include "query.h"
+
+namespace HFSQtLi
+{
+  class Db;
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    // Non-template part of MultiInsert: generates, prepares and caches the statement for every number of rows and runs them
+    class MultiInsertBase
+    {
+    public:
+      ~MultiInsertBase();
+      /// @brief Number of rows inserted since the object was created
+      qint64 rowsInserted() const { return m_rows; }
+      /// @brief Number of INSERT statements executed since the object was created
+      qint64 statementsExecuted() const { return m_statements; }
+      /// @brief Error code of last operation
+      int error() const { return m_error; }
+      /// @brief Error message of last operation
+      QString errorMsg() const { return m_errorMsg; }
+    protected:
+      MultiInsertBase(Db *db, const QString &table, const QStringList &columns, int columnCount);
+      MultiInsertBase(const MultiInsertBase &other)=delete;
+      MultiInsertBase &operator=(const MultiInsertBase &other)=delete;
+      // Returns the statement inserting rows rows, reset and ready to be bound, or null on error
+      Query *statement(int rows);
+      // Sets the error of a failed bind of a row: binding count values instead of m_columnCount
+      void bindFailed(Query *query, int count);
+      // Runs a statement with all the parameters bound and clears the bindings
+      bool execute(Query *query, int rows);
+      void clearError();
+      void setError(int code, const QString &msg);
+      Db *m_db;
+      int m_columnCount;
+      // INSERT INTO table(columns) VALUES, followed by one group of parameters per row
+      QString m_sql;
+      QString m_rowSql;
+      QHash<int, Query *> m_queries;
+      qint64 m_rows;
+      qint64 m_statements;
+      int m_error;
+      QString m_errorMsg;
+    };
+  }
+  /// \endcond INTERNAL
+
+  /**
+   * @brief Inserts rows into a table with multi-row INSERT statements, N rows per step.
+   *
+   * The statement INSERT INTO table(columns) VALUES (?, ...), (?, ...), ... with N groups of parameters is generated and prepared once, and every step inserts N rows:
+   * the cost of starting the statement and of every step is paid once every N rows instead of for every row. Rows left over (less than N) are inserted with statements
+   * of N/2, N/4, ..., 1 rows, also prepared once and cached. The parameters of every row are bound at offsets computed at compile time.
+   *
+   * A row is a std::tuple<Cols...> or any type binding sizeof...(Cols) values (see \ref bindcustomtypes). Values are bound without copy (see Query::bindTemporary).
+   * The number of parameters of a statement (N*sizeof...(Cols)) must not exceed the SQLite limit (SQLITE_MAX_VARIABLE_NUMBER, 32766 by default).
+   *
+   * Statements are run as they are: wrap a bulk load in a transaction (e.g. with Db::runWrite) to avoid a commit per statement.
+   * \code
+   * MultiInsert<64, qint64, QString, double> insert(db, "measures", {"time", "sensor", "value"});
+   * QVector<std::tuple<qint64, QString, double>> rows=...;
+   * db->runWrite([&]{ return insert.insert(rows); });
+   * // Or row by row, N rows are inserted at a time
+   * insert.add(time, "temperature", 21.5);
+   * ...
+   * insert.flush();
+   * \endcode
+   */
+  template <int N, typename ...Cols> class MultiInsert: public Helper::MultiInsertBase
+  {
+    static_assert(N>0, "MultiInsert must insert at least one row per statement");
+    static_assert(sizeof...(Cols)>0, "MultiInsert must insert at least one column");
+  public:
+    /// @brief Type of the rows buffered by add()
+    typedef std::tuple<Cols...> Row;
+    /**
+     * @brief Constructs the inserter. Statements are prepared when first used.
+     * @param db Database to write to
+     * @param table Name of the table, it will be quoted
+     * @param columns Columns to insert, one for each of Cols. If empty all the columns of the table are inserted, in order.
+     */
+    MultiInsert(Db *db, const QString &table, const QStringList &columns=QStringList()): Helper::MultiInsertBase(db, table, columns, int(sizeof...(Cols))) { m_pending.reserve(N); }
+    /**
+     * @brief Inserts all the rows of a container
+     * @param rows Container of rows, e.g. a QVector<std::tuple<Cols...>>
+     * @return True on success. On failure the rows of the statements executed before the error are kept.
+     */
+    template <typename Container> bool insert(const Container &rows);
+    /**
+     * @brief Adds a row to the buffer, inserting the buffered rows when there are N of them
+     * @return True on success
+     */
+    bool add(const Cols &...values);
+    /**
+     * @brief Inserts the rows left in the buffer by add()
+     * @return True on success. The buffer is cleared anyway.
+     */
+    bool flush();
+    /// @brief Number of rows in the buffer, not inserted yet
+    int pending() const { return m_pending.size(); }
+  protected:
+    template <typename T> bool bindRow(Query *query, int index, const T &row);
+    template <typename It, int ...I> bool bindRows(Query *query, It &it, Helper::int_sequence<I...>);
+    // Inserts M rows with one statement
+    template <int M, typename It> bool insertBlock(It &it);
+    // Inserts remaining rows with statements of M, M/2, ..., 1 rows
+    template <int M, typename It> bool insertRemaining(It &it, qint64 remaining);
+    QVector<Row> m_pending;
+  };
+
+  template <int N, typename ...Cols> template <typename Container> bool MultiInsert<N, Cols...>::insert(const Container &rows)
+  {
+    clearError();
+    auto it=std::begin(rows);
+    return insertRemaining<N>(it, qint64(std::size(rows)));
+  }
+
+  template <int N, typename ...Cols> bool MultiInsert<N, Cols...>::add(const Cols &...values)
+  {
+    m_pending.append(Row(values...));
+    return m_pending.size()<N || flush();
+  }
+
+  template <int N, typename ...Cols> bool MultiInsert<N, Cols...>::flush()
+  {
+    bool ret=insert(m_pending);
+    m_pending.clear();
+    return ret;
+  }
+
+  template <int N, typename ...Cols> template <typename T> bool MultiInsert<N, Cols...>::bindRow(Query *query, int index, const T &row)
+  {
+    int bound=query->bindTemporary(index, row);
+    if(bound==int(sizeof...(Cols))+1)
+      return true;
+    bindFailed(query, bound-1);
+    return false;
+  }
+
+  template <int N, typename ...Cols> template <typename It, int ...I> bool MultiInsert<N, Cols...>::bindRows(Query *query, It &it, Helper::int_sequence<I...>)
+  {
+    bool ok=true;
+    // Row I starts at parameter I*columns+1
+    (void)((ok=bindRow(query, I*int(sizeof...(Cols))+1, *it), void(++it), ok) && ...);
+    return ok;
+  }
+
+  template <int N, typename ...Cols> template <int M, typename It> bool MultiInsert<N, Cols...>::insertBlock(It &it)
+  {
+    Query *query=statement(M);
+    if(!query)
+      return false;
+    if(!bindRows(query, it, Helper::make_int_sequence<M>()))
+    {
+      query->clearBindings();
+      return false;
+    }
+    return execute(query, M);
+  }
+
+  template <int N, typename ...Cols> template <int M, typename It> bool MultiInsert<N, Cols...>::insertRemaining(It &it, qint64 remaining)
+  {
+    if constexpr(M>0)
+    {
+      for(;remaining>=M;remaining-=M)
+      {
+        if(!insertBlock<M>(it))
+          return false;
+      }
+      return insertRemaining<M/2>(it, remaining);
+    }
+    else
+      return true;
+  }
+}
@@ -15,28 +15,49 @@ limitations under the License.
 
 #include "query.h"
 #include "blob.h"
+#include "arena.h"
+#include "intern.h"
+#include "rowbuffer.h"
 #include "sqlite3.h"
+#include <cstring>
+#include <atomic>
 
 #ifndef SQLITE_ENABLE_COLUMN_METADATA
 #warning SQLITE_ENABLE_COLUMN_METADATA not enabled. Reduced BLOB functionality (see documentation in section "How to compile")
 #endif
 
+#ifdef SQLITE_ENABLE_CARRAY
+#ifndef SQLITE_CARRAY_INT32
+// carray extension compiled separately from the amalgamation (ext/misc/carray.c)
+extern "C" int sqlite3_carray_bind(sqlite3_stmt *pStmt, int i, void *aData, int nData, int mFlags, void (*xDel)(void *));
+#define SQLITE_CARRAY_INT32 0
+#define SQLITE_CARRAY_INT64 1
+#define SQLITE_CARRAY_DOUBLE 2
+#define SQLITE_CARRAY_TEXT 3
+#endif
+#endif
+
+// Number of virtual machine instructions between two checks of the deadline
+static const int progressDeadlineInstructions=1000;
+// Last value of Query::m_prepareGeneration, shared by all the queries so that no two statements get the same number
+static std::atomic<quint64> lastPrepareGeneration{0};
+
 using namespace HFSQtLi;
-Query::Query(Db *db, const char *query, bool persistent, bool storeErrorMsg, const char **tail): m_db(db), m_stmt(nullptr), m_keepErrorMsg(storeErrorMsg)
+Query::Query(Db *db, const char *query, bool persistent, bool storeErrorMsg, const char **tail): m_db(db), m_stmt(nullptr), m_values(nullptr), m_valueCount(0), m_keepErrorMsg(storeErrorMsg), m_hasDeadline(false), m_deadlineExpired(false), m_parameterIndexesBuilt(false), m_columnIndexesReprepare(-1), m_prepareGeneration(0), m_arena(nullptr), m_internPool(nullptr)
 {
   if(db)
     db->m_queryCount++;
   prepare(query, persistent, tail);
 }
 
-Query::Query(Db *db, const QString &query, bool persistent, bool storeErrorMsg, QString *tail): m_db(db), m_stmt(nullptr), m_keepErrorMsg(storeErrorMsg)
+Query::Query(Db *db, const QString &query, bool persistent, bool storeErrorMsg, QString *tail): m_db(db), m_stmt(nullptr), m_values(nullptr), m_valueCount(0), m_keepErrorMsg(storeErrorMsg), m_hasDeadline(false), m_deadlineExpired(false), m_parameterIndexesBuilt(false), m_columnIndexesReprepare(-1), m_prepareGeneration(0), m_arena(nullptr), m_internPool(nullptr)
 {
   if(db)
     db->m_queryCount++;
   prepare(query, persistent, tail);
 }
 
-Query::Query(Db *db, bool storeErrorMsg): m_db(db), m_stmt(nullptr), m_keepErrorMsg(storeErrorMsg)
+Query::Query(Db *db, bool storeErrorMsg): m_db(db), m_stmt(nullptr), m_values(nullptr), m_valueCount(0), m_keepErrorMsg(storeErrorMsg), m_hasDeadline(false), m_deadlineExpired(false), m_parameterIndexesBuilt(false), m_columnIndexesReprepare(-1), m_prepareGeneration(0), m_arena(nullptr), m_internPool(nullptr)
 {
   if(db)
     db->m_queryCount++;
@@ -60,6 +81,13 @@ bool Query::prepare(const char *query, bool persistent, const char **tail)
       m_error=sqlite3_finalize(m_stmt);
       m_stmt=nullptr;
     }
+    m_parameterIndexes.clear();
+    m_parameterIndexesBuilt=false;
+    m_columnIndexes.clear();
+    m_columnIndexesReprepare=-1;
+    m_prepareGeneration=++lastPrepareGeneration;
+    m_ownedBindings.clear();
+    clearBoundValues();
     if(m_error==SQLITE_OK)
       m_error=sqlite3_prepare_v3(m_db->m_db, query?query:"", -1, persistent?SQLITE_PREPARE_PERSISTENT:0, &m_stmt, tail);
     lock.release(m_errorMsg);
@@ -83,6 +111,13 @@ bool Query::prepare(const QString &query, bool persistent, QString *tail)
       m_error=sqlite3_finalize(m_stmt);
       m_stmt=nullptr;
     }
+    m_parameterIndexes.clear();
+    m_parameterIndexesBuilt=false;
+    m_columnIndexes.clear();
+    m_columnIndexesReprepare=-1;
+    m_prepareGeneration=++lastPrepareGeneration;
+    m_ownedBindings.clear();
+    clearBoundValues();
     if(m_error==SQLITE_OK)
       m_error=sqlite3_prepare16_v3(m_db->m_db, query.data(), query.size()*sizeof(QChar), persistent?SQLITE_PREPARE_PERSISTENT:0, &m_stmt, &tailPtr);
     lock.release(m_errorMsg);
@@ -101,6 +136,8 @@ bool Query::stepNoFetch()
   int ret=0;
   if(!isPrepared())
     setInternalError(SQLITE_MISUSE);
+  else if(m_hasDeadline)
+    ret=stepWithDeadline();
   else
   {
     Db::Lock lock(m_db, m_keepErrorMsg);
@@ -111,6 +148,44 @@ bool Query::stepNoFetch()
   return ret;
 }
 
+bool Query::stepWithDeadline()
+{
+  if(std::chrono::steady_clock::now()>=m_deadline)
+  {
+    setInternalError(SQLiteCode::TIMEOUT, "Query deadline expired");
+    return false;
+  }
+  // Progress handler is per connection: keep the mutex for the whole step so that no other query can replace it.
+  // The handler set with Db::setProgressHandler is called by progressDeadline and restored after the step.
+  Db::Lock lock(m_db, true);
+  m_deadlineExpired=false;
+  int instructions=progressDeadlineInstructions;
+  if(m_db->m_progressHandler && m_db->m_progressInstructions>0)
+    instructions=qMin(instructions, m_db->m_progressInstructions);
+  sqlite3_progress_handler(m_db->m_db, instructions, &Query::progressDeadline, this);
+  m_error=sqlite3_step(m_stmt);
+  sqlite3_progress_handler(m_db->m_db, m_db->m_progressInstructions, m_db->m_progressHandler, m_db->m_progressData);
+  if(m_error==SQLITE_INTERRUPT && m_deadlineExpired)
+  {
+    lock.release();
+    setInternalError(SQLiteCode::TIMEOUT, "Query deadline expired");
+  }
+  else if(m_keepErrorMsg)
+    lock.release(m_errorMsg);
+  return (m_error==SQLITE_ROW);
+}
+
+int Query::progressDeadline(void *query)
+{
+  Query *qry=static_cast<Query *>(query);
+  if(std::chrono::steady_clock::now()>=qry->m_deadline)
+    qry->m_deadlineExpired=true;
+  if(qry->m_deadlineExpired)
+    return 1;
+  Db *db=qry->m_db;
+  return db->m_progressHandler?db->m_progressHandler(db->m_progressData):0;
+}
+
 bool Query::finalize()
 {
   bool ret=false;
@@ -122,6 +197,13 @@ bool Query::finalize()
     m_error=sqlite3_finalize(m_stmt);
     lock.release(m_errorMsg);
     m_stmt=nullptr;
+    m_parameterIndexes.clear();
+    m_parameterIndexesBuilt=false;
+    m_columnIndexes.clear();
+    m_columnIndexesReprepare=-1;
+    m_prepareGeneration=++lastPrepareGeneration;
+    m_ownedBindings.clear();
+    clearBoundValues();
     ret=(m_error==SQLITE_OK);
   }
   return ret;
@@ -138,6 +220,10 @@ bool Query::reset()
       m_error=sqlite3_reset(m_stmt);
       lock.release(m_errorMsg);
       ret=(m_error==SQLITE_OK);
+      // sqlite3_reset returns the error of the last step: report the expired deadline as the step did
+      if(m_error==SQLITE_INTERRUPT && m_deadlineExpired)
+        setInternalError(SQLiteCode::TIMEOUT, "Query deadline expired");
+      m_deadlineExpired=false;
     }
     return ret;
 }
@@ -152,6 +238,8 @@ bool Query::clearBindings()
     Db::Lock lock(m_db, m_keepErrorMsg);
     m_error=sqlite3_clear_bindings(m_stmt);
     lock.release(m_errorMsg);
+    m_ownedBindings.clear();
+    clearBoundValues();
     ret=(m_error==SQLITE_OK);
   }
   return ret;
@@ -161,24 +249,29 @@ bool Query::clearBindings()
 int Query::bindSingle(bool, int i, qint64 value)
 {
   m_error=sqlite3_bind_int64(m_stmt, i, value);
+  recordBinding(i, 'i', &value, sizeof(value));
   return fetchErrorString()?2:0;
 }
 
 int Query::bindSingle(bool, int i, double value)
 {
   m_error=sqlite3_bind_double(m_stmt, i, value);
+  recordBinding(i, 'f', &value, sizeof(value));
   return fetchErrorString()?2:0;
 }
 
 int Query::bindSingle(bool, int i, std::nullptr_t)
 {
   m_error=sqlite3_bind_null(m_stmt, i);
+  recordBinding(i, 'n', nullptr, 0);
   return fetchErrorString()?2:0;
 }
 
 int Query::bindSingle(bool, int i, const ZeroBlob &zeroBlob)
 {
   m_error=sqlite3_bind_zeroblob64(m_stmt, i, zeroBlob.size());
+  qint64 size=zeroBlob.size();
+  recordBinding(i, 'z', &size, sizeof(size));
   return fetchErrorString()?2:0;
 }
 
@@ -186,19 +279,213 @@ int Query::bindSingle(bool, int i, const char *value, int size)
 {
 //  m_error=sqlite3_bind_text(m_stmt, i, value.toUtf8(), -1, SQLITE_TRANSIENT);
   m_error=sqlite3_bind_text(m_stmt, i, value, size, SQLITE_TRANSIENT);
+  if(m_boundValues)
+    recordBinding(i, value?'t':'n', value, !value?0:(size<0?qsizetype(strlen(value)):size));
   return fetchErrorString()?2:0;
 }
 
 int Query::bindSingle(bool temporary, int i, const QString &value)
 {
   m_error=sqlite3_bind_text16(m_stmt, i, value.data(), -1, temporary?SQLITE_STATIC: SQLITE_TRANSIENT);
+  recordBinding(i, 'u', value.constData(), value.size()*sizeof(QChar));
+  return fetchErrorString()?2:0;
+}
+
+int Query::bindSingle(bool temporary, int i, const TextView &value)
+{
+  // A null pointer would bind NULL instead of an empty string
+  m_error=sqlite3_bind_text64(m_stmt, i, value.data()?value.data():"", value.size(), temporary?SQLITE_STATIC: SQLITE_TRANSIENT, SQLITE_UTF8);
+  recordBinding(i, 't', value.data(), value.size());
+  return fetchErrorString()?2:0;
+}
+
+Query::OwnedBinding *Query::ownedBinding(int i)
+{
+  if(i<1 || i>sqlite3_bind_parameter_count(m_stmt))
+    return nullptr;
+  if(m_ownedBindings.size()<i)
+    m_ownedBindings.resize(i);
+  return &m_ownedBindings[i-1];
+}
+
+int Query::bindSingle(bool temporary, int i, QByteArray &&value)
+{
+  OwnedBinding *owned=temporary?nullptr:ownedBinding(i);
+  if(!owned)
+    return bindSingle(temporary, i, const_cast<const QByteArray &>(value));
+  // The data is shared with the query, which outlives the binding: no copy is needed
+  owned->blob=std::move(value);
+  owned->text=QString();
+  m_error=sqlite3_bind_blob64(m_stmt, i, owned->blob.constData(), owned->blob.size(), SQLITE_STATIC);
+  recordBinding(i, 'b', owned->blob.constData(), owned->blob.size());
+  return fetchErrorString()?2:0;
+}
+
+int Query::bindSingle(bool temporary, int i, QString &&value)
+{
+  OwnedBinding *owned=temporary?nullptr:ownedBinding(i);
+  if(!owned)
+    return bindSingle(temporary, i, const_cast<const QString &>(value));
+  owned->text=std::move(value);
+  owned->blob=QByteArray();
+  m_error=sqlite3_bind_text16(m_stmt, i, owned->text.constData(), -1, SQLITE_STATIC);
+  recordBinding(i, 'u', owned->text.constData(), owned->text.size()*sizeof(QChar));
+  return fetchErrorString()?2:0;
+}
+
+int Query::bindSingle(bool temporary, int i, const BlobView &value)
+{
+  // As for TextView a null view binds an empty blob, not NULL
+  m_error=sqlite3_bind_blob64(m_stmt, i, value.data()?value.data():"", value.size(), temporary?SQLITE_STATIC: SQLITE_TRANSIENT);
+  recordBinding(i, 'b', value.data(), value.size());
+  return fetchErrorString()?2:0;
+}
+
+int Query::bindSingle(bool, int i, const ValueRef &value)
+{
+  // SQLite always copies the value
+  m_error=value.isValid()?sqlite3_bind_value(m_stmt, i, value.pointer()):sqlite3_bind_null(m_stmt, i);
+  if(m_boundValues)
+  {
+    switch(value.type())
+    {
+    case Type::Integer:
+    {
+      qint64 number=value.toInt64();
+      recordBinding(i, 'i', &number, sizeof(number));
+      break;
+    }
+    case Type::Float:
+    {
+      double number=value.toDouble();
+      recordBinding(i, 'f', &number, sizeof(number));
+      break;
+    }
+    case Type::Text:
+    {
+      TextView text=value.toText();
+      recordBinding(i, 't', text.data(), text.size());
+      break;
+    }
+    case Type::Blob:
+    {
+      BlobView blob=value.toBlob();
+      recordBinding(i, 'b', blob.data(), blob.size());
+      break;
+    }
+    default:
+      recordBinding(i, 'n', nullptr, 0);
+    }
+  }
   return fetchErrorString()?2:0;
 }
 
+int Query::bindSingle(bool temporary, int i, const OwnedValue &value)
+{
+  switch(value.type())
+  {
+  case Type::Integer: return bindSingle(temporary, i, value.toInt64());
+  case Type::Float: return bindSingle(temporary, i, value.toDouble());
+  case Type::Text: return bindSingle(temporary, i, value.toText());
+  case Type::Blob: return bindSingle(temporary, i, value.toBlob());
+  default: return bindSingle(temporary, i, nullptr);
+  }
+}
+
 int Query::bindSingle(bool temporary, int i, const QByteArray &value)
 {
   m_error=sqlite3_bind_blob64(m_stmt, i, value.data(), value.size(), temporary?SQLITE_STATIC: SQLITE_TRANSIENT);
+  recordBinding(i, 'b', value.data(), value.size());
+  return fetchErrorString()?2:0;
+}
+
+int Query::bindArray(bool temporary, int i, const void *data, qsizetype size, ArrayType type)
+{
+#ifdef SQLITE_ENABLE_CARRAY
+  int flags=SQLITE_CARRAY_INT64;
+  switch(type)
+  {
+    case ArrayType::Int32: flags=SQLITE_CARRAY_INT32; break;
+    case ArrayType::Int64: flags=SQLITE_CARRAY_INT64; break;
+    case ArrayType::Double: flags=SQLITE_CARRAY_DOUBLE; break;
+    case ArrayType::Text: flags=SQLITE_CARRAY_TEXT; break;
+  }
+  // A transient empty array would be copied with sqlite3_malloc64(0), that returns NULL and fails with SQLITE_NOMEM: bind a static element instead
+  static const qint64 emptyArray=0;
+  if(size==0)
+  {
+    data=&emptyArray;
+    temporary=true;
+  }
+  if(size>std::numeric_limits<int>::max())
+    m_error=SQLITE_TOOBIG;
+  else
+    m_error=sqlite3_carray_bind(m_stmt, i, const_cast<void *>(data), int(size), flags, temporary?SQLITE_STATIC:SQLITE_TRANSIENT);
+  if(m_boundValues)
+  {
+    if(type==ArrayType::Text)
+    {
+      // The content of the strings, not their addresses
+      QByteArray strings;
+      for(qsizetype j=0;j<size;j++)
+        strings.append(static_cast<const char *const *>(data)[j]).append('\0');
+      recordBinding(i, char('A'+flags), strings.constData(), strings.size());
+    }
+    else
+      recordBinding(i, char('A'+flags), data, size*(type==ArrayType::Int32?4:8));
+  }
+  return fetchErrorString()?2:0;
+#else
+  Q_UNUSED(temporary);
+  Q_UNUSED(i);
+  Q_UNUSED(data);
+  Q_UNUSED(size);
+  Q_UNUSED(type);
+  setInternalError(SQLITE_MISUSE, "Binding arrays requires SQLite compiled with SQLITE_ENABLE_CARRAY");
+  return 0;
+#endif
+}
+
+int Query::bindSingle(bool, int i, const QStringList &value)
+{
+#ifdef SQLITE_ENABLE_CARRAY
+  // Single allocation holding the table of pointers followed by the strings. Ownership is passed to carray that will release it with sqlite3_free.
+  QVector<QByteArray> utf8;
+  qsizetype bytes=value.size()*sizeof(char *);
+  utf8.reserve(value.size());
+  for(const QString &str: value)
+  {
+    utf8.append(str.toUtf8());
+    bytes+=utf8.last().size()+1;
+  }
+  char **block=static_cast<char **>(sqlite3_malloc64(qMax<qsizetype>(bytes, 1)));
+  if(!block)
+    m_error=SQLITE_NOMEM;
+  else if(value.size()>std::numeric_limits<int>::max())
+  {
+    sqlite3_free(block);
+    m_error=SQLITE_TOOBIG;
+  }
+  else
+  {
+    char *str=reinterpret_cast<char *>(block+value.size());
+    for(qsizetype j=0;j<utf8.size();j++)
+    {
+      block[j]=str;
+      memcpy(str, utf8[j].constData(), utf8[j].size()+1);
+      str+=utf8[j].size()+1;
+    }
+    // Recorded before binding, that passes the ownership of block to carray
+    recordBinding(i, char('A'+SQLITE_CARRAY_TEXT), block+value.size(), bytes-value.size()*sizeof(char *));
+    m_error=sqlite3_carray_bind(m_stmt, i, block, int(value.size()), SQLITE_CARRAY_TEXT, sqlite3_free);
+  }
   return fetchErrorString()?2:0;
+#else
+  Q_UNUSED(i);
+  Q_UNUSED(value);
+  setInternalError(SQLITE_MISUSE, "Binding arrays requires SQLite compiled with SQLITE_ENABLE_CARRAY");
+  return 0;
+#endif
 }
 
 int Query::error(QString *errorOut)
@@ -230,9 +517,30 @@ int Query::clearBindingInternal()
   int ret=SQLITE_MISUSE;
   if(m_stmt)
     ret=sqlite3_clear_bindings(m_stmt);
+  m_ownedBindings.clear();
+  clearBoundValues();
   return ret;
 }
 
+void Query::recordBinding(int i, char tag, const void *data, qsizetype size)
+{
+  if(!m_boundValues || i<1)
+    return;
+  if(m_boundValues->size()<i)
+    m_boundValues->resize(i);
+  QByteArray &value=(*m_boundValues)[i-1];
+  value.resize(1+size);
+  value[0]=tag;
+  if(size>0)
+    memcpy(value.data()+1, data, size);
+}
+
+void Query::clearBoundValues()
+{
+  if(m_boundValues)
+    m_boundValues->clear();
+}
+
 void Query::resetInternalError()
 {
   m_error=SQLITE_OK;
@@ -288,6 +596,79 @@ int Query::assertFetchColumnCount(int i)
   return ret;
 }
 
+int Query::parameterIndex(const char *name)
+{
+  if(!m_stmt || !name)
+    return 0;
+  // Statements without named parameters leave the map empty: a flag avoids scanning them again at every call
+  if(!m_parameterIndexesBuilt)
+  {
+    m_parameterIndexesBuilt=true;
+    int count=sqlite3_bind_parameter_count(m_stmt);
+    for(int i=1;i<=count;i++)
+    {
+      // Parameters with the same name share the index, nameless ones (?) return null
+      const char *parameter=sqlite3_bind_parameter_name(m_stmt, i);
+      if(parameter)
+        m_parameterIndexes.insert(QByteArray(parameter), i);
+    }
+  }
+  return m_parameterIndexes.value(QByteArray::fromRawData(name, int(strlen(name))), 0);
+}
+
+int Query::columnIndex(const char *name)
+{
+  if(!name)
+    return -1;
+  return columnIndex(QByteArray::fromRawData(name, int(strlen(name))));
+}
+
+int Query::columnIndex(const QByteArray &name)
+{
+  if(!m_stmt)
+    return -1;
+  // SQLite reprepares the statement after a schema change, the columns may be different
+  int reprepare=sqlite3_stmt_status(m_stmt, SQLITE_STMTSTATUS_REPREPARE, 0);
+  if(reprepare!=m_columnIndexesReprepare)
+  {
+    m_columnIndexes.clear();
+    m_columnIndexesReprepare=reprepare;
+    int count=sqlite3_column_count(m_stmt);
+    for(int i=0;i<count;i++)
+    {
+      const char *column=sqlite3_column_name(m_stmt, i);
+      if(column && !m_columnIndexes.contains(QByteArray::fromRawData(column, int(strlen(column)))))
+        m_columnIndexes.insert(QByteArray(column), i);
+    }
+  }
+  return m_columnIndexes.value(name, -1);
+}
+
+int Query::namedColumn(const char *name)
+{
+  return name?namedColumn(QByteArray::fromRawData(name, int(strlen(name)))):namedColumn(QByteArray());
+}
+
+int Query::namedColumn(const QByteArray &name)
+{
+  int ret=-1;
+  if(!m_stmt)
+    setInternalError(SQLITE_MISUSE);
+  else if((ret=columnIndex(name))<0)
+    setInternalError(SQLITE_RANGE, QString("Unknown column %1").arg(QString::fromUtf8(name)).toUtf8());
+  return ret;
+}
+
+int Query::namedIndex(const char *name)
+{
+  int ret=0;
+  if(!m_stmt)
+    setInternalError(SQLITE_MISUSE);
+  else if(!(ret=parameterIndex(name)))
+    setInternalError(SQLITE_RANGE, QString("Unknown parameter %1").arg(QString(name)).toUtf8());
+  return ret;
+}
+
 int Query::assertBindColumnCount(int i)
 {
   int ret=-1;
@@ -304,14 +685,56 @@ int Query::assertBindColumnCount(int i)
   return ret;
 }
 
+int Query::cellType(int i)
+{
+  if(!m_values)
+    return sqlite3_column_type(m_stmt, i);
+  return i>=0 && i<m_valueCount?sqlite3_value_type(m_values[i]):SQLITE_NULL;
+}
+
+qint64 Query::cellInt64(int i)
+{
+  if(!m_values)
+    return sqlite3_column_int64(m_stmt, i);
+  return i>=0 && i<m_valueCount?sqlite3_value_int64(m_values[i]):0;
+}
+
+double Query::cellDouble(int i)
+{
+  if(!m_values)
+    return sqlite3_column_double(m_stmt, i);
+  return i>=0 && i<m_valueCount?sqlite3_value_double(m_values[i]):0;
+}
+
+const char *Query::cellText(int i)
+{
+  if(!m_values)
+    return reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, i));
+  return i>=0 && i<m_valueCount?reinterpret_cast<const char *>(sqlite3_value_text(m_values[i])):nullptr;
+}
+
+const void *Query::cellBlob(int i)
+{
+  if(!m_values)
+    return sqlite3_column_blob(m_stmt, i);
+  return i>=0 && i<m_valueCount?sqlite3_value_blob(m_values[i]):nullptr;
+}
+
+int Query::cellBytes(int i)
+{
+  if(!m_values)
+    return sqlite3_column_bytes(m_stmt, i);
+  return i>=0 && i<m_valueCount?sqlite3_value_bytes(m_values[i]):0;
+}
+
 Type Query::columnType(int i)
 {
   Type ret=Type::Invalid;
-  if(!m_stmt)
+  if(!m_stmt && !m_values)
     setInternalError(SQLITE_MISUSE);
   else
   {
-    ret=SQLiteCode::typeFromSqlite(sqlite3_column_type(m_stmt, i));
+    ret=SQLiteCode::typeFromSqlite(cellType(i));
     if(ret==Type::Invalid)
       setInternalError(SQLITE_MISUSE, "Unknown type returned from sqlite3_column_type");
   }
@@ -321,13 +744,13 @@ Type Query::columnType(int i)
 qint64 Query::readColumnIntSQLite(int i, bool &ok)
 {
   ok=true;
-  return sqlite3_column_int64(m_stmt, i);
+  return cellInt64(i);
 }
 
 double Query::readColumnDoubleSQLite(int i, bool &ok)
 {
   ok=true;
-  return sqlite3_column_double(m_stmt, i);
+  return cellDouble(i);
 }
 
 int Query::readColumn(bool strict, int i, QString &value)
@@ -341,18 +764,85 @@ int Query::readColumn(bool strict, int i, QString &value)
       ok=false;
     }
     else
-      value=QString::fromUtf8(sqlite3_column_text(m_stmt, i));
+      value=QString::fromUtf8(cellText(i));
   }
   else
-    value=QString::fromUtf8(sqlite3_column_text(m_stmt, i));
+    value=QString::fromUtf8(cellText(i));
   return ok?2:0;
 }
 
+int Query::readColumn(bool strict, int i, TextView &value)
+{
+  if(strict && columnType(i)!=Type::Text)
+  {
+    setInternalError(SQLiteCode::CONSTRAINT, "Read column was not a string");
+    return 0;
+  }
+  const char *text=cellText(i);
+  qsizetype size=cellBytes(i);
+  if(text && m_arena)
+    text=m_arena->store(text, size, true);
+  value=TextView(text, size);
+  return 2;
+}
+
+int Query::readColumn(bool strict, int i, BlobView &value)
+{
+  if(strict && columnType(i)!=Type::Blob)
+  {
+    setInternalError(SQLiteCode::CONSTRAINT, "Read column was not a blob");
+    return 0;
+  }
+  const char *data=static_cast<const char *>(cellBlob(i));
+  qsizetype size=cellBytes(i);
+  // Empty blobs are returned as a null pointer: only NULL is a null view
+  if(!data && cellType(i)!=SQLITE_NULL)
+    data="";
+  else if(data && m_arena)
+    data=m_arena->store(data, size);
+  value=BlobView(data, size);
+  return 2;
+}
+
+int Query::readColumn(bool strict, int i, Interned<QString> &value)
+{
+  if(strict && columnType(i)!=Type::Text)
+  {
+    setInternalError(SQLiteCode::CONSTRAINT, "Read column was not a string");
+    return 0;
+  }
+  const char *text=cellText(i);
+  value=Interned<QString>(internPool()->intern(text, cellBytes(i)));
+  return 2;
+}
+
+void Query::setInternPool(InternPool *pool)
+{
+  m_internPool=pool;
+}
+
+InternPool *Query::internPool()
+{
+  if(m_internPool)
+    return m_internPool;
+  if(!m_ownInternPool)
+    m_ownInternPool.reset(new InternPool());
+  return m_ownInternPool.data();
+}
+
 int Query::readColumn(bool, int i, Value &result)
 {
   int ret=0;
   result.clear();
-  if(!isPrepared())
+  if(m_values)
+  {
+    // Protected values are duplicated directly, without the connection mutex
+    if(i>=0 && i<m_valueCount)
+      result=Value(sqlite3_value_dup(m_values[i]));
+    setInternalError(result.isValid()?SQLITE_OK:SQLITE_NOMEM);
+    ret=(m_error==SQLITE_OK)?2:0;
+  }
+  else if(!isPrepared())
     setInternalError(SQLITE_MISUSE);
   else
   {
@@ -371,6 +861,52 @@ int Query::readColumn(bool, int i, Value &result)
   return ret;
 }
 
+int Query::readColumn(bool, int i, ValueRef &result)
+{
+  // sqlite3_column_value returns an unprotected value: the ValueRef reads the column with the sqlite3_column_* functions
+  if(m_values)
+    result=i>=0 && i<m_valueCount?ValueRef(m_values[i]):ValueRef();
+  else
+    result=ValueRef(m_stmt, i);
+  return 2;
+}
+
+int Query::readColumn(bool, int i, OwnedValue &result)
+{
+  // The column functions are used instead of sqlite3_column_value, which returns an unprotected value
+  switch(cellType(i))
+  {
+  case SQLITE_INTEGER: result.setInt64(cellInt64(i)); break;
+  case SQLITE_FLOAT: result.setDouble(cellDouble(i)); break;
+  case SQLITE_TEXT:
+  {
+    const char *text=cellText(i);
+    result.setText(text, cellBytes(i));
+    break;
+  }
+  case SQLITE_BLOB:
+  {
+    const char *data=static_cast<const char *>(cellBlob(i));
+    result.setBlob(data, cellBytes(i));
+    break;
+  }
+  default:
+    result.setNull();
+  }
+  return 2;
+}
+
+int Query::readColumn(bool, int i, RowBuffer &row)
+{
+  // A RowBuffer reads the columns of a statement
+  if(m_values)
+  {
+    setInternalError(SQLITE_MISUSE);
+    return 0;
+  }
+  return row.fetch(m_stmt, i, m_prepareGeneration);
+}
+
 int Query::readColumn(bool strict, int i, Blob &value)
 {
   return readColumnInternal(i, value, strict);
@@ -385,11 +921,11 @@ int Query::readColumn(bool strict, int i, QByteArray &value)
   }
   else
   {
-    int bytes=sqlite3_column_bytes(m_stmt, i);
+    int bytes=cellBytes(i);
     if(bytes>0)
     {
       value.resize(bytes);
-      memcpy(value.data(), sqlite3_column_blob(m_stmt, i), bytes);
+      memcpy(value.data(), cellBlob(i), bytes);
       ok=true;
     }
     else if(bytes==0)
@@ -16,9 +16,19 @@ limitations under the License.
 #pragma once
 #include <Qt>
 #include <QString>
+#include <QVector>
+#include <QStringList>
+#include <QHash>
+#include <QByteArray>
+#include <QScopedPointer>
+#include <chrono>
 #include "templatehelper.h"
+#include "exporter.h"
+#include "mapping.h"
+#include "intern.h"
 
 struct sqlite3_stmt;
+struct sqlite3_value;
 //#define SQLITE3_UNIVERSALREF(T, Type) class T, class=typename std::enable_if<std::is_same<typename std::decay<T>::type, Type>::value>::type
 
 namespace HFSQtLi
@@ -28,7 +38,14 @@ namespace HFSQtLi
   class ZeroBlob;
   class Blob;
   class Value;
+  class ValueRef;
+  class OwnedValue;
+  class RowBuffer;
+  class TextView;
+  class BlobView;
+  class ResultArena;
   template <typename ...T> struct Call;
+  template <typename T> class CArray;
 
   enum class Type: int;
   /**
@@ -40,6 +57,8 @@ namespace HFSQtLi
     friend class SqliteDb;
     friend class CustomBind;
     friend class CustomFetch;
+    friend class QueryModel;
+    friend class ResultCache;
 
    /// @name Constructors
    /// @{
@@ -147,6 +166,30 @@ namespace HFSQtLi
     bool keepErrorMsg() const;
     /// @}
 
+    /// @name Deadlines
+    /// A query with a deadline is interrupted (via sqlite3_progress_handler) if a step is still running when the deadline expires.
+    /// A progress handler of the connection must be set with \ref Db::setProgressHandler to be kept during these steps.
+    /// The step then fails with error \ref SQLiteCode::TIMEOUT and the query must be reset before being used again.
+    /// To cancel from another thread whatever is running on a connection see \ref Db::cancel.
+    /// @{
+    /**
+     * @brief Sets the deadline for all next steps of this query
+     * @param deadline Time after which any step will fail with SQLiteCode::TIMEOUT
+     */
+    inline void setDeadline(std::chrono::steady_clock::time_point deadline) { m_deadline=deadline; m_hasDeadline=true; }
+    /**
+     * @brief Sets the deadline to a given time from now
+     * @param timeout Time from now after which any step will fail with SQLiteCode::TIMEOUT
+     */
+    template <class Rep, class Period> inline void setTimeout(std::chrono::duration<Rep, Period> timeout) { setDeadline(std::chrono::steady_clock::now()+std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout)); }
+    /// @brief Removes the deadline
+    inline void clearDeadline() { m_hasDeadline=false; }
+    /// @brief Checks if a deadline is set
+    inline bool hasDeadline() const { return m_hasDeadline; }
+    /// @brief Gets current deadline. Valid only if hasDeadline() is true
+    inline std::chrono::steady_clock::time_point deadline() const { return m_deadline; }
+    /// @}
+
     /// @name Step-and-fetch functions
     /// All the function in this group advances the query to the next row and if this operation is successfull fetches some or all of its data.
     /// They are approximately equivalent to calling:
@@ -194,6 +237,25 @@ namespace HFSQtLi
       if(ret)ret=columnAllHelper(strict, std::forward<Args>(args)...);
       return ret;
     }
+    /**
+     * @brief Steps the query until it is done, appending every row to a container.
+     *
+     * Rows can be of any type fetching all the columns (see \ref fetchtypes), usually a std::tuple or a struct mapped with HFSQTLI_MAP.
+     * Text and blob columns fetched as TextView and BlobView are copied into the arena, with no allocation per value: the views stay valid until the arena is cleared or destroyed.
+     * Other types (e.g. QString) are fetched as usual.
+     * \code
+     * ResultArena arena;
+     * QVector<std::tuple<qint64, TextView>> rows;
+     * qry.bind(1, owner);
+     * if(qry.fetchAll(arena, rows))
+     *   for(const auto &[id, name]: rows)
+     *     ...
+     * \endcode
+     * @param arena Arena receiving text and blob values
+     * @param rows Container of rows, e.g. QVector or std::vector. Rows are appended with push_back.
+     * @return 0 on error, 1+number of fetched rows on success. Rows fetched before an error are kept.
+     */
+    template <typename Container> int fetchAll(ResultArena &arena, Container &rows);
     /// @}
 
     /// @name Single row query execution
@@ -290,6 +352,13 @@ namespace HFSQtLi
     /// @{
     /**
      * @brief Binds some values in a query.
+     *
+     * QString and QByteArray passed as rvalues (temporaries or std::move) are moved into the query and bound without copy: their data is released when the
+     * bindings are cleared, the parameter is bound again with an rvalue or the query is finalized.
+     * \code
+     * QByteArray payload=...; // Some MB
+     * qry.bind(1, std::move(payload)); // Not copied by SQLite
+     * \endcode
      * @param i First index to bind (1-based)
      * @param args Values to bind (see \ref bindtypes)
      * @return 0 on error, 1+number of bound columns on success
@@ -311,6 +380,39 @@ namespace HFSQtLi
      * @copydetails bindAll
      */
     template <typename... Args> inline int bindTemporaryAll(Args &&...args) { int ret=bindSingleWithChecks(true, 1, std::forward_as_tuple<decltype(args)...>(std::forward<Args>(args)...)); return (ret<0)?0:(assertBindColumnCount(ret-1)+1); }
+    /**
+     * @brief Binds some values starting from a named parameter.
+     * \code
+     * qry.prepare("SELECT name FROM users WHERE id=:user");
+     * qry.bind(":user", id);
+     * \endcode
+     * @param name Name of the parameter, prefix included (e.g. ":user", "@user" or "$user"). See parameterIndex().
+     * @param args Values to bind (see \ref bindtypes)
+     * @return 0 on error, 1+number of bound columns on success
+     */
+    template <typename... Args> inline int bind(const char *name, Args &&...args) { int i=namedIndex(name); return i>0?bind(i, std::forward<Args>(args)...):0; }
+    /**
+     * @brief Binds some values starting from a named parameter. The existence of passed values must be guaranteed to persist until the binding is cleared (Query is destroyed or clearBindings() is called)
+     * @copydetails bind(const char *, Args &&...)
+     */
+    template <typename... Args> inline int bindTemporary(const char *name, Args &&...args) { int i=namedIndex(name); return i>0?bindTemporary(i, std::forward<Args>(args)...):0; }
+    /**
+     * @brief Binds named parameters given as pairs of a name and a value
+     * \code
+     * qry.bindNamed(":a", x, ":b", y);
+     * \endcode
+     * @param args Names (const char *, prefix included) each followed by the value to bind (see \ref bindtypes)
+     * @return 0 on error, 1+number of bound columns on success
+     */
+    template <typename... Args> inline int bindNamed(Args &&...args);
+    /**
+     * @brief Gets the index of a named parameter.
+     * Names are looked up in the prepared statement once, the first time this function is called after prepare, and then kept in a hash table:
+     * binding by name costs one hash lookup more than binding by index.
+     * @param name Name of the parameter, prefix included (e.g. ":user")
+     * @return The index (1-based) of the parameter or 0 if the statement has no parameter with this name
+     */
+    int parameterIndex(const char *name);
     /// @}
 
     /// @name Functions to fetch data
@@ -340,6 +442,78 @@ namespace HFSQtLi
      * @copydetails columnAll
      */
     template <typename... Args> inline int columnStrictAll(Args &&...args) { return columnAllHelper(true, std::forward<Args>(args)...); }
+    /**
+     * @brief Retrieves some columns from a row, starting from the column with the given name.
+     * \code
+     * qry.prepare("SELECT id, price FROM items");
+     * while(qry.stepNoFetch())
+     *   qry.column("price", price);
+     * \endcode
+     * @param name Name of the column (see columnIndex())
+     * @param args Reference to data to retrive (see \ref fetchtypes)
+     * @return 0 on error, 1+number of fetched columns on success
+     */
+    template <typename... Args> inline int column(const char *name, Args &&...args) { int i=namedColumn(name); return i>=0?columnHelper(false, i, std::forward<Args>(args)...):0; }
+    /**
+     * @brief Retrieves some columns from a row, starting from the column with the given name, returning error if types do not match.
+     * @copydetails column(const char *, Args &&...)
+     */
+    template <typename... Args> inline int columnStrict(const char *name, Args &&...args) { int i=namedColumn(name); return i>=0?columnHelper(true, i, std::forward<Args>(args)...):0; }
+    /**
+     * @brief Retrieves a struct mapped with HFSQTLI_MAP from the columns named as its fields, in any order (see \ref Mapping).
+     * Columns not named as a field are ignored.
+     * @param value Struct to fill
+     * @return 0 on error (e.g. a field without a column), 1+number of fetched columns on success
+     */
+    template <typename T> inline int columnByName(T &value) { return readByName(false, value, Helper::make_int_sequence<Helper::mappedSize<T>()>()); }
+    /**
+     * @brief Retrieves a struct mapped with HFSQTLI_MAP from the columns named as its fields, returning error if types do not match.
+     * @copydetails columnByName
+     */
+    template <typename T> inline int columnByNameStrict(T &value) { return readByName(true, value, Helper::make_int_sequence<Helper::mappedSize<T>()>()); }
+    /**
+     * @brief Gets the index of a column of the result.
+     * Names (see sqlite3_column_name: the AS name if given) are read from the prepared statement once, the first time this function is called after prepare,
+     * and then kept in a hash table: fetching by name costs one hash lookup more than fetching by index. If more columns have the same name the first one is used.
+     * @param name Name of the column
+     * @return The index (0-based) of the column or -1 if the result has no column with this name
+     */
+    int columnIndex(const char *name);
+    /// @}
+
+    /// @name Interning
+    /// @{
+    /**
+     * @brief Sets the pool used to fetch Interned<QString> values
+     * @param pool Pool to use, it must outlive the query. If null the query uses its own pool.
+     */
+    void setInternPool(InternPool *pool);
+    /// @brief Gets the pool used to fetch Interned<QString> values, creating the own pool of the query if needed
+    InternPool *internPool();
+    /// @}
+
+    /// @name Export
+    /// @{
+    /**
+     * @brief Steps the query until it is done, writing every row to a device.
+     *
+     * Cells are written straight from the pointers returned by SQLite (sqlite3_column_text/sqlite3_column_blob) to a buffered writer: no QString, QByteArray or
+     * \ref Value is created per cell, so memory usage does not depend on the size of the result. Blobs are written as hexadecimal strings.
+     * When the device does not keep up (e.g. a socket to a slow client) the export waits for it to drain (see ExportOptions::maxPendingBytes).
+     *
+     * The query must be prepared with its parameters bound. If the query is positioned on a row (e.g. after step()) the export starts from that row, otherwise from the first one: usually it is called right after binding.
+     * \code
+     * qry.prepare("SELECT id, name, data FROM items WHERE owner=$1");
+     * qry.bind(1, owner);
+     * qry.exportTo(socket, ExportFormat::Json);
+     * \endcode
+     * @param device Device to write to, must be open for writing
+     * @param format Output format
+     * @param options Export options
+     * @param rows If not null it is filled with the number of rows exported
+     * @return True on success. On failure error() returns the SQLite error or SQLITE_IOERR if the device could not be written.
+     */
+    bool exportTo(QIODevice *device, ExportFormat format, const ExportOptions &options=ExportOptions(), qint64 *rows=nullptr);
     /// @}
 
     /// \cond INTERNAL
@@ -350,6 +524,14 @@ namespace HFSQtLi
   protected:
     // Note: function guarantees 0 will be returned on error
     template <typename... Args> inline int bindSingleWithChecks(bool temporary, int i, const std::tuple<Args...> &args);
+    // Index of a named parameter, setting the error if it does not exist
+    int namedIndex(const char *name);
+    // Index of a named column, setting the error if it does not exist
+    int namedColumn(const char *name);
+    int namedColumn(const QByteArray &name);
+    int columnIndex(const QByteArray &name);
+    template <typename T, int ...I> inline int readByName(bool strict, T &value, Helper::int_sequence<I...>);
+    template <typename T, typename... Args> inline bool bindNamedHelper(int &count, const char *name, T &&value, Args &&...args);
 
     // Gets the error string from the database if m_error contains an error. Note: Mutex must be held when calling this function. Return true on success, false on failure
     inline bool fetchErrorString();
@@ -359,11 +541,15 @@ namespace HFSQtLi
     int assertBindColumnCount(int i);
     // Note: all next function expects that the db mutex is hold when calling them and that the query is valid. If an error is returned m_errorString should be set (if necessary)
     template <typename T> inline int bindSingle(bool, int i, T &&value );
+    // Binds the fields of a struct mapped with HFSQTLI_MAP at consecutive indexes known at compile time
+    template <typename T, int ...I> inline int bindMapped(bool temporary, int i, const T &value, Helper::int_sequence<I...>);
+    template <typename F> inline bool bindMappedField(bool temporary, int i, const F &value);
 
 
     int bindSingle(bool, int i, std::nullptr_t);
 
-    inline int bindSingle(bool temporary, int i, QByteArray &&value) { return bindSingle(temporary, i, const_cast<const QByteArray &>(value)); }
+    // Rvalues are moved into the query and bound without copy (see Query::bind)
+    int bindSingle(bool temporary, int i, QByteArray &&value);
     inline int bindSingle(bool temporary, int i, QByteArray &value) { return bindSingle(temporary, i, const_cast<const QByteArray &>(value)); }
     int bindSingle(bool, int i, const QByteArray &value);
 
@@ -384,6 +570,47 @@ namespace HFSQtLi
     inline int bindSingle(bool temporary, int i, int value) { return bindSingle(temporary, i, (qint64) value); }
     inline int bindSingle(bool temporary, int i, unsigned value) { return bindSingle(temporary, i, (qint64) value); }
     int bindSingle(bool temporary, int i, const QString &value);
+    inline int bindSingle(bool temporary, int i, QString &value) { return bindSingle(temporary, i, const_cast<const QString &>(value)); }
+    int bindSingle(bool temporary, int i, QString &&value);
+    inline int bindSingle(bool temporary, int i, TextView &&value) { return bindSingle(temporary, i, const_cast<const TextView &>(value)); }
+    inline int bindSingle(bool temporary, int i, TextView &value) { return bindSingle(temporary, i, const_cast<const TextView &>(value)); }
+    int bindSingle(bool temporary, int i, const TextView &value);
+    inline int bindSingle(bool temporary, int i, BlobView &&value) { return bindSingle(temporary, i, const_cast<const BlobView &>(value)); }
+    inline int bindSingle(bool temporary, int i, BlobView &value) { return bindSingle(temporary, i, const_cast<const BlobView &>(value)); }
+    int bindSingle(bool temporary, int i, const BlobView &value);
+    inline int bindSingle(bool temporary, int i, ValueRef &&value) { return bindSingle(temporary, i, const_cast<const ValueRef &>(value)); }
+    inline int bindSingle(bool temporary, int i, ValueRef &value) { return bindSingle(temporary, i, const_cast<const ValueRef &>(value)); }
+    int bindSingle(bool temporary, int i, const ValueRef &value);
+    inline int bindSingle(bool temporary, int i, OwnedValue &&value) { return bindSingle(temporary, i, const_cast<const OwnedValue &>(value)); }
+    inline int bindSingle(bool temporary, int i, OwnedValue &value) { return bindSingle(temporary, i, const_cast<const OwnedValue &>(value)); }
+    int bindSingle(bool temporary, int i, const OwnedValue &value);
+    inline int bindSingle(bool temporary, int i, const Interned<QString> &value) { return bindSingle(temporary, i, value.value()); }
+    inline int bindSingle(bool temporary, int i, Interned<QString> &value) { return bindSingle(temporary, i, value.value()); }
+    inline int bindSingle(bool temporary, int i, Interned<QString> &&value) { return bindSingle(temporary, i, value.value()); }
+    // Arrays bound via carray extension
+    enum class ArrayType: int { Int32, Int64, Double, Text };
+    int bindArray(bool temporary, int i, const void *data, qsizetype size, ArrayType type);
+    inline int bindSingle(bool temporary, int i, const CArray<int> &value);
+    inline int bindSingle(bool temporary, int i, const CArray<qint64> &value);
+    inline int bindSingle(bool temporary, int i, const CArray<double> &value);
+    inline int bindSingle(bool temporary, int i, const CArray<const char *> &value);
+    template <typename T> inline int bindSingle(bool temporary, int i, CArray<T> &value) { return bindSingle(temporary, i, const_cast<const CArray<T> &>(value)); }
+    template <typename T> inline int bindSingle(bool temporary, int i, CArray<T> &&value) { return bindSingle(temporary, i, const_cast<const CArray<T> &>(value)); }
+
+    inline int bindSingle(bool temporary, int i, const QVector<int> &value) { return bindArray(temporary, i, value.constData(), value.size(), ArrayType::Int32); }
+    inline int bindSingle(bool temporary, int i, QVector<int> &value) { return bindSingle(temporary, i, const_cast<const QVector<int> &>(value)); }
+    inline int bindSingle(bool temporary, int i, QVector<int> &&value) { return bindSingle(temporary, i, const_cast<const QVector<int> &>(value)); }
+    inline int bindSingle(bool temporary, int i, const QVector<qint64> &value) { return bindArray(temporary, i, value.constData(), value.size(), ArrayType::Int64); }
+    inline int bindSingle(bool temporary, int i, QVector<qint64> &value) { return bindSingle(temporary, i, const_cast<const QVector<qint64> &>(value)); }
+    inline int bindSingle(bool temporary, int i, QVector<qint64> &&value) { return bindSingle(temporary, i, const_cast<const QVector<qint64> &>(value)); }
+    inline int bindSingle(bool temporary, int i, const QVector<double> &value) { return bindArray(temporary, i, value.constData(), value.size(), ArrayType::Double); }
+    inline int bindSingle(bool temporary, int i, QVector<double> &value) { return bindSingle(temporary, i, const_cast<const QVector<double> &>(value)); }
+    inline int bindSingle(bool temporary, int i, QVector<double> &&value) { return bindSingle(temporary, i, const_cast<const QVector<double> &>(value)); }
+    // Strings are always converted to UTF-8 in a single block owned by SQLite
+    int bindSingle(bool temporary, int i, const QStringList &value);
+    inline int bindSingle(bool temporary, int i, QStringList &value) { return bindSingle(temporary, i, const_cast<const QStringList &>(value)); }
+    inline int bindSingle(bool temporary, int i, QStringList &&value) { return bindSingle(temporary, i, const_cast<const QStringList &>(value)); }
+
     template <class ...T> int bindSingle(bool temporary, int i, const std::tuple<T...> &value) { return bindSingleHelper(temporary, i, value, Helper::make_int_sequence<sizeof...(T)>()); }
     template <class ...T> int bindSingle(bool temporary, int i, std::tuple<T...> &&value) { return bindSingle(temporary, i, static_cast<const std::tuple<T...> &>(value)); }
     template <class ...T, int ...I> int bindSingleHelper(bool temporary, int i, const std::tuple<T...> &value, Helper::int_sequence<I...>);
@@ -403,6 +630,9 @@ namespace HFSQtLi
     double readColumnDoubleSQLite(int i, bool &ok);
     // Helper function for reading an int
     template <class T> inline int readColumnInt(bool strict, int i, T &value);
+    // Fetches the fields of a struct mapped with HFSQTLI_MAP from consecutive columns
+    template <typename T, int ...I> inline int readMapped(bool strict, int i, T &value, Helper::int_sequence<I...>);
+    template <typename F> inline bool readMappedField(bool strict, int i, F &value);
 
   public:
     //    template <typename T> inline int readColumn(bool, int, T &&)=delete;
@@ -423,7 +653,14 @@ namespace HFSQtLi
     int readColumn(bool strict, int i, QString &value);
     int readColumn(bool strict,int i, Blob &value);
     int readColumn(bool strict, int i, QByteArray &value);
+    // Views point to the memory of SQLite, or to m_arena when fetchAll is running
+    int readColumn(bool strict, int i, TextView &value);
+    int readColumn(bool strict, int i, BlobView &value);
+    int readColumn(bool strict, int i, Interned<QString> &value);
     int readColumn(bool, int i, Value &result);
+    int readColumn(bool, int i, ValueRef &result);
+    int readColumn(bool, int i, OwnedValue &result);
+    int readColumn(bool, int i, RowBuffer &row);
     template <class T> inline int readColumn(bool strict, int i, std::optional<T> &result);
 
     template <class ...T> inline int readColumn(bool strict, int i, Call<T...> &call) { return readColumn(strict, i, static_cast<const Call<T...> &>(call)); }
@@ -443,20 +680,69 @@ namespace HFSQtLi
     template <class ...Args, int ...Index> int readColumnHelper(bool strict, int i, const std::tuple<Args...> &values, Helper::int_sequence<Index...>);
     template <class ...Args, int ...Index> int readColumnHelper(bool strict, int i, std::tuple<Args...> &values, Helper::int_sequence<Index...> seq);
     int readColumnInternal(int i, Blob &value, bool strict);
+    // Reads protected values (arguments of user defined functions, rows of the result cache) in place of the columns of m_stmt, see Helper::readValues
+    template <typename Tuple> int readValues(sqlite3_value **values, int count, Tuple &&result);
+    // Cell i of the current row: a column of m_stmt, or m_values[i] while readValues runs (NULL when out of range)
+    int cellType(int i);
+    qint64 cellInt64(int i);
+    double cellDouble(int i);
+    const char *cellText(int i);
+    const void *cellBlob(int i);
+    int cellBytes(int i);
 
     // Clears the bindings without changing m_error. Used for resetting after temporary bindings (e.g. exec(...); )
     int clearBindingInternal();
+    // Gets the holder of the value moved into parameter i, null if i is not a valid parameter
+    struct OwnedBinding;
+    OwnedBinding *ownedBinding(int i);
+    // Stores a type tag and the bytes of the value bound to parameter i in m_boundValues, if enabled
+    void recordBinding(int i, char tag, const void *data, qsizetype size);
+    void clearBoundValues();
 
     template <typename T> bool bindTemporary(int i, const T &v);
     template <typename T, typename... Args> bool bindTemporary(int i, const T &v, const Args &...args);
 
     void resetInternalError();
     void setInternalError(int code, const char *explicitMessag=nullptr);
+    // Step with a progress handler checking m_deadline installed
+    bool stepWithDeadline();
+    // Writes the current row with the given format
+    void exportRow(Helper::ExportWriter &writer, ExportFormat format, const QVector<QByteArray> &names, qint64 row);
+    static int progressDeadline(void *query);
     Db *m_db;
     sqlite3_stmt *m_stmt;
+    // Values read by readValues instead of the columns of m_stmt
+    sqlite3_value **m_values;
+    int m_valueCount;
     int m_error;
     QString m_errorMsg;
     bool m_keepErrorMsg;
+    bool m_hasDeadline;
+    bool m_deadlineExpired;
+    std::chrono::steady_clock::time_point m_deadline;
+    // Index of every named parameter, filled by the first call to parameterIndex after prepare
+    QHash<QByteArray, int> m_parameterIndexes;
+    bool m_parameterIndexesBuilt;
+    // Index of every column name, filled by the first call to columnIndex after prepare or after the statement was reprepared
+    QHash<QByteArray, int> m_columnIndexes;
+    // Number of times the statement was reprepared when m_columnIndexes was filled, -1 if not filled
+    int m_columnIndexesReprepare;
+    // Changed by every prepare and finalize, unique among all the queries: identifies the statement for caches outside the query (e.g. RowBuffer)
+    quint64 m_prepareGeneration;
+    // Arena receiving TextView and BlobView values while fetchAll runs
+    ResultArena *m_arena;
+    // Values moved into the query by rvalue binds, one per parameter, kept until the bindings are cleared or the statement is finalized
+    struct OwnedBinding
+    {
+      QByteArray blob;
+      QString text;
+    };
+    QVector<OwnedBinding> m_ownedBindings;
+    // Bound values in binary form, one per parameter, recorded only for the queries of ResultCache that use them as keys
+    QScopedPointer<QVector<QByteArray>> m_boundValues;
+    // Pool of Interned<QString> values: m_ownInternPool unless set by setInternPool
+    InternPool *m_internPool;
+    QScopedPointer<InternPool> m_ownInternPool;
   };
 }
 #include "query_template.h"
@@ -31,20 +31,97 @@ namespace HFSQtLi
     return ret;
   }
 
-  template <typename T> int Query::bindSingle(bool, int i, T &&value )
+  template <typename T> int Query::bindSingle(bool temporary, int i, T &&value )
   {
-    CustomBind custom(this, i);
-    using Custom::customBind;
-    customBind(custom, std::forward<T>(value));
-    return custom.numBound()+1;
+    if constexpr(Helper::IsMapped<std::decay_t<T>>::value)
+      return bindMapped(temporary, i, value, Helper::make_int_sequence<Helper::mappedSize<std::decay_t<T>>()>());
+    else
+    {
+      CustomBind custom(this, i);
+      using Custom::customBind;
+      customBind(custom, std::forward<T>(value));
+      return custom.numBound()+1;
+    }
+  }
+
+  template <typename T, int ...I> int Query::bindMapped(bool temporary, int i, const T &value, Helper::int_sequence<I...>)
+  {
+    auto fields=hfsqtliMapFields(value);
+    bool ok=true;
+    (void)((ok=bindMappedField(temporary, i+I, std::get<I>(fields))) && ...);
+    return ok?int(sizeof...(I))+1:0;
   }
 
+  template <typename F> bool Query::bindMappedField(bool temporary, int i, const F &value)
+  {
+    if constexpr(Helper::IsOptional<F>::value)
+      return value?bindMappedField(temporary, i, *value):bindSingle(temporary, i, nullptr)>0;
+    else if constexpr(std::is_integral<F>::value)
+      return bindSingle(temporary, i, qint64(value))>0;
+    else if constexpr(std::is_floating_point<F>::value)
+      return bindSingle(temporary, i, double(value))>0;
+    else
+      return bindSingle(temporary, i, value)>0;
+  }
+
+  inline int Query::bindSingle(bool temporary, int i, const CArray<int> &value) { return bindArray(temporary, i, value.data(), value.size(), ArrayType::Int32); }
+  inline int Query::bindSingle(bool temporary, int i, const CArray<qint64> &value) { return bindArray(temporary, i, value.data(), value.size(), ArrayType::Int64); }
+  inline int Query::bindSingle(bool temporary, int i, const CArray<double> &value) { return bindArray(temporary, i, value.data(), value.size(), ArrayType::Double); }
+  inline int Query::bindSingle(bool temporary, int i, const CArray<const char *> &value) { return bindArray(temporary, i, value.data(), value.size(), ArrayType::Text); }
+
   template <typename T> int Query::readColumn(bool strict, int i, T &&value)
   {
-    CustomFetch custom(this, strict, i);
-    using Custom::customFetch;
-    customFetch(custom, std::forward<T>(value));
-    return custom.numFetched()+1;
+    if constexpr(Helper::IsMapped<std::decay_t<T>>::value)
+      return readMapped(strict, i, value, Helper::make_int_sequence<Helper::mappedSize<std::decay_t<T>>()>());
+    else if constexpr(std::is_same<std::decay_t<T>, bool>::value)
+    {
+      qint64 read=0;
+      int ret=readColumnInt(strict, i, read);
+      value=read!=0;
+      return ret;
+    }
+    else if constexpr(std::is_integral<std::decay_t<T>>::value)
+      return readColumnInt(strict, i, value); // Integer types without an overload, e.g. long
+    else
+    {
+      CustomFetch custom(this, strict, i);
+      using Custom::customFetch;
+      customFetch(custom, std::forward<T>(value));
+      return custom.numFetched()+1;
+    }
+  }
+
+  template <typename T, int ...I> int Query::readMapped(bool strict, int i, T &value, Helper::int_sequence<I...>)
+  {
+    auto fields=hfsqtliMapFields(value);
+    bool ok=true;
+    (void)((ok=readMappedField(strict, i+I, std::get<I>(fields))) && ...);
+    return ok?int(sizeof...(I))+1:0;
+  }
+
+  template <typename F> bool Query::readMappedField(bool strict, int i, F &value)
+  {
+    if constexpr(Helper::IsOptional<F>::value)
+    {
+      if(columnType(i)==Type::Null)
+      {
+        value.reset();
+        return true;
+      }
+      value.emplace();
+      return readMappedField(strict, i, *value);
+    }
+    else if constexpr(std::is_same<F, bool>::value)
+    {
+      qint64 read=0;
+      bool ok=readColumnInt(strict, i, read)>0;
+      value=read!=0;
+      return ok;
+    }
+    else if constexpr(std::is_integral<F>::value)
+      return readColumnInt(strict, i, value)>0;
+    else
+      return readColumn(strict, i, value)>0;
   }
 
   template <class T> inline int Query::readColumn(bool strict, int i, std::optional<T> &result)
@@ -243,6 +320,90 @@ namespace HFSQtLi
     return ret;
   }
 
+  template <typename T, int ...I> int Query::readByName(bool strict, T &value, Helper::int_sequence<I...>)
+  {
+    const QVector<QByteArray> &names=Mapping<T>::columnNames();
+    const int indexes[]={namedColumn(names[I])...};
+    for(int index: indexes)
+    {
+      if(index<0)
+        return 0;
+    }
+    auto fields=hfsqtliMapFields(value);
+    bool ok=true;
+    (void)((ok=readMappedField(strict, indexes[I], std::get<I>(fields))) && ...);
+    return ok?int(sizeof...(I))+1:0;
+  }
+
+  template <typename Container> int Query::fetchAll(ResultArena &arena, Container &rows)
+  {
+    typename Container::value_type row{};
+    ResultArena *previous=m_arena;
+    m_arena=&arena;
+    int count=0;
+    bool ok=true;
+    while(ok && stepNoFetch())
+    {
+      int fetched=readColumn(false, 0, row);
+      // Number of columns is checked on the first row only
+      if(fetched<=0 || (count==0 && assertFetchColumnCount(fetched-1)<0))
+        ok=false;
+      else
+      {
+        rows.push_back(row);
+        count++;
+      }
+    }
+    m_arena=previous;
+    return ok && isDone()?count+1:0;
+  }
+
+  template <typename Tuple> int Query::readValues(sqlite3_value **values, int count, Tuple &&result)
+  {
+    m_values=values;
+    m_valueCount=count;
+    int ret=readColumn(false, 0, std::forward<Tuple>(result));
+    m_values=nullptr;
+    m_valueCount=0;
+    return ret;
+  }
+
+  namespace Helper
+  {
+    template <typename Tuple> bool readValues(sqlite3_value **values, int count, Tuple &&result, QString *errorMsg)
+    {
+      Query reader(nullptr, errorMsg!=nullptr);
+      bool ret=reader.readValues(values, count, std::forward<Tuple>(result))>0;
+      if(!ret && errorMsg)
+        *errorMsg=reader.errorMsg();
+      return ret;
+    }
+  }
+
+  template <typename... Args> int Query::bindNamed(Args &&...args)
+  {
+    static_assert(sizeof...(Args)%2==0, "bindNamed requires pairs of names and values");
+    int count=0;
+    if constexpr(sizeof...(Args)>0)
+    {
+      if(!bindNamedHelper(count, std::forward<Args>(args)...))
+        return 0;
+    }
+    return count+1;
+  }
+
+  template <typename T, typename... Args> bool Query::bindNamedHelper(int &count, const char *name, T &&value, Args &&...args)
+  {
+    int bound=bind(name, std::forward<T>(value));
+    if(bound<=0)
+      return false;
+    count+=bound-1;
+    if constexpr(sizeof...(Args)>0)
+      return bindNamedHelper(count, std::forward<Args>(args)...);
+    else
+      return true;
+  }
+
   template <typename... Args> inline int Query::executeCommand(Args &&... args)
   {
     int ret=0;
@@ -0,0 +1,322 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "querymodel.h"
+#include "database.h"
+#include "sqlite3.h"
+#include <limits>
+
+using namespace HFSQtLi;
+
+QueryModel::QueryModel(Db *db, QObject *parent):
+  QAbstractTableModel(parent), m_db(db), m_blockSize(256), m_prefetch(true), m_rows(0), m_query(db, true), m_cache(64),
+  m_lastBlock(-1), m_blockReads(0), m_prefetchHits(0), m_error(SQLITE_OK)
+{
+}
+
+QueryModel::~QueryModel()
+{
+  // The background connection must be closed before the model (and maybe the database) goes away
+  m_prefetcher.reset();
+}
+
+bool QueryModel::setSource(const QString &table, const QStringList &columns, const QString &where, const QString &key)
+{
+  m_table=table;
+  m_columns=columns;
+  m_where=where;
+  m_key=key;
+  return refresh();
+}
+
+bool QueryModel::refresh()
+{
+  beginResetModel();
+  clear();
+  bool ret=load();
+  if(!ret)
+    clear();
+  endResetModel();
+  return ret;
+}
+
+void QueryModel::clear()
+{
+  m_prefetcher.reset();
+  m_query.finalize();
+  m_cache.clear();
+  m_blockKeys.clear();
+  m_headers.clear();
+  m_rows=0;
+  m_lastBlock=-1;
+  m_blockReads=m_prefetchHits=0;
+}
+
+bool QueryModel::load()
+{
+  m_error=SQLITE_OK;
+  m_errorMsg.clear();
+  if(!m_db || m_table.isEmpty() || m_columns.isEmpty())
+  {
+    setError(SQLITE_MISUSE, SQLiteCode::errorString(SQLITE_MISUSE));
+    return false;
+  }
+  QString where=m_where.isEmpty()?QString():"("+m_where+") AND ";
+  // Only the first key of every block is kept
+  {
+    Query keys(m_db, true);
+    if(!keys.prepare("SELECT "+m_key+" FROM "+m_table+(m_where.isEmpty()?QString():" WHERE "+m_where)+" ORDER BY "+m_key, false))
+    {
+      setError(keys.error(), keys.errorMsg());
+      return false;
+    }
+    qint64 key;
+    qint64 rows=0;
+    while(keys.step(key))
+    {
+      if(rows%m_blockSize==0)
+        m_blockKeys.append(key);
+      rows++;
+    }
+    if(!keys.isDone())
+    {
+      setError(keys.error(), keys.errorMsg());
+      return false;
+    }
+    if(rows>std::numeric_limits<int>::max())
+    {
+      setError(SQLITE_TOOBIG, "Too many rows for a model");
+      return false;
+    }
+    m_rows=int(rows);
+  }
+  QString sql="SELECT "+m_key+", "+m_columns.join(", ")+" FROM "+m_table+" WHERE "+where+m_key+">=?1 AND "+m_key+"<=?2 ORDER BY "+m_key+
+      " LIMIT "+QString::number(m_blockSize);
+  if(!m_query.prepare(sql, true))
+  {
+    setError(m_query.error(), m_query.errorMsg());
+    return false;
+  }
+  int columns=sqlite3_column_count(m_query.m_stmt)-1;
+  for(int i=1;i<=columns;i++)
+    m_headers.append(QString::fromUtf8(sqlite3_column_name(m_query.m_stmt, i)));
+  // The background connection needs a file that another connection can open
+  const char *filename=sqlite3_db_filename(m_db->internalDb(), "main");
+  if(m_prefetch && m_blockKeys.size()>1 && filename && *filename)
+  {
+    Db *connection=Db::open(QString::fromUtf8(filename), QIODevice::ReadOnly);
+    if(connection)
+    {
+      m_prefetcher.reset(new Prefetcher(connection, sql, m_blockSize, columns));
+      m_prefetcher->start();
+    }
+  }
+  return true;
+}
+
+qint64 QueryModel::blockEnd(int block) const
+{
+  // Keys are unique integers: the block ends right before the first key of the next one
+  return block+1<m_blockKeys.size()?m_blockKeys[block+1]-1:std::numeric_limits<qint64>::max();
+}
+
+bool QueryModel::readBlock(Query &query, qint64 from, qint64 to, int blockSize, int columns, Block &block)
+{
+  block.values.clear();
+  block.values.reserve(blockSize*columns);
+  block.rows=0;
+  if(!query.reset() || !query.bind(1, from, to))
+    return false;
+  while(query.stepNoFetch())
+  {
+    sqlite3_stmt *stmt=query.m_stmt;
+    for(int i=1;i<=columns;i++)
+    {
+      switch(sqlite3_column_type(stmt, i))
+      {
+      case SQLITE_INTEGER:
+        block.values.append(QVariant(qint64(sqlite3_column_int64(stmt, i))));
+        break;
+      case SQLITE_FLOAT:
+        block.values.append(QVariant(sqlite3_column_double(stmt, i)));
+        break;
+      case SQLITE_TEXT:
+        block.values.append(QVariant(QString::fromUtf8(reinterpret_cast<const char *>(sqlite3_column_text(stmt, i)), sqlite3_column_bytes(stmt, i))));
+        break;
+      case SQLITE_BLOB:
+        block.values.append(QVariant(QByteArray(static_cast<const char *>(sqlite3_column_blob(stmt, i)), sqlite3_column_bytes(stmt, i))));
+        break;
+      default:
+        block.values.append(QVariant());
+        break;
+      }
+    }
+    block.rows++;
+  }
+  bool ret=query.isDone();
+  // Don't keep a read transaction open between blocks
+  query.reset();
+  return ret;
+}
+
+const QueryModel::Block *QueryModel::block(int block) const
+{
+  const Block *ret=m_cache.object(block);
+  if(!ret)
+  {
+    auto *read=new Block;
+    if(m_prefetcher && m_prefetcher->take(block, *read))
+      m_prefetchHits++;
+    else
+    {
+      m_blockReads++;
+      if(!readBlock(m_query, m_blockKeys[block], blockEnd(block), m_blockSize, m_headers.size(), *read))
+      {
+        delete read;
+        return nullptr;
+      }
+    }
+    m_cache.insert(block, read, 1);
+    ret=read;
+  }
+  if(block!=m_lastBlock)
+  {
+    // Read in advance the next block in the direction of scrolling
+    int next=block+(block<m_lastBlock?-1:1);
+    if(next<0 || next>=m_blockKeys.size())
+      next=2*block-next; // At the first or last block only the other direction is possible
+    m_lastBlock=block;
+    if(m_prefetcher && next>=0 && next<m_blockKeys.size() && !m_cache.contains(next))
+      m_prefetcher->request(next, m_blockKeys[next], blockEnd(next));
+  }
+  return ret;
+}
+
+int QueryModel::rowCount(const QModelIndex &parent) const
+{
+  return parent.isValid()?0:m_rows;
+}
+
+int QueryModel::columnCount(const QModelIndex &parent) const
+{
+  return parent.isValid()?0:m_headers.size();
+}
+
+QVariant QueryModel::data(const QModelIndex &index, int role) const
+{
+  if(!index.isValid() || (role!=Qt::DisplayRole && role!=Qt::EditRole) || index.row()>=m_rows || index.column()>=m_headers.size())
+    return QVariant();
+  const Block *rows=block(index.row()/m_blockSize);
+  int row=index.row()%m_blockSize;
+  // Rows deleted after the keys were loaded are missing from the block
+  if(!rows || row>=rows->rows)
+    return QVariant();
+  return rows->values.at(row*m_headers.size()+index.column());
+}
+
+QVariant QueryModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+  if(role==Qt::DisplayRole && orientation==Qt::Horizontal && section>=0 && section<m_headers.size())
+    return m_headers.at(section);
+  return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+void QueryModel::setError(int code, const QString &msg)
+{
+  m_error=code;
+  m_errorMsg=msg;
+}
+
+QueryModel::Prefetcher::Prefetcher(Db *connection, const QString &sql, int blockSize, int columns):
+  m_connection(connection), m_sql(sql), m_blockSize(blockSize), m_columns(columns), m_stop(false), m_running(true), m_requested(-1), m_inFlight(-1), m_from(0), m_to(0)
+{
+}
+
+QueryModel::Prefetcher::~Prefetcher()
+{
+  stop();
+}
+
+void QueryModel::Prefetcher::stop()
+{
+  {
+    QMutexLocker locker(&m_mutex);
+    m_stop=true;
+    m_wake.wakeAll();
+  }
+  wait();
+}
+
+void QueryModel::Prefetcher::request(int block, qint64 from, qint64 to)
+{
+  QMutexLocker locker(&m_mutex);
+  if(m_ready.contains(block))
+    return;
+  m_requested=block;
+  m_from=from;
+  m_to=to;
+  m_wake.wakeAll();
+}
+
+bool QueryModel::Prefetcher::take(int block, Block &result)
+{
+  QMutexLocker locker(&m_mutex);
+  // A block already requested is waited for instead of being read twice
+  while(m_running && (m_requested==block || m_inFlight==block))
+    m_readyWake.wait(&m_mutex);
+  auto it=m_ready.find(block);
+  if(it==m_ready.end())
+    return false;
+  result=std::move(it.value());
+  m_ready.erase(it);
+  return true;
+}
+
+void QueryModel::Prefetcher::run()
+{
+  // The query is created here so that the connection is only used by this thread
+  Query query(m_connection.data(), true);
+  bool ok=query.prepare(m_sql, true);
+  QMutexLocker locker(&m_mutex);
+  while(!m_stop && ok)
+  {
+    if(m_requested<0)
+      m_wake.wait(&m_mutex);
+    if(m_stop || m_requested<0)
+      continue;
+    int block=m_requested;
+    qint64 from=m_from;
+    qint64 to=m_to;
+    m_requested=-1;
+    m_inFlight=block;
+    locker.unlock();
+
+    Block result;
+    bool read=readBlock(query, from, to, m_blockSize, m_columns, result);
+
+    locker.relock();
+    m_inFlight=-1;
+    if(read)
+    {
+      // Blocks not taken are stale prefetches of a view scrolled elsewhere
+      if(m_ready.size()>=4)
+        m_ready.clear();
+      m_ready.insert(block, std::move(result));
+    }
+    m_readyWake.wakeAll();
+  }
+  m_running=false;
+  m_readyWake.wakeAll();
+}
@@ -0,0 +1,173 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QAbstractTableModel>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QScopedPointer>
+#include <QCache>
+#include <QHash>
+#include <QVector>
+#include <QVariant>
+#include <QStringList>
+#include "query.h"
+
+namespace HFSQtLi
+{
+  class Db;
+  /**
+   * @brief Read-only table model showing a table or view of any size, keeping in memory only the rows around the visible ones.
+   *
+   * Rows are ordered by an integer key, unique for every row (rowid by default, or an indexed INTEGER column). When the source is set the model scans the keys once,
+   * storing only the first key of every block of blockSize() rows: this gives rowCount() and allows any block to be read with a single keyset query
+   * (WHERE key>=first AND key<next) on a prepared statement, without the growing cost of OFFSET. Scrolling to any position therefore costs the same as reading the first rows.
+   *
+   * Decoded blocks are kept in a LRU cache of cacheSize() blocks, so memory is bounded whatever the size of the result.
+   * For file databases the block following the one last accessed (in the direction of scrolling) is read in advance on a background connection, opened read-only on the same file.
+   * The background connection sees only committed data.
+   *
+   * The model shows the data as it was when the keys were scanned: call refresh() after modifying the source. Rows deleted in the meantime are shown empty.
+   * \code
+   * QueryModel *model=new QueryModel(db, view);
+   * model->setSource("measures", {"time", "sensor", "value"}, "sensor<>0");
+   * view->setModel(model);
+   * \endcode
+   */
+  class QueryModel: public QAbstractTableModel
+  {
+    Q_OBJECT
+  public:
+    /**
+     * @brief Constructs an empty model
+     * @param db Database to read from. It must outlive the model.
+     * @param parent Parent object
+     */
+    QueryModel(Db *db, QObject *parent=nullptr);
+    ~QueryModel();
+
+    /**
+     * @brief Sets the rows shown by the model and loads their keys
+     * @param table Table or view to read, used verbatim in the FROM clause
+     * @param columns Columns or expressions to show, used verbatim in the SELECT
+     * @param where Optional condition filtering the rows
+     * @param key Unique integer column ordering the rows. It should be indexed.
+     * @return True on success. On failure the model is empty and error() and errorMsg() describe the error.
+     */
+    bool setSource(const QString &table, const QStringList &columns, const QString &where=QString(), const QString &key="rowid");
+    /**
+     * @brief Scans the keys again and clears the cache, showing the current content of the source
+     * @return True on success
+     */
+    bool refresh();
+
+    /// @name Settings
+    /// @{
+    /// @brief Number of rows read with a single query
+    int blockSize() const { return m_blockSize; }
+    /// @brief Sets the number of rows read with a single query (default 256). Takes effect on next setSource() or refresh().
+    void setBlockSize(int size) { m_blockSize=qMax(size, 1); }
+    /// @brief Maximum number of blocks kept in memory
+    int cacheSize() const { return m_cache.maxCost(); }
+    /// @brief Sets the maximum number of blocks kept in memory (default 64)
+    void setCacheSize(int blocks) { m_cache.setMaxCost(qMax(blocks, 2)); }
+    /// @brief True if blocks are read in advance on a background connection
+    bool prefetch() const { return m_prefetch; }
+    /// @brief Enables or disables reading blocks in advance (default true). Ignored for in-memory and temporary databases. Takes effect on next setSource() or refresh().
+    void setPrefetch(bool prefetch) { m_prefetch=prefetch; }
+    /// @}
+
+    /// @name Metrics
+    /// @{
+    /// @brief Number of blocks read by the model thread because they were not in the cache
+    int blockReads() const { return m_blockReads; }
+    /// @brief Number of blocks taken from the background connection instead of being read by the model thread
+    int prefetchHits() const { return m_prefetchHits; }
+    /// @}
+
+    /// @brief Error code of last operation
+    int error() const { return m_error; }
+    /// @brief Error message of last operation
+    QString errorMsg() const { return m_errorMsg; }
+
+    int rowCount(const QModelIndex &parent=QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent=QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role=Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role=Qt::DisplayRole) const override;
+  protected:
+    // Decoded rows of a block, row by row
+    struct Block
+    {
+      QVector<QVariant> values;
+      int rows=0;
+    };
+    // Reads blocks requested by the model on its own connection
+    class Prefetcher: public QThread
+    {
+    public:
+      Prefetcher(Db *connection, const QString &sql, int blockSize, int columns);
+      ~Prefetcher();
+      // Replaces any pending request
+      void request(int block, qint64 from, qint64 to);
+      // Moves a block already read to result, waiting for it if it is requested or being read. Returns false if it is not available
+      bool take(int block, Block &result);
+      void stop();
+    protected:
+      void run() override;
+      QScopedPointer<Db> m_connection;
+      QString m_sql;
+      int m_blockSize;
+      int m_columns;
+      QMutex m_mutex;
+      QWaitCondition m_wake;
+      QWaitCondition m_readyWake;
+      bool m_stop;
+      bool m_running;
+      int m_requested;
+      int m_inFlight;
+      qint64 m_from;
+      qint64 m_to;
+      QHash<int, Block> m_ready;
+    };
+    // Reads the rows with key in [from, to) into block, decoding columns 1 to columns (column 0 is the key)
+    static bool readBlock(Query &query, qint64 from, qint64 to, int blockSize, int columns, Block &block);
+    bool load();
+    void clear();
+    const Block *block(int block) const;
+    qint64 blockEnd(int block) const;
+    void setError(int code, const QString &msg);
+    Db *m_db;
+    QString m_table;
+    QStringList m_columns;
+    QString m_where;
+    QString m_key;
+    int m_blockSize;
+    bool m_prefetch;
+    // First key of every block
+    QVector<qint64> m_blockKeys;
+    int m_rows;
+    QStringList m_headers;
+    // State changed by data(), which is const for the view
+    mutable Query m_query;
+    mutable QCache<int, Block> m_cache;
+    mutable int m_lastBlock;
+    mutable int m_blockReads;
+    mutable int m_prefetchHits;
+    QScopedPointer<Prefetcher> m_prefetcher;
+    int m_error;
+    QString m_errorMsg;
+  };
+}
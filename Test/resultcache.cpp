@@ -0,0 +1,279 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "changes.h"
+#include "database.h"
+#include "resultcache.h"
+#include "sqlite3.h"
+#include <cstring>
+
+using namespace HFSQtLi;
+
+ResultCache::Entry::~Entry()
+{
+  for(sqlite3_value *value: qAsConst(values))
+    sqlite3_value_free(value);
+}
+
+ResultCache::ResultCache(Db *db): m_db(db), m_entries(16*1024*1024), m_dataVersionQuery(nullptr), m_dataVersion(-1),
+  m_schemaVersionQuery(nullptr), m_schemaVersion(-1), m_recording(nullptr),
+  m_userAuthorizer(nullptr), m_userAuthorizerData(nullptr), m_hits(0), m_misses(0), m_invalidations(0)
+{
+  if(m_db && m_db->m_db)
+    sqlite3_set_authorizer(m_db->m_db, &ResultCache::authorizer, this);
+}
+
+ResultCache::~ResultCache()
+{
+  if(m_db && m_db->m_db)
+    sqlite3_set_authorizer(m_db->m_db, nullptr, nullptr);
+  for(const Statement &statement: qAsConst(m_statements))
+    delete statement.query;
+  delete m_dataVersionQuery;
+  delete m_schemaVersionQuery;
+}
+
+void ResultCache::clear()
+{
+  m_entries.clear();
+  m_uncached.reset();
+}
+
+void ResultCache::invalidate(const QString &table)
+{
+  tableChanged(table.toUtf8().constData());
+}
+
+int ResultCache::tableIndex(const char *table)
+{
+  QByteArray name(table);
+  auto it=m_tableIndexes.constFind(name);
+  if(it!=m_tableIndexes.constEnd())
+    return it.value();
+  int ret=m_versions.size();
+  m_tableIndexes.insert(name, ret);
+  m_versions.append(0);
+  return ret;
+}
+
+void ResultCache::tableChanged(const char *table)
+{
+  int index=tableIndex(table);
+  m_versions[index]++;
+  m_dirty.insert(index);
+}
+
+void ResultCache::transactionEnd(bool committed)
+{
+  // Entries read inside the transaction may contain rolled back data
+  if(!committed)
+    for(int index: qAsConst(m_dirty))
+      m_versions[index]++;
+  m_dirty.clear();
+}
+
+void ResultCache::setAuthorizer(Authorizer authorizer, void *userData)
+{
+  m_userAuthorizer=authorizer;
+  m_userAuthorizerData=userData;
+}
+
+int ResultCache::authorizer(void *cache, int action, const char *arg1, const char *arg2, const char *database, const char *trigger)
+{
+  auto *self=static_cast<ResultCache *>(cache);
+  // A denied or ignored action is not done: the cache doesn't need to track it
+  if(self->m_userAuthorizer)
+  {
+    int ret=self->m_userAuthorizer(self->m_userAuthorizerData, action, arg1, arg2, database, trigger);
+    if(ret!=SQLITE_OK)
+      return ret;
+  }
+  switch(action)
+  {
+  case SQLITE_READ:
+    // arg1 is the table, reported with an empty column even when no column is read (e.g. SELECT COUNT(*))
+    if(self->m_recording && arg1)
+    {
+      int index=self->tableIndex(arg1);
+      if(!self->m_recording->contains(index))
+        self->m_recording->append(index);
+    }
+    break;
+  case SQLITE_DROP_TABLE:
+  case SQLITE_DROP_TEMP_TABLE:
+  case SQLITE_DROP_VIEW:
+  case SQLITE_DROP_TEMP_VIEW:
+    // The statement is only being prepared: the drop itself is detected by checkDataVersion through the schema version
+    if(arg1)
+      self->m_dropping=arg1;
+    break;
+  case SQLITE_DELETE:
+    // Ignoring DELETE disables the truncate optimization, so the update hook is called for every row.
+    // Deletes from the schema table and from the table being dropped are done by DROP statements and must be allowed, ignoring them would skip the DROP.
+    if(arg1 && strncmp(arg1, "sqlite_", 7)!=0)
+    {
+      if(strcmp(arg1, self->m_dropping.constData())!=0)
+        return SQLITE_IGNORE;
+      self->m_dropping.clear();
+    }
+    break;
+  default:
+    break;
+  }
+  return SQLITE_OK;
+}
+
+ResultCache::Statement *ResultCache::statement(const QString &sql, QString *errorMsg)
+{
+  auto it=m_statements.find(sql);
+  if(it!=m_statements.end())
+    return &it.value();
+  // Bound the number of prepared statements kept
+  if(m_statements.size()>=64)
+  {
+    for(const Statement &statement: qAsConst(m_statements))
+      delete statement.query;
+    m_statements.clear();
+  }
+  Statement statement{new Query(m_db, true), QVector<int>()};
+  statement.query->m_boundValues.reset(new QVector<QByteArray>);
+  m_recording=&statement.tables;
+  bool ok=statement.query->prepare(sql, true);
+  m_recording=nullptr;
+  if(!ok)
+  {
+    if(errorMsg)
+      *errorMsg=statement.query->errorMsg();
+    delete statement.query;
+    return nullptr;
+  }
+  return &m_statements.insert(sql, statement).value();
+}
+
+bool ResultCache::checkDataVersion()
+{
+  if(!m_dataVersionQuery)
+    m_dataVersionQuery=new Query(m_db, "PRAGMA data_version", true);
+  if(!m_schemaVersionQuery)
+    m_schemaVersionQuery=new Query(m_db, "PRAGMA schema_version", true);
+  qint64 version=-1, schemaVersion=-1;
+  bool ret=m_dataVersionQuery->step(version);
+  m_dataVersionQuery->reset();
+  ret=ret && m_schemaVersionQuery->step(schemaVersion);
+  m_schemaVersionQuery->reset();
+  // Another connection committed (tables changed are unknown) or the schema changed (the update hook is not called for the rows of a
+  // dropped table, and a table created again with the same name must not match old entries)
+  if(ret && (version!=m_dataVersion || schemaVersion!=m_schemaVersion))
+  {
+    if(m_dataVersion>=0)
+    {
+      m_invalidations+=m_entries.size();
+      clear();
+    }
+    m_dataVersion=version;
+    m_schemaVersion=schemaVersion;
+  }
+  return ret;
+}
+
+sqlite3_value **ResultCache::fetch(Statement *statement, int columns)
+{
+  Query *query=statement->query;
+  sqlite3_stmt *stmt=query->m_stmt;
+  m_uncached.reset();
+  if(sqlite3_column_count(stmt)!=columns)
+  {
+    query->assertFetchColumnCount(columns);
+    return nullptr;
+  }
+  // A commit of this connection done since the last hook releases the tables it changed
+  if(m_db->m_changes)
+    m_db->m_changes->checkCommitted(false);
+  bool cacheable=checkDataVersion();
+  // Rows read after a change of the running transaction may be undone by a ROLLBACK TO, which calls no hook: they are not cached
+  for(int index: qAsConst(statement->tables))
+    cacheable&=!m_dirty.contains(index);
+  QByteArray key;
+  if(cacheable)
+  {
+    // The SQL text followed by the size and the bytes of every bound value. Values are not converted to text, that would round doubles.
+    key=sqlite3_sql(stmt);
+    const QVector<QByteArray> &values=*query->m_boundValues;
+    int count=sqlite3_bind_parameter_count(stmt);
+    for(int i=0;i<count;i++)
+    {
+      QByteArray value=i<values.size()?values.at(i):QByteArray();
+      qint32 size=qint32(value.size());
+      key.append(reinterpret_cast<const char *>(&size), sizeof(size));
+      key.append(value);
+    }
+  }
+  if(cacheable)
+  {
+    if(Entry *entry=m_entries.object(key))
+    {
+      bool valid=true;
+      for(const auto &version: qAsConst(entry->versions))
+        valid&=m_versions[version.first]==version.second;
+      if(valid)
+      {
+        m_hits++;
+        return entry->values.data();
+      }
+      m_invalidations++;
+      m_entries.remove(key);
+    }
+  }
+  m_misses++;
+  QScopedPointer<Entry> entry(new Entry);
+  // Versions are taken before running the query, so changes made while it runs make the entry stale
+  for(int index: qAsConst(statement->tables))
+    entry->versions.append(qMakePair(index, m_versions[index]));
+  if(!query->stepNoFetch())
+  {
+    if(query->isDone())
+      query->setInternalError(SQLiteCode::CONSTRAINT, "Step single query returned no rows");
+    return nullptr;
+  }
+  qint64 cost=sizeof(Entry)+key.size();
+  for(int i=0;i<columns;i++)
+  {
+    sqlite3_value *value=sqlite3_value_dup(sqlite3_column_value(stmt, i));
+    if(!value)
+    {
+      query->setInternalError(SQLITE_NOMEM);
+      return nullptr;
+    }
+    entry->values.append(value);
+    cost+=64;
+    // Asking the size of numbers would convert them to text
+    int type=sqlite3_value_type(value);
+    if(type==SQLITE_TEXT || type==SQLITE_BLOB)
+      cost+=sqlite3_value_bytes(value);
+  }
+  if(query->stepNoFetch())
+  {
+    query->setInternalError(SQLiteCode::CONSTRAINT, "Step single query returned more than one row");
+    return nullptr;
+  }
+  if(!query->isDone())
+    return nullptr;
+  sqlite3_value **ret=entry->values.data();
+  if(cacheable && cost<=m_entries.maxCost())
+    m_entries.insert(key, entry.take(), cost);
+  else
+    m_uncached.reset(entry.take());
+  return ret;
+}
@@ -0,0 +1,141 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QCache>
+#include <QPair>
+#include <QScopedPointer>
+
+struct sqlite3_value;
+
+namespace HFSQtLi
+{
+  class Db;
+  class Query;
+  class ChangeNotifier;
+  /**
+   * @brief Cache of the results of single row read queries, see Db::executeCached.
+   *
+   * Entries are keyed by the SQL text and the bound values in binary form, and store a copy of the values of the row.
+   * While a statement is prepared an authorizer records the tables it reads (views and subqueries included): an entry is valid as long as none of these tables changed.
+   * - Changes made through this connection are tracked with the update hook, which bumps a version number of the table. Changes rolled back bump it again.
+   * - Changes made by other connections or processes are detected with PRAGMA data_version before every lookup, and clear the whole cache.
+   * - Schema changes (e.g. a table dropped and created again) are detected with PRAGMA schema_version before every lookup, and clear the whole cache.
+   * - ROLLBACK TO a savepoint calls no hook: rows read from a table after the running transaction changed it are returned but not cached.
+   *
+   * To make DELETE without WHERE visible to the update hook the authorizer disables the truncate optimization while the cache exists, so these deletes are done row by row.
+   * Changes to WITHOUT ROWID tables and to virtual tables are not tracked: call invalidate() after changing them.
+   * Queries using non deterministic functions (random(), date('now'), ...) should not be cached.
+   * Entries are evicted in LRU order when their total size exceeds memoryBudget().
+   *
+   * The cache is created by Db::resultCache() and owned by the database. It installs its own authorizer on the connection, replacing any authorizer set
+   * with sqlite3_set_authorizer: install authorizers with setAuthorizer() instead, the cache calls them first.
+   */
+  class ResultCache
+  {
+    friend class Db;
+    friend class ChangeNotifier;
+  public:
+    ~ResultCache();
+    /// @brief Maximum size in bytes of the cached rows
+    qint64 memoryBudget() const { return m_entries.maxCost(); }
+    /// @brief Sets the maximum size in bytes of the cached rows (default 16 MiB). Least recently used entries are evicted to fit.
+    void setMemoryBudget(qint64 bytes) { m_entries.setMaxCost(qMax<qint64>(bytes, 0)); }
+    /// @brief Approximate size in bytes of the cached rows
+    qint64 memoryUsed() const { return m_entries.totalCost(); }
+    /// @brief Number of cached rows
+    int size() const { return int(m_entries.size()); }
+    /// @brief Removes all entries
+    void clear();
+    /// @brief Invalidates the entries reading a table. Needed only for changes not seen by the update hook (see \ref ResultCache).
+    void invalidate(const QString &table);
+    /// @brief Authorizer callback, with the arguments of the sqlite3_set_authorizer callback
+    typedef int (*Authorizer)(void *userData, int action, const char *arg1, const char *arg2, const char *database, const char *trigger);
+    /**
+     * @brief Sets an authorizer called by the authorizer of the cache, in place of sqlite3_set_authorizer (see \ref ResultCache)
+     * @param authorizer The callback, nullptr to remove it. Actions it denies or ignores are not tracked by the cache.
+     * @param userData First argument passed to the callback
+     */
+    void setAuthorizer(Authorizer authorizer, void *userData=nullptr);
+
+    /// @name Metrics
+    /// @{
+    /// @brief Number of lookups answered from the cache
+    quint64 hits() const { return m_hits; }
+    /// @brief Number of lookups that executed the query
+    quint64 misses() const { return m_misses; }
+    /// @brief Number of entries found stale because a table they read changed
+    quint64 invalidations() const { return m_invalidations; }
+    /// @brief Fraction of lookups answered from the cache (0 if there was no lookup)
+    double hitRatio() const { return m_hits+m_misses?double(m_hits)/double(m_hits+m_misses):0; }
+    /// @brief Clears the metrics
+    void resetStats() { m_hits=m_misses=m_invalidations=0; }
+    /// @}
+  protected:
+    struct Entry
+    {
+      ~Entry();
+      QVector<sqlite3_value *> values;
+      // Version of every table read when the query was executed
+      QVector<QPair<int, quint64>> versions;
+    };
+    struct Statement
+    {
+      Query *query;
+      QVector<int> tables;
+    };
+    explicit ResultCache(Db *db);
+    // Gets the prepared statement of sql, preparing it if needed. Returns null on error.
+    Statement *statement(const QString &sql, QString *errorMsg);
+    // Returns the values of the row of the bound statement, from the cache or executing it. Returns null on error.
+    sqlite3_value **fetch(Statement *statement, int columns);
+    int tableIndex(const char *table);
+    bool checkDataVersion();
+    // Called by the hooks installed by ChangeNotifier, which confirm commits
+    void tableChanged(const char *table);
+    // Called when the running transaction is rolled back or its commit is done
+    void transactionEnd(bool committed);
+    bool hasDirtyTables() const { return !m_dirty.isEmpty(); }
+    static int authorizer(void *cache, int action, const char *arg1, const char *arg2, const char *database, const char *trigger);
+    Db *m_db;
+    QCache<QByteArray, Entry> m_entries;
+    // Entry bigger than the budget, kept only until next fetch
+    QScopedPointer<Entry> m_uncached;
+    QHash<QString, Statement> m_statements;
+    Query *m_dataVersionQuery;
+    qint64 m_dataVersion;
+    Query *m_schemaVersionQuery;
+    qint64 m_schemaVersion;
+    QHash<QByteArray, int> m_tableIndexes;
+    QVector<quint64> m_versions;
+    // Tables changed by the running transaction
+    QSet<int> m_dirty;
+    // Tables read by the statement being prepared
+    QVector<int> *m_recording;
+    // Table or view named by the DROP statement being prepared
+    QByteArray m_dropping;
+    // Authorizer set with setAuthorizer
+    Authorizer m_userAuthorizer;
+    void *m_userAuthorizerData;
+    quint64 m_hits;
+    quint64 m_misses;
+    quint64 m_invalidations;
+  };
+}
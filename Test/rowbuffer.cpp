@@ -0,0 +1,203 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "rowbuffer.h"
+#include "sqlite3.h"
+#include <cstring>
+
+using namespace HFSQtLi;
+
+RowBuffer::RowBuffer(): m_poolUsed(0), m_namesGeneration(0), m_namesReprepare(-1), m_namesFirst(0)
+{
+}
+
+int RowBuffer::fetch(sqlite3_stmt *stmt, int first, quint64 generation)
+{
+  int count=qMax(sqlite3_column_count(stmt)-first, 0);
+  // Names are read once per statement, the same buffer is usually fetched from the same query.
+  // The address of the statement is not enough: a statement prepared after another one was finalized may get the same address.
+  int reprepare=sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_REPREPARE, 0);
+  if(generation!=m_namesGeneration || reprepare!=m_namesReprepare || first!=m_namesFirst || count!=m_names.size())
+  {
+    m_names.resize(count);
+    for(int i=0;i<count;i++)
+      m_names[i]=QString::fromUtf8(sqlite3_column_name(stmt, first+i));
+    m_namesGeneration=generation;
+    m_namesReprepare=reprepare;
+    m_namesFirst=first;
+  }
+  m_cells.resize(count);
+  m_poolUsed=0;
+  for(int i=0;i<count;i++)
+  {
+    Cell &cell=m_cells[i];
+    int column=first+i;
+    switch(sqlite3_column_type(stmt, column))
+    {
+    case SQLITE_INTEGER:
+      cell.type=Type::Integer;
+      cell.integer=sqlite3_column_int64(stmt, column);
+      break;
+    case SQLITE_FLOAT:
+      cell.type=Type::Float;
+      cell.real=sqlite3_column_double(stmt, column);
+      break;
+    case SQLITE_TEXT:
+    {
+      const char *text=reinterpret_cast<const char *>(sqlite3_column_text(stmt, column));
+      cell.type=Type::Text;
+      cell.size=sqlite3_column_bytes(stmt, column);
+      cell.offset=store(text, cell.size);
+      break;
+    }
+    case SQLITE_BLOB:
+    {
+      const char *data=static_cast<const char *>(sqlite3_column_blob(stmt, column));
+      cell.type=Type::Blob;
+      cell.size=sqlite3_column_bytes(stmt, column);
+      cell.offset=store(data, cell.size);
+      break;
+    }
+    default:
+      cell.type=Type::Null;
+      cell.size=0;
+      cell.integer=0;
+    }
+  }
+  return count+1;
+}
+
+qsizetype RowBuffer::store(const char *data, qsizetype size)
+{
+  qsizetype offset=m_poolUsed;
+  qsizetype needed=offset+size+1;
+  // The pool never shrinks: after the largest row no more allocations are needed
+  if(needed>m_pool.size())
+    m_pool.resize(qMax(needed, 2*m_pool.size()));
+  char *dest=m_pool.data()+offset;
+  if(size>0)
+    memcpy(dest, data, size);
+  dest[size]=0;
+  m_poolUsed=needed;
+  return offset;
+}
+
+qint64 RowBuffer::toInt64(int i) const
+{
+  switch(type(i))
+  {
+  case Type::Integer: return m_cells[i].integer;
+  case Type::Float: return Helper::doubleToInt64(m_cells[i].real);
+  case Type::Text:
+  {
+    TextView value=text(i);
+    return Helper::textToInt64(value.data(), value.size());
+  }
+  default: return 0;
+  }
+}
+
+double RowBuffer::toDouble(int i) const
+{
+  switch(type(i))
+  {
+  case Type::Integer: return double(m_cells[i].integer);
+  case Type::Float: return m_cells[i].real;
+  case Type::Text:
+  {
+    TextView value=text(i);
+    return Helper::textToDouble(value.data(), value.size());
+  }
+  default: return 0;
+  }
+}
+
+TextView RowBuffer::text(int i) const
+{
+  Type t=type(i);
+  if(t!=Type::Text && t!=Type::Blob)
+    return TextView();
+  return TextView(m_pool.constData()+m_cells[i].offset, m_cells[i].size);
+}
+
+BlobView RowBuffer::blob(int i) const
+{
+  TextView data=text(i);
+  return BlobView(data.data(), data.size());
+}
+
+QString RowBuffer::toString(int i) const
+{
+  switch(type(i))
+  {
+  case Type::Integer: return QString::number(m_cells[i].integer);
+  case Type::Float: return QString::number(m_cells[i].real, 'g', 15);
+  case Type::Text:
+  case Type::Blob: return text(i).toString();
+  default: return QString();
+  }
+}
+
+QVariant RowBuffer::toVariant(int i) const
+{
+  switch(type(i))
+  {
+  case Type::Integer: return QVariant(m_cells[i].integer);
+  case Type::Float: return QVariant(m_cells[i].real);
+  case Type::Text: return QVariant(text(i).toString());
+  case Type::Blob: return QVariant(blob(i).toByteArray());
+  default: return QVariant();
+  }
+}
+
+QJsonValue RowBuffer::toJsonValue(int i) const
+{
+  switch(type(i))
+  {
+  case Type::Integer: return QJsonValue(m_cells[i].integer);
+  case Type::Float: return QJsonValue(m_cells[i].real);
+  case Type::Text: return QJsonValue(text(i).toString());
+  case Type::Blob: return QJsonValue(QString::fromLatin1(blob(i).toByteArray().toHex()));
+  default: return QJsonValue(QJsonValue::Null);
+  }
+}
+
+QVariantList RowBuffer::toVariantList() const
+{
+  QVariantList ret;
+  ret.reserve(m_cells.size());
+  for(int i=0;i<m_cells.size();i++)
+    ret.append(toVariant(i));
+  return ret;
+}
+
+QJsonObject RowBuffer::toJsonObject() const
+{
+  QJsonObject ret;
+  for(int i=0;i<m_cells.size();i++)
+    ret.insert(m_names.value(i), toJsonValue(i));
+  return ret;
+}
+
+void RowBuffer::clear()
+{
+  m_cells.clear();
+  m_pool.clear();
+  m_poolUsed=0;
+  m_names.clear();
+  m_namesGeneration=0;
+  m_namesReprepare=-1;
+  m_namesFirst=0;
+}
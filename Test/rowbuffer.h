@@ -0,0 +1,114 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QVariant>
+#include <QVariantList>
+#include <QJsonValue>
+#include <QJsonObject>
+#include "util.h"
+
+struct sqlite3_stmt;
+
+namespace HFSQtLi
+{
+  class Query;
+
+  /**
+   * @brief Reusable buffer holding a row of a query whose columns are known only at run time.
+   *
+   * Fetching a RowBuffer reads all the columns left in the row (from the first fetched one to the last column of the query), whatever their number and types.
+   * Cells are stored in a flat array of typed values and text and blobs are copied in a single byte pool: both are sized on the first row and reused by the
+   * following ones, so once the largest row has been seen stepping allocates nothing. Values are converted (to QString, QVariant, QJsonValue...) only when accessed.
+   * \code
+   * Query qry(db, sql); // Any query, e.g. typed by a user
+   * RowBuffer row;
+   * while(qry.step(row))
+   * {
+   *   for(int i=0;i<row.columnCount();i++)
+   *     out << row.columnName(i) << "=" << row.toString(i);
+   *   json.append(row.toJsonObject());
+   * }
+   * \endcode
+   */
+  class RowBuffer
+  {
+  public:
+    /// @brief Constructs an empty buffer
+    RowBuffer();
+    /// @brief Number of cells of the last fetched row
+    int columnCount() const { return m_cells.size(); }
+    /// @brief Name of a column, as returned by sqlite3_column_name. Names are read again only when the buffer is fetched from another statement or after it was prepared again.
+    QString columnName(int i) const { return m_names.value(i); }
+    /// @brief Type of a cell, Type::Invalid if i is out of range
+    Type type(int i) const { return (i>=0 && i<m_cells.size())?m_cells[i].type:Type::Invalid; }
+    bool isNull(int i) const { return type(i)==Type::Null; }
+
+    /// @brief Converts a cell to integer: floats are truncated, text is parsed, NULL and blobs are 0
+    qint64 toInt64(int i) const;
+    /// @brief Converts a cell to double: text is parsed, NULL and blobs are 0
+    double toDouble(int i) const;
+    /// @brief View over a text or blob cell, nul terminated, valid until the next fetch. Null for other types.
+    TextView text(int i) const;
+    /// @brief View over a text or blob cell, valid until the next fetch. Null for other types.
+    BlobView blob(int i) const;
+    /// @brief Converts a cell to a string: NULL is a null string
+    QString toString(int i) const;
+    /// @brief Converts a cell to a QVariant: qint64, double, QString, QByteArray or an invalid QVariant for NULL
+    QVariant toVariant(int i) const;
+    /// @brief Converts a cell to a QJsonValue. Blobs are hexadecimal strings, as in Query::exportTo.
+    QJsonValue toJsonValue(int i) const;
+    /// @brief Converts all the cells to QVariant
+    QVariantList toVariantList() const;
+    /// @brief Converts the row to a JSON object, the keys are the column names
+    QJsonObject toJsonObject() const;
+
+    /// @brief Bytes reserved for text and blobs
+    qsizetype poolCapacity() const { return m_pool.size(); }
+    /// @brief Frees the cells and the byte pool
+    void clear();
+  protected:
+    friend class Query;
+    // Reads the columns of the current row of stmt from first. generation is Query::m_prepareGeneration. Returns 1+number of columns read.
+    int fetch(sqlite3_stmt *stmt, int first, quint64 generation);
+    // Copies data to the pool, with a nul terminator, and returns its offset
+    qsizetype store(const char *data, qsizetype size);
+    struct Cell
+    {
+      Type type;
+      // Size of text and blobs
+      int size;
+      union
+      {
+        qint64 integer;
+        double real;
+        // Offset of text and blobs in m_pool
+        qsizetype offset;
+      };
+    };
+    QVector<Cell> m_cells;
+    // Text and blobs of the row; only m_poolUsed bytes are used, the rest is kept for the next rows
+    QByteArray m_pool;
+    qsizetype m_poolUsed;
+    QVector<QString> m_names;
+    // Prepare generation, reprepare count (SQLITE_STMTSTATUS_REPREPARE) and first column of the statement the names were read from
+    quint64 m_namesGeneration;
+    int m_namesReprepare;
+    int m_namesFirst;
+  };
+}
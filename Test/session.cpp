@@ -0,0 +1,334 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "session.h"
+#include "sqlite3.h"
+
+using namespace HFSQtLi;
+
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+namespace
+{
+  // Moves a buffer allocated by the session extension into result
+  void takeBuffer(void *buffer, int size, QByteArray &result)
+  {
+    result=QByteArray(static_cast<const char *>(buffer), size);
+    sqlite3_free(buffer);
+  }
+}
+#else
+namespace
+{
+  const char *sessionUnsupported="Sessions require SQLite compiled with SQLITE_ENABLE_SESSION and SQLITE_ENABLE_PREUPDATE_HOOK";
+}
+#endif
+
+Db::Session::Session(Db *db, const char *database): m_db(db), m_session(nullptr), m_error(SQLITE_OK)
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(!m_db || !m_db->m_db)
+    setError(SQLITE_MISUSE);
+  else
+    setError(sqlite3session_create(m_db->m_db, database, &m_session));
+#else
+  Q_UNUSED(database)
+  setError(SQLITE_MISUSE);
+#endif
+}
+
+Db::Session::~Session()
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(m_session)
+    sqlite3session_delete(m_session);
+#endif
+}
+
+bool Db::Session::setError(int code)
+{
+  m_error=code;
+  if(code==SQLITE_OK)
+    m_errorMsg.clear();
+#if !defined(SQLITE_ENABLE_SESSION) || !defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  else if(code==SQLITE_MISUSE)
+    m_errorMsg=QString::fromUtf8(sessionUnsupported);
+#endif
+  else if(m_db && m_db->m_db && sqlite3_errcode(m_db->m_db)==code)
+    m_errorMsg=QString::fromUtf8(sqlite3_errmsg(m_db->m_db));
+  else
+    m_errorMsg=SQLiteCode::errorString(code);
+  return code==SQLITE_OK;
+}
+
+bool Db::Session::attach(const QString &table)
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(!m_session)
+    return setError(SQLITE_MISUSE);
+  return setError(sqlite3session_attach(m_session, table.isNull()?nullptr:table.toUtf8().constData()));
+#else
+  Q_UNUSED(table)
+  return setError(SQLITE_MISUSE);
+#endif
+}
+
+bool Db::Session::isEnabled() const
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  return m_session && sqlite3session_enable(m_session, -1);
+#else
+  return false;
+#endif
+}
+
+void Db::Session::setEnabled(bool enabled)
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(m_session)
+    sqlite3session_enable(m_session, enabled?1:0);
+#else
+  Q_UNUSED(enabled)
+#endif
+}
+
+bool Db::Session::isEmpty() const
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  return !m_session || sqlite3session_isempty(m_session);
+#else
+  return true;
+#endif
+}
+
+bool Db::Session::changeset(QByteArray &changeset)
+{
+  changeset.clear();
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(!m_session)
+    return setError(SQLITE_MISUSE);
+  int size=0;
+  void *buffer=nullptr;
+  int code=sqlite3session_changeset(m_session, &size, &buffer);
+  if(code==SQLITE_OK)
+    takeBuffer(buffer, size, changeset);
+  return setError(code);
+#else
+  return setError(SQLITE_MISUSE);
+#endif
+}
+
+bool Db::Session::patchset(QByteArray &patchset)
+{
+  patchset.clear();
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(!m_session)
+    return setError(SQLITE_MISUSE);
+  int size=0;
+  void *buffer=nullptr;
+  int code=sqlite3session_patchset(m_session, &size, &buffer);
+  if(code==SQLITE_OK)
+    takeBuffer(buffer, size, patchset);
+  return setError(code);
+#else
+  return setError(SQLITE_MISUSE);
+#endif
+}
+
+bool Db::applyChangeset(const QByteArray &changeset, const std::function<ConflictAction(const ChangesetConflict &)> &onConflict, QString *errorMsg)
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  int code=SQLITE_MISUSE;
+  if(m_db)
+    code=sqlite3changeset_apply(m_db, int(changeset.size()), const_cast<char *>(changeset.constData()), nullptr, &changesetConflict,
+                                const_cast<std::function<ConflictAction(const ChangesetConflict &)> *>(&onConflict));
+  if(code!=SQLITE_OK && errorMsg)
+  {
+    if(code==SQLITE_ABORT)
+      *errorMsg=QString::fromUtf8("Changeset aborted on conflict");
+    else
+      *errorMsg=m_db && sqlite3_errcode(m_db)==code?QString::fromUtf8(sqlite3_errmsg(m_db)):SQLiteCode::errorString(code);
+  }
+  return code==SQLITE_OK;
+#else
+  Q_UNUSED(changeset)
+  Q_UNUSED(onConflict)
+  if(errorMsg)
+    *errorMsg=QString::fromUtf8(sessionUnsupported);
+  return false;
+#endif
+}
+
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+int Db::changesetConflict(void *context, int type, sqlite3_changeset_iter *iterator)
+{
+  auto &onConflict=*static_cast<const std::function<ConflictAction(const ChangesetConflict &)> *>(context);
+  if(!onConflict)
+    return SQLITE_CHANGESET_ABORT;
+  switch(onConflict(ChangesetConflict(iterator, type)))
+  {
+  case ConflictAction::Omit:
+    return SQLITE_CHANGESET_OMIT;
+  case ConflictAction::Replace:
+    return SQLITE_CHANGESET_REPLACE;
+  default:
+    return SQLITE_CHANGESET_ABORT;
+  }
+}
+#endif
+
+bool Db::concatChangesets(const QByteArray &first, const QByteArray &second, QByteArray &result, QString *errorMsg)
+{
+  result.clear();
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  int size=0;
+  void *buffer=nullptr;
+  int code=sqlite3changeset_concat(int(first.size()), const_cast<char *>(first.constData()), int(second.size()), const_cast<char *>(second.constData()), &size, &buffer);
+  if(code==SQLITE_OK)
+    takeBuffer(buffer, size, result);
+  else if(errorMsg)
+    *errorMsg=SQLiteCode::errorString(code);
+  return code==SQLITE_OK;
+#else
+  Q_UNUSED(first)
+  Q_UNUSED(second)
+  if(errorMsg)
+    *errorMsg=QString::fromUtf8(sessionUnsupported);
+  return false;
+#endif
+}
+
+bool Db::invertChangeset(const QByteArray &changeset, QByteArray &result, QString *errorMsg)
+{
+  result.clear();
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  int size=0;
+  void *buffer=nullptr;
+  int code=sqlite3changeset_invert(int(changeset.size()), changeset.constData(), &size, &buffer);
+  if(code==SQLITE_OK)
+    takeBuffer(buffer, size, result);
+  else if(errorMsg)
+    *errorMsg=SQLiteCode::errorString(code);
+  return code==SQLITE_OK;
+#else
+  Q_UNUSED(changeset)
+  if(errorMsg)
+    *errorMsg=QString::fromUtf8(sessionUnsupported);
+  return false;
+#endif
+}
+
+ChangesetConflict::ChangesetConflict(sqlite3_changeset_iter *iterator, int type): m_iterator(iterator)
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  switch(type)
+  {
+  case SQLITE_CHANGESET_DATA:
+    m_type=Type::Data;
+    break;
+  case SQLITE_CHANGESET_NOTFOUND:
+    m_type=Type::NotFound;
+    break;
+  case SQLITE_CHANGESET_CONFLICT:
+    m_type=Type::Conflict;
+    break;
+  case SQLITE_CHANGESET_FOREIGN_KEY:
+    m_type=Type::ForeignKey;
+    break;
+  default:
+    m_type=Type::Constraint;
+    break;
+  }
+#else
+  Q_UNUSED(type)
+  m_type=Type::Constraint;
+#endif
+}
+
+QString ChangesetConflict::table() const
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  const char *table=nullptr;
+  int columns=0;
+  int operation=0;
+  if(m_type!=Type::ForeignKey && sqlite3changeset_op(m_iterator, &table, &columns, &operation, nullptr)==SQLITE_OK)
+    return QString::fromUtf8(table);
+#endif
+  return QString();
+}
+
+ChangeSet::Operation ChangesetConflict::operation() const
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  const char *table=nullptr;
+  int columns=0;
+  int operation=0;
+  if(m_type!=Type::ForeignKey && sqlite3changeset_op(m_iterator, &table, &columns, &operation, nullptr)==SQLITE_OK)
+  {
+    if(operation==SQLITE_INSERT)
+      return ChangeSet::Operation::Insert;
+    if(operation==SQLITE_DELETE)
+      return ChangeSet::Operation::Delete;
+  }
+#endif
+  return ChangeSet::Operation::Update;
+}
+
+int ChangesetConflict::columnCount() const
+{
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  const char *table=nullptr;
+  int columns=0;
+  int operation=0;
+  if(m_type!=Type::ForeignKey && sqlite3changeset_op(m_iterator, &table, &columns, &operation, nullptr)==SQLITE_OK)
+    return columns;
+#endif
+  return 0;
+}
+
+Value ChangesetConflict::oldValue(int column) const
+{
+  sqlite3_value *value=nullptr;
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(m_type==Type::ForeignKey || sqlite3changeset_old(m_iterator, column, &value)!=SQLITE_OK)
+    value=nullptr;
+#else
+  Q_UNUSED(column)
+#endif
+  return Value(value?sqlite3_value_dup(value):nullptr);
+}
+
+Value ChangesetConflict::newValue(int column) const
+{
+  sqlite3_value *value=nullptr;
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if(m_type==Type::ForeignKey || sqlite3changeset_new(m_iterator, column, &value)!=SQLITE_OK)
+    value=nullptr;
+#else
+  Q_UNUSED(column)
+#endif
+  return Value(value?sqlite3_value_dup(value):nullptr);
+}
+
+Value ChangesetConflict::conflictingValue(int column) const
+{
+  sqlite3_value *value=nullptr;
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  if((m_type!=Type::Data && m_type!=Type::Conflict) || sqlite3changeset_conflict(m_iterator, column, &value)!=SQLITE_OK)
+    value=nullptr;
+#else
+  Q_UNUSED(column)
+#endif
+  return Value(value?sqlite3_value_dup(value):nullptr);
+}
@@ -0,0 +1,142 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QString>
+#include <QByteArray>
+#include "database.h"
+#include "changes.h"
+
+struct sqlite3_session;
+struct sqlite3_changeset_iter;
+
+namespace HFSQtLi
+{
+  /**
+   * @brief Records the changes made to the tables of a connection as a changeset or a patchset (see the SQLite session extension).
+   *
+   * A changeset is a compact binary description of the rows inserted, updated and deleted, with their primary key and the old and new values of the changed columns.
+   * It can be applied to another database with the same schema by Db::applyChangeset, inverted to undo the changes (Db::invertChangeset) and concatenated with other changesets
+   * (Db::concatChangesets). A patchset is smaller (only the primary key of deleted rows and the new values of updated ones are stored) but can't be inverted and reports fewer conflicts.
+   *
+   * Only tables with a declared PRIMARY KEY are recorded. Changes made to the same row are merged: a row inserted and then deleted is not reported at all.
+   *
+   * Requires SQLite compiled with SQLITE_ENABLE_SESSION and SQLITE_ENABLE_PREUPDATE_HOOK (see \ref howtocompile), otherwise all operations fail with SQLITE_MISUSE.
+   * The session must be destroyed before the database.
+   * \code
+   * Db::Session session(db);
+   * session.attach("measures");
+   * db->runWrite([](Db &db){ ... });
+   * QByteArray changes;
+   * if(session.changeset(changes))
+   *   central->applyChangeset(changes);
+   * \endcode
+   */
+  class Db::Session
+  {
+  public:
+    /**
+     * @brief Creates a session recording changes to a database of a connection. No table is recorded until attach() is called.
+     * @param db Database connection
+     * @param database Name of the database (e.g. "main", "temp" or an attached database)
+     */
+    explicit Session(Db *db, const char *database="main");
+    Session(const Session &other)=delete;
+    Session &operator=(const Session &other)=delete;
+    ~Session();
+
+    /// @brief True if the last operation succeeded
+    bool isOk() const { return m_error==SQLiteCode::OK; }
+    /// @brief Error code of the last operation
+    int error() const { return m_error; }
+    /// @brief Error message of the last operation
+    QString errorMsg() const { return m_errorMsg; }
+
+    /**
+     * @brief Starts recording changes to a table
+     * @param table Name of the table. A null string records all the tables, including the ones created later.
+     * @return True on success
+     */
+    bool attach(const QString &table=QString());
+    /// @brief True if changes are being recorded
+    bool isEnabled() const;
+    /// @brief Pauses (false) or resumes (true) recording. Changes made while paused are not recorded, even to rows already in the changeset.
+    void setEnabled(bool enabled);
+    /// @brief True if no change was recorded
+    bool isEmpty() const;
+
+    /**
+     * @brief Gets the changes recorded so far as a changeset. Recording continues.
+     * @param changeset Filled with the changeset
+     * @return True on success
+     */
+    bool changeset(QByteArray &changeset);
+    /**
+     * @brief Gets the changes recorded so far as a patchset. Recording continues.
+     * @param patchset Filled with the patchset
+     * @return True on success
+     */
+    bool patchset(QByteArray &patchset);
+  protected:
+    bool setError(int code);
+    Db *m_db;
+    sqlite3_session *m_session;
+    int m_error;
+    QString m_errorMsg;
+  };
+
+  /**
+   * @brief Conflict found by Db::applyChangeset, passed to the conflict handler.
+   *
+   * Values can be read only while the handler runs.
+   */
+  class ChangesetConflict
+  {
+    friend class Db;
+  public:
+    /// @brief Kind of conflict (see sqlite3changeset_apply)
+    enum class Type: int
+    {
+      /// @brief The row to update or delete exists but its values are not the expected old ones. conflictingValue() gives the current values.
+      Data,
+      /// @brief The row to update or delete does not exist
+      NotFound,
+      /// @brief The row to insert already exists. conflictingValue() gives the current values.
+      Conflict,
+      /// @brief The change violates a constraint (NOT NULL, UNIQUE, CHECK, ...)
+      Constraint,
+      /// @brief Applying the whole changeset leaves foreign key violations. Only Abort or Omit (commit anyway) are allowed.
+      ForeignKey
+    };
+    /// @brief Kind of conflict
+    Type type() const { return m_type; }
+    /// @brief Table of the change
+    QString table() const;
+    /// @brief Operation of the change
+    ChangeSet::Operation operation() const;
+    /// @brief Number of columns of the table
+    int columnCount() const;
+    /// @brief Old value of a column of an update or delete. Invalid if not available (e.g. columns not changed by an update).
+    Value oldValue(int column) const;
+    /// @brief New value of a column of an insert or update. Invalid if not available (e.g. columns not changed by an update).
+    Value newValue(int column) const;
+    /// @brief Value of a column of the row in the database conflicting with the change, for Data and Conflict conflicts
+    Value conflictingValue(int column) const;
+  protected:
+    ChangesetConflict(sqlite3_changeset_iter *iterator, int type);
+    sqlite3_changeset_iter *m_iterator;
+    Type m_type;
+  };
+}
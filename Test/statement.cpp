@@ -0,0 +1,75 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "statement.h"
+#include "sqlite3.h"
+
+using namespace HFSQtLi;
+
+Helper::StatementBase::StatementBase(Db *db, const QString &sql, int parameters, int columns): Query(db, sql, true)
+{
+  if(m_stmt)
+  {
+    QString mismatch;
+    int count=sqlite3_bind_parameter_count(m_stmt);
+    if(count!=parameters)
+      mismatch=QString("Statement has %1 parameter(s), %2 declared").arg(count).arg(parameters);
+    else if((count=sqlite3_column_count(m_stmt))!=columns)
+      mismatch=QString("Statement returns %1 column(s), %2 declared").arg(count).arg(columns);
+    if(!mismatch.isEmpty())
+    {
+      // finalize() also drops the state built for the statement (parameter indexes, owned bindings...)
+      finalize();
+      setInternalError(SQLITE_CONSTRAINT, mismatch.toUtf8());
+    }
+  }
+}
+
+bool Helper::StatementBase::checkPrepared()
+{
+  if(m_stmt)
+    return true;
+  setInternalError(SQLITE_MISUSE);
+  return false;
+}
+
+bool Helper::StatementBase::stepFirst()
+{
+  if(stepNoFetch())
+    return true;
+  if(isDone())
+    setInternalError(SQLITE_CONSTRAINT, "Step single query returned no rows");
+  return false;
+}
+
+bool Helper::StatementBase::stepLast()
+{
+  if(stepNoFetch())
+  {
+    setInternalError(SQLITE_CONSTRAINT, "Step single query returned more than one row");
+    return false;
+  }
+  return isDone();
+}
+
+bool Helper::StatementBase::stepCommand()
+{
+  if(stepNoFetch())
+  {
+    setInternalError(SQLITE_CONSTRAINT, "Command query returned a row");
+    return false;
+  }
+  return isDone();
+}
@@ -0,0 +1,218 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QString>
+#include <array>
+#include "query.h"
+#include "database.h"
+
+namespace HFSQtLi
+{
+  /// @brief Types of the parameters of a \ref Statement
+  template <typename ...T> struct In { };
+  /// @brief Types of the columns of a \ref Statement
+  template <typename ...T> struct Out { };
+
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    template <typename T> struct IsStatementValue: std::integral_constant<bool, std::is_integral<T>::value || std::is_floating_point<T>::value ||
+                                                                                std::is_same<T, QString>::value || std::is_same<T, Interned<QString>>::value ||
+                                                                                std::is_same<T, QByteArray>::value || CodecSqlType<T>::type!=nullptr> { };
+    template <typename T> struct IsStatementValue<std::optional<T>>: IsStatementValue<T> { };
+
+    // Number of parameters or columns used by a value of a Statement
+    template <typename T> constexpr int statementColumns()
+    {
+      if constexpr(IsMapped<T>::value)
+        return mappedSize<T>();
+      else
+      {
+        static_assert(IsStatementValue<T>::value, "Statement values must be integers, floating points, QString, Interned<QString>, QByteArray, types with a built-in codec, std::optional of them or structs mapped with HFSQTLI_MAP");
+        return 1;
+      }
+    }
+
+    // Offset of the first parameter or column of every value, followed by the total
+    template <typename ...T> constexpr std::array<int, sizeof...(T)+1> statementOffsets()
+    {
+      constexpr int sizes[]={0, statementColumns<T>()...};
+      std::array<int, sizeof...(T)+1> ret{};
+      for(std::size_t i=1;i<ret.size();i++)
+        ret[i]=ret[i-1]+sizes[i];
+      return ret;
+    }
+
+    // Non-template part of Statement: prepare time checks and single row execution
+    class StatementBase: protected Query
+    {
+    public:
+      using Query::error;
+      using Query::errorMsg;
+      using Query::isOk;
+      using Query::isDone;
+      using Query::isPrepared;
+      using Query::reset;
+      using Query::clearBindings;
+      using Query::setKeepErrorMsg;
+      using Query::keepErrorMsg;
+      using Query::setDeadline;
+      using Query::setTimeout;
+      using Query::clearDeadline;
+      using Query::hasDeadline;
+      using Query::deadline;
+      /// \cond INTERNAL
+      using Query::pointerStatement;
+      /// \endcond INTERNAL
+    protected:
+      StatementBase(Db *db, const QString &sql, int parameters, int columns);
+      StatementBase(const StatementBase &other)=delete;
+      StatementBase &operator=(const StatementBase &other)=delete;
+      // Sets the error and returns false if the statement is not prepared
+      bool checkPrepared();
+      // First step of a single row execution: true if a row was returned
+      bool stepFirst();
+      // Last step of a single row execution: true if the statement is done
+      bool stepLast();
+      // Last step of a command: true if the statement is done without returning a row
+      bool stepCommand();
+    };
+  }
+  /// \endcond INTERNAL
+
+  template <typename Inputs, typename Outputs=Out<>> class Statement;
+
+  /**
+   * @brief Prepared statement with the types of its parameters and columns fixed at compile time.
+   *
+   * Statement<In<Params...>, Out<Columns...>> checks when prepared that the statement has as many parameters and columns as declared: if not the statement is
+   * not prepared and error() is SQLITE_CONSTRAINT. After that every value is bound or fetched at an offset computed at compile time with the native function of its type:
+   * no tuple is built, no count of bound parameters or fetched columns is checked on every call and columns are always fetched as in Query::column (not strict).
+   *
+   * Values can be integers, floating points, QString, Interned<QString>, QByteArray, std::optional of them (empty is NULL) and structs mapped with HFSQTLI_MAP (see \ref Mapping),
+   * which use one parameter or column for each field.
+   * \code
+   * Statement<In<qint64>, Out<QString, double>> lookup(db, "SELECT name, reading FROM sensors WHERE id=?");
+   * QString name;
+   * double reading;
+   * if(lookup.executeSingle(id, name, reading))
+   *   ...
+   * Statement<In<qint64, double>> insert(db, "INSERT INTO readings(sensor, value) VALUES (?, ?)");
+   * insert.execute(id, 21.5);
+   * \endcode
+   */
+  template <typename ...Params, typename ...Columns> class Statement<In<Params...>, Out<Columns...>>: public Helper::StatementBase
+  {
+  public:
+    /// @brief Number of parameters of the statement
+    static constexpr int parameterCount() { return s_params.back(); }
+    /// @brief Number of columns of the statement
+    static constexpr int columnCount() { return s_columns.back(); }
+    /**
+     * @brief Prepares the statement (persistent) and checks its number of parameters and columns
+     * @param db Database
+     * @param sql Statement to prepare
+     */
+    Statement(Db *db, const QString &sql): Helper::StatementBase(db, sql, parameterCount(), columnCount()) { }
+    /**
+     * @brief Binds all the parameters. Values are copied, the statement must be reset before binding again after a step.
+     * @return True on success
+     */
+    bool bind(const Params &...values) { return bindValues(false, values...); }
+    /**
+     * @brief Steps to the next row and fetches it
+     * @return True if a row was fetched. At the end isDone() is true, otherwise there was an error.
+     */
+    bool step(Columns &...values) { return stepNoFetch() && fetchValues(Helper::make_int_sequence<sizeof...(Columns)>(), values...); }
+    /**
+     * @brief Fetches the current row
+     * @return True on success
+     */
+    bool fetch(Columns &...values) { return checkPrepared() && fetchValues(Helper::make_int_sequence<sizeof...(Columns)>(), values...); }
+    /**
+     * @brief Resets the statement, binds the parameters and fetches the only row returned
+     * @return True on success. Fails if the statement returns no rows or more than one row.
+     * \warning Values are bound without copy and cleared before returning
+     */
+    bool executeSingle(const Params &...params, Columns &...values);
+    /**
+     * @brief Resets the statement, binds the parameters and runs it. The statement must return no rows.
+     * @return True on success
+     * \warning Values are bound without copy and cleared before returning
+     */
+    bool execute(const Params &...params);
+  protected:
+    static constexpr std::array<int, sizeof...(Params)+1> s_params=Helper::statementOffsets<Params...>();
+    static constexpr std::array<int, sizeof...(Columns)+1> s_columns=Helper::statementOffsets<Columns...>();
+    bool bindValues(bool temporary, const Params &...values);
+    template <int ...I> bool bindAt(bool temporary, Helper::int_sequence<I...>, const Params &...values);
+    template <typename T> bool bindValue(bool temporary, int i, const T &value);
+    template <int ...I> bool fetchValues(Helper::int_sequence<I...>, Columns &...values);
+    template <typename T> bool fetchValue(int i, T &value);
+  };
+
+  template <typename ...Params, typename ...Columns> bool Statement<In<Params...>, Out<Columns...>>::executeSingle(const Params &...params, Columns &...values)
+  {
+    bool ret=reset() && bindValues(true, params...) && stepFirst() && fetchValues(Helper::make_int_sequence<sizeof...(Columns)>(), values...) && stepLast();
+    clearBindingInternal();
+    return ret;
+  }
+
+  template <typename ...Params, typename ...Columns> bool Statement<In<Params...>, Out<Columns...>>::execute(const Params &...params)
+  {
+    bool ret=reset() && bindValues(true, params...) && stepCommand();
+    clearBindingInternal();
+    return ret;
+  }
+
+  template <typename ...Params, typename ...Columns> bool Statement<In<Params...>, Out<Columns...>>::bindValues(bool temporary, const Params &...values)
+  {
+    if(!checkPrepared())
+      return false;
+    Db::Lock lock(m_db, m_keepErrorMsg);
+    return bindAt(temporary, Helper::make_int_sequence<sizeof...(Params)>(), values...);
+  }
+
+  template <typename ...Params, typename ...Columns> template <int ...I> bool Statement<In<Params...>, Out<Columns...>>::bindAt(bool temporary, Helper::int_sequence<I...>, const Params &...values)
+  {
+    bool ok=true;
+    (void)((ok=bindValue(temporary, s_params[I]+1, values)) && ...);
+    return ok;
+  }
+
+  template <typename ...Params, typename ...Columns> template <typename T> bool Statement<In<Params...>, Out<Columns...>>::bindValue(bool temporary, int i, const T &value)
+  {
+    if constexpr(Helper::IsMapped<T>::value)
+      return bindMapped(temporary, i, value, Helper::make_int_sequence<Helper::mappedSize<T>()>())>0;
+    else
+      return bindMappedField(temporary, i, value);
+  }
+
+  template <typename ...Params, typename ...Columns> template <int ...I> bool Statement<In<Params...>, Out<Columns...>>::fetchValues(Helper::int_sequence<I...>, Columns &...values)
+  {
+    bool ok=true;
+    (void)((ok=fetchValue(s_columns[I], values)) && ...);
+    return ok;
+  }
+
+  template <typename ...Params, typename ...Columns> template <typename T> bool Statement<In<Params...>, Out<Columns...>>::fetchValue(int i, T &value)
+  {
+    if constexpr(Helper::IsMapped<T>::value)
+      return readMapped(false, i, value, Helper::make_int_sequence<Helper::mappedSize<T>()>())>0;
+    else
+      return readMappedField(false, i, value);
+  }
+}
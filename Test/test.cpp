@@ -21,6 +21,7 @@ QTEST_MAIN(TestHFSqlite)
 /// \cond INTERNAL
 
 #include <QDebug>
+#include <QBuffer>
 
 using namespace HFSQtLi;
 
@@ -153,7 +154,1459 @@ void customFetch(CustomFetch &fetch, TestType &type)
     type=val-1;
 }
 
+// Row type of the virtual table exposed in test14ExposeTable
+struct Sensor
+{
+  qint64 id;
+  QString name;
+  double reading;
+};
+
+void customBindConst(CustomBind &bind, const Sensor &sensor)
+{
+  bind.bind(sensor.id, sensor.name, sensor.reading);
+}
+
+// Window function state: sum of squares over the frame
+struct SumSquares
+{
+  static int g_live;
+  qint64 sum=0;
+  SumSquares() { g_live++; }
+  ~SumSquares() { g_live--; }
+  void step(qint64 v) { sum+=v*v; }
+  void inverse(qint64 v) { sum-=v*v; }
+  qint64 value() const { return sum; }
+};
+int SumSquares::g_live=0;
+
+// Plain aggregate state (no inverse)
+struct JoinText
+{
+  QStringList parts;
+  void step(const QString &text, std::optional<QString> separator) { parts.append(text); if(separator) m_separator=*separator; }
+  QString value() const { return parts.join(m_separator); }
+  QString m_separator=",";
+};
+
+// Struct mapped with HFSQTLI_MAP, bound and fetched without customBind/customFetch
+struct Reading
+{
+  qint64 id;
+  QString sensor;
+  std::optional<double> value;
+  bool valid;
+};
+HFSQTLI_MAP(Reading, id, sensor, value, valid)
+
 #ifndef DEVELOPING
+void TestHFSqlite::test30Codecs()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE events (id BLOB PRIMARY KEY, time INTEGER, scheduled REAL, day INTEGER, at INTEGER, legacy TEXT)"));
+  QDateTime time=QDateTime::fromMSecsSinceEpoch(1614834367890, Qt::UTC); // 2021-03-04T05:06:07.890Z
+  QUuid id=QUuid::createUuid();
+  QDate day(2021, 3, 4);
+  QTime at(5, 6, 7, 890);
+  Query insert(db.data(), "INSERT INTO events VALUES ($1, $2, $3, $4, $5, $6)");
+  QVERIFY(insert.bindAll(id, time, JulianDay<QDateTime>(time), day, at, QString("2021-03-04T05:06:07.890Z")));
+  QVERIFY(!insert.stepNoFetch() && insert.isDone());
+
+  // Binary encodings, usable by SQL
+  QString types, date, dateTime;
+  int size=0, sameDay=0;
+  QVERIFY(db->executeSingleAll("SELECT typeof(id)||typeof(time)||typeof(scheduled)||typeof(day)||typeof(at), length(id), date(scheduled), datetime(time/1000000, 'unixepoch'), "
+                               "day=CAST(julianday('2021-03-04')+0.5 AS INTEGER) FROM events", types, size, date, dateTime, sameDay));
+  QCOMPARE(types, QString("blobintegerrealintegerinteger"));
+  QCOMPARE(size, 16);
+  QCOMPARE(date, QString("2021-03-04"));
+  QCOMPARE(dateTime, QString("2021-03-04 05:06:07"));
+  QCOMPARE(sameDay, 1);
+
+  // Round trip
+  QUuid readId;
+  QDateTime readTime, legacyTime;
+  JulianDay<QDateTime> readScheduled;
+  QDate readDay;
+  QTime readAt;
+  QVERIFY(db->executeSingleAll("SELECT id, time, scheduled, day, at, legacy FROM events", readId, readTime, readScheduled, readDay, readAt, legacyTime));
+  QVERIFY(readId==id);
+  QVERIFY(readTime==time);
+  QVERIFY(readScheduled.value()==time); // Julian days are stored as doubles, rounded to the nearest millisecond
+  QVERIFY(readDay==day);
+  QVERIFY(readAt==at);
+  QVERIFY(legacyTime==time); // ISO 8601 text is parsed
+  QVERIFY(db->executeSingleAll("SELECT '2021-03-04 05:06:07.890'", legacyTime));
+  QVERIFY(legacyTime==time); // Text without offset, as written by datetime(), is UTC
+  QVERIFY(db->executeSingleAll<1>("SELECT $1", id.toString(), readId));
+  QVERIFY(readId==id);
+
+  // Lookup by key and range scans compare the binary values
+  int count=0;
+  QVERIFY(db->executeSingleAll<3>("SELECT count(*) FROM events WHERE id=$1 AND time BETWEEN $2 AND $3", id, time, time.addSecs(1), count));
+  QCOMPARE(count, 1);
+
+  // std::chrono keeps microseconds
+  std::chrono::system_clock::time_point point(std::chrono::microseconds(1614834367890123)), readPoint;
+  qint64 micros=0;
+  QVERIFY(db->executeSingleAll<1>("SELECT $1, $1", point, micros, readPoint));
+  QCOMPARE(micros, qint64(1614834367890123));
+  QVERIFY(readPoint==point);
+  // Julian days have millisecond precision, also with std::chrono
+  JulianDay<std::chrono::system_clock::time_point> readJulianPoint;
+  QVERIFY(db->executeSingleAll<1>("SELECT $1", JulianDay<std::chrono::system_clock::time_point>(point), readJulianPoint));
+  QVERIFY(readJulianPoint.value()==std::chrono::system_clock::time_point(std::chrono::microseconds(1614834367890000)));
+
+  // Invalid values are NULL
+  int isNull=0;
+  QVERIFY(db->executeSingleAll<1>("SELECT $1 IS NULL", QDateTime(), isNull));
+  QVERIFY(isNull);
+  QVERIFY(db->executeSingleAll("SELECT NULL", readTime));
+  QVERIFY(!readTime.isValid());
+
+  // Strict fetches require the binary encoding
+  Query strict(db.data(), "SELECT time, legacy FROM events");
+  QVERIFY(strict.step());
+  QVERIFY(strict.columnStrict(0, readTime));
+  QVERIFY(readTime==time);
+  QVERIFY(!strict.columnStrict(1, readTime));
+}
+
+void TestHFSqlite::test29RowBuffer()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT, value REAL, data BLOB)"));
+  QVERIFY(db->execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<100) INSERT INTO test SELECT i, 'name'||i, i/2.0, CASE WHEN i%2 THEN x'00ff' END FROM n"));
+  Query qry(db.data(), "SELECT * FROM test ORDER BY id");
+  RowBuffer row;
+  int rows=0;
+  qsizetype capacity=0;
+  while(qry.step(row))
+  {
+    rows++;
+    QCOMPARE(row.columnCount(), 4);
+    QCOMPARE(row.toInt64(0), qint64(rows));
+    QCOMPARE(row.toString(1), "name"+QString::number(rows));
+    QCOMPARE(row.text(1).data()[row.text(1).size()], '\0');
+    QCOMPARE(row.toDouble(2), rows/2.0);
+    if(rows%2)
+      QCOMPARE(row.blob(3).toByteArray(), QByteArray("\x00\xff", 2));
+    else
+      QVERIFY(row.isNull(3) && row.toVariant(3).isNull());
+    // The pool grows only with the size of the rows
+    if(rows>12)
+      QCOMPARE(row.poolCapacity(), capacity);
+    capacity=row.poolCapacity();
+  }
+  QCOMPARE(rows, 100);
+  QCOMPARE(row.columnName(0), QString("id"));
+  QCOMPARE(row.columnName(3), QString("data"));
+  QVERIFY(row.type(4)==Type::Invalid);
+
+  // Lazy conversions
+  QVERIFY(qry.reset());
+  QVERIFY(qry.step(row));
+  QCOMPARE(row.toVariant(0).toLongLong(), qlonglong(1));
+  QCOMPARE(row.toVariant(3).toByteArray(), QByteArray("\x00\xff", 2));
+  QCOMPARE(row.toVariantList().size(), 4);
+  QJsonObject object=row.toJsonObject();
+  QCOMPARE(int(object.size()), 4);
+  QCOMPARE(object.value("name").toString(), QString("name1"));
+  QCOMPARE(object.value("value").toDouble(), 0.5);
+  QCOMPARE(object.value("data").toString(), QString("00ff"));
+
+  // Columns after the first fetched one
+  qint64 id;
+  QVERIFY(qry.step(id, row));
+  QCOMPARE(id, qint64(2));
+  QCOMPARE(row.columnCount(), 3);
+  QCOMPARE(row.columnName(0), QString("name"));
+  QVERIFY(row.isNull(2));
+
+  // Names are read again for a statement prepared again, even if SQLite reuses the address of the previous one
+  QVERIFY(qry.prepare("SELECT id AS first FROM test"));
+  QVERIFY(qry.step(row));
+  QCOMPARE(row.columnName(0), QString("first"));
+  QVERIFY(qry.prepare("SELECT id AS second FROM test"));
+  QVERIFY(qry.step(row));
+  QCOMPARE(row.columnName(0), QString("second"));
+}
+
+void TestHFSqlite::test28ValueRef()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, v)"));
+  QVERIFY(db->execute("INSERT INTO test VALUES (1, 42), (2, 1.5), (3, 'short'), (4, 'a text longer than the inline buffer'), (5, x'0102'), (6, NULL), (7, '')"));
+  Query qry(db.data(), "SELECT v FROM test ORDER BY id");
+  QVector<OwnedValue> values;
+  ValueRef ref;
+  while(qry.step(ref))
+  {
+    QVERIFY(ref.isValid());
+    OwnedValue value(ref);
+    QVERIFY(value.type()==ref.type());
+    values.append(value);
+  }
+  QCOMPARE(values.size(), 7);
+  QCOMPARE(values[0].toInt64(), qint64(42));
+  QCOMPARE(values[0].toString(), QString("42"));
+  QCOMPARE(values[1].toDouble(), 1.5);
+  QCOMPARE(values[1].toInt64(), qint64(1));
+  QVERIFY(values[2].isText() && values[2].isInline());
+  QCOMPARE(values[2].toString(), QString("short"));
+  QCOMPARE(values[2].toText().data()[5], '\0');
+  QVERIFY(values[3].isText() && !values[3].isInline());
+  QCOMPARE(values[3].toString(), QString("a text longer than the inline buffer"));
+  QVERIFY(values[4].isBlob());
+  QCOMPARE(values[4].toBlob().toByteArray(), QByteArray("\x01\x02"));
+  QVERIFY(values[5].isNull());
+  QVERIFY(values[5].toString().isNull());
+  QVERIFY(values[6].isText() && values[6].toText().size()==0 && !values[6].toText().isNull());
+
+  // Copies keep the inline data
+  OwnedValue copy=values[2];
+  values[2].setInt64(7);
+  QCOMPARE(copy.toString(), QString("short"));
+
+  // Conversions follow SQLite: numeric prefixes of text, clamped floats
+  copy.setText("12abc", 5);
+  QCOMPARE(copy.toInt64(), qint64(12));
+  copy.setText(" 3.5e2x", 7);
+  QCOMPARE(copy.toDouble(), 350.);
+  copy.setDouble(1e300);
+  QCOMPARE(copy.toInt64(), std::numeric_limits<qint64>::max());
+  copy.setDouble(qQNaN());
+  QCOMPARE(copy.toInt64(), qint64(0));
+  int sameAsSqlite=0;
+  QVERIFY(db->executeSingleAll("SELECT CAST('12abc' AS INTEGER)=12 AND CAST(' 3.5e2x' AS REAL)=350", sameAsSqlite));
+  QVERIFY(sameAsSqlite);
+
+  // Values read as OwnedValue and bound again round-trip with their type
+  QVERIFY(db->execute("CREATE TABLE copy (id INTEGER PRIMARY KEY, v)"));
+  Query read(db.data(), "SELECT id, v FROM test ORDER BY id");
+  Query write(db.data(), "INSERT INTO copy VALUES ($1, $2)");
+  qint64 id;
+  OwnedValue value;
+  while(read.step(id, value))
+  {
+    QVERIFY(write.bindAll(id, value));
+    QVERIFY(!write.stepNoFetch() && write.isDone());
+    QVERIFY(write.reset());
+  }
+  int same=0;
+  QVERIFY(db->executeSingleAll("SELECT count(*) FROM test JOIN copy USING(id) WHERE test.v IS copy.v AND typeof(test.v)=typeof(copy.v)", same));
+  QCOMPARE(same, 7);
+
+  // A ValueRef binds a copy of the cell
+  Query cell(db.data(), "SELECT v FROM test WHERE id=4");
+  QVERIFY(cell.step(ref));
+  QString text;
+  QVERIFY(db->executeSingleAll<1>("SELECT $1", ref, text));
+  QCOMPARE(text, QString("a text longer than the inline buffer"));
+}
+
+void TestHFSqlite::test27Interned()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, status TEXT)"));
+  QVERIFY(db->execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<300) INSERT INTO test SELECT i, CASE i%3 WHEN 0 THEN 'open' WHEN 1 THEN 'closed' END FROM n"));
+  Query qry(db.data(), "SELECT id, status FROM test ORDER BY id");
+  QVector<std::tuple<qint64, Interned<QString>>> rows;
+  std::tuple<qint64, Interned<QString>> row;
+  while(qry.step(row))
+    rows.append(row);
+  QCOMPARE(rows.size(), 300);
+  QCOMPARE(qry.internPool()->size(), 2); // NULL is not pooled
+  QCOMPARE(qry.internPool()->misses(), quint64(2));
+  QCOMPARE(qry.internPool()->hits(), quint64(198));
+  QCOMPARE(std::get<1>(rows[0]).value(), QString("closed"));
+  QCOMPARE(std::get<1>(rows[2]).value(), QString("open"));
+  QVERIFY(std::get<1>(rows[1])->isNull());
+  // Repeated values share the same string data
+  QCOMPARE(std::get<1>(rows[3])->constData(), std::get<1>(rows[0])->constData());
+
+  // A pool can be shared and limited
+  InternPool pool(1);
+  Query other(db.data(), "SELECT status FROM test WHERE status IS NOT NULL ORDER BY id LIMIT 4");
+  other.setInternPool(&pool);
+  Interned<QString> status;
+  QVERIFY(other.step(status));
+  QCOMPARE(status.value(), QString("closed"));
+  QVERIFY(other.step(status));
+  QCOMPARE(status.value(), QString("open"));
+  QCOMPARE(pool.size(), 1);
+  // Binding an interned string binds its value
+  int count=0;
+  QVERIFY(db->executeSingleAll<1>("SELECT count(*) FROM test WHERE status=$1", status, count));
+  QCOMPARE(count, 100);
+}
+
+void TestHFSqlite::test26ResultArena()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT, data BLOB)"));
+  QVERIFY(db->execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<1000) INSERT INTO test SELECT i, 'name'||i, CASE WHEN i%10 THEN zeroblob(i%7) END FROM n"));
+  ResultArena arena(4096);
+  QVector<std::tuple<qint64, TextView, BlobView>> rows;
+  Query qry(db.data(), "SELECT id, name, data FROM test ORDER BY id");
+  QCOMPARE(qry.fetchAll(arena, rows), 1001);
+  QCOMPARE(rows.size(), 1000);
+  QVERIFY(arena.bytesUsed()>0 && arena.bytesAllocated()>=arena.bytesUsed());
+  for(const auto &[id, name, data]: rows)
+  {
+    QCOMPARE(name.toString(), "name"+QString::number(id));
+    QCOMPARE(name.data()[name.size()], '\0');
+    QCOMPARE(data.isNull(), id%10==0);
+    QCOMPARE(data.size(), qsizetype(id%10?id%7:0));
+  }
+
+  // Views outlive the query, not the arena
+  QVERIFY(qry.prepare("SELECT name FROM test WHERE id<=3 ORDER BY id"));
+  QVector<TextView> names;
+  QCOMPARE(qry.fetchAll(arena, names), 4);
+  qry.finalize();
+  QCOMPARE(names.last().toString(), QString("name3"));
+
+  // A large value gets its own slab
+  QByteArray large(10000, 'x');
+  QVERIFY(db->execute("INSERT INTO test VALUES (2000, 'large', $1)", large));
+  QVector<BlobView> blobs;
+  QVERIFY(qry.prepare("SELECT data FROM test WHERE id=2000"));
+  QCOMPARE(qry.fetchAll(arena, blobs), 2);
+  QCOMPARE(blobs[0].toByteArray(), large);
+  arena.clear();
+  QCOMPARE(arena.bytesUsed(), qsizetype(0));
+  QCOMPARE(arena.bytesAllocated(), qsizetype(4096));
+
+  // Without an arena views point to SQLite memory, valid until the next step
+  QVERIFY(qry.prepare("SELECT name FROM test WHERE id=5"));
+  TextView view;
+  QVERIFY(qry.step(view));
+  QCOMPARE(view.toString(), QString("name5"));
+  QVERIFY(qry.prepare("SELECT id, name FROM test"));
+  QCOMPARE(qry.fetchAll(arena, names), 0);
+}
+
+void TestHFSqlite::test25ColumnByName()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, sensor TEXT, value REAL)"));
+  QVERIFY(db->execute("INSERT INTO test VALUES (1, 'temperature', 21.5), (2, 'humidity', NULL)"));
+  Query qry(db.data(), "SELECT value, sensor AS name, id, id FROM test ORDER BY id");
+  QCOMPARE(qry.columnIndex("value"), 0);
+  QCOMPARE(qry.columnIndex("name"), 1);
+  QCOMPARE(qry.columnIndex("sensor"), -1);
+  QCOMPARE(qry.columnIndex("id"), 2); // First of the columns with the same name
+  QVERIFY(qry.stepNoFetch());
+  qint64 id=0;
+  QString name;
+  double value=0;
+  QCOMPARE(qry.column("id", id), 2);
+  QCOMPARE(qry.column("name", name, id), 3); // Values after the first are fetched from the following columns
+  QCOMPARE(qry.columnStrict("value", value), 2);
+  QCOMPARE(id, qint64(1));
+  QCOMPARE(name, QString("temperature"));
+  QCOMPARE(value, 21.5);
+  QCOMPARE(qry.column("missing", value), 0);
+  QVERIFY(!qry.isOk());
+
+  // Mapped structs are fetched by the names of their fields, whatever the order of the columns
+  QVERIFY(qry.prepare("SELECT value IS NOT NULL AS valid, value, id, sensor, 'ignored' AS other FROM test ORDER BY id"));
+  QCOMPARE(qry.columnIndex("name"), -1);
+  Reading r;
+  QVERIFY(qry.stepNoFetch());
+  QCOMPARE(qry.columnByName(r), 5);
+  QCOMPARE(r.id, qint64(1));
+  QCOMPARE(r.sensor, QString("temperature"));
+  QVERIFY(r.value && *r.value==21.5 && r.valid);
+  QVERIFY(qry.stepNoFetch());
+  QCOMPARE(qry.columnByNameStrict(r), 5);
+  QCOMPARE(r.id, qint64(2));
+  QVERIFY(!r.value && !r.valid);
+  QVERIFY(qry.prepare("SELECT id, sensor, value FROM test"));
+  QVERIFY(qry.stepNoFetch());
+  QCOMPARE(qry.columnByName(r), 0);
+
+  // Columns are looked up again after the statement is reprepared for a schema change
+  QVERIFY(qry.prepare("SELECT * FROM test"));
+  QCOMPARE(qry.columnIndex("value"), 2);
+  QVERIFY(db->execute("DROP TABLE test"));
+  QVERIFY(db->execute("CREATE TABLE test (value REAL, id INTEGER PRIMARY KEY)"));
+  QVERIFY(qry.reset());
+  QVERIFY(qry.stepNoFetch() || qry.isDone());
+  QCOMPARE(qry.columnIndex("value"), 0);
+  QCOMPARE(qry.columnIndex("sensor"), -1);
+}
+
+void TestHFSqlite::test24NamedBind()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT, value REAL)"));
+  Query insert(db.data(), "INSERT INTO test(id, name, value) VALUES (:id, @name, $value)");
+  QCOMPARE(insert.parameterIndex(":id"), 1);
+  QCOMPARE(insert.parameterIndex("@name"), 2);
+  QCOMPARE(insert.parameterIndex("$value"), 3);
+  QCOMPARE(insert.parameterIndex("id"), 0);
+  QCOMPARE(insert.bind(":id", 1), 2);
+  QCOMPARE(insert.bind("@name", "first", 1.5), 3); // Values after the first are bound to the following parameters
+  QVERIFY(!insert.stepNoFetch() && insert.isDone());
+  QVERIFY(insert.reset());
+  QCOMPARE(insert.bindNamed("$value", 2.5, ":id", 2, "@name", "second"), 4);
+  QVERIFY(!insert.stepNoFetch() && insert.isDone());
+  QVERIFY(insert.reset());
+  QCOMPARE(insert.bind(":missing", 3), 0);
+  QVERIFY(!insert.isOk());
+  QCOMPARE(insert.bindNamed(":id", 3, ":missing", 3), 0);
+
+  // The same name used twice is a single parameter. Indexes are looked up again after prepare.
+  Query select(db.data(), "SELECT name FROM test WHERE id=:id OR value=:id*1.25");
+  QCOMPARE(select.parameterIndex(":id"), 1);
+  QString name;
+  QVERIFY(select.bind(":id", 2) && select.step(name));
+  QCOMPARE(name, QString("second"));
+  QVERIFY(select.prepare("SELECT name FROM test WHERE value=:value AND id=:id"));
+  QCOMPARE(select.parameterIndex(":id"), 2);
+  QVERIFY(select.bindNamed(":id", 1, ":value", 1.5) && select.step(name));
+  QCOMPARE(name, QString("first"));
+}
+
+void TestHFSqlite::test23Statement()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT, value REAL)"));
+  Statement<In<qint64, QString, std::optional<double>>> insert(db.data(), "INSERT INTO test(id, name, value) VALUES (?, ?, ?)");
+  QVERIFY(insert.isPrepared());
+  QCOMPARE(insert.parameterCount(), 3);
+  QCOMPARE(insert.columnCount(), 0);
+  for(int i=0;i<10;i++)
+    QVERIFY(insert.execute(i, QString::number(i), i%2?std::optional<double>(i/2.):std::nullopt));
+  QVERIFY(!insert.execute(1, "duplicate", 0.5));
+
+  Statement<In<qint64>, Out<QString, std::optional<double>>> lookup(db.data(), "SELECT name, value FROM test WHERE id=?");
+  QString name;
+  std::optional<double> value;
+  QVERIFY(lookup.executeSingle(3, name, value));
+  QCOMPARE(name, QString("3"));
+  QVERIFY(value && *value==1.5);
+  QVERIFY(lookup.executeSingle(4, name, value));
+  QVERIFY(!value);
+  QVERIFY(!lookup.executeSingle(100, name, value));
+  QCOMPARE(lookup.error(), SQLiteCode::CONSTRAINT);
+
+  // Step through the rows, also fetching a mapped struct
+  Statement<In<qint64>, Out<Reading>> all(db.data(), "SELECT id, name, value, value IS NOT NULL FROM test WHERE id>=? ORDER BY id");
+  QCOMPARE(all.columnCount(), 4);
+  QVERIFY(all.bind(5));
+  Reading r;
+  int count=0;
+  while(all.step(r))
+  {
+    QCOMPARE(r.id, qint64(5+count));
+    QCOMPARE(r.valid, r.id%2==1);
+    count++;
+  }
+  QVERIFY(all.isDone());
+  QCOMPARE(count, 5);
+
+  // Parameters and columns are checked when prepared
+  Statement<In<qint64, qint64>, Out<QString>> wrongParameters(db.data(), "SELECT name FROM test WHERE id=?");
+  QVERIFY(!wrongParameters.isPrepared());
+  QCOMPARE(wrongParameters.error(), SQLiteCode::CONSTRAINT);
+  Statement<In<qint64>, Out<QString>> wrongColumns(db.data(), "SELECT name, value FROM test WHERE id=?");
+  QVERIFY(!wrongColumns.isPrepared());
+  QVERIFY(!wrongColumns.executeSingle(1, name));
+  QCOMPARE(wrongColumns.error(), SQLiteCode::MISUSE);
+}
+
+void TestHFSqlite::test22Mapping()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QCOMPARE(Mapping<Reading>::columnCount(), 4);
+  QCOMPARE(Mapping<Reading>::table(), QString("Reading"));
+  QCOMPARE(Mapping<Reading>::columns(), QStringList({"id", "sensor", "value", "valid"}));
+  QCOMPARE(Mapping<Reading>::createTableSql(QString(), "PRIMARY KEY(id)"), QString("CREATE TABLE IF NOT EXISTS \"Reading\" (\"id\" INTEGER NOT NULL, \"sensor\" TEXT NOT NULL, \"value\" REAL, \"valid\" INTEGER NOT NULL, PRIMARY KEY(id))"));
+  QCOMPARE(Mapping<Reading>::insertSql("readings"), QString("INSERT INTO \"readings\" (\"id\", \"sensor\", \"value\", \"valid\") VALUES (?, ?, ?, ?)"));
+  QCOMPARE(Mapping<Reading>::selectSql("readings", "id=?"), QString("SELECT \"id\", \"sensor\", \"value\", \"valid\" FROM \"readings\" WHERE id=?"));
+
+  QVERIFY(db->execute(Mapping<Reading>::createTableSql("readings", "PRIMARY KEY(id)")));
+  Query insert(db.data(), Mapping<Reading>::insertSql("readings"));
+  QCOMPARE(insert.bindAll(Reading{1, "temperature", 21.5, true}), 5);
+  QVERIFY(!insert.stepNoFetch() && insert.isDone());
+  QVERIFY(insert.reset());
+  QCOMPARE(insert.bindAll(Reading{2, "humidity", std::nullopt, false}), 5);
+  QVERIFY(!insert.stepNoFetch() && insert.isDone());
+
+  // A mapped struct counts as one column per field, also mixed with other values
+  Reading r;
+  QVERIFY(db->executeSingleAll<1>(Mapping<Reading>::selectSql("readings", "id=?"), 1, r));
+  QCOMPARE(r.id, qint64(1));
+  QCOMPARE(r.sensor, QString("temperature"));
+  QVERIFY(r.value && *r.value==21.5);
+  QVERIFY(r.valid);
+  int extra=0;
+  QVERIFY(db->executeSingleAll<1>("SELECT id, sensor, value, valid, 7 FROM readings WHERE id=?", 2, r, extra));
+  QCOMPARE(r.id, qint64(2));
+  QVERIFY(!r.value);
+  QVERIFY(!r.valid);
+  QCOMPARE(extra, 7);
+  QVERIFY(!db->executeSingleAll<1>("SELECT id, sensor, value FROM readings WHERE id=?", 2, r));
+
+  QVector<Reading> readings({{10, "a", 1.5, true}, {11, "b", std::nullopt, false}});
+  QVERIFY(db->exposeTable("live", readings));
+  double sum=0;
+  QString names;
+  QVERIFY(db->executeSingleAll<0>("SELECT sum(value), group_concat(sensor, '') FROM live WHERE valid", sum, names));
+  QCOMPARE(sum, 1.5);
+  QCOMPARE(names, QString("a"));
+}
+
+void TestHFSqlite::test21MultiInsert()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT, value REAL)"));
+  MultiInsert<8, qint64, QString, double> insert(db.data(), "test", {"id", "name", "value"});
+  QVector<std::tuple<qint64, QString, double>> rows;
+  for(int i=0;i<21;i++)
+    rows.append(std::make_tuple(qint64(i), QString::number(i), i/2.));
+  // 8+8+4+1 rows
+  QVERIFY(db->runWrite([&]{ return insert.insert(rows); }));
+  QCOMPARE(insert.rowsInserted(), qint64(21));
+  QCOMPARE(insert.statementsExecuted(), qint64(4));
+  int count=0;
+  double sum=0;
+  QString name;
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*), SUM(value) FROM test", count, sum));
+  QCOMPARE(count, 21);
+  QCOMPARE(sum, 105.);
+  QVERIFY(db->executeSingleAll<1>("SELECT name FROM test WHERE id=$1", 20, name));
+  QCOMPARE(name, QString("20"));
+
+  // Rows added one at a time are inserted N at a time
+  for(int i=100;i<110;i++)
+    QVERIFY(insert.add(i, "added", 1));
+  QCOMPARE(insert.statementsExecuted(), qint64(5));
+  QCOMPARE(insert.pending(), 2);
+  QVERIFY(insert.flush());
+  QCOMPARE(insert.pending(), 0);
+  QCOMPARE(insert.rowsInserted(), qint64(31));
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM test WHERE name='added'", count));
+  QCOMPARE(count, 10);
+
+  // Any row type binding the right number of values
+  MultiInsert<2, qint64, QString, double> sensors(db.data(), "test");
+  QVERIFY(sensors.insert(QVector<Sensor>{{200, "a", 1}, {201, "b", 2}, {202, "c", 3}}));
+  QCOMPARE(sensors.statementsExecuted(), qint64(2));
+  QVERIFY(!sensors.insert(QVector<TestType>{TestType(1), TestType(2)}));
+  QCOMPARE(sensors.error(), SQLiteCode::MISUSE);
+
+  // Errors
+  QVERIFY(!insert.insert(rows));
+  QVERIFY(!insert.errorMsg().isEmpty());
+  QCOMPARE(insert.rowsInserted(), qint64(31));
+  MultiInsert<4, int> missing(db.data(), "missing");
+  QVERIFY(!missing.insert(QVector<std::tuple<int>>{std::make_tuple(1)}));
+  QVERIFY(missing.errorMsg().contains(QString("missing")));
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM test", count));
+  QCOMPARE(count, 34);
+}
+
+void TestHFSqlite::test20Session()
+{
+  QScopedPointer<Db> edge(Db::open(":memory:", QIODevice::ReadWrite));
+  QScopedPointer<Db> central(Db::open(":memory:", QIODevice::ReadWrite));
+  for(Db *db: {edge.data(), central.data()})
+  {
+    QVERIFY(db->execute("CREATE TABLE measures (id INTEGER PRIMARY KEY, sensor INTEGER, value REAL)"));
+    QVERIFY(db->execute("INSERT INTO measures VALUES (1, 1, 0.5)"));
+  }
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+  QByteArray changes;
+  QByteArray patch;
+  {
+    Db::Session session(edge.data());
+    QVERIFY(session.isOk());
+    QVERIFY(session.attach("measures"));
+    QVERIFY(session.isEmpty());
+    QVERIFY(edge->execute("INSERT INTO measures VALUES (2, 1, 1.5), (3, 2, 2.5)"));
+    QVERIFY(edge->execute("UPDATE measures SET value=0.75 WHERE id=1"));
+    // Changes to the same row are merged
+    QVERIFY(edge->execute("INSERT INTO measures VALUES (4, 2, 0)"));
+    QVERIFY(edge->execute("DELETE FROM measures WHERE id=4"));
+    QVERIFY(!session.isEmpty());
+    QVERIFY(session.changeset(changes));
+    QVERIFY(session.patchset(patch));
+    QVERIFY(patch.size()<changes.size());
+
+    session.setEnabled(false);
+    QVERIFY(!session.isEnabled());
+    QVERIFY(edge->execute("INSERT INTO measures VALUES (5, 3, 3)"));
+    QByteArray paused;
+    QVERIFY(session.changeset(paused));
+    QCOMPARE(paused, changes);
+  }
+  QVERIFY(central->applyChangeset(changes));
+  int count=0;
+  double sum=0;
+  QVERIFY(central->executeSingleAll("SELECT COUNT(*), SUM(value) FROM measures", count, sum));
+  QCOMPARE(count, 3);
+  QCOMPARE(sum, 4.75);
+
+  // Conflicts
+  QVERIFY(central->execute("UPDATE measures SET value=9 WHERE id=2"));
+  QByteArray update;
+  {
+    Db::Session session(edge.data());
+    QVERIFY(session.attach());
+    QVERIFY(edge->execute("UPDATE measures SET value=2 WHERE id=2"));
+    QVERIFY(session.changeset(update));
+  }
+  QString error;
+  QVERIFY(!central->applyChangeset(update, nullptr, &error));
+  QCOMPARE(error, QString("Changeset aborted on conflict"));
+  double value=0;
+  QVERIFY(central->executeSingleAll("SELECT value FROM measures WHERE id=2", value));
+  QCOMPARE(value, 9.);
+  int conflicts=0;
+  QVERIFY(central->applyChangeset(update, [&conflicts](const ChangesetConflict &conflict){
+    conflicts++;
+    if(conflict.type()!=ChangesetConflict::Type::Data || conflict.table()!="measures" || conflict.operation()!=ChangeSet::Operation::Update || conflict.columnCount()!=3)
+      return Db::ConflictAction::Abort;
+    // Columns not changed by an update have no new value
+    if(conflict.oldValue(2).toDouble()!=1.5 || conflict.newValue(2).toDouble()!=2 || conflict.conflictingValue(2).toDouble()!=9 || conflict.newValue(1).isValid())
+      return Db::ConflictAction::Abort;
+    return Db::ConflictAction::Replace;
+  }));
+  QCOMPARE(conflicts, 1);
+  QVERIFY(central->executeSingleAll("SELECT value FROM measures WHERE id=2", value));
+  QCOMPARE(value, 2.);
+
+  // The inverse of all the changes restores the initial content
+  QByteArray all;
+  QByteArray inverted;
+  QVERIFY(Db::concatChangesets(changes, update, all));
+  QVERIFY(Db::invertChangeset(all, inverted));
+  QVERIFY(central->applyChangeset(inverted));
+  QVERIFY(central->executeSingleAll("SELECT COUNT(*), SUM(value) FROM measures", count, sum));
+  QCOMPARE(count, 1);
+  QCOMPARE(sum, 0.5);
+
+  QVERIFY(!Db::invertChangeset(patch, inverted, &error));
+  QVERIFY(!central->applyChangeset(QByteArray("garbage"), nullptr, &error));
+  QVERIFY(!error.isEmpty());
+#else
+  Db::Session session(edge.data());
+  QVERIFY(!session.isOk());
+  QCOMPARE(session.error(), SQLiteCode::MISUSE);
+  QVERIFY(!session.attach());
+  QString error;
+  QVERIFY(!central->applyChangeset(QByteArray(), nullptr, &error));
+  QVERIFY(!error.isEmpty());
+#endif
+}
+
+void TestHFSqlite::test19ResultCache()
+{
+  QScopedPointer<Db> db(Db::open(m_tempFile, QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE measures (id INTEGER PRIMARY KEY, sensor INTEGER, value INTEGER)"));
+  QVERIFY(db->execute("CREATE TABLE other (id INTEGER PRIMARY KEY)"));
+  QVERIFY(db->execute("WITH RECURSIVE n(i) AS (SELECT 0 UNION ALL SELECT i+1 FROM n WHERE i<99) INSERT INTO measures(sensor, value) SELECT i%4, i FROM n"));
+
+  // Without a cache the query is executed every time
+  int count=0;
+  QCOMPARE(db->executeCached("SELECT COUNT(*) FROM measures", count), 2);
+  QCOMPARE(count, 100);
+
+  ResultCache *cache=db->resultCache();
+  QVERIFY(cache);
+  QCOMPARE(db->resultCache(), cache);
+  qint64 sum=0;
+  for(int i=0;i<10;i++)
+  {
+    sum=0;
+    QCOMPARE(db->executeCached<1>("SELECT SUM(value) FROM measures WHERE sensor=$1", 1, sum), 2);
+    QCOMPARE(sum, qint64(1225));
+  }
+  QCOMPARE(cache->misses(), quint64(1));
+  QCOMPARE(cache->hits(), quint64(9));
+  QCOMPARE(cache->hitRatio(), 0.9);
+  // Different bound values are different entries
+  QCOMPARE(db->executeCached<1>("SELECT SUM(value) FROM measures WHERE sensor=$1", 2, sum), 2);
+  QCOMPARE(sum, qint64(1250));
+  QCOMPARE(cache->size(), 2);
+  QVERIFY(cache->memoryUsed()>0);
+  // Doubles are compared in binary form, not rounded to 15 digits
+  QCOMPARE(db->executeCached<1>("SELECT COUNT(*) FROM measures WHERE value<$1", 1.0, count), 2);
+  QCOMPARE(count, 1);
+  QCOMPARE(db->executeCached<1>("SELECT COUNT(*) FROM measures WHERE value<$1", 1.0000000000000002, count), 2);
+  QCOMPARE(count, 2);
+
+  // Changes to other tables don't invalidate the entry
+  QVERIFY(db->execute("INSERT INTO other(id) VALUES (1)"));
+  QCOMPARE(db->executeCached<1>("SELECT SUM(value) FROM measures WHERE sensor=$1", 1, sum), 2);
+  QCOMPARE(cache->hits(), quint64(10));
+  QVERIFY(db->execute("INSERT INTO measures(sensor, value) VALUES (1, 1000)"));
+  QCOMPARE(db->executeCached<1>("SELECT SUM(value) FROM measures WHERE sensor=$1", 1, sum), 2);
+  QCOMPARE(sum, qint64(2225));
+  QCOMPARE(cache->invalidations(), quint64(1));
+
+  // Tables are tracked even if no column is read, and DELETE without WHERE is seen
+  QCOMPARE(db->executeCached("SELECT COUNT(*) FROM other", count), 2);
+  QCOMPARE(count, 1);
+  QVERIFY(db->execute("DELETE FROM other"));
+  QCOMPARE(db->executeCached("SELECT COUNT(*) FROM other", count), 2);
+  QCOMPARE(count, 0);
+
+  // Rolled back changes
+  QVERIFY(db->execute("BEGIN"));
+  QVERIFY(db->execute("INSERT INTO measures(sensor, value) VALUES (1, 1)"));
+  QCOMPARE(db->executeCached<1>("SELECT SUM(value) FROM measures WHERE sensor=$1", 1, sum), 2);
+  QCOMPARE(sum, qint64(2226));
+  QVERIFY(db->execute("ROLLBACK"));
+  QCOMPARE(db->executeCached<1>("SELECT SUM(value) FROM measures WHERE sensor=$1", 1, sum), 2);
+  QCOMPARE(sum, qint64(2225));
+  QVERIFY(db->execute("BEGIN"));
+  QVERIFY(db->execute("SAVEPOINT s"));
+  QVERIFY(db->execute("INSERT INTO measures(sensor, value) VALUES (1, 1)"));
+  QCOMPARE(db->executeCached<1>("SELECT SUM(value) FROM measures WHERE sensor=$1", 1, sum), 2);
+  QCOMPARE(sum, qint64(2226));
+  QVERIFY(db->execute("ROLLBACK TO s"));
+  QCOMPARE(db->executeCached<1>("SELECT SUM(value) FROM measures WHERE sensor=$1", 1, sum), 2);
+  QCOMPARE(sum, qint64(2225));
+  QVERIFY(db->execute("COMMIT"));
+
+  // Changes made by other connections
+  {
+    QScopedPointer<Db> other(Db::open(m_tempFile, QIODevice::ReadWrite));
+    QVERIFY(other->execute("INSERT INTO measures(sensor, value) VALUES (1, 1)"));
+  }
+  QCOMPARE(db->executeCached<1>("SELECT SUM(value) FROM measures WHERE sensor=$1", 1, sum), 2);
+  QCOMPARE(sum, qint64(2226));
+
+  // Errors are reported and not cached
+  QString error;
+  qint64 id=0;
+  QCOMPARE(db->executeCached<1>(&error, "SELECT id FROM measures WHERE sensor=$1", 1, id), 0);
+  QCOMPARE(error, QString("Step single query returned more than one row"));
+  QCOMPARE(db->executeCached<1>(&error, "SELECT id FROM measures WHERE sensor=$1", 7, id), 0);
+  QCOMPARE(error, QString("Step single query returned no rows"));
+  QCOMPARE(db->executeCached<0>(&error, "SELECT COUNT(*) FROM missing", count), 0);
+  QVERIFY(!error.isEmpty());
+
+  cache->setMemoryBudget(0);
+  QCOMPARE(cache->size(), 0);
+  QCOMPARE(db->executeCached<1>("SELECT SUM(value) FROM measures WHERE sensor=$1", 1, sum), 2);
+  QCOMPARE(sum, qint64(2226));
+  QCOMPARE(cache->size(), 0);
+
+  // Schema changes still work
+  cache->setMemoryBudget(16*1024*1024);
+  QVERIFY(db->execute("DROP TABLE other"));
+  QCOMPARE(db->executeCached<0>(&error, "SELECT COUNT(*) FROM other", count), 0);
+  QVERIFY(db->execute("CREATE TABLE other (id INTEGER PRIMARY KEY)"));
+  QCOMPARE(db->executeCached("SELECT COUNT(*) FROM other", count), 2);
+  QCOMPARE(count, 0);
+  // Preparing a DROP doesn't invalidate the entries, running it does (the view is created without calling the update hook)
+  quint64 hits=cache->hits();
+  Query drop(db.data(), "DROP TABLE other");
+  QCOMPARE(db->executeCached("SELECT COUNT(*) FROM other", count), 2);
+  QCOMPARE(cache->hits(), hits+1);
+  QVERIFY(drop.executeCommand());
+  QVERIFY(db->execute("CREATE VIEW other AS SELECT 1 AS id"));
+  QCOMPARE(db->executeCached("SELECT COUNT(*) FROM other", count), 2);
+  QCOMPARE(count, 1);
+
+  // Authorizers are called by the one of the cache
+  int calls=0;
+  cache->setAuthorizer([](void *calls, int, const char *, const char *, const char *, const char *){ ++*static_cast<int *>(calls); return 0; }, &calls);
+  QCOMPARE(db->executeCached("SELECT MAX(id) FROM other", count), 2);
+  QCOMPARE(count, 1);
+  QVERIFY(calls>0);
+  cache->setAuthorizer(nullptr);
+}
+
+void TestHFSqlite::test18Changes()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE a (id INTEGER PRIMARY KEY, value TEXT)"));
+  QVERIFY(db->execute("CREATE TABLE b (id INTEGER PRIMARY KEY, value TEXT)"));
+  ChangeNotifier *changes=db->changes();
+  QVERIFY(changes);
+  QCOMPARE(db->changes(), changes);
+  QSignalSpy spy(changes, &ChangeNotifier::changed);
+
+  // One signal for the whole transaction
+  QVERIFY(db->execute("BEGIN"));
+  QVERIFY(db->execute("INSERT INTO a(id, value) VALUES (1, 'x'), (2, 'y')"));
+  QVERIFY(db->execute("UPDATE a SET value='z' WHERE id=1"));
+  QVERIFY(db->execute("INSERT INTO b(id, value) VALUES (10, 'w')"));
+  QVERIFY(db->execute("DELETE FROM a WHERE id=2"));
+  QVERIFY(db->execute("COMMIT"));
+  QVERIFY(spy.wait(1000));
+  QCOMPARE(spy.size(), 1);
+  ChangeSet set=spy.at(0).at(0).value<ChangeSet>();
+  QCOMPARE(set.tables(), QStringList({"a", "b"}));
+  QCOMPARE(set.size(), 5);
+  QVERIFY(!set.isTruncated());
+  QCOMPARE(set.rowids("a", ChangeSet::Operation::Insert), QVector<qint64>({1, 2}));
+  QCOMPARE(set.rowids("a", ChangeSet::Operation::Update), QVector<qint64>({1}));
+  QCOMPARE(set.rowids("a", ChangeSet::Operation::Delete), QVector<qint64>({2}));
+  QCOMPARE(set.rowids("b", ChangeSet::Operation::Insert), QVector<qint64>({10}));
+  QCOMPARE(set.table(3), QString("b"));
+  QCOMPARE(set.operation(4), ChangeSet::Operation::Delete);
+
+  // Rolled back changes are not reported
+  QVERIFY(db->execute("BEGIN"));
+  QVERIFY(db->execute("INSERT INTO a(id, value) VALUES (3, 'x')"));
+  QVERIFY(db->execute("ROLLBACK"));
+  QTest::qWait(50);
+  QCOMPARE(spy.size(), 1);
+
+  // Only changes to the filtered tables are reported
+  changes->setTables({"b"});
+  QVERIFY(db->execute("INSERT INTO a(id, value) VALUES (4, 'x')"));
+  QVERIFY(db->execute("INSERT INTO b(id, value) VALUES (11, 'x')"));
+  QTRY_COMPARE(spy.size(), 2);
+  set=spy.at(1).at(0).value<ChangeSet>();
+  QCOMPARE(set.tables(), QStringList({"b"}));
+  QCOMPARE(set.size(), 1);
+  QCOMPARE(set.rowid(0), qint64(11));
+
+  // Big transactions report only the tables
+  changes->setTables(QStringList());
+  changes->setMaxChanges(10);
+  QVERIFY(db->execute("WITH RECURSIVE n(i) AS (SELECT 100 UNION ALL SELECT i+1 FROM n WHERE i<200) INSERT INTO a(id, value) SELECT i, 'v' FROM n"));
+  QTRY_COMPARE(spy.size(), 3);
+  set=spy.at(2).at(0).value<ChangeSet>();
+  QVERIFY(set.isTruncated());
+  QCOMPARE(set.size(), 0);
+  QCOMPARE(set.tables(), QStringList({"a"}));
+  QCOMPARE(changes->transactionCount(), qint64(3));
+
+  // Changes are reported only once the commit is done: a reader makes COMMIT fail with SQLITE_BUSY
+  QString file=m_tempFile+"_changes";
+  QFile::remove(file);
+  QScopedPointer<Db> writer(Db::open(file, QIODevice::ReadWrite));
+  QScopedPointer<Db> reader(Db::open(file, QIODevice::ReadWrite));
+  QVERIFY(writer->execute("CREATE TABLE a (id INTEGER PRIMARY KEY)"));
+  QSignalSpy writerSpy(writer->changes(), &ChangeNotifier::changed);
+  int count=0;
+  QVERIFY(reader->execute("BEGIN"));
+  QVERIFY(reader->executeSingleAll("SELECT COUNT(*) FROM a", count));
+  QVERIFY(writer->execute("BEGIN"));
+  QVERIFY(writer->execute("INSERT INTO a(id) VALUES (1)"));
+  QVERIFY(!writer->execute("COMMIT"));
+  QTest::qWait(50);
+  QCOMPARE(writerSpy.size(), 0);
+  QVERIFY(writer->execute("ROLLBACK"));
+  QVERIFY(writer->execute("BEGIN"));
+  QVERIFY(writer->execute("INSERT INTO a(id) VALUES (2)"));
+  QVERIFY(!writer->execute("COMMIT"));
+  QVERIFY(reader->execute("COMMIT"));
+  QVERIFY(writer->execute("COMMIT")); // Retried commit
+  QTRY_COMPARE(writerSpy.size(), 1);
+  set=writerSpy.at(0).at(0).value<ChangeSet>();
+  QCOMPARE(set.rowids("a", ChangeSet::Operation::Insert), QVector<qint64>({2}));
+  QTest::qWait(50);
+  QCOMPARE(writerSpy.size(), 1);
+  QCOMPARE(writer->changes()->transactionCount(), qint64(1));
+  writer.reset();
+  reader.reset();
+  QFile::remove(file);
+}
+
+void TestHFSqlite::test17QueryModel()
+{
+  QScopedPointer<Db> db(Db::open(m_tempFile, QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE big (id INTEGER PRIMARY KEY, name TEXT, value REAL)"));
+  QVERIFY(db->execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<10000) INSERT INTO big SELECT i, 'name'||i, i/2.0 FROM n"));
+  // Keys with gaps
+  QVERIFY(db->execute("DELETE FROM big WHERE id%7=0"));
+  int count=0;
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM big WHERE id>10", count));
+
+  QueryModel model(db.data());
+  model.setBlockSize(100);
+  model.setCacheSize(4);
+  QVERIFY(!model.setSource("missing", {"name"}));
+  QVERIFY(!model.errorMsg().isEmpty());
+  QCOMPARE(model.rowCount(), 0);
+
+  QVERIFY(model.setSource("big", {"name", "value*2 AS doubled"}, "id>10"));
+  QCOMPARE(model.rowCount(), count);
+  QCOMPARE(model.columnCount(), 2);
+  QCOMPARE(model.headerData(1, Qt::Horizontal).toString(), QString("doubled"));
+
+  // Random access far from the beginning
+  QString name;
+  double doubled=0;
+  QVERIFY(db->executeSingleAll("SELECT name, value*2 FROM big WHERE id>10 ORDER BY id LIMIT 1 OFFSET 5000", name, doubled));
+  QCOMPARE(model.data(model.index(5000, 0)).toString(), name);
+  QCOMPARE(model.data(model.index(5000, 1)).toDouble(), doubled);
+  QVERIFY(db->executeSingleAll("SELECT name FROM big WHERE id>10 ORDER BY id DESC LIMIT 1", name));
+  QCOMPARE(model.data(model.index(count-1, 0)).toString(), name);
+  QVERIFY(!model.data(model.index(count, 0)).isValid());
+  QCOMPARE(model.blockReads(), 2);
+
+  // Scrolling down: the next block is read in the background
+  QCOMPARE(model.data(model.index(0, 0)).toString(), QString("name11"));
+  QCOMPARE(model.data(model.index(100, 0)).toString(), QString("name128"));
+  QTRY_COMPARE(model.prefetchHits(), 1);
+  QCOMPARE(model.blockReads(), 3);
+
+  // Only cacheSize() blocks are kept
+  for(int i=10;i<20;i++)
+    model.data(model.index(i*100, 0));
+  int reads=model.blockReads()+model.prefetchHits();
+  model.data(model.index(0, 0));
+  QCOMPARE(model.blockReads()+model.prefetchHits(), reads+1);
+
+  QVERIFY(db->execute("INSERT INTO big(id, name, value) VALUES (20000, 'last', 0)"));
+  QCOMPARE(model.rowCount(), count);
+  QVERIFY(model.refresh());
+  QCOMPARE(model.rowCount(), count+1);
+  QCOMPARE(model.data(model.index(count, 0)).toString(), QString("last"));
+
+  // In-memory databases are read without prefetching
+  QScopedPointer<Db> memory(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(memory->execute("CREATE TABLE test (name TEXT)"));
+  QVERIFY(memory->execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<1000) INSERT INTO test SELECT 'row'||i FROM n"));
+  QueryModel memoryModel(memory.data());
+  memoryModel.setBlockSize(10);
+  QVERIFY(memoryModel.setSource("test", {"name"}));
+  for(int i=0;i<memoryModel.rowCount();i++)
+    QCOMPARE(memoryModel.data(memoryModel.index(i, 0)).toString(), QString("row%1").arg(i+1));
+  QCOMPARE(memoryModel.prefetchHits(), 0);
+  QCOMPARE(memoryModel.blockReads(), 100);
+}
+
+void TestHFSqlite::test16Export()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER, name TEXT, value REAL, data BLOB)"));
+  QVERIFY(db->execute("INSERT INTO test VALUES (1, 'plain', 1.5, x'00ff'), (2, 'a,b \"quoted\"', NULL, NULL), (3, 'tab\there'||char(10)||'line', 1e999, x'')"));
+  Query qry(db.data());
+  QVERIFY(qry.prepare("SELECT id, name AS \"the name\", value, data FROM test WHERE id>=$1 ORDER BY id"));
+
+  QByteArray out;
+  QBuffer buffer(&out);
+  QVERIFY(buffer.open(QIODevice::WriteOnly));
+  qint64 rows=0;
+  QVERIFY(qry.bind(1, 1));
+  QVERIFY(qry.exportTo(&buffer, ExportFormat::Csv, ExportOptions(), &rows));
+  QCOMPARE(rows, qint64(3));
+  QCOMPARE(out, QByteArray("id,the name,value,data\r\n"
+                           "1,plain,1.5,00ff\r\n"
+                           "2,\"a,b \"\"quoted\"\"\",,\r\n"
+                           "3,\"tab\there\nline\",Inf,\r\n"));
+
+  buffer.close();
+  out.clear();
+  QVERIFY(buffer.open(QIODevice::WriteOnly));
+  QVERIFY(qry.reset());
+  ExportOptions noHeader;
+  noHeader.header=false;
+  QVERIFY(qry.exportTo(&buffer, ExportFormat::Tsv, noHeader));
+  QCOMPARE(out, QByteArray("1\tplain\t1.5\t00ff\n"
+                           "2\ta,b \"quoted\"\t\\N\t\\N\n"
+                           "3\ttab\\there\\nline\tInf\t\n"));
+
+  buffer.close();
+  out.clear();
+  QVERIFY(buffer.open(QIODevice::WriteOnly));
+  QVERIFY(qry.reset());
+  QVERIFY(qry.exportTo(&buffer, ExportFormat::JsonLines));
+  QCOMPARE(out, QByteArray("{\"id\":1,\"the name\":\"plain\",\"value\":1.5,\"data\":\"00ff\"}\n"
+                           "{\"id\":2,\"the name\":\"a,b \\\"quoted\\\"\",\"value\":null,\"data\":null}\n"
+                           "{\"id\":3,\"the name\":\"tab\\there\\nline\",\"value\":null,\"data\":\"\"}\n"));
+
+  // Doubles keep their full precision, a query already positioned exports its current row too
+  buffer.close();
+  out.clear();
+  QVERIFY(buffer.open(QIODevice::WriteOnly));
+  Query numbers(db.data(), "SELECT 0.1, 1.0/3, 2.0, -1e300 UNION ALL SELECT 1, 2, 3, 4");
+  QVERIFY(numbers.step());
+  QVERIFY(numbers.exportTo(&buffer, ExportFormat::Csv, noHeader, &rows));
+  QCOMPARE(rows, qint64(2));
+  QCOMPARE(out, QByteArray("0.1,0.33333333333333331,2.0,-1e+300\r\n"
+                           "1,2,3,4\r\n"));
+
+  // Empty result and small buffer
+  buffer.close();
+  out.clear();
+  QVERIFY(buffer.open(QIODevice::WriteOnly));
+  QVERIFY(qry.reset());
+  QVERIFY(qry.bind(1, 100));
+  QVERIFY(qry.exportTo(&buffer, ExportFormat::Json, ExportOptions(), &rows));
+  QCOMPARE(rows, qint64(0));
+  QCOMPARE(out, QByteArray("[]\n"));
+
+  QVERIFY(db->execute("CREATE TABLE big (id INTEGER PRIMARY KEY, name TEXT)"));
+  QVERIFY(db->execute("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<5000) INSERT INTO big SELECT i, 'name'||i FROM n"));
+  buffer.close();
+  out.clear();
+  QVERIFY(buffer.open(QIODevice::WriteOnly));
+  QVERIFY(qry.prepare("SELECT id, name FROM big"));
+  ExportOptions small;
+  small.bufferSize=1024;
+  QVERIFY(qry.exportTo(&buffer, ExportFormat::Json, small, &rows));
+  QCOMPARE(rows, qint64(5000));
+  QVERIFY(out.startsWith("[\n{\"id\":1,\"name\":\"name1\"},\n"));
+  QVERIFY(out.endsWith("{\"id\":5000,\"name\":\"name5000\"}\n]\n"));
+
+  buffer.close();
+  out.clear();
+  QVERIFY(buffer.open(QIODevice::WriteOnly));
+  QVERIFY(qry.reset());
+  ExportOptions gzip;
+  gzip.gzip=true;
+#ifdef HFSQTLI_ENABLE_ZLIB
+  QVERIFY(qry.exportTo(&buffer, ExportFormat::Csv, gzip, &rows));
+  QCOMPARE(rows, qint64(5000));
+  QVERIFY(out.startsWith("\x1f\x8b")); // gzip magic number
+  QVERIFY(out.size()<5000*10);
+#else
+  QVERIFY(!qry.exportTo(&buffer, ExportFormat::Csv, gzip));
+  QCOMPARE(qry.error(), SQLiteCode::MISUSE);
+#endif
+}
+
+void TestHFSqlite::test15BulkImport()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id, name, value)"));
+  QByteArray csv("id,name,value\r\n");
+  csv+="1,\"Smith, John\",1.5\r\n";
+  csv+="2,\"Say \"\"hello\"\"\",abc\n";
+  csv+="\n";
+  csv+="3,\"multi\nline\",\n";
+  for(int i=4;i<=3000;i++)
+    csv+=QByteArray::number(i)+",name"+QByteArray::number(i)+","+QByteArray::number(i*0.25)+"\n";
+  csv+="3001,last,"; // No newline at the end
+  QBuffer buffer(&csv);
+  QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+  BulkImporter importer(db.data());
+  importer.setHeader(true);
+  importer.setChunkSize(1024); // Records cross chunk boundaries
+  importer.setRowsPerTransaction(100);
+  importer.setAffinities({BulkImporter::Affinity::Integer, BulkImporter::Affinity::Text, BulkImporter::Affinity::Numeric});
+  importer.setEmptyAsNull(true);
+  int progressCalls=0;
+  importer.setProgressCallback([&progressCalls](qint64, qint64) { progressCalls++; return true; });
+  QVERIFY2(importer.import(&buffer, "test"), qPrintable(importer.errorMsg()));
+  QCOMPARE(importer.rowsImported(), qint64(3001));
+  QCOMPARE(importer.bytesRead(), qint64(csv.size()));
+  QVERIFY(progressCalls>1);
+
+  int count=0;
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM test", count));
+  QCOMPARE(count, 3001);
+  QString name, value;
+  QVERIFY(db->executeSingleAll("SELECT name, value FROM test WHERE id=1", name, value));
+  QCOMPARE(name, QString("Smith, John"));
+  QVERIFY(db->executeSingleAll("SELECT name, value FROM test WHERE id=2", name, value));
+  QCOMPARE(name, QString("Say \"hello\""));
+  QCOMPARE(value, QString("abc")); // Not numeric, kept as text
+  QVERIFY(db->executeSingleAll("SELECT name FROM test WHERE id=3", name));
+  QCOMPARE(name, QString("multi\nline"));
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM test WHERE value IS NULL", count));
+  QCOMPARE(count, 2);
+  QString type;
+  QVERIFY(db->executeSingleAll("SELECT typeof(id)||typeof(value) FROM test WHERE id=5", type)); // Untyped columns: coercion done by the importer
+  QCOMPARE(type, QString("integerreal"));
+  QVERIFY(db->executeSingleAll("SELECT typeof(value) FROM test WHERE id=4", type));
+  QCOMPARE(type, QString("integer"));
+
+  // TSV without header, explicit columns, stopped by the progress callback
+  QVERIFY(db->execute("DELETE FROM test"));
+  QByteArray tsv;
+  for(int i=0;i<1000;i++)
+    tsv+=QByteArray::number(i)+"\tname \"quoted\"\n";
+  QBuffer tsvBuffer(&tsv);
+  QVERIFY(tsvBuffer.open(QIODevice::ReadOnly));
+  BulkImporter tsvImporter(db.data(), BulkImporter::Format::Tsv);
+  tsvImporter.setChunkSize(1024);
+  tsvImporter.setRowsPerTransaction(10);
+  tsvImporter.setProgressCallback([](qint64 bytes, qint64) { return bytes<2048; });
+  QVERIFY(!tsvImporter.import(&tsvBuffer, "test", {"id", "name"}));
+  QCOMPARE(tsvImporter.error(), SQLiteCode::INTERRUPT);
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM test", count));
+  QCOMPARE(qint64(count), tsvImporter.rowsImported());
+  QVERIFY(count>0 && count<1000);
+  QVERIFY(db->executeSingleAll("SELECT name FROM test WHERE id=0", name));
+  QCOMPARE(name, QString("name \"quoted\""));
+
+  // Malformed input
+  QByteArray bad("1,\"a\"b,2\n");
+  QBuffer badBuffer(&bad);
+  QVERIFY(badBuffer.open(QIODevice::ReadOnly));
+  QVERIFY(!importer.import(&badBuffer, "test"));
+  QCOMPARE(importer.error(), SQLiteCode::CONSTRAINT);
+}
+
+void TestHFSqlite::test14ExposeTable()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVector<Sensor> sensors;
+  for(int i=0;i<100;i++)
+    sensors.append(Sensor{1000+i, "sensor"+QString::number(i), i*1.5});
+  QVERIFY(db->exposeTable("sensors", sensors, {"id", "name"})); // Third column gets default name c3
+  int count=0;
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM sensors", count));
+  QCOMPARE(count, 100);
+
+  QString name;
+  double reading=0;
+  QVERIFY(db->executeSingleAll("SELECT name, c3 FROM sensors WHERE rowid=10", name, reading));
+  QCOMPARE(name, QString("sensor10"));
+  QCOMPARE(reading, 15.);
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM sensors WHERE rowid>=10 AND rowid<20", count));
+  QCOMPARE(count, 10);
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM sensors WHERE rowid>97.5", count));
+  QCOMPARE(count, 2);
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM sensors WHERE rowid=1000 OR rowid=-1 OR rowid=NULL", count));
+  QCOMPARE(count, 0);
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM sensors WHERE rowid='10'", count));
+  QCOMPARE(count, 1);
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM sensors WHERE rowid='abc'", count));
+  QCOMPARE(count, 0);
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM sensors WHERE rowid<'abc' AND rowid>=90", count)); // Numbers sort before text
+  QCOMPARE(count, 10);
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM sensors WHERE id=1042", count));
+  QCOMPARE(count, 1);
+
+  // Join with a table on disk
+  QVERIFY(db->execute("CREATE TABLE alarms (sensorId INTEGER, level REAL)"));
+  QVERIFY(db->execute("INSERT INTO alarms VALUES (1001, 1), (1050, 2), (5000, 3)"));
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM alarms JOIN sensors ON sensors.id=alarms.sensorId", count));
+  QCOMPARE(count, 2);
+
+  // Changes to the container are visible to following statements
+  sensors.resize(10);
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM sensors", count));
+  QCOMPARE(count, 10);
+  QVERIFY(!db->execute("INSERT INTO sensors VALUES (1, 'new', 0)")); // Read-only
+}
+
+void TestHFSqlite::test13Aggregate()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->registerAggregate<SumSquares>("sumSquares", Db::FunctionDeterministic));
+  QVERIFY(db->registerAggregate<JoinText>("joinText"));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, grp INTEGER, value INTEGER, name TEXT)"));
+  for(int i=1;i<=10;i++)
+  {
+    const QString name=QString::number(i);
+    QVERIFY(db->execute("INSERT INTO test(id, grp, value, name) VALUES ($1, $2, $3, $4)", i, i%2, i, name));
+  }
+
+  qint64 sum=0;
+  QVERIFY(db->executeSingleAll("SELECT sumSquares(value) FROM test", sum));
+  QCOMPARE(sum, qint64(385));
+  QVERIFY(db->executeSingleAll("SELECT sumSquares(value) FROM test WHERE id>100", sum)); // Empty group
+  QCOMPARE(sum, qint64(0));
+  QCOMPARE(SumSquares::g_live, 0);
+
+  Query qry(db.data());
+  QVERIFY(qry.prepare("SELECT grp, sumSquares(value) FROM test GROUP BY grp ORDER BY grp"));
+  int grp=-1;
+  QVERIFY(qry.step(grp, sum));
+  QCOMPARE(sum, qint64(4+16+36+64+100));
+  QVERIFY(qry.step(grp, sum));
+  QCOMPARE(sum, qint64(1+9+25+49+81));
+  QVERIFY(!qry.step(grp, sum));
+
+  // Sliding window uses inverse to remove the rows leaving the frame
+  QVERIFY(qry.prepare("SELECT sumSquares(value) OVER (ORDER BY id ROWS 1 PRECEDING) FROM test ORDER BY id"));
+  QVector<qint64> expected{1, 5, 13, 25, 41, 61, 85, 113, 145, 181};
+  for(qint64 value: expected)
+  {
+    QVERIFY(qry.step(sum));
+    QCOMPARE(sum, value);
+  }
+  QVERIFY(!qry.step(sum));
+  QVERIFY(qry.prepare("SELECT 1"));
+  QCOMPARE(SumSquares::g_live, 0);
+
+  QString text;
+  QVERIFY(db->executeSingleAll("SELECT joinText(name, NULL) FROM (SELECT name FROM test WHERE id<=3 ORDER BY id)", text));
+  QCOMPARE(text, QString("1,2,3"));
+  QVERIFY(db->executeSingleAll("SELECT joinText(name, '-') FROM (SELECT name FROM test WHERE id<=3 ORDER BY id)", text));
+  QCOMPARE(text, QString("1-2-3"));
+}
+
+void TestHFSqlite::test12Function()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  int calls=0;
+  QVERIFY(db->registerFunction("score", [&calls](qint64 a, const QString &b) { calls++; return double(a)*b.size(); }, Db::FunctionDeterministic|Db::FunctionInnocuous));
+  QVERIFY(db->registerFunction("greet", [](QString name) { return "Hello, "+name+"!"; }));
+  QVERIFY(db->registerFunction("orDefault", [](std::optional<int> value, int def) { return value.value_or(def); }));
+  QVERIFY(db->registerFunction("nothing", [](const QByteArray &) { }));
+  QVERIFY(db->registerFunction("volatileId", [](qint64 a) { return a; }));
+  // Arguments are decoded like columns, so custom types and codecs work too
+  QVERIFY(db->registerFunction("testValue", [](const TestType &type) { return type.value(); }));
+  QVERIFY(db->registerFunction("micros", [](std::chrono::system_clock::time_point point) { return qint64(std::chrono::duration_cast<std::chrono::microseconds>(point.time_since_epoch()).count()); }));
+
+  double score=0;
+  QVERIFY(db->executeSingleAll("SELECT score(3, 'abcd')", score));
+  QCOMPARE(score, 12.);
+  QCOMPARE(calls, 1);
+  QString greeting;
+  QVERIFY(db->executeSingleAll("SELECT greet('world')", greeting));
+  QCOMPARE(greeting, QString("Hello, world!"));
+  int a=0, b=0;
+  QVERIFY(db->executeSingleAll("SELECT orDefault(NULL, 7), orDefault(5, 7)", a, b));
+  QCOMPARE(a, 7);
+  QCOMPARE(b, 5);
+  Value value;
+  QVERIFY(db->executeSingleAll("SELECT nothing(x'0102')", value));
+  QVERIFY(value.isNull());
+  QVERIFY(db->executeSingleAll("SELECT testValue(42)", a));
+  QCOMPARE(a, 41);
+  qint64 micros=0;
+  QVERIFY(db->executeSingleAll("SELECT micros('2021-03-04 05:06:07.890')", micros)); // Text dates are decoded by the codec
+  QCOMPARE(micros, qint64(1614834367890000));
+
+  // Wrong number of arguments is rejected when the statement is prepared
+  QVERIFY(!db->execute("SELECT score(1)"));
+  // Only deterministic functions can be used in indexes
+  QVERIFY(db->execute("CREATE TABLE test (a INTEGER, b TEXT)"));
+  QVERIFY(db->execute("CREATE INDEX testScore ON test(score(a, b))"));
+  QVERIFY(!db->execute("CREATE INDEX testVolatile ON test(volatileId(a))"));
+  QVERIFY(db->execute("INSERT INTO test(a, b) VALUES (2, 'xyz')"));
+  QVERIFY(db->executeSingleAll("SELECT a FROM test WHERE score(a, b)=6", a));
+  QCOMPARE(a, 2);
+}
+
+void TestHFSqlite::test11BindArray()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT, value REAL)"));
+  for(int i=0;i<100;i++)
+  {
+    const QString name=QString::number(i);
+    QVERIFY(db->execute("INSERT INTO test(id, name, value) VALUES ($1, $2, $3)", i, name, i/2.));
+  }
+  QVector<qint64> ids{4, 8, 15, 16, 23, 42};
+  Query qry(db.data());
+  int count=0;
+#ifdef SQLITE_ENABLE_CARRAY
+  QVERIFY(qry.prepare("SELECT COUNT(*) FROM test WHERE id IN carray($1)"));
+  QVERIFY(qry.executeSingle<1>(ids, count));
+  QCOMPARE(count, 6);
+  ids.resize(2);
+  QVERIFY(qry.executeSingle<1>(ids, count)); // Same statement, different number of values
+  QCOMPARE(count, 2);
+  QVERIFY(qry.executeSingle<1>(QVector<int>{1, 2, 3, 1000}, count));
+  QCOMPARE(count, 3);
+  std::vector<qint64> stdIds{1, 2, 3, 4, 5};
+  QVERIFY(qry.reset());
+  QVERIFY(qry.bindTemporary(1, CArray<qint64>(stdIds.data(), stdIds.size())));
+  QVERIFY(qry.step(count));
+  QCOMPARE(count, 5);
+  QVERIFY(qry.executeSingle<1>(QVector<qint64>(), count)); // Empty arrays are not copied
+  QCOMPARE(count, 0);
+  ids.clear();
+  QVERIFY(qry.executeSingle<1>(ids, count));
+  QCOMPARE(count, 0);
+
+  QVERIFY(qry.prepare("SELECT COUNT(*) FROM test WHERE value IN carray($1)"));
+  QVERIFY(qry.executeSingle<1>(QVector<double>{0.5, 1, 7.25, 3}, count));
+  QCOMPARE(count, 3);
+
+  QVERIFY(qry.prepare("SELECT COUNT(*) FROM test WHERE name IN carray($1)"));
+  QVERIFY(qry.executeSingle<1>(QStringList{"1", "10", "foo", "99"}, count));
+  QCOMPARE(count, 3);
+  QVERIFY(qry.executeSingle<1>(QStringList(), count));
+  QCOMPARE(count, 0);
+#else
+  QVERIFY(qry.prepare("SELECT $1"));
+  QVERIFY(!qry.bind(1, ids));
+  QCOMPARE(qry.error(), SQLiteCode::MISUSE);
+  Q_UNUSED(count);
+#endif
+}
+
+void TestHFSqlite::test10RunWrite()
+{
+  QScopedPointer<Db> db(Db::open(m_tempFile, QIODevice::ReadWrite));
+  QScopedPointer<Db> other(Db::open(m_tempFile, QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, value INTEGER)"));
+  QVERIFY(db->runWrite([](Db &db){ return db.execute("INSERT INTO test(id, value) VALUES (1, 0)"); }));
+  QCOMPARE(db->writeStats().retries.count(), quint64(1));
+  QCOMPARE(db->writeStats().retries.max(), quint64(0));
+
+  // Function returning false rolls back
+  QString error;
+  int value=-1;
+  int calls=0;
+  QVERIFY(!db->runWrite([&calls](Db &db){ calls++; db.execute("UPDATE test SET value=5"); return false; }, &error));
+  QCOMPARE(error, QString("Write function aborted the transaction"));
+  QCOMPARE(calls, 1);
+  QVERIFY(db->executeSingleAll("SELECT value FROM test", value));
+  QCOMPARE(value, 0);
+  // No transaction is left open
+  QVERIFY(db->execute("BEGIN"));
+  QVERIFY(db->execute("ROLLBACK"));
+
+  // Another connection holds the write lock for a while
+  QVERIFY(other->execute("BEGIN IMMEDIATE"));
+  QScopedPointer<QThread> releaser(QThread::create([&other](){ QThread::msleep(100); other->execute("COMMIT"); }));
+  releaser->start();
+  db->resetWriteStats();
+  QVERIFY(db->runWrite([](Db &db){ return db.execute("UPDATE test SET value=value+1"); }, &error));
+  QVERIFY(error.isEmpty());
+  QVERIFY(releaser->wait(10000));
+  QVERIFY(db->writeStats().retries.max()>0);
+  QVERIFY(db->writeStats().waitTime.sum()>0);
+  QVERIFY(db->executeSingleAll("SELECT value FROM test", value));
+  QCOMPARE(value, 1);
+
+  // Lock never released: gives up after the retries
+  QVERIFY(other->execute("BEGIN IMMEDIATE"));
+  db->setWritePolicy(WritePolicy{1, 100, 1000, 10});
+  QVERIFY(!db->runWrite([](){ }));
+  QCOMPARE(db->writeStats().failures, quint64(1));
+  QVERIFY(other->execute("ROLLBACK"));
+
+  // A statement of the function failing on a lock (here of an attached database) runs the whole transaction again
+  QString attached=m_tempFile+"_attached";
+  QFile::remove(attached);
+  QScopedPointer<Db> holder(Db::open(attached, QIODevice::ReadWrite));
+  QVERIFY(holder->execute("CREATE TABLE other (id INTEGER)"));
+  QVERIFY(db->execute("ATTACH $1 AS aux", attached));
+  QVERIFY(holder->execute("BEGIN IMMEDIATE"));
+  calls=0;
+  QVERIFY(db->runWrite([&](Db &db){ if(++calls==2) holder->execute("ROLLBACK"); return db.execute("INSERT INTO aux.other VALUES (1)"); }, &error));
+  QCOMPARE(calls, 2);
+  QVERIFY(db->execute("DETACH aux"));
+  holder.reset();
+  QFile::remove(attached);
+
+  // The busy timeout of the connection is restored
+  QVERIFY(db->execute("PRAGMA busy_timeout=1234"));
+  QVERIFY(db->runWrite([](Db &db){ return db.execute("UPDATE test SET value=value+1"); }));
+  QVERIFY(db->executeSingleAll("PRAGMA busy_timeout", value));
+  QCOMPARE(value, 1234);
+}
+
+void TestHFSqlite::test09Deadline()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  Query qry(db.data());
+  int count=0;
+  QVERIFY(qry.prepare("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c) SELECT COUNT(*) FROM c"));
+  qry.setTimeout(std::chrono::milliseconds(50));
+  QVERIFY(qry.hasDeadline());
+  QVERIFY(!qry.step(count));
+  QCOMPARE(qry.error(), SQLiteCode::TIMEOUT);
+  QVERIFY(!qry.errorMsg().isEmpty());
+
+  // Reset reports the error of the last step
+  QVERIFY(!qry.reset());
+  QCOMPARE(qry.error(), SQLiteCode::TIMEOUT);
+  QVERIFY(qry.reset());
+
+  // A progress handler of the connection is called during steps with a deadline and kept after them
+  int progressCalls=0;
+  db->setProgressHandler(100, [](void *calls){ ++*static_cast<int *>(calls); return 0; }, &progressCalls);
+  qry.setTimeout(std::chrono::milliseconds(50));
+  QVERIFY(!qry.step(count));
+  QCOMPARE(qry.error(), SQLiteCode::TIMEOUT);
+  QVERIFY(progressCalls>0);
+  QVERIFY(!qry.reset());
+  progressCalls=0;
+  qry.clearDeadline();
+  QVERIFY(qry.prepare("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x<10000) SELECT COUNT(*) FROM c"));
+  QVERIFY(qry.step(count));
+  QCOMPARE(count, 10000);
+  QVERIFY(progressCalls>0);
+  db->setProgressHandler(0, nullptr);
+
+  // Cancel from another thread
+  QVERIFY(qry.prepare("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c) SELECT COUNT(*) FROM c"));
+  QScopedPointer<QThread> canceller(QThread::create([&db](){ QThread::msleep(50); db->cancel(); }));
+  canceller->start();
+  QVERIFY(!qry.step(count));
+  QCOMPARE(qry.error(), SQLiteCode::INTERRUPT);
+  QVERIFY(canceller->wait(10000));
+
+  // Deadline far in the future does not influence the query
+  QVERIFY(qry.prepare("SELECT 4"));
+  qry.setTimeout(std::chrono::seconds(60));
+  QVERIFY(qry.step(count));
+  QCOMPARE(count, 4);
+}
+
+void TestHFSqlite::test08Checkpointer()
+{
+  QScopedPointer<Db> db(Db::open(m_tempFile, QIODevice::ReadWrite));
+  QString mode;
+  QVERIFY(db->executeSingleAll("PRAGMA journal_mode=WAL", mode));
+  QCOMPARE(mode, "wal");
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, value)"));
+  int pages=0;
+  QVERIFY(db->executeSingleAll("PRAGMA wal_autocheckpoint=123", pages));
+  {
+    QScopedPointer<Checkpointer> checkpointer(db->checkpointer(10, 1));
+    QVERIFY(checkpointer);
+    QSignalSpy spy(checkpointer.data(), &Checkpointer::checkpointed);
+    checkpointer->start();
+    for(int i=0;i<100;i++)
+      QVERIFY(db->execute("INSERT INTO test(id, value) VALUES ($1, $2)", i, ZeroBlob(1000)));
+    checkpointer->checkpointNow();
+    QTRY_VERIFY(checkpointer->checkpointCount()>0);
+    checkpointer->stop();
+    QVERIFY(spy.size()>0);
+    QVERIFY(checkpointer->escalatedCount()>0);
+    QVERIFY(checkpointer->maxDuration()>=checkpointer->lastDuration());
+  }
+  // The automatic checkpoint set before starting is restored
+  QVERIFY(db->executeSingleAll("PRAGMA wal_autocheckpoint", pages));
+  QCOMPARE(pages, 123);
+  int count=0;
+  QVERIFY(db->executeSingleAll("SELECT COUNT(*) FROM test", count));
+  QCOMPARE(count, 100);
+
+  QScopedPointer<Db> memory(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(!memory->checkpointer());
+}
+
+void TestHFSqlite::test07Backup()
+{
+  QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
+  QVERIFY(db->execute("CREATE TABLE test (id INTEGER PRIMARY KEY, value TEXT)"));
+  for(int i=0;i<1000;i++)
+  {
+    const QString value(100, QChar('a'+i%26));
+    QVERIFY(db->execute("INSERT INTO test(id, value) VALUES ($1, $2)", i, value));
+  }
+  {
+    QScopedPointer<Backup> backup(db->backupTo(m_tempFile, 5, 0));
+    QVERIFY(backup);
+    QSignalSpy spy(backup.data(), &Backup::progress);
+    backup->start();
+    QVERIFY(backup->wait(10000));
+    QVERIFY(backup->isOk());
+    QCOMPARE(backup->remaining(), 0);
+    QVERIFY(spy.size()>1);
+  }
+  QScopedPointer<Db> copy(Db::open(m_tempFile, QIODevice::ReadWrite));
+  int count=0;
+  QVERIFY(copy->executeSingleAll("SELECT COUNT(*) FROM test", count));
+  QCOMPARE(count, 1000);
+
+  // Cancelled backup reports SQLITE_INTERRUPT
+  QScopedPointer<Db> other(Db::open(":memory:", QIODevice::ReadWrite));
+  QScopedPointer<Backup> backup(db->backupTo(other.data(), 1, 50));
+  backup->start();
+  backup->cancel();
+  QVERIFY(backup->wait(10000));
+  QVERIFY(!backup->isOk());
+  QCOMPARE(backup->error(), SQLiteCode::INTERRUPT);
+}
+
 void TestHFSqlite::test06Performance()
 {
   QScopedPointer<Db> db(Db::open(":memory:", QIODevice::ReadWrite));
@@ -182,6 +1635,28 @@ void TestHFSqlite::test06Performance()
   QCOMPARE(TestType::numNewImmediate(),1);
   QCOMPARE(TestType::numSetImmediate(),1);
   QCOMPARE(TestType::numOperations(),2);
+
+  // Rvalue QByteArray and QString are moved into the query: SQLite reads the original data, without a copy
+  QByteArray payload(4*1024*1024, 'x');
+  const char *raw=payload.constData();
+  QVERIFY(qry.reset());
+  QCOMPARE(qry.bind(1, std::move(payload)), 2);
+  QVERIFY(qry.reset()); // Still bound after reset
+  BlobView view;
+  QVERIFY(qry.step(view));
+  QVERIFY(view.data()==raw);
+  QCOMPARE(view.size(), qsizetype(4*1024*1024));
+  QString text("Hello"), fetched;
+  QVERIFY(qry.reset());
+  QCOMPARE(qry.bind(1, text), 2); // Lvalues are copied
+  text="Changed";
+  QVERIFY(qry.step(fetched));
+  QCOMPARE(fetched, QString("Hello"));
+  QVERIFY(qry.reset());
+  QCOMPARE(qry.bind(1, QString("World")), 2);
+  QVERIFY(qry.step(fetched));
+  QCOMPARE(fetched, QString("World"));
+  QVERIFY(qry.clearBindings());
 }
 
 template <int ...Is> struct NameType::NameOfBaseType<Helper::int_sequence<Is...> >
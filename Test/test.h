@@ -34,6 +34,30 @@ private slots:
   void test04Call();
   void test05Blob();
   void test06Performance();
+  void test07Backup();
+  void test08Checkpointer();
+  void test09Deadline();
+  void test10RunWrite();
+  void test11BindArray();
+  void test12Function();
+  void test13Aggregate();
+  void test14ExposeTable();
+  void test15BulkImport();
+  void test16Export();
+  void test17QueryModel();
+  void test18Changes();
+  void test19ResultCache();
+  void test20Session();
+  void test21MultiInsert();
+  void test22Mapping();
+  void test23Statement();
+  void test24NamedBind();
+  void test25ColumnByName();
+  void test26ResultArena();
+  void test27Interned();
+  void test28ValueRef();
+  void test29RowBuffer();
+  void test30Codecs();
 #endif
 private:
   QString m_tempFile;
@@ -15,6 +15,9 @@ limitations under the License.
 
 #include "util.h"
 #include "sqlite3.h"
+#include <cstring>
+#include <cmath>
+#include <limits>
 
 Q_STATIC_ASSERT(SQLITE_OK==0);
 
@@ -23,6 +26,10 @@ const int SQLiteCode::MISUSE=SQLITE_MISUSE;
 const int SQLiteCode::CONSTRAINT=SQLITE_CONSTRAINT;
 const int SQLiteCode::OK=SQLITE_OK;
 const int SQLiteCode::DONE=SQLITE_DONE;
+const int SQLiteCode::INTERRUPT=SQLITE_INTERRUPT;
+const int SQLiteCode::ABORT=SQLITE_ABORT;
+// Extended code of SQLITE_INTERRUPT not used by SQLite
+const int SQLiteCode::TIMEOUT=SQLITE_INTERRUPT|(0x80<<8);
 
 bool SQLiteCode::isSuccess(int code)
 {
@@ -39,12 +46,111 @@ bool SQLiteCode::isSuccess(int code)
 
 QString SQLiteCode::errorStringFull(int code)
 {
+  if(code==TIMEOUT)
+    return QString::fromUtf8("deadline expired");
   return QString::fromUtf8(sqlite3_errstr(code));
 }
 
 QString SQLiteCode::errorString(int code)
 {
-  return isSuccess(code)?QString():QString::fromUtf8(sqlite3_errstr(code));
+  return isSuccess(code)?QString():errorStringFull(code);
+}
+
+QString TextView::toString() const
+{
+  return QString::fromUtf8(m_data, m_size);
+}
+
+QByteArray BlobView::toByteArray() const
+{
+  return QByteArray(m_data, m_size);
+}
+
+QString Helper::quoteIdentifier(const QString &name)
+{
+  QString ret=name;
+  ret.replace("\"", "\"\"");
+  return "\""+ret+"\"";
+}
+
+namespace
+{
+  // Same characters as sqlite3Isspace
+  inline bool isSqlSpace(char c)
+  {
+    return c==' ' || (c>='\t' && c<='\r');
+  }
+
+  inline bool isDigit(char c)
+  {
+    return c>='0' && c<='9';
+  }
+}
+
+qint64 Helper::textToInt64(const char *text, qsizetype size)
+{
+  // As sqlite3Atoi64: leading spaces, optional sign and the following digits, clamped on overflow
+  qsizetype i=0;
+  while(i<size && isSqlSpace(text[i]))
+    i++;
+  bool negative=false;
+  if(i<size && (text[i]=='-' || text[i]=='+'))
+    negative=text[i++]=='-';
+  quint64 value=0;
+  const quint64 limit=quint64(std::numeric_limits<qint64>::max())+(negative?1:0);
+  for(;i<size && isDigit(text[i]);i++)
+  {
+    unsigned digit=unsigned(text[i]-'0');
+    if(value>(limit-digit)/10)
+      return negative?std::numeric_limits<qint64>::min():std::numeric_limits<qint64>::max();
+    value=value*10+digit;
+  }
+  return negative?qint64(0-value):qint64(value);
+}
+
+double Helper::textToDouble(const char *text, qsizetype size)
+{
+  // As sqlite3AtoF: the longest prefix that is a number, after leading spaces
+  qsizetype i=0;
+  while(i<size && isSqlSpace(text[i]))
+    i++;
+  qsizetype start=i;
+  if(i<size && (text[i]=='-' || text[i]=='+'))
+    i++;
+  int digits=0;
+  for(;i<size && isDigit(text[i]);i++)
+    digits++;
+  if(i<size && text[i]=='.')
+    for(i++;i<size && isDigit(text[i]);i++)
+      digits++;
+  if(!digits)
+    return 0;
+  qsizetype end=i;
+  if(i<size && (text[i]=='e' || text[i]=='E'))
+  {
+    i++;
+    if(i<size && (text[i]=='-' || text[i]=='+'))
+      i++;
+    if(i<size && isDigit(text[i]))
+    {
+      while(i<size && isDigit(text[i]))
+        i++;
+      end=i;
+    }
+  }
+  return QByteArray(text+start, int(end-start)).toDouble();
+}
+
+qint64 Helper::doubleToInt64(double value)
+{
+  // As sqlite3VdbeIntValue: values out of range are clamped instead of being undefined behaviour
+  if(std::isnan(value))
+    return 0;
+  if(value<=double(std::numeric_limits<qint64>::min()))
+    return std::numeric_limits<qint64>::min();
+  if(value>=double(std::numeric_limits<qint64>::max()))
+    return std::numeric_limits<qint64>::max();
+  return qint64(value);
 }
 
 Type SQLiteCode::typeFromSqlite(int type)
@@ -137,3 +243,210 @@ Type Value::type()
 {
   return m_value?SQLiteCode::typeFromSqlite(sqlite3_value_type(m_value)):Type::Invalid;
 }
+
+sqlite3_value *ValueRef::pointer() const
+{
+  return m_stmt?sqlite3_column_value(m_stmt, m_column):m_value;
+}
+
+Type ValueRef::type() const
+{
+  if(m_stmt)
+    return SQLiteCode::typeFromSqlite(sqlite3_column_type(m_stmt, m_column));
+  return m_value?SQLiteCode::typeFromSqlite(sqlite3_value_type(m_value)):Type::Invalid;
+}
+
+double ValueRef::toDouble() const
+{
+  if(m_stmt)
+    return sqlite3_column_double(m_stmt, m_column);
+  return m_value?sqlite3_value_double(m_value):qQNaN();
+}
+
+qint64 ValueRef::toInt64() const
+{
+  if(m_stmt)
+    return sqlite3_column_int64(m_stmt, m_column);
+  return m_value?sqlite3_value_int64(m_value):0;
+}
+
+QString ValueRef::toString() const
+{
+  return toText().toString();
+}
+
+TextView ValueRef::toText() const
+{
+  Type t=type();
+  if(t==Type::Invalid || t==Type::Null)
+    return TextView();
+  const char *text;
+  int size;
+  if(m_stmt)
+  {
+    text=reinterpret_cast<const char *>(sqlite3_column_text(m_stmt, m_column));
+    size=sqlite3_column_bytes(m_stmt, m_column);
+  }
+  else
+  {
+    text=reinterpret_cast<const char *>(sqlite3_value_text(m_value));
+    size=sqlite3_value_bytes(m_value);
+  }
+  return TextView(text?text:"", size);
+}
+
+BlobView ValueRef::toBlob() const
+{
+  Type t=type();
+  if(t==Type::Invalid || t==Type::Null)
+    return BlobView();
+  const char *data;
+  int size;
+  if(m_stmt)
+  {
+    data=static_cast<const char *>(sqlite3_column_blob(m_stmt, m_column));
+    size=sqlite3_column_bytes(m_stmt, m_column);
+  }
+  else
+  {
+    data=static_cast<const char *>(sqlite3_value_blob(m_value));
+    size=sqlite3_value_bytes(m_value);
+  }
+  // Empty blobs are returned as a null pointer: only NULL is a null view
+  return BlobView(data?data:"", size);
+}
+
+OwnedValue::OwnedValue(const ValueRef &value): OwnedValue()
+{
+  set(value);
+}
+
+void OwnedValue::set(const ValueRef &value)
+{
+  switch(value.type())
+  {
+  case Type::Integer: setInt64(value.toInt64()); break;
+  case Type::Float: setDouble(value.toDouble()); break;
+  case Type::Text:
+  {
+    TextView text=value.toText();
+    setText(text.data(), text.size());
+    break;
+  }
+  case Type::Blob:
+  {
+    BlobView blob=value.toBlob();
+    setBlob(blob.data(), blob.size());
+    break;
+  }
+  default:
+    setNull();
+  }
+}
+
+void OwnedValue::setNull()
+{
+  m_heap=QByteArray();
+  m_type=Type::Null;
+  m_size=0;
+  m_int=0;
+}
+
+void OwnedValue::setInt64(qint64 value)
+{
+  m_heap=QByteArray();
+  m_type=Type::Integer;
+  m_size=0;
+  m_int=value;
+}
+
+void OwnedValue::setDouble(double value)
+{
+  m_heap=QByteArray();
+  m_type=Type::Float;
+  m_size=0;
+  m_double=value;
+}
+
+void OwnedValue::setText(const char *data, qsizetype size)
+{
+  setData(Type::Text, data, size);
+}
+
+void OwnedValue::setBlob(const char *data, qsizetype size)
+{
+  setData(Type::Blob, data, size);
+}
+
+void OwnedValue::setData(Type type, const char *data, qsizetype size)
+{
+  m_type=type;
+  if(size<=InlineSize)
+  {
+    m_heap=QByteArray();
+    m_size=int(size);
+    if(size>0)
+      memcpy(m_inline, data, size);
+    m_inline[size]=0;
+  }
+  else
+  {
+    m_size=0;
+    m_heap=QByteArray(data, size);
+  }
+}
+
+double OwnedValue::toDouble() const
+{
+  switch(m_type)
+  {
+  case Type::Integer: return double(m_int);
+  case Type::Float: return m_double;
+  case Type::Text:
+  {
+    TextView text=toText();
+    return Helper::textToDouble(text.data(), text.size());
+  }
+  default: return 0;
+  }
+}
+
+qint64 OwnedValue::toInt64() const
+{
+  switch(m_type)
+  {
+  case Type::Integer: return m_int;
+  case Type::Float: return Helper::doubleToInt64(m_double);
+  case Type::Text:
+  {
+    TextView text=toText();
+    return Helper::textToInt64(text.data(), text.size());
+  }
+  default: return 0;
+  }
+}
+
+QString OwnedValue::toString() const
+{
+  switch(m_type)
+  {
+  case Type::Integer: return QString::number(m_int);
+  case Type::Float: return QString::number(m_double, 'g', 15);
+  case Type::Text:
+  case Type::Blob: return toText().toString();
+  default: return QString();
+  }
+}
+
+TextView OwnedValue::toText() const
+{
+  if(m_type!=Type::Text && m_type!=Type::Blob)
+    return TextView();
+  return isInline()?TextView(m_inline, m_size):TextView(m_heap.constData(), m_heap.size());
+}
+
+BlobView OwnedValue::toBlob() const
+{
+  TextView text=toText();
+  return BlobView(text.data(), text.size());
+}
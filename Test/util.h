@@ -15,9 +15,13 @@ limitations under the License.
 
 #pragma once
 #include <Qt>
+#include <QString>
+#include <QByteArray>
 #include "templatehelper.h"
+#include <type_traits>
 
 struct sqlite3_value;
+struct sqlite3_stmt;
 /// @brief Global namespace for library
 namespace HFSQtLi
 {
@@ -65,9 +69,25 @@ namespace HFSQtLi
    * \endcode
    *
    */
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    struct ColumnSink;
+    template <typename ...T> int sinkColumns(ColumnSink *sink, int index, T &&...values);
+    // Quotes a table or column name to be used in generated SQL
+    QString quoteIdentifier(const QString &name);
+    // Conversions with the rules of SQLite: text is parsed up to the first character that is not part of the number (0 if there is none),
+    // floats out of the range of qint64 are clamped and NaN is 0
+    qint64 textToInt64(const char *text, qsizetype size);
+    double textToDouble(const char *text, qsizetype size);
+    qint64 doubleToInt64(double value);
+  }
+  /// \endcond INTERNAL
+
   class CustomBind
   {
     friend class Query;
+    template <typename ...T> friend int Helper::sinkColumns(Helper::ColumnSink *sink, int index, T &&...values);
   public:
     /**
      * @brief Binds some values
@@ -115,8 +135,11 @@ namespace HFSQtLi
      */
     constexpr int numBound() { return m_bound; }
   protected:
-    constexpr CustomBind(Query *query, int base): m_query(query), m_base(base), m_bound(0) { }
+    constexpr CustomBind(Query *query, int base): m_query(query), m_sink(nullptr), m_base(base), m_bound(0) { }
+    // Used by virtual tables (See Db::exposeTable) to extract a column from a custom type instead of binding it
+    constexpr CustomBind(Helper::ColumnSink *sink, int base): m_query(nullptr), m_sink(sink), m_base(base), m_bound(0) { }
     Query *m_query;
+    Helper::ColumnSink *m_sink;
     int m_base;
     int m_bound;
   };
@@ -199,6 +222,8 @@ namespace HFSQtLi
      * @return The number of columns fetched so far, or -1 if any error occoured in a fetch
      */
     constexpr int numFetched() { return m_fetched; }
+    /// @brief True if the types of the columns must match the fetched types (see Query::columnStrict)
+    constexpr bool isStrict() const { return m_strict; }
   protected:
     constexpr CustomFetch(Query *query, bool strict, int base): m_query(query), m_strict(strict), m_base(base), m_fetched(0) { }
     Query *m_query;
@@ -239,6 +264,12 @@ namespace HFSQtLi
     extern const int MISUSE;
     /// @brief Integer value corresonding to SQLITE_CONSTRAINT
     extern const int CONSTRAINT;
+    /// @brief Integer value corresonding to SQLITE_INTERRUPT
+    extern const int INTERRUPT;
+    /// @brief Integer value corresonding to SQLITE_ABORT
+    extern const int ABORT;
+    /// @brief Error code returned when a query deadline expires (see Query::setDeadline). Its primary code is SQLITE_INTERRUPT.
+    extern const int TIMEOUT;
     /**
      * @brief Converts an SQLite type to a \ref Type
      * @param type Type to convert
@@ -313,6 +344,96 @@ namespace HFSQtLi
     constexpr Null() { }
   };
 
+  /**
+   * @brief Non owning view over a contiguous array, bound as a carray table-valued parameter (See \ref bindarrays).
+   *
+   * T can be int, qint64, double or const char * (nul terminated UTF-8 strings).
+   *
+   * Example usage:
+   * \code
+   * std::vector<qint64> ids=...;
+   * qry.prepare("SELECT name FROM items WHERE id IN carray($1)");
+   * qry.bindTemporary(1, CArray<qint64>(ids.data(), ids.size())); // Zero-copy: ids must live until the bindings are cleared
+   * \endcode
+   */
+  template <typename T> class CArray
+  {
+    static_assert(std::is_same_v<T, int> || std::is_same_v<T, qint64> || std::is_same_v<T, double> || std::is_same_v<T, const char *>, "CArray supports only int, qint64, double and const char *");
+  public:
+    /**
+     * @brief Constructs a view over an array
+     * @param data Pointer to first element
+     * @param size Number of elements
+     */
+    constexpr CArray(const T *data, qsizetype size): m_data(data), m_size(size) { }
+    /// @brief Constructs a view over a contiguous container (e.g. QVector or std::vector)
+    template <typename C, typename=decltype(std::declval<const C &>().data())> constexpr CArray(const C &container): m_data(container.data()), m_size(container.size()) { }
+    constexpr const T *data() const { return m_data; }
+    constexpr qsizetype size() const { return m_size; }
+  protected:
+    const T *m_data;
+    qsizetype m_size;
+  };
+
+  /**
+   * @brief Non owning view over UTF-8 text of known size, bound as TEXT. The text does not need to be nul terminated.
+   *
+   * Together with Query::bindTemporary it binds text without any copy or conversion, e.g. fields parsed from a buffer (See \ref BulkImporter).
+   * When fetched it points to the memory of SQLite, valid until the next step or reset of the query, or to a \ref ResultArena (see Query::fetchAll).
+   * \code
+   * qry.bindTemporary(1, TextView(buffer.constData()+start, length)); // buffer must live until the bindings are cleared
+   * \endcode
+   */
+  class TextView
+  {
+  public:
+    /**
+     * @brief Constructs a view over a string
+     * @param data Pointer to first character
+     * @param size Size in bytes
+     */
+    constexpr TextView(const char *data, qsizetype size): m_data(data), m_size(size) { }
+    /// @brief Constructs a null view
+    constexpr TextView(): m_data(nullptr), m_size(0) { }
+    constexpr const char *data() const { return m_data; }
+    constexpr qsizetype size() const { return m_size; }
+    /// @brief True for a view over NULL (e.g. fetched from a NULL column)
+    constexpr bool isNull() const { return !m_data; }
+    /// @brief Converts the text to a QString
+    QString toString() const;
+  protected:
+    const char *m_data;
+    qsizetype m_size;
+  };
+
+  /**
+   * @brief Non owning view over binary data of known size, bound as BLOB.
+   *
+   * As TextView it binds data without copy (with Query::bindTemporary). When fetched it points to the memory of SQLite, valid until the next step or reset of the query,
+   * or to a \ref ResultArena (see Query::fetchAll).
+   */
+  class BlobView
+  {
+  public:
+    /**
+     * @brief Constructs a view over binary data
+     * @param data Pointer to first byte
+     * @param size Size in bytes
+     */
+    constexpr BlobView(const char *data, qsizetype size): m_data(data), m_size(size) { }
+    /// @brief Constructs a null view
+    constexpr BlobView(): m_data(nullptr), m_size(0) { }
+    constexpr const char *data() const { return m_data; }
+    constexpr qsizetype size() const { return m_size; }
+    /// @brief True for a view over NULL (e.g. fetched from a NULL column)
+    constexpr bool isNull() const { return !m_data; }
+    /// @brief Copies the data to a QByteArray
+    QByteArray toByteArray() const;
+  protected:
+    const char *m_data;
+    qsizetype m_size;
+  };
+
   /**
    * @brief Maps a sqlite3_value type
    */
@@ -342,6 +463,120 @@ namespace HFSQtLi
   protected:
     sqlite3_value *m_value;
   };
+
+  /**
+   * @brief Non owning view over a cell of the current row of a query or over a sqlite3_value (e.g. an argument of a SQL function).
+   *
+   * Fetching a \ref Value duplicates the cell (sqlite3_value_dup): text and blobs are allocated and copied. A ValueRef refers to the cell of the statement
+   * and reads it with the sqlite3_column_* functions, to inspect a cell of the current row at no cost (the value returned by sqlite3_column_value is unprotected
+   * and can't be read directly). It is valid until the next step or reset of the query, and it must be used in the thread running the query.
+   * Use OwnedValue or Value to keep the cell.
+   * \code
+   * ValueRef cell;
+   * while(qry.step(cell))
+   *   if(cell.type()==Type::Text)
+   *     out << cell.toText().toString();
+   * \endcode
+   */
+  class ValueRef
+  {
+  public:
+    /// @brief Wraps a protected value, e.g. an argument of a SQL function or a value returned by sqlite3_value_dup
+    inline constexpr ValueRef(sqlite3_value *value=nullptr): m_value(value), m_stmt(nullptr), m_column(0) { }
+    /// @brief Refers to a column of the current row of a statement
+    inline constexpr ValueRef(sqlite3_stmt *stmt, int column): m_value(nullptr), m_stmt(stmt), m_column(column) { }
+    /// @brief The value, to be passed only to sqlite3_bind_value, sqlite3_result_value or sqlite3_value_dup when the ValueRef refers to a column
+    sqlite3_value *pointer() const;
+    inline constexpr bool isValid() const { return m_value!=nullptr || m_stmt!=nullptr; }
+
+    Type type() const;
+    inline bool isNull() const { return type()==Type::Null; }
+    inline bool isInt() const { return type()==Type::Integer; }
+    inline bool isFloat() const { return type()==Type::Float; }
+    inline bool isText() const { return type()==Type::Text; }
+    inline bool isBlob() const { return type()==Type::Blob; }
+
+    double toDouble() const;
+    qint64 toInt64() const;
+    QString toString() const;
+    /// @brief View over the value as UTF-8 text, valid as the ValueRef. Numbers are converted to text in place as sqlite3_value_text does.
+    TextView toText() const;
+    /// @brief View over the value as a blob, valid as the ValueRef
+    BlobView toBlob() const;
+  protected:
+    sqlite3_value *m_value;
+    // Column of the current row, used instead of m_value when m_stmt is set
+    sqlite3_stmt *m_stmt;
+    int m_column;
+  };
+
+  /**
+   * @brief Owned copy of a SQLite value, stored without heap allocation when it is small.
+   *
+   * Integers, floats, NULL and text or blobs up to InlineSize bytes are stored inside the object; only longer text and blobs are copied to a QByteArray.
+   * Unlike \ref Value no sqlite3_value is allocated, so a vector of OwnedValue is a cheap way to keep generic rows (e.g. to dump a table of unknown schema).
+   * \code
+   * qry.prepare("SELECT * FROM "+table);
+   * QVector<OwnedValue> row(columns);
+   * while(qry.step())
+   * {
+   *   for(int i=0;i<row.size();i++)
+   *     qry.column(i, row[i]);
+   *   ...
+   * }
+   * \endcode
+   */
+  class OwnedValue
+  {
+  public:
+    /// @brief Maximum size in bytes of text and blobs stored in the object
+    static constexpr int InlineSize=15;
+    /// @brief Constructs a NULL value
+    inline OwnedValue(): m_type(Type::Null), m_size(0), m_int(0) { }
+    /// @brief Copies a value
+    explicit OwnedValue(const ValueRef &value);
+
+    void set(const ValueRef &value);
+    void setNull();
+    void setInt64(qint64 value);
+    void setDouble(double value);
+    /// @brief Sets UTF-8 text of size bytes
+    void setText(const char *data, qsizetype size);
+    void setBlob(const char *data, qsizetype size);
+
+    inline Type type() const { return m_type; }
+    inline bool isNull() const { return m_type==Type::Null; }
+    inline bool isInt() const { return m_type==Type::Integer; }
+    inline bool isFloat() const { return m_type==Type::Float; }
+    inline bool isText() const { return m_type==Type::Text; }
+    inline bool isBlob() const { return m_type==Type::Blob; }
+    /// @brief True if the value is stored in the object, without heap allocation
+    inline bool isInline() const { return m_heap.isNull(); }
+
+    /// @brief Converts the value to double: text is parsed, NULL and blobs are 0
+    double toDouble() const;
+    /// @brief Converts the value to integer: floats are truncated, text is parsed, NULL and blobs are 0
+    qint64 toInt64() const;
+    /// @brief Converts the value to a string: NULL is a null string
+    QString toString() const;
+    /// @brief View over text or blob data, nul terminated, valid until the value is changed or destroyed. Null for other types.
+    TextView toText() const;
+    /// @brief View over text or blob data, valid until the value is changed or destroyed. Null for other types.
+    BlobView toBlob() const;
+  protected:
+    void setData(Type type, const char *data, qsizetype size);
+    Type m_type;
+    // Size of text or blob stored in m_inline
+    int m_size;
+    union
+    {
+      qint64 m_int;
+      double m_double;
+      char m_inline[InlineSize+1];
+    };
+    // Text or blob longer than InlineSize
+    QByteArray m_heap;
+  };
 }
 
 #include "util_template.h"
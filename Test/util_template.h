@@ -26,13 +26,17 @@ namespace HFSQtLi
     {
       if(i<=0)
       {
-        m_query->setInternalError(SQLiteCode::MISUSE, "Custom bind with index <=0");
+        if(m_query)
+          m_query->setInternalError(SQLiteCode::MISUSE, "Custom bind with index <=0");
         m_bound=-1;
       }
       else
       {
         ret=0;
-        ret=m_query->bindSingle(false, m_base+i-1, std::tuple<decltype(value)...>(std::forward<T>(value)...));
+        if(m_sink)
+          ret=Helper::sinkColumns(m_sink, m_base+i-1, std::forward<T>(value)...);
+        else
+          ret=m_query->bindSingle(false, m_base+i-1, std::tuple<decltype(value)...>(std::forward<T>(value)...));
         if(ret)
           m_bound=qMax(m_bound, i+ret-2);
         else
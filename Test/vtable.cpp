@@ -0,0 +1,323 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "database.h"
+#include "vtable.h"
+#include "sqlite3.h"
+#include <cmath>
+#include <cstring>
+
+using namespace HFSQtLi;
+
+namespace
+{
+  // Bits of idxNum describing the rowid constraints used by the plan. Arguments are passed in the same order.
+  enum RowidConstraint
+  {
+    RowidEq=1,
+    RowidGe=2,
+    RowidGt=4,
+    RowidLe=8,
+    RowidLt=16
+  };
+
+  struct Table
+  {
+    sqlite3_vtab base;
+    const Helper::TableSource *source;
+  };
+
+  struct Cursor
+  {
+    sqlite3_vtab_cursor base;
+    qint64 row;
+    qint64 end;
+  };
+
+  const Helper::TableSource *cursorSource(sqlite3_vtab_cursor *cursor)
+  {
+    return reinterpret_cast<Table *>(cursor->pVtab)->source;
+  }
+
+  // Converts a rowid bound to the first row index satisfying it (or the index following the last one for upper bounds)
+  qint64 rowBound(sqlite3_value *value, int constraint, qint64 rows)
+  {
+    double d=sqlite3_value_double(value);
+    double ret;
+    switch(constraint)
+    {
+    case RowidGe:
+    case RowidLt:
+      ret=std::ceil(d);
+      break;
+    default: // RowidGt, RowidLe
+      ret=std::floor(d)+1;
+      break;
+    }
+    return ret<0?0:(ret>double(rows)?rows:qint64(ret));
+  }
+
+  int tableConnect(sqlite3 *db, void *aux, int, const char *const *, sqlite3_vtab **vtab, char **)
+  {
+    auto *source=static_cast<const Helper::TableSource *>(aux);
+    int ret=sqlite3_declare_vtab(db, source->schema().constData());
+    if(ret==SQLITE_OK)
+    {
+      auto *table=static_cast<Table *>(sqlite3_malloc(sizeof(Table)));
+      if(table)
+      {
+        memset(table, 0, sizeof(Table));
+        table->source=source;
+        *vtab=&table->base;
+      }
+      else
+        ret=SQLITE_NOMEM;
+    }
+    return ret;
+  }
+
+  int tableDisconnect(sqlite3_vtab *vtab)
+  {
+    sqlite3_free(vtab);
+    return SQLITE_OK;
+  }
+
+  int constraintBit(unsigned char op)
+  {
+    switch(op)
+    {
+    case SQLITE_INDEX_CONSTRAINT_EQ: return RowidEq;
+    case SQLITE_INDEX_CONSTRAINT_GE: return RowidGe;
+    case SQLITE_INDEX_CONSTRAINT_GT: return RowidGt;
+    case SQLITE_INDEX_CONSTRAINT_LE: return RowidLe;
+    case SQLITE_INDEX_CONSTRAINT_LT: return RowidLt;
+    default: return 0;
+    }
+  }
+
+  int tableBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info)
+  {
+    double rows=double(qMax<qint64>(reinterpret_cast<Table *>(vtab)->source->rowCount(), 1));
+    int idxNum=0;
+    bool equality=false;
+    int used[5]={-1, -1, -1, -1, -1}; // Constraint used for each bit of RowidConstraint
+    for(int i=0;i<info->nConstraint;i++)
+    {
+      const auto &constraint=info->aConstraint[i];
+      if(!constraint.usable)
+        continue;
+      if(constraint.iColumn>=0)
+      {
+        // Equality on other columns can't use an index, but makes the planner expect fewer rows when ordering joins
+        equality|=constraint.op==SQLITE_INDEX_CONSTRAINT_EQ;
+        continue;
+      }
+      int bit=constraintBit(constraint.op);
+      // Use at most one lower and one upper bound
+      if(!bit || (idxNum&bit) || ((bit&(RowidGe|RowidGt)) && (idxNum&(RowidGe|RowidGt))) || ((bit&(RowidLe|RowidLt)) && (idxNum&(RowidLe|RowidLt))))
+        continue;
+      idxNum|=bit;
+      for(int j=0;j<5;j++)
+        if(bit==(1<<j))
+          used[j]=i;
+    }
+    // Arguments are passed to xFilter in the order of the bits
+    int argc=0;
+    for(int j=0;j<5;j++)
+    {
+      if(used[j]>=0)
+      {
+        // Not omitted: xFilter ignores the values that are not numbers and SQLite checks them against every row
+        info->aConstraintUsage[used[j]].argvIndex=++argc;
+      }
+    }
+    if(idxNum&RowidEq)
+    {
+      info->estimatedCost=1;
+      info->estimatedRows=1;
+      info->idxFlags=SQLITE_INDEX_SCAN_UNIQUE;
+    }
+    else
+    {
+      if((idxNum&(RowidGe|RowidGt)) && (idxNum&(RowidLe|RowidLt)))
+        rows/=16;
+      else if(idxNum)
+        rows/=4;
+      info->estimatedCost=rows;
+      info->estimatedRows=qMax<sqlite3_int64>(sqlite3_int64(equality?rows/10:rows), 1);
+    }
+    info->idxNum=idxNum;
+    // Rows are always visited in rowid order
+    if(info->nOrderBy==1 && info->aOrderBy[0].iColumn<0 && !info->aOrderBy[0].desc)
+      info->orderByConsumed=1;
+    return SQLITE_OK;
+  }
+
+  int cursorOpen(sqlite3_vtab *, sqlite3_vtab_cursor **cursor)
+  {
+    auto *ret=static_cast<Cursor *>(sqlite3_malloc(sizeof(Cursor)));
+    if(!ret)
+      return SQLITE_NOMEM;
+    memset(ret, 0, sizeof(Cursor));
+    *cursor=&ret->base;
+    return SQLITE_OK;
+  }
+
+  int cursorClose(sqlite3_vtab_cursor *cursor)
+  {
+    sqlite3_free(cursor);
+    return SQLITE_OK;
+  }
+
+  int cursorFilter(sqlite3_vtab_cursor *vtabCursor, int idxNum, const char *, int argc, sqlite3_value **argv)
+  {
+    auto *cursor=reinterpret_cast<Cursor *>(vtabCursor);
+    qint64 rows=cursorSource(vtabCursor)->rowCount();
+    cursor->row=0;
+    cursor->end=rows;
+    int arg=0;
+    for(int bit=RowidEq;bit<=RowidLt && arg<argc;bit<<=1)
+    {
+      if(!(idxNum&bit))
+        continue;
+      sqlite3_value *value=argv[arg++];
+      int type=sqlite3_value_numeric_type(value);
+      if(type==SQLITE_NULL)
+      {
+        // Comparisons with NULL are never true
+        cursor->end=0;
+        break;
+      }
+      // Text that is not a number and blobs don't restrict the range: the constraint is evaluated by SQLite
+      if(type!=SQLITE_INTEGER && type!=SQLITE_FLOAT)
+        continue;
+      switch(bit)
+      {
+      case RowidEq:
+        {
+          double d=sqlite3_value_double(value);
+          if(d>=0 && d<double(rows) && std::floor(d)==d)
+          {
+            cursor->row=qMax(cursor->row, qint64(d));
+            cursor->end=qMin(cursor->end, qint64(d)+1);
+          }
+          else
+            cursor->end=0;
+        }
+        break;
+      case RowidGe:
+      case RowidGt:
+        cursor->row=qMax(cursor->row, rowBound(value, bit, rows));
+        break;
+      default:
+        cursor->end=qMin(cursor->end, rowBound(value, bit, rows));
+        break;
+      }
+    }
+    return SQLITE_OK;
+  }
+
+  int cursorNext(sqlite3_vtab_cursor *cursor)
+  {
+    reinterpret_cast<Cursor *>(cursor)->row++;
+    return SQLITE_OK;
+  }
+
+  int cursorEof(sqlite3_vtab_cursor *vtabCursor)
+  {
+    auto *cursor=reinterpret_cast<Cursor *>(vtabCursor);
+    // The container may shrink while a statement is running
+    return cursor->row>=cursor->end || cursor->row>=cursorSource(vtabCursor)->rowCount();
+  }
+
+  int cursorColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *context, int i)
+  {
+    cursorSource(cursor)->column(context, reinterpret_cast<Cursor *>(cursor)->row, i);
+    return SQLITE_OK;
+  }
+
+  int cursorRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+  {
+    *rowid=reinterpret_cast<Cursor *>(cursor)->row;
+    return SQLITE_OK;
+  }
+
+  // Eponymous-only module: xCreate is null, the table exists in the main schema as soon as the module is registered
+  const sqlite3_module g_module=
+  {
+    0,                // iVersion
+    nullptr,          // xCreate
+    tableConnect,     // xConnect
+    tableBestIndex,   // xBestIndex
+    tableDisconnect,  // xDisconnect
+    tableDisconnect,  // xDestroy
+    cursorOpen,       // xOpen
+    cursorClose,      // xClose
+    cursorFilter,     // xFilter
+    cursorNext,       // xNext
+    cursorEof,        // xEof
+    cursorColumn,     // xColumn
+    cursorRowid,      // xRowid
+    nullptr,          // xUpdate
+    nullptr,          // xBegin
+    nullptr,          // xSync
+    nullptr,          // xCommit
+    nullptr,          // xRollback
+    nullptr,          // xFindFunction
+    nullptr,          // xRename
+    nullptr,          // xSavepoint
+    nullptr,          // xRelease
+    nullptr,          // xRollbackTo
+    nullptr           // xShadowName
+  };
+}
+
+Helper::TableSource::TableSource(int columns, const QStringList &names): m_columns(qMax(columns, 0)), m_names(names)
+{
+}
+
+Helper::TableSource::~TableSource()
+{
+}
+
+QByteArray Helper::TableSource::schema() const
+{
+  QByteArray ret("CREATE TABLE x(");
+  for(int i=0;i<m_columns;i++)
+  {
+    if(i)
+      ret+=", ";
+    QByteArray name=i<m_names.size()?m_names.at(i).toUtf8():QByteArray("c")+QByteArray::number(i+1);
+    ret+='"'+name.replace('"', "\"\"")+'"';
+  }
+  ret+=")";
+  return ret;
+}
+
+void Helper::TableSource::destroy(void *source)
+{
+  delete static_cast<TableSource *>(source);
+}
+
+bool Db::createTableModule(const char *name, Helper::TableSource *source)
+{
+  if(!m_db || source->columnCount()<=0)
+  {
+    delete source;
+    return false;
+  }
+  // On failure SQLite destroys source too
+  return sqlite3_create_module_v2(m_db, name, &g_module, source, &Helper::TableSource::destroy)==SQLITE_OK;
+}
@@ -0,0 +1,114 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <QVector>
+#include <QStringList>
+#include <type_traits>
+#include "util.h"
+#include "function.h"
+
+namespace HFSQtLi
+{
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    // Receives the values bound by a customBind function and returns the one of the requested column to SQLite
+    struct ColumnSink
+    {
+      sqlite3_context *context;
+      int column;
+      bool found;
+    };
+
+    template <typename T, typename=void> struct IsResultType: std::false_type { };
+    template <typename T> struct IsResultType<T, std::void_t<decltype(resultValue(std::declval<sqlite3_context *>(), std::declval<const T &>()))>>: std::true_type { };
+
+    // Same semantic of Query::bindSingle: returns 1+number of columns
+    template <typename ...T> int sinkColumns(ColumnSink *sink, int index, T &&...values)
+    {
+      int count=0;
+      auto sinkColumn=[sink, index, &count](auto &&value)
+      {
+        typedef std::decay_t<decltype(value)> Type;
+        if(count<0)
+          return;
+        if constexpr(IsResultType<Type>::value)
+        {
+          if(index+count==sink->column)
+          {
+            resultValue(sink->context, value);
+            sink->found=true;
+          }
+          count++;
+        }
+        else if constexpr(IsMapped<Type>::value)
+        {
+          int sunk=std::apply([sink, index, count](const auto &...fields) { return sinkColumns(sink, index+count, fields...); }, hfsqtliMapFields(value));
+          count=sunk>0?count+sunk-1:-1;
+        }
+        else
+        {
+          CustomBind custom(sink, index+count);
+          using Custom::customBind;
+          customBind(custom, std::forward<decltype(value)>(value));
+          count=custom.numBound()>=0?count+custom.numBound():-1;
+        }
+      };
+      (sinkColumn(std::forward<T>(values)), ...);
+      return count+1;
+    }
+
+    // Type erased content of a virtual table created by Db::exposeTable
+    class TableSource
+    {
+    public:
+      TableSource(int columns, const QStringList &names);
+      virtual ~TableSource();
+      virtual qint64 rowCount() const=0;
+      // Sets the result of context to the value of the given row and column
+      virtual void column(sqlite3_context *context, qint64 row, int column) const=0;
+      int columnCount() const { return m_columns; }
+      // CREATE TABLE statement passed to sqlite3_declare_vtab
+      QByteArray schema() const;
+      static void destroy(void *source);
+    protected:
+      int m_columns;
+      QStringList m_names;
+    };
+
+    template <typename T> class ContainerSource: public TableSource
+    {
+    public:
+      ContainerSource(const QVector<T> *data, const QStringList &names): TableSource(countColumns(), names), m_data(data) { }
+      qint64 rowCount() const override { return m_data->size(); }
+      void column(sqlite3_context *context, qint64 row, int column) const override
+      {
+        ColumnSink sink{context, column, false};
+        sinkColumns(&sink, 0, m_data->at(row));
+        if(!sink.found)
+          resultNull(context);
+      }
+    protected:
+      static int countColumns()
+      {
+        ColumnSink sink{nullptr, -1, false};
+        return sinkColumns(&sink, 0, T())-1;
+      }
+      const QVector<T> *m_data;
+    };
+  }
+  /// \endcond INTERNAL
+}
@@ -0,0 +1,54 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "writer.h"
+
+using namespace HFSQtLi;
+
+void Histogram::add(quint64 value)
+{
+  int i=0;
+  for(quint64 v=value; v; v>>=1)
+    i++;
+  m_buckets[qMin(i, Buckets-1)]++;
+  m_count++;
+  m_sum+=value;
+  m_max=qMax(m_max, value);
+}
+
+double Histogram::mean() const
+{
+  return m_count?double(m_sum)/m_count:qQNaN();
+}
+
+quint64 Histogram::percentile(double p) const
+{
+  quint64 ret=0;
+  if(m_count)
+  {
+    quint64 target=qMax<quint64>(1, quint64(qBound(0., p, 1.)*m_count+0.5));
+    quint64 cumulative=0;
+    for(int i=0;i<Buckets;i++)
+    {
+      cumulative+=m_buckets[i];
+      if(cumulative>=target)
+      {
+        ret=qMin(bucketUpperBound(i), m_max);
+        break;
+      }
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,125 @@
+/* Copyright 2021 Marzocchi Alessandro
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#pragma once
+#include <Qt>
+#include <type_traits>
+#include <limits>
+
+namespace HFSQtLi
+{
+  class Db;
+  /**
+   * @brief Histogram with power of two buckets.
+   *
+   * Bucket 0 counts the value 0, bucket i (i>0) counts values in [2^(i-1), 2^i - 1].
+   */
+  class Histogram
+  {
+  public:
+    /// @brief Number of buckets
+    static constexpr int Buckets=64;
+    constexpr Histogram(): m_buckets{}, m_count(0), m_sum(0), m_max(0) { }
+    /// @brief Adds a sample
+    void add(quint64 value);
+    /// @brief Removes all samples
+    void reset() { *this=Histogram(); }
+    /// @brief Number of samples
+    constexpr quint64 count() const { return m_count; }
+    /// @brief Sum of all samples
+    constexpr quint64 sum() const { return m_sum; }
+    /// @brief Biggest sample
+    constexpr quint64 max() const { return m_max; }
+    /// @brief Average of samples (NaN if no sample was added)
+    double mean() const;
+    /// @brief Number of samples in bucket i
+    constexpr quint64 bucket(int i) const { return (i>=0 && i<Buckets)?m_buckets[i]:0; }
+    /// @brief Smallest value counted by bucket i
+    static constexpr quint64 bucketLowerBound(int i) { return i<=0?0:(quint64(1)<<(i-1)); }
+    /// @brief Biggest value counted by bucket i
+    static constexpr quint64 bucketUpperBound(int i) { return i<=0?0:(i>=Buckets?std::numeric_limits<quint64>::max():(quint64(1)<<i)-1); }
+    /**
+     * @brief Estimates a percentile
+     * @param p Percentile in the range [0, 1]
+     * @return The upper bound of the bucket containing the percentile, capped to max()
+     */
+    quint64 percentile(double p) const;
+  protected:
+    quint64 m_buckets[Buckets];
+    quint64 m_count;
+    quint64 m_sum;
+    quint64 m_max;
+  };
+
+  /**
+   * @brief Retry policy used by Db::runWrite
+   */
+  struct WritePolicy
+  {
+    /// @brief Maximum number of times the whole transaction is run again after failing with SQLITE_BUSY or SQLITE_LOCKED
+    int maxRetries=10;
+    /// @brief First backoff delay in microseconds. The delay doubles on every retry.
+    int initialBackoff=100;
+    /// @brief Maximum backoff delay in microseconds
+    int maxBackoff=100000;
+    /// @brief Maximum time in milliseconds spent waiting for a single lock in the busy handler before giving up
+    int busyTimeout=5000;
+  };
+
+  /**
+   * @brief Statistics collected by Db::runWrite. Each call of runWrite adds one sample to every histogram.
+   */
+  struct WriteStats
+  {
+    /// @brief Time spent waiting for locks (busy handler and backoff between retries) in microseconds
+    Histogram waitTime;
+    /// @brief Number of retries (busy handler invocations plus transaction retries)
+    Histogram retries;
+    /// @brief Number of runWrite calls that failed
+    quint64 failures=0;
+    /// @brief Clears all statistics
+    void reset() { waitTime.reset(); retries.reset(); failures=0; }
+  };
+
+  /// \cond INTERNAL
+  namespace Helper
+  {
+    // Calls a runWrite function that may take a Db & or no parameter, and may return void (always successful) or a value convertible to bool
+    template <typename F> bool callWrite(Db &db, F &&function)
+    {
+      if constexpr(std::is_invocable_v<F, Db &>)
+      {
+        if constexpr(std::is_void_v<std::invoke_result_t<F, Db &>>)
+        {
+          std::forward<F>(function)(db);
+          return true;
+        }
+        else
+          return static_cast<bool>(std::forward<F>(function)(db));
+      }
+      else
+      {
+        Q_UNUSED(db);
+        if constexpr(std::is_void_v<std::invoke_result_t<F>>)
+        {
+          std::forward<F>(function)();
+          return true;
+        }
+        else
+          return static_cast<bool>(std::forward<F>(function)());
+      }
+    }
+  }
+  /// \endcond INTERNAL
+}